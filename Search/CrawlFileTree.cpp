@@ -11,9 +11,18 @@
 
 #include "./CrawlFileTree.hpp"
 #include "./HttpUtils.hpp"
-#include <fstream>
-#include <algorithm>
-#include <cctype>
+#include "./ShardedIndex.hpp"
+#include "./ThreadPool.hpp"
+#include "./Tokenizer.hpp"
+
+extern "C" {
+  #include <pthread.h>
+  #include <sched.h>
+}
+
+#include <atomic>
+#include <deque>
+#include <memory>
 
 using std::string;
 using std::optional;
@@ -25,36 +34,244 @@ namespace searchserver {
 // Internal helper functions and constants
 //////////////////////////////////////////////////////////////////////////////
 
-static bool handle_dir(const string& dir_path, WordIndex& index);
+static bool handle_dir(const string& dir_path, WordIndex& index,
+                       Tokenizer* tokenizer);
 
 // Read and parse the specified file, then inject it into the MemIndex.
-static void handle_file(const string& fpath, WordIndex& index);
+static void handle_file(const string& fpath, WordIndex& index,
+                        Tokenizer* tokenizer);
+
+
+// A directory found by the parallel crawl. Its entries are kept in the
+// order readdir returned them, so that the order in which a serial crawl
+// would have visited the files can be rebuilt once every directory has
+// been listed.
+struct DirNode {
+  struct Entry {
+    string path;
+    // The listing of the entry if it is a directory, or null for a file
+    std::unique_ptr<DirNode> dir;
+  };
+
+  string path;
+  vector<Entry> entries;
+};
+
+// A unit of work for a parallel crawl worker: either a directory to list
+// or a file to tokenize
+struct CrawlTask {
+  DirNode* dir;
+  const string* file;
+};
+
+// The queue of tasks owned by one crawl worker. The owner pushes and pops
+// at the back, so it works depth-first through what it found last, while
+// idle workers steal from the front, which holds the oldest and usually
+// largest parts of the tree.
+class WorkStealingDeque {
+ public:
+  WorkStealingDeque() : lock_() { pthread_mutex_init(&lock_, nullptr); }
+  ~WorkStealingDeque() { pthread_mutex_destroy(&lock_); }
+
+  void push(const CrawlTask& task) {
+    pthread_mutex_lock(&lock_);
+    tasks_.push_back(task);
+    pthread_mutex_unlock(&lock_);
+  }
+
+  bool pop(CrawlTask* task) {
+    return take(task, false);
+  }
+
+  bool steal(CrawlTask* task) {
+    return take(task, true);
+  }
+
+  WorkStealingDeque(const WorkStealingDeque& other) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque& other) = delete;
+
+ private:
+  bool take(CrawlTask* task, bool front) {
+    pthread_mutex_lock(&lock_);
+    bool found = !tasks_.empty();
+    if (found) {
+      if (front) {
+        *task = tasks_.front();
+        tasks_.pop_front();
+      } else {
+        *task = tasks_.back();
+        tasks_.pop_back();
+      }
+    }
+    pthread_mutex_unlock(&lock_);
+    return found;
+  }
+
+  pthread_mutex_t lock_;
+  std::deque<CrawlTask> tasks_;
+};
+
+// State shared by the workers of a parallel crawl
+struct ParallelCrawl {
+  // One deque and one tokenizer per worker, and one partial index per
+  // worker and shard, those of worker i starting at parts[i * num_shards]
+  vector<std::unique_ptr<WorkStealingDeque>> deques;
+  vector<WordIndex> parts;
+  vector<Tokenizer> tokenizers;
+  size_t num_shards = 1;
+
+  // The number of tasks that have been pushed but not yet finished. The
+  // crawl is over once this drops to zero.
+  std::atomic<size_t> pending{0};
+
+  // Set if some directory could not be read
+  std::atomic<bool> failed{false};
+};
+
+// The argument given to each parallel crawl worker
+struct CrawlWorker {
+  ParallelCrawl* crawl;
+  size_t id;
+};
+
+// Runs a parallel crawl worker until there is no work left anywhere
+static void crawl_worker(void* arg);
+
+// Lists the directory in task, or tokenizes its file into the worker's
+// partial index. Returns false if a directory could not be read.
+static bool run_task(const CrawlWorker& worker, const CrawlTask& task);
+
+// Appends the paths of the files under dir to order, in the order a
+// serial crawl would have visited them
+static void serial_order(const DirNode& dir, vector<string>* order);
+
+// Crawls root_dir with num_threads workers, splitting the documents
+// between shards, which have to be empty, by ShardedIndex::shard_of().
+// The shards are merged but not finalized. Returns false if any directory
+// could not be read.
+static bool crawl_parallel(const string& root_dir, size_t num_threads,
+                           bool positions, vector<WordIndex>* shards);
 
 
 //////////////////////////////////////////////////////////////////////////////
 // Externally-exported functions
 //////////////////////////////////////////////////////////////////////////////
 
-optional<WordIndex> crawl_filetree(const string& root_dir) {
+optional<WordIndex> crawl_filetree(const string& root_dir,
+                                   size_t num_threads, bool positions) {
   // Create a new word index
-  WordIndex index;
-  
-  // Call handle_dir on the root directory to start the crawl
-  if (!handle_dir(root_dir, index)) {
-    // Return nullopt if there was an error processing the directory
-    return nullopt;
+  WordIndex index(positions);
+
+  if (num_threads <= 1) {
+    // Call handle_dir on the root directory to start the crawl
+    Tokenizer tokenizer;
+    if (!handle_dir(root_dir, index, &tokenizer)) {
+      // Return nullopt if there was an error processing the directory
+      return nullopt;
+    }
+  } else {
+    vector<WordIndex> shards(1, WordIndex(positions));
+    if (!crawl_parallel(root_dir, num_threads, positions, &shards)) {
+      return nullopt;
+    }
+    index = std::move(shards[0]);
   }
+
+  // Precompute the document lengths and collection statistics used for
+  // ranking now, rather than on the first query
+  index.finalize();
   
   // Return the populated index
   return index;
 }
 
 
+optional<vector<WordIndex>> crawl_filetree_shards(const string& root_dir,
+                                                  size_t num_threads,
+                                                  size_t num_shards,
+                                                  bool positions) {
+  num_shards = std::max<size_t>(num_shards, 1);
+  vector<WordIndex> shards(num_shards, WordIndex(positions));
+  if (!crawl_parallel(root_dir, std::max<size_t>(num_threads, 1), positions,
+                      &shards)) {
+    return nullopt;
+  }
+
+  // Finalizing a shard only touches that shard, so they can all be
+  // finalized at once
+  {
+    ThreadPool pool(std::min(std::max<size_t>(num_threads, 1), num_shards));
+    for (WordIndex& shard : shards) {
+      pool.dispatch([&shard]() { shard.finalize(); });
+    }
+  }
+  return shards;
+}
+
+
 //////////////////////////////////////////////////////////////////////////////
 // Internal helper functions
 //////////////////////////////////////////////////////////////////////////////
 
-static bool handle_dir(const string& dir_path, WordIndex& index) {
+static bool crawl_parallel(const string& root_dir, size_t num_threads,
+                           bool positions, vector<WordIndex>* shards) {
+  size_t num_shards = shards->size();
+  ParallelCrawl crawl;
+  crawl.num_shards = num_shards;
+  crawl.parts.resize(num_threads * num_shards, WordIndex(positions));
+  for (size_t i = 0; i < num_threads; i++) {
+    crawl.deques.push_back(std::make_unique<WorkStealingDeque>());
+    crawl.tokenizers.emplace_back();
+  }
+
+  // Seed the first worker with the root directory; the others will
+  // steal from it until they have work of their own
+  DirNode root{root_dir, {}};
+  crawl.pending = 1;
+  crawl.deques[0]->push(CrawlTask{&root, nullptr});
+
+  vector<CrawlWorker> workers;
+  for (size_t i = 0; i < num_threads; i++) {
+    workers.push_back(CrawlWorker{&crawl, i});
+  }
+  {
+    // The pool's destructor waits for every worker to finish
+    ThreadPool pool(num_threads);
+    for (CrawlWorker& worker : workers) {
+      pool.dispatch(ThreadPool::Task{crawl_worker, &worker});
+    }
+  }
+  if (crawl.failed) {
+    return false;
+  }
+
+  // Number the documents of each shard in the order a serial crawl would
+  // have, merging the parts every worker recorded for it
+  vector<string> order;
+  serial_order(root, &order);
+  vector<vector<string>> shard_orders(num_shards);
+  for (string& name : order) {
+    shard_orders[ShardedIndex::shard_of(name, num_shards)].push_back(
+        std::move(name));
+  }
+  {
+    ThreadPool pool(std::min(num_threads, num_shards));
+    for (size_t s = 0; s < num_shards; s++) {
+      pool.dispatch([&crawl, &shard_orders, shards, num_threads, s]() {
+        vector<WordIndex> parts;
+        for (size_t w = 0; w < num_threads; w++) {
+          parts.push_back(
+              std::move(crawl.parts[w * crawl.num_shards + s]));
+        }
+        (*shards)[s].merge(&parts, shard_orders[s]);
+      });
+    }
+  }
+  return true;
+}
+
+static bool handle_dir(const string& dir_path, WordIndex& index,
+                       Tokenizer* tokenizer) {
   // Recursively descend into the passed-in directory, looking for files and
   // subdirectories.  Any encountered files are processed via handle_file(); any
   // subdirectories are recusively handled by handle_dir().
@@ -78,57 +295,137 @@ static bool handle_dir(const string& dir_path, WordIndex& index) {
     }
     
     // Construct the full path to the entry
-    string full_path = dir_path;
-    if (full_path.back() != '/') {
-      full_path += "/";
-    }
-    full_path += entry.name;
+    string full_path = entry_path(dir_path, entry.name);
     
     if (entry.is_dir) {
       // If it's a directory, recursively handle it
-      if (!handle_dir(full_path, index)) {
+      if (!handle_dir(full_path, index, tokenizer)) {
         return false;
       }
     } else {
       // If it's a file, process it
-      handle_file(full_path, index);
+      handle_file(full_path, index, tokenizer);
     }
   }
   
   return true;
 }
 
-static void handle_file(const string& fpath, WordIndex &index) {
-  // Read the contents of the specified file into a string
-  std::ifstream file(fpath);
-  if (!file.is_open()) {
-    return;
+string entry_path(const string& dir_path, const string& name) {
+  string full_path = dir_path;
+  if (full_path.back() != '/') {
+    full_path += "/";
   }
-  
-    string content((std::istreambuf_iterator<char>(file)),
-                  std::istreambuf_iterator<char>());
-  
-  // Close the file
-  file.close();
-  
-  // Define the delimiters
-  const string delimiters = " \r\t\v\n,.:;?!";
-  vector<string> tokens = split(content, delimiters);
-  
-  // Record each token as a word into the WordIndex
-  for (string token : tokens) {
-    // Skip empty tokens
-    if (token.empty()) {
+  full_path += name;
+  return full_path;
+}
+
+static void crawl_worker(void* arg) {
+  const CrawlWorker& worker = *static_cast<CrawlWorker*>(arg);
+  ParallelCrawl& crawl = *worker.crawl;
+  size_t num_workers = crawl.deques.size();
+
+  while (!crawl.failed) {
+    // Take our own most recent task, or else steal the oldest task of
+    // the next worker that has any
+    CrawlTask task{};
+    bool found = crawl.deques[worker.id]->pop(&task);
+    for (size_t i = 1; !found && i < num_workers; i++) {
+      found = crawl.deques[(worker.id + i) % num_workers]->steal(&task);
+    }
+
+    if (!found) {
+      if (crawl.pending == 0) {
+        return;
+      }
+      // Someone is still listing a directory that may produce more work
+      sched_yield();
       continue;
     }
-    
-    // Convert to lowercase
-    std::transform(token.begin(), token.end(), token.begin(),
-                  [](unsigned char c) { return std::tolower(c); });
-    
-    // Record the word in the index using the exact file path
-    index.record(token, fpath);
+
+    if (!run_task(worker, task)) {
+      crawl.failed = true;
+    }
+    crawl.pending--;
+  }
+}
+
+static bool run_task(const CrawlWorker& worker, const CrawlTask& task) {
+  ParallelCrawl& crawl = *worker.crawl;
+  if (task.file != nullptr) {
+    size_t shard = (crawl.num_shards == 1)
+                       ? 0
+                       : ShardedIndex::shard_of(*task.file, crawl.num_shards);
+    handle_file(*task.file, crawl.parts[worker.id * crawl.num_shards + shard],
+                &crawl.tokenizers[worker.id]);
+    return true;
+  }
+
+  DirNode& dir = *task.dir;
+  auto entries_opt = readdir(dir.path);
+  if (!entries_opt) {
+    return false;
+  }
+  for (const auto& entry : *entries_opt) {
+    // Skip "." and ".." directories
+    if (entry.name == "." || entry.name == "..") {
+      continue;
+    }
+    string full_path = entry_path(dir.path, entry.name);
+    std::unique_ptr<DirNode> child;
+    if (entry.is_dir) {
+      child = std::make_unique<DirNode>(DirNode{full_path, {}});
+    }
+    dir.entries.push_back(DirNode::Entry{std::move(full_path), std::move(child)});
+  }
+
+  // Only hand out the entries once the list is complete, since other
+  // workers keep pointers into it
+  for (const DirNode::Entry& entry : dir.entries) {
+    crawl.pending++;
+    crawl.deques[worker.id]->push(
+        CrawlTask{entry.dir.get(), entry.dir ? nullptr : &entry.path});
+  }
+  return true;
+}
+
+static void serial_order(const DirNode& dir, vector<string>* order) {
+  for (const DirNode::Entry& entry : dir.entries) {
+    if (entry.dir) {
+      serial_order(*entry.dir, order);
+    } else {
+      order->push_back(entry.path);
+    }
+  }
+}
+
+static void handle_file(const string& fpath, WordIndex &index,
+                        Tokenizer* tokenizer) {
+  if (!tokenizer->open(fpath)) {
+    return;
+  }
+
+  // Record each word in the index using the exact file path. The words
+  // point into the tokenizer's buffer, and are only copied by the index
+  // the first time it sees them.
+  std::string_view word;
+  while (tokenizer->next(&word)) {
+    index.record(word, fpath);
+  }
+}
+
+optional<vector<string>> read_words(const string& path) {
+  Tokenizer tokenizer;
+  if (!tokenizer.open(path)) {
+    return nullopt;
+  }
+
+  vector<string> words;
+  std::string_view word;
+  while (tokenizer.next(&word)) {
+    words.emplace_back(word);
   }
+  return words;
 }
 
 }  // namespace searchserver
\ No newline at end of file
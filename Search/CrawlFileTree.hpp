@@ -0,0 +1,78 @@
+/*
+ * Copyright ©2025 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2025 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef CRAWLFILETREE_HPP_
+#define CRAWLFILETREE_HPP_
+
+#include <optional>  // for std::optional
+#include <string>    // for std::string
+#include <vector>    // for std::vector
+
+#include "./WordIndex.hpp"
+
+namespace searchserver {
+
+// Crawls the directory tree rooted at root_dir, reading every file in it
+// and recording each of the words in the file into a WordIndex.
+//
+// With more than one thread, directories are listed and files tokenized
+// by a pool of workers that steal work from each other, each recording
+// into its own partial index. The partial indexes are merged at the end,
+// so the result is identical to that of a single-threaded crawl.
+//
+// Arguments:
+//  - root_dir: the directory to crawl
+//  - num_threads: the number of threads to crawl with
+//  - positions: whether the index records the position of every word, so
+//    that it can answer phrase and proximity queries
+//
+// Returns:
+//  - the populated WordIndex, or nullopt if any directory in the tree
+//    could not be read
+std::optional<WordIndex> crawl_filetree(const std::string& root_dir,
+                                        size_t num_threads = 1,
+                                        bool positions = false);
+
+// Crawls a directory tree like crawl_filetree(), but splits the documents
+// between num_shards indexes, putting each one in the shard that
+// ShardedIndex::shard_of() picks for its name. The files are tokenized by
+// num_threads workers, and the shards are then merged and finalized in
+// parallel too.
+//
+// Arguments:
+//  - root_dir: the directory to crawl
+//  - num_threads: the number of threads to crawl with
+//  - num_shards: the number of shards to split the documents between
+//  - positions: whether the shards record the position of every word
+//
+// Returns:
+//  - the shards, or nullopt if any directory in the tree could not be read
+std::optional<std::vector<WordIndex>> crawl_filetree_shards(
+    const std::string& root_dir, size_t num_threads, size_t num_shards,
+    bool positions = false);
+
+// Reads a file and splits it into the words the crawler records for it,
+// lowercased, in the order they appear.
+//
+// Arguments:
+//  - path: the file to read
+//
+// Returns:
+//  - the words, or nullopt if the file could not be opened
+std::optional<std::vector<std::string>> read_words(const std::string& path);
+
+// Returns the path the crawler gives the entry with the given name in a
+// directory, which is also the name of the document if it is a file
+std::string entry_path(const std::string& dir_path, const std::string& name);
+
+}  // namespace searchserver
+
+#endif  // CRAWLFILETREE_HPP_
@@ -0,0 +1,132 @@
+#include "./Epoch.hpp"
+
+#include <sched.h>  // for sched_yield()
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>  // for _mm_pause()
+#endif
+
+#include <atomic>
+#include <cstdint>
+
+namespace searchserver {
+
+// How many times epoch_synchronize() checks a reader again before it
+// starts yielding the CPU to it
+static const int kSpinsBeforeYield = 64;
+
+// Where a thread announces the epoch it is reading in. Slots are never
+// freed; a thread that exits hands its slot to the next thread that
+// needs one.
+struct alignas(64) ReaderSlot {
+  // The epoch the thread entered its outermost guard in, or 0 while it
+  // is not reading
+  std::atomic<uint64_t> epoch{0};
+  std::atomic<bool> in_use{true};
+  ReaderSlot* next = nullptr;
+};
+
+// The calling thread's slot and how deeply its guards are nested
+struct ThreadSlot {
+  ReaderSlot* slot = nullptr;
+  int depth = 0;
+
+  // gives the slot back when the thread exits
+  ~ThreadSlot();
+};
+
+// The current epoch, which starts at 1 so that 0 can mean "not reading"
+static std::atomic<uint64_t> global_epoch{1};
+
+// Every slot ever handed out, newest first
+static std::atomic<ReaderSlot*> all_slots{nullptr};
+
+static thread_local ThreadSlot thread_slot;
+
+// Returns a slot for the calling thread, reusing one given back by an
+// exited thread if there is one
+static ReaderSlot* claim_slot();
+
+// Tells the CPU that this thread is spinning
+static void cpu_relax();
+
+EpochGuard::EpochGuard() {
+  ThreadSlot& self = thread_slot;
+  if (self.depth++ > 0) {
+    return;
+  }
+  if (self.slot == nullptr) {
+    self.slot = claim_slot();
+  }
+
+  // Announce the epoch before loading anything it protects. The fence
+  // pairs with the one in epoch_synchronize(): either the writer sees
+  // this reader's epoch and waits for it, or this reader sees what the
+  // writer published before it started waiting.
+  self.slot->epoch.store(global_epoch.load(), std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+EpochGuard::~EpochGuard() {
+  ThreadSlot& self = thread_slot;
+  if (--self.depth == 0) {
+    self.slot->epoch.store(0, std::memory_order_release);
+  }
+}
+
+void epoch_synchronize() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  uint64_t target = global_epoch.fetch_add(1) + 1;
+
+  // Readers that entered before the epoch moved on may still hold what
+  // was unpublished; any that enter from now on cannot
+  for (ReaderSlot* slot = all_slots.load(std::memory_order_acquire);
+       slot != nullptr; slot = slot->next) {
+    for (int spins = 0;; spins++) {
+      uint64_t epoch = slot->epoch.load(std::memory_order_acquire);
+      if (epoch == 0 || epoch >= target) {
+        break;
+      }
+      if (spins < kSpinsBeforeYield) {
+        cpu_relax();
+      } else {
+        sched_yield();
+      }
+    }
+  }
+}
+
+ThreadSlot::~ThreadSlot() {
+  if (slot != nullptr) {
+    slot->epoch.store(0, std::memory_order_relaxed);
+    slot->in_use.store(false, std::memory_order_release);
+  }
+}
+
+static ReaderSlot* claim_slot() {
+  for (ReaderSlot* slot = all_slots.load(std::memory_order_acquire);
+       slot != nullptr; slot = slot->next) {
+    bool in_use = false;
+    if (!slot->in_use.load(std::memory_order_relaxed) &&
+        slot->in_use.compare_exchange_strong(in_use, true,
+                                             std::memory_order_acquire)) {
+      return slot;
+    }
+  }
+
+  ReaderSlot* slot = new ReaderSlot();
+  slot->next = all_slots.load(std::memory_order_relaxed);
+  while (!all_slots.compare_exchange_weak(slot->next, slot,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+  }
+  return slot;
+}
+
+static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#endif
+}
+
+}  // namespace searchserver
@@ -0,0 +1,37 @@
+#ifndef EPOCH_HPP_
+#define EPOCH_HPP_
+
+namespace searchserver {
+
+// Epoch-based protection of data that readers use without taking locks.
+//
+// Readers wrap each use of shared data in an EpochGuard, which only
+// announces the current epoch in a slot owned by the reading thread. A
+// writer that has unpublished something, for example by swapping the
+// pointer readers load it from, calls epoch_synchronize() before freeing
+// or modifying it. That waits for every reader that might have loaded
+// the old pointer to leave its guard. Readers never wait for writers;
+// a writer waits for at most the readers that were already reading.
+
+// Marks the lifetime of the guard as a read-side critical section, in
+// which pointers loaded from shared data stay valid. Guards may be
+// nested within a thread, and must be destroyed by the thread that
+// created them.
+class EpochGuard {
+ public:
+  EpochGuard();
+  ~EpochGuard();
+
+  // disable copying and moving, a guard belongs to one scope
+  EpochGuard(const EpochGuard& other) = delete;
+  EpochGuard& operator=(const EpochGuard& other) = delete;
+};
+
+// Waits until every EpochGuard that existed when it was called has been
+// destroyed. Anything unpublished before the call can then no longer be
+// in use. Must not be called while the calling thread holds a guard.
+void epoch_synchronize();
+
+}  // namespace searchserver
+
+#endif  // EPOCH_HPP_
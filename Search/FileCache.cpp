@@ -0,0 +1,149 @@
+#include "./FileCache.hpp"
+
+#include <fcntl.h>   // for open()
+#include <unistd.h>  // for close()
+
+#include <algorithm>
+#include <vector>
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace searchserver {
+
+// How long a cached file is served before its path is checked again
+static const std::chrono::seconds kRevalidateInterval{1};
+
+// Returns true if two stats describe the same, unmodified file
+static bool same_file(const struct stat& a, const struct stat& b);
+
+OpenFile::~OpenFile() {
+  close(fd);
+}
+
+FileCache::FileCache(const string& root_dir, size_t max_files)
+    : root_dir_(root_dir), max_files_(std::max<size_t>(max_files, 1)), lock_() {
+  pthread_mutex_init(&lock_, nullptr);
+
+  // Remove trailing slash from root_dir
+  if (!root_dir_.empty() && root_dir_.back() == '/') {
+    root_dir_.pop_back();
+  }
+}
+
+FileCache::~FileCache() {
+  pthread_mutex_destroy(&lock_);
+}
+
+shared_ptr<const OpenFile> FileCache::open(const string& path) {
+  Clock::time_point now = Clock::now();
+
+  pthread_mutex_lock(&lock_);
+  auto it = index_.find(path);
+  if (it != index_.end()) {
+    Entry& entry = *it->second;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    if (now - entry.checked < kRevalidateInterval) {
+      hits_++;
+      shared_ptr<const OpenFile> file = entry.file;
+      pthread_mutex_unlock(&lock_);
+      return file;
+    }
+
+    // The file has been trusted long enough. Check that its path still
+    // names the same file, without holding the lock during the stat().
+    Entry cached = entry;
+    pthread_mutex_unlock(&lock_);
+
+    struct stat info{};
+    if (stat(cached.resolved.c_str(), &info) == 0 &&
+        same_file(info, cached.file->info)) {
+      pthread_mutex_lock(&lock_);
+      hits_++;
+      cached.checked = now;
+      insert(cached);
+      pthread_mutex_unlock(&lock_);
+      return cached.file;
+    }
+    pthread_mutex_lock(&lock_);
+  }
+  misses_++;
+  pthread_mutex_unlock(&lock_);
+
+  string resolved;
+  shared_ptr<const OpenFile> file = resolve(path, &resolved);
+
+  pthread_mutex_lock(&lock_);
+  if (file != nullptr) {
+    insert(Entry{path, resolved, file, now});
+  } else if ((it = index_.find(path)) != index_.end()) {
+    // The file is gone, so stop serving the cached copy
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+  pthread_mutex_unlock(&lock_);
+  return file;
+}
+
+FileCache::Stats FileCache::stats() const {
+  pthread_mutex_lock(&lock_);
+  Stats stats;
+  stats.hits = hits_;
+  stats.misses = misses_;
+  stats.open_files = entries_.size();
+  pthread_mutex_unlock(&lock_);
+  return stats;
+}
+
+shared_ptr<const OpenFile> FileCache::resolve(const string& path,
+                                              string* resolved) const {
+  // Try the path directly, then relative to the root directory, then
+  // without a leading "./"
+  vector<string> candidates{path};
+  candidates.push_back(root_dir_ + "/" +
+                       (!path.empty() && path.front() == '/' ? path.substr(1)
+                                                             : path));
+  if (path.size() >= 2 && path.substr(0, 2) == "./") {
+    candidates.push_back(path.substr(2));
+  }
+
+  for (const string& candidate : candidates) {
+    int fd = ::open(candidate.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      continue;
+    }
+    struct stat info{};
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode)) {
+      close(fd);
+      continue;
+    }
+    *resolved = candidate;
+    return std::make_shared<const OpenFile>(fd, info);
+  }
+  return nullptr;
+}
+
+void FileCache::insert(Entry entry) {
+  auto it = index_.find(entry.path);
+  if (it != index_.end()) {
+    entries_.erase(it->second);
+    index_.erase(it);
+  }
+
+  while (entries_.size() >= max_files_) {
+    index_.erase(entries_.back().path);
+    entries_.pop_back();
+  }
+
+  entries_.push_front(std::move(entry));
+  index_.emplace(entries_.front().path, entries_.begin());
+}
+
+static bool same_file(const struct stat& a, const struct stat& b) {
+  return a.st_dev == b.st_dev && a.st_ino == b.st_ino &&
+         a.st_size == b.st_size && a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+         a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+}  // namespace searchserver
@@ -0,0 +1,118 @@
+#ifndef FILE_CACHE_HPP_
+#define FILE_CACHE_HPP_
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace searchserver {
+
+// A regular file opened for reading. The descriptor is closed once the
+// last reference to the OpenFile is dropped, so a response can keep
+// sending from a file even after the cache has evicted it.
+struct OpenFile {
+  OpenFile(int fd, const struct stat& info) : fd(fd), info(info) {}
+
+  // closes the file
+  ~OpenFile();
+
+  // Returns the size of the file when it was opened
+  off_t size() const { return info.st_size; }
+
+  int fd;
+  struct stat info;
+
+  // disable copying, the descriptor belongs to one object
+  OpenFile(const OpenFile& other) = delete;
+  OpenFile& operator=(const OpenFile& other) = delete;
+};
+
+// A FileCache keeps the files served under /static/ open, so that hot
+// documents can be sent without resolving their path or opening them
+// again on every request.
+//
+// Files are cached by the path the client asked for. A cached file is
+// trusted for a short while; after that the next request for it stats
+// the path again, and reopens it if it was replaced or modified. Only
+// the most recently used files are kept open.
+class FileCache {
+ public:
+  // Hit and miss counters
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t open_files = 0;
+  };
+
+  // Creates an empty cache.
+  //
+  // Arguments:
+  //  - root_dir: the directory that request paths are relative to
+  //  - max_files: the most files to keep open at once
+  FileCache(const std::string& root_dir, size_t max_files);
+
+  // destroys the lock
+  ~FileCache();
+
+  // Opens the file a request asks for. The path is tried as given, then
+  // relative to the root directory, and finally without a leading "./".
+  //
+  // Arguments:
+  //  - path: the path from the request, after "/static/"
+  //
+  // Returns:
+  //  - the open file, or nullptr if no regular file could be opened
+  std::shared_ptr<const OpenFile> open(const std::string& path);
+
+  // Returns the current counters
+  Stats stats() const;
+
+  // disable copying and moving, the cache holds a lock
+  FileCache(const FileCache& other) = delete;
+  FileCache& operator=(const FileCache& other) = delete;
+  FileCache(FileCache&& other) = delete;
+  FileCache& operator=(FileCache&& other) = delete;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // A cached file: the request path it was opened for, the path it was
+  // resolved to, and when that path was last checked
+  struct Entry {
+    std::string path;
+    std::string resolved;
+    std::shared_ptr<const OpenFile> file;
+    Clock::time_point checked;
+  };
+
+  // Resolves a request path and opens the file it names, setting
+  // resolved to the path that was opened. Returns nullptr if no
+  // candidate is a regular file that can be read.
+  std::shared_ptr<const OpenFile> resolve(const std::string& path,
+                                          std::string* resolved) const;
+
+  // Caches an entry as the most recently used one, replacing any older
+  // entry for the same path. The cache must be locked.
+  void insert(Entry entry);
+
+  std::string root_dir_;
+  size_t max_files_;
+
+  // Entries from the most recently used to the least, and an index of
+  // them by request path
+  mutable pthread_mutex_t lock_;
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+}  // namespace searchserver
+
+#endif  // FILE_CACHE_HPP_
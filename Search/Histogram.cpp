@@ -0,0 +1,92 @@
+#include "./Histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace searchserver {
+
+// Values below kSubBuckets have a bucket each. Above that, every power of
+// two from 2^kSubBucketBits to 2^63 has kSubBuckets of its own.
+static constexpr size_t kNumBuckets =
+    (64 - Histogram::kSubBucketBits + 1) * Histogram::kSubBuckets;
+
+Histogram::Histogram()
+    : counts_(kNumBuckets, 0),
+      count_(0),
+      min_(std::numeric_limits<uint64_t>::max()),
+      max_(0),
+      sum_(0) {}
+
+void Histogram::record(uint64_t value) {
+  counts_[bucket(value)]++;
+  count_++;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+  sum_ += static_cast<double>(value);
+}
+
+void Histogram::merge(const Histogram& other) {
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    counts_[i] += other.counts_[i];
+  }
+  count_ += other.count_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+  sum_ += other.sum_;
+}
+
+void Histogram::clear() {
+  std::fill(counts_.begin(), counts_.end(), 0);
+  count_ = 0;
+  min_ = std::numeric_limits<uint64_t>::max();
+  max_ = 0;
+  sum_ = 0;
+}
+
+double Histogram::mean() const {
+  return count_ == 0 ? 0 : sum_ / static_cast<double>(count_);
+}
+
+uint64_t Histogram::percentile(double percent) const {
+  if (count_ == 0) {
+    return 0;
+  }
+
+  // The rank of the value wanted, counting from 1
+  percent = std::clamp(percent, 0.0, 100.0);
+  auto rank = static_cast<uint64_t>(
+      std::ceil(percent / 100.0 * static_cast<double>(count_)));
+  rank = std::max<uint64_t>(rank, 1);
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kNumBuckets; i++) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      return std::min(highest_value(i), max_);
+    }
+  }
+  return max_;
+}
+
+size_t Histogram::bucket(uint64_t value) {
+  if (value < kSubBuckets) {
+    return value;
+  }
+
+  // Keep the kSubBucketBits bits below the highest set bit; the position
+  // of that bit picks the power of two
+  size_t shift = 63 - __builtin_clzll(value) - kSubBucketBits;
+  return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+}
+
+uint64_t Histogram::highest_value(size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  size_t shift = bucket / kSubBuckets - 1;
+  uint64_t lowest = (kSubBuckets + bucket % kSubBuckets) << shift;
+  return lowest + ((uint64_t{1} << shift) - 1);
+}
+
+}  // namespace searchserver
@@ -0,0 +1,66 @@
+#ifndef HISTOGRAM_HPP_
+#define HISTOGRAM_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace searchserver {
+
+// A Histogram counts recorded values, such as latencies in nanoseconds,
+// in log-linear buckets like an HDR histogram: every power of two is
+// split into kSubBuckets equal steps, so any value from 1 to 2^63 is kept
+// to within 1% of what was recorded. Recording a value is a few shifts
+// and an increment, with no allocation, and the memory used does not
+// depend on how many values are recorded.
+class Histogram {
+ public:
+  // How many equal steps each power of two is split into
+  static constexpr size_t kSubBucketBits = 7;
+  static constexpr size_t kSubBuckets = size_t{1} << kSubBucketBits;
+
+  // Creates an empty histogram
+  Histogram();
+
+  // Counts one value
+  void record(uint64_t value);
+
+  // Adds every value counted by other to this histogram
+  void merge(const Histogram& other);
+
+  // Forgets every value counted so far
+  void clear();
+
+  uint64_t count() const { return count_; }
+  uint64_t min() const { return count_ == 0 ? 0 : min_; }
+  uint64_t max() const { return max_; }
+  double mean() const;
+
+  // Returns a value that at least the given percentage of the recorded
+  // values are at or below: the highest value of the bucket that
+  // percentile falls in, or the largest value recorded if that is lower.
+  //
+  // Arguments:
+  //  - percent: from 0 to 100, such as 99.9
+  //
+  // Returns:
+  //  - the value, or 0 if nothing has been recorded
+  uint64_t percentile(double percent) const;
+
+ private:
+  // Returns the bucket a value is counted in
+  static size_t bucket(uint64_t value);
+
+  // Returns the highest value counted in a bucket
+  static uint64_t highest_value(size_t bucket);
+
+  std::vector<uint64_t> counts_;
+  uint64_t count_;
+  uint64_t min_;
+  uint64_t max_;
+  double sum_;
+};
+
+}  // namespace searchserver
+
+#endif  // HISTOGRAM_HPP_
@@ -0,0 +1,227 @@
+#include "./HttpRequest.hpp"
+
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace searchserver {
+
+// Returns the first line feed in [begin, end), or end if there is none
+static const char* find_newline(const char* begin, const char* end);
+
+// Returns true if the line feed at data[pos] ends a "\r\n\r\n"
+static bool ends_header(std::string_view data, size_t pos);
+
+// Compares two header names, ignoring the case of ASCII letters
+static bool equal_ignore_case(std::string_view a, std::string_view b);
+
+// Strips spaces and tabs from both ends of a header value
+static std::string_view trim(std::string_view value);
+
+bool HttpRequest::parse(std::string_view header) {
+  header_ = header;
+  num_headers_ = 0;
+
+  // Every line of the header ends in "\r\n", including the empty one
+  // that ends the header itself
+  const char* pos = header.data();
+  const char* end = header.data() + header.size();
+  const char* eol = find_newline(pos, end);
+  if (eol == end || eol == pos || eol[-1] != '\r') {
+    return false;
+  }
+
+  // The request line: method, target and version separated by spaces.
+  // A carriage return is only allowed at the end of a line, so that a
+  // line cannot be read differently by something in front of the server.
+  std::string_view line(pos, eol - 1 - pos);
+  if (line.find('\r') != std::string_view::npos) {
+    return false;
+  }
+  std::string_view parts[3];
+  size_t num_parts = 0;
+  size_t i = 0;
+  while (i < line.size()) {
+    if (line[i] == ' ') {
+      i++;
+      continue;
+    }
+    size_t word_end = line.find(' ', i);
+    if (word_end == std::string_view::npos) {
+      word_end = line.size();
+    }
+    if (num_parts == 3) {
+      return false;
+    }
+    parts[num_parts++] = line.substr(i, word_end - i);
+    i = word_end;
+  }
+  if (num_parts != 3) {
+    return false;
+  }
+  method_ = parts[0];
+  target_ = parts[1];
+  version_ = parts[2];
+  size_t question = target_.find('?');
+  path_ = target_.substr(0, question);
+  query_ = (question == std::string_view::npos) ? std::string_view()
+                                                : target_.substr(question + 1);
+
+  // The fields, one "name: value" per line, until the empty line
+  pos = eol + 1;
+  while (true) {
+    eol = find_newline(pos, end);
+    if (eol == end || eol == pos || eol[-1] != '\r') {
+      return false;
+    }
+    line = std::string_view(pos, eol - 1 - pos);
+    pos = eol + 1;
+    if (line.empty()) {
+      // Anything after the empty line is not part of this header
+      return pos == end;
+    }
+
+    size_t colon = line.find(':');
+    if (colon == 0 || colon == std::string_view::npos ||
+        line.find('\r') != std::string_view::npos ||
+        line[colon - 1] == ' ' || line[colon - 1] == '\t' ||
+        line[0] == ' ' || line[0] == '\t' ||
+        num_headers_ == kMaxHeaders) {
+      return false;
+    }
+    headers_[num_headers_++] = {line.substr(0, colon),
+                                trim(line.substr(colon + 1))};
+  }
+}
+
+std::optional<std::string_view> HttpRequest::find_header(
+    std::string_view name) const {
+  for (size_t i = 0; i < num_headers_; i++) {
+    if (equal_ignore_case(headers_[i].name, name)) {
+      return headers_[i].value;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<std::string_view> HttpRequest::arg(std::string_view name) const {
+  std::optional<std::string_view> found;
+  size_t pos = 0;
+  while (pos < query_.size()) {
+    size_t amp = query_.find('&', pos);
+    if (amp == std::string_view::npos) {
+      amp = query_.size();
+    }
+    std::string_view pair = query_.substr(pos, amp - pos);
+    pos = amp + 1;
+
+    size_t equals = pair.find('=');
+    if (equals == std::string_view::npos || equals + 1 == pair.size()) {
+      continue;
+    }
+    if (pair.substr(0, equals) == name) {
+      found = pair.substr(equals + 1);
+    }
+  }
+  return found;
+}
+
+size_t find_header_end(std::string_view data, size_t* scanned) {
+  // A terminator that straddles what was scanned before and what arrived
+  // since is still found, since each line feed is checked against the
+  // three bytes before it
+  size_t start = (*scanned < data.size()) ? *scanned : data.size();
+  const char* begin = data.data();
+  const char* end = begin + data.size();
+  const char* pos = begin + start;
+  while (true) {
+    pos = find_newline(pos, end);
+    if (pos == end) {
+      *scanned = data.size();
+      return 0;
+    }
+    size_t lf = pos - begin;
+    if (ends_header(data, lf)) {
+      *scanned = lf + 1;
+      return lf + 1;
+    }
+    pos++;
+  }
+}
+
+static const char* find_newline(const char* begin, const char* end) {
+  const char* pos = begin;
+
+#if defined(__AVX2__)
+  // Compare 32 bytes at a time against '\n'; each set bit of the mask is
+  // a line feed
+  const __m256i newlines = _mm256_set1_epi8('\n');
+  for (; end - pos >= 32; pos += 32) {
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+    auto mask = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newlines)));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+#if defined(__SSE2__)
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; end - pos >= 16; pos += 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    auto mask = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  for (; pos < end; pos++) {
+    if (*pos == '\n') {
+      return pos;
+    }
+  }
+  return end;
+}
+
+static bool ends_header(std::string_view data, size_t pos) {
+  return pos >= 3 && data[pos - 1] == '\r' && data[pos - 2] == '\n' &&
+         data[pos - 3] == '\r';
+}
+
+static bool equal_ignore_case(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    char x = a[i];
+    char y = b[i];
+    if (x >= 'A' && x <= 'Z') {
+      x = static_cast<char>(x - 'A' + 'a');
+    }
+    if (y >= 'A' && y <= 'Z') {
+      y = static_cast<char>(y - 'A' + 'a');
+    }
+    if (x != y) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::string_view trim(std::string_view value) {
+  size_t first = value.find_first_not_of(" \t");
+  if (first == std::string_view::npos) {
+    return {};
+  }
+  size_t last = value.find_last_not_of(" \t");
+  return value.substr(first, last - first + 1);
+}
+
+}  // namespace searchserver
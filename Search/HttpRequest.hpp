@@ -0,0 +1,101 @@
+#ifndef HTTP_REQUEST_HPP_
+#define HTTP_REQUEST_HPP_
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace searchserver {
+
+// One field of a request header, with the whitespace around its value
+// removed
+struct HttpHeader {
+  std::string_view name;
+  std::string_view value;
+};
+
+// An HttpRequest is a request header parsed in place. Every part of it is
+// a view into the buffer the header was read into, so parsing copies and
+// allocates nothing, and the request is only valid as long as the buffer
+// is left alone.
+class HttpRequest {
+ public:
+  // The most header fields a request may have
+  static constexpr size_t kMaxHeaders = 64;
+
+  // Parses a request header.
+  //
+  // Arguments:
+  //  - header: the whole header, up to and including the "\r\n\r\n" that
+  //    ends it, as found by find_header_end()
+  //
+  // Returns:
+  //  - false if the header is malformed: the request line does not have
+  //    a method, target and version, a field has no name or colon, a
+  //    line has a carriage return before its end, or there are more than
+  //    kMaxHeaders fields
+  bool parse(std::string_view header);
+
+  // The parts of the request line. The target is split into the path
+  // and the query string after the first '?', both still percent-encoded.
+  std::string_view method() const { return method_; }
+  std::string_view target() const { return target_; }
+  std::string_view path() const { return path_; }
+  std::string_view query() const { return query_; }
+  std::string_view version() const { return version_; }
+
+  // The whole header the request was parsed from
+  std::string_view header() const { return header_; }
+
+  // Returns the header fields, in the order they were sent
+  size_t num_headers() const { return num_headers_; }
+  const HttpHeader& header(size_t i) const { return headers_[i]; }
+
+  // Finds a header field by name, ignoring case.
+  //
+  // Returns:
+  //  - the value of the first field with that name, or nullopt if there
+  //    is none
+  std::optional<std::string_view> find_header(std::string_view name) const;
+
+  // Finds an argument of the query string. Arguments are "name=value"
+  // pairs separated by '&'; a pair with an empty value, or without an
+  // '=', is ignored, and if a name is given more than once the last
+  // value counts.
+  //
+  // Returns:
+  //  - the value, still percent-encoded, or nullopt if there is none
+  std::optional<std::string_view> arg(std::string_view name) const;
+
+ private:
+  std::string_view header_;
+  std::string_view method_;
+  std::string_view target_;
+  std::string_view path_;
+  std::string_view query_;
+  std::string_view version_;
+  std::array<HttpHeader, kMaxHeaders> headers_;
+  size_t num_headers_ = 0;
+};
+
+// Finds the "\r\n\r\n" that ends the request header at the start of some
+// data, so that a header that arrives in pieces can be found without
+// searching what was already searched each time more of it arrives. The
+// data is scanned for line feeds 16 or 32 bytes at a time with SSE2 or
+// AVX2 when the build targets them.
+//
+// Arguments:
+//  - data: the data received so far
+//  - scanned: how much of the data has already been searched. Start at
+//    0, and pass the value this leaves behind with the same data plus
+//    whatever arrived since.
+//
+// Returns:
+//  - the length of the header including the "\r\n\r\n", or 0 if data
+//    does not contain a whole header yet
+size_t find_header_end(std::string_view data, size_t* scanned);
+
+}  // namespace searchserver
+
+#endif  // HTTP_REQUEST_HPP_
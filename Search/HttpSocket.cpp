@@ -10,10 +10,21 @@
  */
 
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <limits.h>  // for IOV_MAX
+#include <netinet/in.h>
+#include <netinet/tcp.h>  // for TCP_NODELAY
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
 #include <array>
+#include <cerrno>
 #include <cstdint>
 #include <cstring>
 #include <string>
+#include <string_view>
 
 #include "./HttpSocket.hpp"
 #include "./HttpUtils.hpp"
@@ -27,8 +38,13 @@ using std::vector;
 
 namespace searchserver {
 
-static const char* const kHeaderEnd = "\r\n\r\n";
-static const int kHeaderEndLen = 4;
+// Sends all of buf, waiting for room in the socket's send buffer when
+// it is non-blocking. Returns false if the connection failed.
+static bool send_all(int fd, const string& buf, int flags);
+
+// Waits until a non-blocking socket has room to send more. Returns false
+// if it still has none after HttpSocket::kWriteTimeoutMs.
+static bool wait_writable(int fd);
 
 optional<string> HttpSocket::next_request() {
   // Use "wrapped_read" to read data into the buffer_
@@ -47,37 +63,219 @@ optional<string> HttpSocket::next_request() {
 
   // TODO
 
-  size_t header_end = buffer_.find(kHeaderEnd);
+  while (!has_request()) {
+    // Read straight into the buffer's free space. A header too big for
+    // the buffer is treated like a dropped connection.
+    if (!buffer_.reserve()) {
+      return std::nullopt;
+    }
+    ssize_t res = read(fd_, buffer_.tail(), buffer_.room());
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return std::nullopt;
+    }
+    buffer_.commit(static_cast<size_t>(res));
+  }
 
-  while (header_end == string::npos) {
-    size_t data_read = wrapped_read(fd_, &buffer_);
+  return string(take_request());
+}
 
-    if (data_read == 0) {
-      if (buffer_.empty()) {
-        return std::nullopt;
-      }
+RequestStatus HttpSocket::next_request(HttpRequest* request) {
+  if (!has_request()) {
+    return RequestStatus::kIncomplete;
+  }
+  return request->parse(take_request()) ? RequestStatus::kComplete
+                                        : RequestStatus::kMalformed;
+}
+
+std::string_view HttpSocket::take_request() {
+  std::string_view header = buffer_.data().substr(0, header_len_);
+  buffer_.consume(header_len_);
+  scanned_ = 0;
+  header_len_ = 0;
+  return header;
+}
+
+bool HttpSocket::write_response(const std::string& response) const {
+  // TODO
+  return send_all(fd_, response, 0);
+}
+
+bool HttpSocket::write_response(const string& header,
+                                const string& body) const {
+  std::vector<struct iovec> parts(2);
+  parts[0].iov_base = const_cast<char*>(header.data());
+  parts[0].iov_len = header.size();
+  parts[1].iov_base = const_cast<char*>(body.data());
+  parts[1].iov_len = body.size();
+  return write_parts(&parts, false);
+}
+
+bool HttpSocket::write_response(const string& header, int file_fd,
+                                off_t offset, size_t length) const {
+  // MSG_MORE holds the header back until the start of the body follows,
+  // so small responses leave in one segment instead of two
+  if (!send_all(fd_, header, length > 0 ? MSG_MORE : 0)) {
+    return false;
+  }
+  return write_file(file_fd, offset, length);
+}
+
+bool HttpSocket::write_parts(std::vector<struct iovec>* parts,
+                             bool more) const {
+  size_t next = 0;
+  while (true) {
+    WriteStatus status = try_write_parts(parts, &next, more);
+    if (status != WriteStatus::kBlocked) {
+      return status == WriteStatus::kDone;
+    }
+    if (!wait_writable(fd_)) {
+      return false;
+    }
+  }
+}
+
+WriteStatus HttpSocket::try_write_parts(std::vector<struct iovec>* parts,
+                                        size_t* next, bool more) const {
+  // sendmsg() rather than writev(), so that a client that went away
+  // fails the write instead of raising SIGPIPE
+  while (*next < parts->size()) {
+    size_t remaining = parts->size() - *next;
+    struct msghdr msg{};
+    msg.msg_iov = parts->data() + *next;
+    msg.msg_iovlen = std::min<size_t>(remaining, IOV_MAX);
+    int flags = MSG_NOSIGNAL;
+    if (more || msg.msg_iovlen < remaining) {
+      flags |= MSG_MORE;
+    }
+    ssize_t res = sendmsg(fd_, &msg, flags);
+    if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return WriteStatus::kBlocked;
+    }
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1) {
+      return WriteStatus::kFailed;
     }
 
-    header_end = buffer_.find(kHeaderEnd);
+    // Skip past what was sent, which may end part way through a piece
+    auto sent = static_cast<size_t>(res);
+    while (*next < parts->size() && sent >= (*parts)[*next].iov_len) {
+      sent -= (*parts)[*next].iov_len;
+      (*next)++;
+    }
+    if (*next < parts->size()) {
+      struct iovec& part = (*parts)[*next];
+      part.iov_base = static_cast<char*>(part.iov_base) + sent;
+      part.iov_len -= sent;
+    }
+  }
+  return WriteStatus::kDone;
+}
+
+bool HttpSocket::write_file(int file_fd, off_t offset, size_t length) const {
+  while (true) {
+    WriteStatus status = try_write_file(file_fd, &offset, &length);
+    if (status != WriteStatus::kBlocked) {
+      return status == WriteStatus::kDone;
+    }
+    if (!wait_writable(fd_)) {
+      return false;
+    }
   }
+}
 
-  if (header_end != string::npos) {
-    string header = buffer_.substr(0, header_end + kHeaderEndLen);
-    buffer_.erase(0, header_end + kHeaderEndLen);
-    return header;
+WriteStatus HttpSocket::try_write_file(int file_fd, off_t* offset,
+                                       size_t* length) const {
+  while (*length > 0) {
+    ssize_t res = sendfile(fd_, file_fd, offset, *length);
+    if (res > 0) {
+      *length -= static_cast<size_t>(res);
+    } else if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return WriteStatus::kBlocked;
+    } else if (res == -1 && errno == EINTR) {
+      continue;
+    } else {
+      // Either the connection failed, or the file was truncated after
+      // the header promised the client more of it
+      return WriteStatus::kFailed;
+    }
   }
+  return WriteStatus::kDone;
+}
 
-  return std::nullopt;
+bool HttpSocket::set_nonblocking() {
+  int flags = fcntl(fd_, F_GETFL, 0);
+  return flags != -1 && fcntl(fd_, F_SETFL, flags | O_NONBLOCK) != -1;
 }
 
-bool HttpSocket::write_response(const std::string& response) const {
-  // TODO
-  size_t response_written = wrapped_write(fd_, response);
-  if (response_written == response.size()) {
-    return true;
+bool HttpSocket::set_nodelay() {
+  int on = 1;
+  return setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == 0;
+}
+
+bool HttpSocket::read_available() {
+  // Edge-triggered readiness is only reported again once the socket has
+  // been drained, so keep reading until the kernel has nothing left
+  while (true) {
+    // Once the buffer is full, stop and let the requests in it be
+    // answered; the connection is read again when it is next armed
+    if (!buffer_.reserve()) {
+      return true;
+    }
+    ssize_t res = read(fd_, buffer_.tail(), buffer_.room());
+    if (res > 0) {
+      buffer_.commit(static_cast<size_t>(res));
+      continue;
+    }
+    if (res == 0) {
+      return false;
+    }
+    if (errno == EINTR) {
+      continue;
+    }
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+}
+
+bool HttpSocket::has_request() const {
+  if (header_len_ == 0) {
+    header_len_ = find_header_end(buffer_.data(), &scanned_);
   }
+  return header_len_ != 0;
+}
+
+
+static bool send_all(int fd, const string& buf, int flags) {
+  size_t sent = 0;
+  while (sent < buf.size()) {
+    ssize_t res = send(fd, buf.data() + sent, buf.size() - sent,
+                       flags | MSG_NOSIGNAL);
+    if (res > 0) {
+      sent += static_cast<size_t>(res);
+    } else if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (!wait_writable(fd)) {
+        return false;
+      }
+    } else if (res == -1 && errno == EINTR) {
+      continue;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
 
-  return false;
+static bool wait_writable(int fd) {
+  struct pollfd pfd = {fd, POLLOUT, 0};
+  int res = 0;
+  do {
+    res = poll(&pfd, 1, HttpSocket::kWriteTimeoutMs);
+  } while (res == -1 && errno == EINTR);
+  return res == 1;
 }
 
 // Below functions are given to you
@@ -0,0 +1,271 @@
+/*
+ * Copyright ©2025 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2025 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HTTPSOCKET_HPP_
+#define HTTPSOCKET_HPP_
+
+#include <sys/socket.h>  // for struct sockaddr_storage, socklen_t
+#include <sys/uio.h>     // for struct iovec
+#include <unistd.h>      // for close()
+
+#include <cstdint>   // for uint16_t
+#include <cstring>   // for memcpy()
+#include <optional>  // for std::optional
+#include <string>    // for std::string
+#include <string_view>  // for std::string_view
+#include <vector>    // for std::vector
+
+#include "./HttpRequest.hpp"
+#include "./ReadBuffer.hpp"
+
+namespace searchserver {
+
+// What HttpSocket::next_request() found in the buffer
+enum class RequestStatus {
+  kComplete,    // a request was parsed
+  kIncomplete,  // the next request header has not all arrived yet
+  kMalformed,   // the next request header could not be parsed
+};
+
+// How far a write to a non-blocking socket got without waiting
+enum class WriteStatus {
+  kDone,     // everything was written
+  kBlocked,  // the send buffer filled up, so the rest is still to write
+  kFailed,   // the connection failed
+};
+
+// An HttpSocket wraps the socket of one connected client. It reads the
+// client's requests off the socket one header at a time, and writes back
+// the responses.
+class HttpSocket {
+ public:
+  // Takes ownership of a connected socket, along with the address of the
+  // client on the other end of it
+  HttpSocket(int fd, socklen_t addr_len, const struct sockaddr* addr)
+      : fd_(fd), addr_len_(addr_len) {
+    memcpy(&addr_, addr, addr_len);
+  }
+
+  // Closes the socket
+  ~HttpSocket() {
+    if (fd_ != -1) {
+      close(fd_);
+    }
+  }
+
+  // Reads the next request header from the client, blocking until a whole
+  // one has arrived. Anything read past the end of the header is kept for
+  // the next call.
+  //
+  // Returns:
+  //  - the request header, including the "\r\n\r\n" that ends it, or
+  //    nullopt if the connection was closed
+  std::optional<std::string> next_request();
+
+  // Takes the next request header out of the buffer and parses it in
+  // place, without reading from the socket.
+  //
+  // Arguments:
+  //  - request: set to the parsed request. It points into the socket's
+  //    buffer, so it is only valid until the socket next reads.
+  //
+  // Returns:
+  //  - kComplete if a request was parsed, kIncomplete if no whole header
+  //    is buffered, or kMalformed if the header that was taken out of
+  //    the buffer could not be parsed
+  RequestStatus next_request(HttpRequest* request);
+
+  // The write_ functions below wait for a non-blocking socket to have
+  // room for more, but give up on a client that has not read anything for
+  // this long
+  static constexpr int kWriteTimeoutMs = 10000;
+
+  // Writes a whole response to the client.
+  //
+  // Returns:
+  //  - true if the whole response was written
+  bool write_response(const std::string& response) const;
+
+  // Writes a response whose header and body are held separately, with
+  // one gathering write of both rather than joining them first.
+  //
+  // Arguments:
+  //  - header: the response header, including the "\r\n\r\n" that ends it
+  //  - body: the response body
+  //
+  // Returns:
+  //  - true if the whole response was written
+  bool write_response(const std::string& header,
+                      const std::string& body) const;
+
+  // Writes a response whose body is a range of a file. The header is
+  // written first and the body is sent with sendfile(), so it is never
+  // copied through the process.
+  //
+  // Arguments:
+  //  - header: the response header, including the "\r\n\r\n" that ends it
+  //  - file_fd: the file to send the body from
+  //  - offset: the position in the file the body starts at
+  //  - length: the length of the body
+  //
+  // Returns:
+  //  - true if the whole response was written. False if the connection
+  //    failed, or if the file ended before length bytes were sent, in
+  //    which case the client cannot tell where the response ends and the
+  //    connection must be closed.
+  bool write_response(const std::string& header, int file_fd, off_t offset,
+                      size_t length) const;
+
+  // Writes the pieces of one or more responses in order, gathering as
+  // many of them into each system call as the kernel takes, so that a
+  // batch of pipelined responses usually leaves with a single write.
+  //
+  // Arguments:
+  //  - parts: the pieces to write. They are advanced past whatever was
+  //    written, so their contents are not meaningful afterwards.
+  //  - more: true if a file body is sent right after with write_file(),
+  //    so the last piece is held back to leave in the same segment
+  //
+  // Returns:
+  //  - true if every piece was written
+  bool write_parts(std::vector<struct iovec>* parts, bool more) const;
+
+  // Writes as many of the pieces as the socket takes without waiting for
+  // the client to read, so that an event loop can carry on with the rest
+  // once the socket is writable again.
+  //
+  // Arguments:
+  //  - parts: the pieces to write. Those that were written in part are
+  //    advanced past what was written.
+  //  - next: the index of the first piece not yet written, which is
+  //    advanced past every piece written whole
+  //  - more: as for write_parts()
+  //
+  // Returns:
+  //  - kDone once every piece is written, or kBlocked if the socket's send
+  //    buffer filled up first
+  WriteStatus try_write_parts(std::vector<struct iovec>* parts, size_t* next,
+                              bool more) const;
+
+  // Sends a range of a file with sendfile(), after a header written with
+  // write_parts().
+  //
+  // Returns:
+  //  - true if the whole range was sent. False if the connection failed
+  //    or the file ended early, after which the connection must be
+  //    closed.
+  bool write_file(int file_fd, off_t offset, size_t length) const;
+
+  // Sends as much of a range of a file with sendfile() as the socket
+  // takes without waiting for the client to read, as try_write_parts()
+  // does for pieces in memory.
+  //
+  // Arguments:
+  //  - file_fd: the file to send from
+  //  - offset: the position in the file to send from, which is advanced
+  //    past what was sent
+  //  - length: the length still to send, which is reduced by what was
+  //    sent
+  //
+  // Returns:
+  //  - kDone once the whole range is sent, or kBlocked if the socket's
+  //    send buffer filled up first. kFailed if the connection failed or
+  //    the file ended early, after which the connection must be closed.
+  WriteStatus try_write_file(int file_fd, off_t* offset, size_t* length) const;
+
+  // Puts the socket in non-blocking mode, so that it can be driven by an
+  // event loop instead of a thread blocked on it.
+  //
+  // Returns:
+  //  - false if the mode could not be changed
+  bool set_nonblocking();
+
+  // Turns off Nagle's algorithm, so that a response written while the
+  // client has not yet acknowledged the previous one is sent right away
+  // instead of waiting for the acknowledgement. Only for callers that
+  // write whole responses, or that hold partial ones back themselves.
+  //
+  // Returns:
+  //  - false if the option could not be set
+  bool set_nodelay();
+
+  // Reads everything the client has sent so far into the buffer, until
+  // reading from a non-blocking socket would block or the buffer is full.
+  //
+  // Returns:
+  //  - false if the client closed the connection or the read failed.
+  //    Whatever was read before that stays buffered.
+  bool read_available();
+
+  // Returns true if a whole request header is buffered, in which case
+  // next_request() returns it without reading from the socket. Only the
+  // bytes that arrived since the last call are searched.
+  bool has_request() const;
+
+  // Returns the number of bytes read but not yet returned as requests
+  size_t buffered() const { return buffer_.size(); }
+
+  // Returns true if the buffer cannot take any more without a request
+  // being returned from it first
+  bool buffer_full() const { return buffer_.full(); }
+
+  // Gives the read buffer back to its pool if nothing is buffered, so
+  // that a connection waiting for its client holds no buffer. Requests
+  // returned before are no longer valid afterwards.
+  void release_buffer() { buffer_.release_if_empty(); }
+
+  // Returns the socket's file descriptor
+  int fd() const { return fd_; }
+
+  // These return the address and port of either end of the connection
+  std::string client_addr() const;
+  uint16_t client_port() const;
+  std::string server_addr() const;
+  uint16_t server_port() const;
+
+  // allow moving, the socket is closed by whichever object owns it last
+  HttpSocket(HttpSocket&& other) noexcept
+      : fd_(other.fd_),
+        addr_(other.addr_),
+        addr_len_(other.addr_len_),
+        buffer_(std::move(other.buffer_)),
+        scanned_(other.scanned_),
+        header_len_(other.header_len_) {
+    other.fd_ = -1;
+  }
+
+  // disable copying and assignment
+  HttpSocket& operator=(HttpSocket&& other) = delete;
+  HttpSocket(const HttpSocket& other) = delete;
+  HttpSocket& operator=(const HttpSocket& other) = delete;
+
+ private:
+  int fd_;
+  struct sockaddr_storage addr_;
+  socklen_t addr_len_;
+
+  // Takes the buffered header found by has_request() out of the buffer,
+  // returning a view of it that is valid until the socket next reads
+  std::string_view take_request();
+
+  // Data read from the client that has not been returned as a request
+  // yet. Returned requests stay in place until the socket next reads.
+  ReadBuffer buffer_;
+
+  // How far into the buffer it has been searched for the end of a
+  // header, and the length of the header found there, or 0
+  mutable size_t scanned_ = 0;
+  mutable size_t header_len_ = 0;
+};
+
+}  // namespace searchserver
+
+#endif  // HTTPSOCKET_HPP_
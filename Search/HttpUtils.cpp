@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <poll.h>
 
 #include <iostream>
 #include <vector>
@@ -44,6 +45,10 @@ using std::array;
 
 namespace searchserver {
 
+// How long wrapped_write() waits for room in a non-blocking socket's send
+// buffer before giving up on the peer
+static const int kWriteTimeoutMs = 10000;
+
 vector<string> split(const string& input, const string& delims) {
   vector<string> tokens;
 
@@ -247,18 +252,23 @@ void URLParser::parse(const string &url) {
 }
 
 size_t wrapped_read(int fd, string *buf) {
+  // Read straight into the end of the string, instead of into a small
+  // stack array that is then copied into a temporary string and appended
+  static const size_t kReadSize = 16384;
+  size_t old_size = buf->size();
   ssize_t res = 0;
-  array<char, 1024> buffer{};
-  while (true) {
-    res = read(fd, buffer.data(), 1024);
-    if (res == -1) {
-      if ((errno == EAGAIN) || (errno == EINTR))
-        continue;
+  buf->resize_and_overwrite(old_size + kReadSize, [&](char* data, size_t) {
+    while (true) {
+      res = read(fd, data + old_size, kReadSize);
+      if (res == -1) {
+        if ((errno == EAGAIN) || (errno == EINTR))
+          continue;
+      }
+      break;
     }
-    break;
-  }
-  *buf += string(buffer.data(), res);
-  return static_cast<size_t>(res);
+    return old_size + (res > 0 ? static_cast<size_t>(res) : 0);
+  });
+  return res > 0 ? static_cast<size_t>(res) : 0;
 }
 
 size_t wrapped_write(int fd, const string& buf)  {
@@ -268,7 +278,16 @@ size_t wrapped_write(int fd, const string& buf)  {
   while (written_so_far < buf.size()) {
     res = write(fd, buf.c_str() + written_so_far, buf.size() - written_so_far);
     if (res == -1) {
-      if ((errno == EAGAIN) || (errno == EINTR))
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // A non-blocking socket's send buffer is full, so wait for the
+        // peer to drain it rather than spinning, but not for a peer that
+        // has stopped reading altogether
+        struct pollfd pfd = {fd, POLLOUT, 0};
+        if (poll(&pfd, 1, kWriteTimeoutMs) == 0)
+          break;
+        continue;
+      }
+      if (errno == EINTR)
         continue;
       break;
     }
@@ -321,6 +340,7 @@ bool connect_to_server(const string &host_name, uint16_t port_num,
     }
     // Try connecting to the peer.
     if (connect(client_sock, r->ai_addr, r->ai_addrlen) == -1) {
+      close(client_sock);
       continue;
     }
     *client_fd = client_sock;
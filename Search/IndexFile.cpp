@@ -0,0 +1,209 @@
+#include "./IndexFile.hpp"
+
+#include <fcntl.h>     // for open()
+#include <sys/mman.h>  // for mmap(), munmap()
+#include <sys/stat.h>  // for fstat()
+#include <unistd.h>    // for close()
+
+#include <cstring>
+
+namespace searchserver {
+
+// Returns true if [offset, offset + count * elem_size) lies inside a file
+// of file_size bytes and offset is suitably aligned for the section
+static bool section_fits(uint64_t offset, uint64_t count, uint64_t elem_size,
+                         uint64_t file_size);
+
+// Returns the bytes of a string stored at [offsets[i], offsets[i + 1]) in
+// a blob of blob_size bytes, or an empty string if the offsets are corrupt
+static std::string_view blob_string(const uint64_t* offsets, const char* blob,
+                                    uint64_t blob_size, size_t i);
+
+std::shared_ptr<const IndexFile> IndexFile::open(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return nullptr;
+  }
+
+  struct stat st{};
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(IndexFileHeader)) {
+    close(fd);
+    return nullptr;
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  auto size = static_cast<size_t>(st.st_size);
+  void* base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return nullptr;
+  }
+
+  std::shared_ptr<const IndexFile> file(
+      new IndexFile(static_cast<const char*>(base), size));
+
+  // Check that the file is an index of this version and that every
+  // section lies inside it. The contents of the sections are only
+  // checked as they are read, so opening stays O(1) in the index size.
+  const IndexFileHeader& h = *file->header_;
+  if (memcmp(h.magic, kIndexFileMagic, sizeof(h.magic)) != 0 ||
+      h.version != kIndexFileVersion || h.file_size != size ||
+      !section_fits(h.doc_offsets, h.num_docs + 1, sizeof(uint64_t), size)) {
+    return nullptr;
+  }
+  const auto* doc_offsets =
+      reinterpret_cast<const uint64_t*>(file->base_ + h.doc_offsets);
+  uint64_t term_blocks = (h.num_terms + kTermBlockSize - 1) / kTermBlockSize;
+  if (!section_fits(h.doc_names, doc_offsets[h.num_docs], 1, size) ||
+      !section_fits(h.doc_lens, h.num_docs, sizeof(uint32_t), size) ||
+      !section_fits(h.norms, h.num_docs, sizeof(float), size) ||
+      !section_fits(h.term_blocks, term_blocks, sizeof(uint32_t), size) ||
+      !section_fits(h.terms, h.term_bytes, 1, size) ||
+      !section_fits(h.entries, h.num_terms, sizeof(TermEntry), size) ||
+      !section_fits(h.postings, h.posting_bytes, 1, size) ||
+      !section_fits(h.blocks, h.num_blocks, sizeof(BlockMax), size)) {
+    return nullptr;
+  }
+  if (file->has_positions() &&
+      (!section_fits(h.positions, h.position_bytes, 1, size) ||
+       !section_fits(h.position_starts, h.num_blocks, sizeof(uint32_t),
+                     size))) {
+    return nullptr;
+  }
+  return file;
+}
+
+IndexFile::IndexFile(const char* base, size_t size)
+    : base_(base), size_(size),
+      header_(reinterpret_cast<const IndexFileHeader*>(base)) {
+  // Pointers are only dereferenced once open() has checked the offsets
+  doc_offsets_ = reinterpret_cast<const uint64_t*>(base_ + header_->doc_offsets);
+  doc_names_ = base_ + header_->doc_names;
+  doc_lens_ = reinterpret_cast<const uint32_t*>(base_ + header_->doc_lens);
+  norms_ = reinterpret_cast<const float*>(base_ + header_->norms);
+  term_blocks_ =
+      reinterpret_cast<const uint32_t*>(base_ + header_->term_blocks);
+  terms_ = reinterpret_cast<const uint8_t*>(base_ + header_->terms);
+  entries_ = reinterpret_cast<const TermEntry*>(base_ + header_->entries);
+  postings_ = reinterpret_cast<const uint8_t*>(base_ + header_->postings);
+  blocks_ = reinterpret_cast<const BlockMax*>(base_ + header_->blocks);
+  positions_ = reinterpret_cast<const uint8_t*>(base_ + header_->positions);
+  position_starts_ =
+      reinterpret_cast<const uint32_t*>(base_ + header_->position_starts);
+}
+
+IndexFile::~IndexFile() {
+  munmap(const_cast<char*>(base_), size_);
+}
+
+std::string_view IndexFile::doc_name(DocId doc) const {
+  return blob_string(doc_offsets_, doc_names_,
+                     doc_offsets_[header_->num_docs], doc);
+}
+
+TermDictionaryView IndexFile::terms() const {
+  TermDictionaryView dict;
+  dict.data = terms_;
+  dict.num_bytes = header_->term_bytes;
+  dict.blocks = term_blocks_;
+  dict.num_blocks = (header_->num_terms + kTermBlockSize - 1) / kTermBlockSize;
+  dict.size = header_->num_terms;
+  return dict;
+}
+
+PostingListView IndexFile::postings(size_t i) const {
+  PostingListView list;
+  const TermEntry& entry = entries_[i];
+  uint64_t num_blocks =
+      (entry.num_postings + kPostingBlockSize - 1) / kPostingBlockSize;
+  if (entry.postings > header_->posting_bytes ||
+      entry.num_bytes > header_->posting_bytes - entry.postings ||
+      entry.blocks > header_->num_blocks ||
+      num_blocks > header_->num_blocks - entry.blocks ||
+      (num_blocks > 0 &&
+       blocks_[entry.blocks + num_blocks - 1].last_doc >= header_->num_docs)) {
+    // A corrupt entry reads as an empty list. The blocks themselves are
+    // checked against their skip entries as they are decoded, which keeps
+    // every DocId below the last one checked here.
+    return list;
+  }
+
+  list.data = postings_ + entry.postings;
+  list.num_bytes = entry.num_bytes;
+  list.size = entry.num_postings;
+  list.blocks = blocks_ + entry.blocks;
+  list.num_blocks = num_blocks;
+  list.max_tf = entry.max_tf;
+  list.max_bm25 = entry.max_bm25;
+
+  // Corrupt positions only cost the list its positions. Each block's start
+  // is checked against position_bytes as it is decoded.
+  if (has_positions() && entry.positions <= header_->position_bytes &&
+      entry.position_bytes <= header_->position_bytes - entry.positions) {
+    list.positions = positions_ + entry.positions;
+    list.position_bytes = entry.position_bytes;
+    list.position_starts = position_starts_ + entry.blocks;
+  }
+  return list;
+}
+
+size_t IndexFile::find(std::string_view word) const {
+  return terms().find(word);
+}
+
+IndexFileWriter::IndexFileWriter(const std::string& path)
+    : out_(path, std::ios::binary | std::ios::trunc),
+      offset_(sizeof(IndexFileHeader)) {
+  IndexFileHeader blank{};
+  out_.write(reinterpret_cast<const char*>(&blank), sizeof(blank));
+}
+
+uint64_t IndexFileWriter::write(const void* data, size_t bytes) {
+  static const char kPadding[8] = {};
+  size_t padding = (8 - offset_ % 8) % 8;
+  out_.write(kPadding, static_cast<std::streamsize>(padding));
+  offset_ += padding;
+
+  uint64_t start = offset_;
+  append(data, bytes);
+  return start;
+}
+
+void IndexFileWriter::append(const void* data, size_t bytes) {
+  out_.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+  offset_ += bytes;
+}
+
+bool IndexFileWriter::finish(IndexFileHeader* header) {
+  // Pad the last section, so the file size is a multiple of 8 too
+  write(nullptr, 0);
+  memcpy(header->magic, kIndexFileMagic, sizeof(header->magic));
+  header->version = kIndexFileVersion;
+  header->file_size = offset_;
+
+  out_.seekp(0);
+  out_.write(reinterpret_cast<const char*>(header), sizeof(*header));
+  out_.close();
+  return !out_.fail();
+}
+
+static bool section_fits(uint64_t offset, uint64_t count, uint64_t elem_size,
+                         uint64_t file_size) {
+  if (offset % 8 != 0 || offset > file_size) {
+    return false;
+  }
+  return count <= (file_size - offset) / elem_size;
+}
+
+static std::string_view blob_string(const uint64_t* offsets, const char* blob,
+                                    uint64_t blob_size, size_t i) {
+  uint64_t start = offsets[i];
+  uint64_t end = offsets[i + 1];
+  if (start > end || end > blob_size) {
+    return {};
+  }
+  return {blob + start, end - start};
+}
+
+}  // namespace searchserver
@@ -0,0 +1,199 @@
+#ifndef INDEX_FILE_HPP_
+#define INDEX_FILE_HPP_
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "./PostingList.hpp"
+#include "./TermDictionary.hpp"
+
+namespace searchserver {
+
+// An index file holds a finalized WordIndex in a form that can be mapped
+// into memory and queried in place, without deserializing anything.
+//
+// The file starts with an IndexFileHeader, followed by these sections,
+// each starting at an 8-byte aligned offset recorded in the header.
+// Numbers are stored in the byte order of the machine that wrote them.
+//
+//   doc_offsets   uint64_t[num_docs + 1]   where each name starts in doc_names
+//   doc_names     char[]                   document names, back to back
+//   doc_lens      uint32_t[num_docs]       words recorded per document
+//   norms         float[num_docs]          BM25 length normalizations
+//   term_blocks   uint32_t[term blocks]    where each block of words starts
+//   terms         uint8_t[term_bytes]      words in sorted order, front-coded
+//                                          as a TermDictionary
+//   entries       TermEntry[num_terms]     where each word's postings are
+//   postings      uint8_t[posting_bytes]   every encoded list, back to back
+//   blocks        BlockMax[num_blocks]     every list's skip entries
+//
+// If the index records positions (kIndexHasPositions is set in flags),
+// two more sections follow:
+//
+//   positions        uint8_t[position_bytes]  every list's encoded positions
+//   position_starts  uint32_t[num_blocks]     where each block's positions
+//                                             start in its list's positions
+
+// Identifies an index file, and the version of the layout above. The
+// version must be bumped whenever the layout changes.
+constexpr char kIndexFileMagic[8] = {'S', 'R', 'C', 'H', 'I', 'D', 'X', '\0'};
+constexpr uint32_t kIndexFileVersion = 4;
+
+// Set in IndexFileHeader::flags if the file holds word positions
+constexpr uint32_t kIndexHasPositions = 1;
+
+struct IndexFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+
+  uint64_t num_docs;
+  uint64_t num_terms;
+  uint64_t num_postings;
+  uint64_t num_blocks;
+  uint64_t posting_bytes;
+  uint64_t position_bytes;
+  uint64_t term_bytes;
+
+  // Byte offsets of each section from the start of the file
+  uint64_t doc_offsets;
+  uint64_t doc_names;
+  uint64_t doc_lens;
+  uint64_t norms;
+  uint64_t term_blocks;
+  uint64_t terms;
+  uint64_t entries;
+  uint64_t postings;
+  uint64_t blocks;
+  uint64_t positions;
+  uint64_t position_starts;
+
+  // The size of the whole file, to detect truncation
+  uint64_t file_size;
+};
+
+// Where the posting list of one word lives in the file
+struct TermEntry {
+  // Where the word's encoded postings start in the postings section, and
+  // the index of its first skip entry
+  uint64_t postings;
+  uint64_t blocks;
+
+  uint32_t num_postings;
+  uint32_t max_tf;
+  float max_bm25;
+  uint32_t num_bytes;
+
+  // Where the word's encoded positions start in the positions section,
+  // and how many bytes they take up; both 0 without positions
+  uint64_t positions;
+  uint32_t position_bytes;
+  uint32_t reserved;
+};
+
+// A read-only index file mapped into memory. Every accessor reads straight
+// from the mapped pages, which the kernel shares between all processes
+// that map the same file.
+class IndexFile {
+ public:
+  // Maps the index file at path.
+  //
+  // Returns:
+  //  - the mapped file, or null if it could not be opened or is not an
+  //    index file of the current version
+  static std::shared_ptr<const IndexFile> open(const std::string& path);
+
+  // unmaps the file
+  ~IndexFile();
+
+  size_t num_docs() const { return header_->num_docs; }
+  size_t num_terms() const { return header_->num_terms; }
+
+  // Returns true if the posting lists include the positions of each word
+  bool has_positions() const {
+    return (header_->flags & kIndexHasPositions) != 0;
+  }
+
+  // Returns the name of a document
+  std::string_view doc_name(DocId doc) const;
+
+  // Returns the per-document word counts and BM25 normalizations
+  const uint32_t* doc_lens() const { return doc_lens_; }
+  const float* norms() const { return norms_; }
+
+  // Returns the sorted words, numbered like the posting lists
+  TermDictionaryView terms() const;
+
+  // Returns the posting list of the i-th word in sorted order
+  PostingListView postings(size_t i) const;
+
+  // Looks up a word in the dictionary.
+  //
+  // Returns:
+  //  - the index of the word, or num_terms() if it is not in the file
+  size_t find(std::string_view word) const;
+
+  // disable copying, the mapping belongs to one object
+  IndexFile(const IndexFile& other) = delete;
+  IndexFile& operator=(const IndexFile& other) = delete;
+
+ private:
+  IndexFile(const char* base, size_t size);
+
+  const char* base_;
+  size_t size_;
+  const IndexFileHeader* header_;
+
+  // Pointers to the start of each section
+  const uint64_t* doc_offsets_;
+  const char* doc_names_;
+  const uint32_t* doc_lens_;
+  const float* norms_;
+  const uint32_t* term_blocks_;
+  const uint8_t* terms_;
+  const TermEntry* entries_;
+  const uint8_t* postings_;
+  const BlockMax* blocks_;
+  const uint8_t* positions_;
+  const uint32_t* position_starts_;
+};
+
+// Writes the sections of an index file one after the other, starting each
+// at an 8-byte boundary and remembering where it started.
+class IndexFileWriter {
+ public:
+  // Creates (or truncates) the file at path, leaving room for the header
+  explicit IndexFileWriter(const std::string& path);
+
+  // Returns false if any write so far has failed
+  bool ok() const { return out_.good(); }
+
+  // Starts a new section at the next 8-byte boundary and writes bytes
+  // into it.
+  //
+  // Returns:
+  //  - the offset at which the section starts
+  uint64_t write(const void* data, size_t bytes);
+
+  // Appends bytes to the end of the current section, without padding, so
+  // that a section can be written in several pieces. The next write()
+  // pads the section and starts a new one.
+  void append(const void* data, size_t bytes);
+
+  // Fills in the header and writes it at the start of the file.
+  //
+  // Returns:
+  //  - true if the whole file was written successfully
+  bool finish(IndexFileHeader* header);
+
+ private:
+  std::ofstream out_;
+  uint64_t offset_;
+};
+
+}  // namespace searchserver
+
+#endif  // INDEX_FILE_HPP_
@@ -0,0 +1,42 @@
+#include "./IndexSnapshots.hpp"
+
+#include <utility>
+
+namespace searchserver {
+
+IndexSnapshots::IndexSnapshots(ShardedIndex index)
+    : copies_{std::make_unique<ShardedIndex>(std::move(index)), nullptr},
+      current_(copies_[0].get()),
+      write_lock_() {
+  pthread_mutex_init(&write_lock_, nullptr);
+}
+
+IndexSnapshots::~IndexSnapshots() {
+  pthread_mutex_destroy(&write_lock_);
+}
+
+void IndexSnapshots::update(
+    const std::function<void(ShardedIndex*)>& edit) {
+  pthread_mutex_lock(&write_lock_);
+  ShardedIndex* published = current_.load(std::memory_order_relaxed);
+  if (copies_[1] == nullptr) {
+    copies_[1] = std::make_unique<ShardedIndex>(*published);
+  }
+  ShardedIndex* spare = (published == copies_[0].get()) ? copies_[1].get()
+                                                        : copies_[0].get();
+
+  // Nobody reads the spare copy, so it can be changed in place, and is
+  // finalized before anyone can see it
+  edit(spare);
+  spare->finalize();
+  current_.store(spare, std::memory_order_release);
+
+  // Wait for the readers that may still be searching the old snapshot
+  // before bringing it up to date as the next spare
+  epoch_synchronize();
+  edit(published);
+  published->finalize();
+  pthread_mutex_unlock(&write_lock_);
+}
+
+}  // namespace searchserver
@@ -0,0 +1,85 @@
+#ifndef INDEX_SNAPSHOTS_HPP_
+#define INDEX_SNAPSHOTS_HPP_
+
+#include <pthread.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "./Epoch.hpp"
+#include "./ShardedIndex.hpp"
+
+namespace searchserver {
+
+// IndexSnapshots publishes a ShardedIndex that may be updated while it is
+// being searched. Readers pin the published snapshot without taking a
+// lock, and keep searching it even if a newer one is published in the
+// meantime; they never wait for an update.
+//
+// A published snapshot is never modified. An update is made to a second
+// copy of the index, which is then published by swapping a pointer. Once
+// every reader of the old snapshot is done with it, the same update is
+// made to the old copy too, which becomes the one the next update is
+// made to. Copying the whole index for every update would take far
+// longer than the updates themselves, which usually change a handful of
+// documents; the cost instead is holding the index in memory twice once
+// it has been updated.
+class IndexSnapshots {
+ public:
+  // Pins the snapshot that is published when it is created, until it is
+  // destroyed. Every lookup made through it sees the same version of the
+  // index. The snapshot has been finalized, so lookups do not modify it.
+  class Reader {
+   public:
+    explicit Reader(const IndexSnapshots& snapshots)
+        : guard_(),
+          index_(snapshots.current_.load(std::memory_order_acquire)) {}
+
+    ShardedIndex& operator*() const { return *index_; }
+    ShardedIndex* operator->() const { return index_; }
+
+    // disable copying, the pin belongs to one scope
+    Reader(const Reader& other) = delete;
+    Reader& operator=(const Reader& other) = delete;
+
+   private:
+    EpochGuard guard_;
+    ShardedIndex* index_;
+  };
+
+  // Publishes an index, which should already be finalized
+  explicit IndexSnapshots(ShardedIndex index);
+
+  // destroys the lock
+  ~IndexSnapshots();
+
+  // Updates the index and publishes the result. edit is called twice,
+  // once on the copy that is about to be published and once on the copy
+  // that was published before, and has to make the same change to both.
+  // Each copy is finalized after edit returns. Updates are made one at a
+  // time; readers are never blocked by them.
+  //
+  // Arguments:
+  //  - edit: makes the change to the index it is given
+  void update(const std::function<void(ShardedIndex*)>& edit);
+
+  // disable copying and moving, readers point into the snapshots
+  IndexSnapshots(const IndexSnapshots& other) = delete;
+  IndexSnapshots& operator=(const IndexSnapshots& other) = delete;
+  IndexSnapshots(IndexSnapshots&& other) = delete;
+  IndexSnapshots& operator=(IndexSnapshots&& other) = delete;
+
+ private:
+  // The two copies of the index, the second of which is only made on
+  // the first update, and which of them is published
+  std::unique_ptr<ShardedIndex> copies_[2];
+  std::atomic<ShardedIndex*> current_;
+
+  // Held by update()
+  pthread_mutex_t write_lock_;
+};
+
+}  // namespace searchserver
+
+#endif  // INDEX_SNAPSHOTS_HPP_
@@ -0,0 +1,298 @@
+#include "./IndexWatcher.hpp"
+
+#include <poll.h>          // for poll()
+#include <sys/eventfd.h>   // for eventfd()
+#include <sys/inotify.h>   // for inotify_init1(), inotify_add_watch(), etc.
+#include <sys/stat.h>      // for stat()
+#include <unistd.h>        // for read(), write(), close()
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "./CrawlFileTree.hpp"
+#include "./HttpUtils.hpp"
+
+using std::optional;
+using std::runtime_error;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace searchserver {
+
+// How long the tree has to be quiet before pending changes are applied,
+// so that a file written in several steps, or a burst of files, is only
+// read and indexed once
+static const int kQuietMillis = 10;
+
+// The longest changes are held back while events keep arriving
+static const std::chrono::milliseconds kMaxDelay{100};
+
+// The events that may change which files are in the tree or what they
+// contain. Files are only read once they have been closed after writing,
+// or moved into place.
+static const uint32_t kWatchMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                   IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+// Returns true if path is inside the directory that prefix, which ends
+// with a slash, names
+static bool under(const string& path, const string& prefix);
+
+IndexWatcher::IndexWatcher(const string& root_dir, IndexSnapshots* index)
+    : root_dir_(root_dir),
+      index_(index),
+      inotify_fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+      stop_fd_(-1),
+      thread_() {
+  if (inotify_fd_ == -1) {
+    throw runtime_error("inotify_init1() failed: " + string(strerror(errno)));
+  }
+  stop_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (stop_fd_ == -1) {
+    close(inotify_fd_);
+    throw runtime_error("eventfd() failed: " + string(strerror(errno)));
+  }
+
+  // The index already holds the files that are in the tree now, so they
+  // are only remembered, not read again
+  if (!watch_tree(root_dir_, &files_)) {
+    close(inotify_fd_);
+    close(stop_fd_);
+    throw runtime_error("could not watch every directory under " + root_dir_);
+  }
+
+  int result = pthread_create(&thread_, nullptr, thread_loop, this);
+  if (result != 0) {
+    close(inotify_fd_);
+    close(stop_fd_);
+    throw runtime_error("Failed to create thread: " + std::to_string(result));
+  }
+}
+
+IndexWatcher::~IndexWatcher() {
+  uint64_t one = 1;
+  if (write(stop_fd_, &one, sizeof(one)) != sizeof(one)) {
+    std::cerr << "Failed to stop the index watcher\n";
+  }
+  pthread_join(thread_, nullptr);
+  close(inotify_fd_);
+  close(stop_fd_);
+}
+
+IndexWatcher::Stats IndexWatcher::stats() const {
+  Stats stats;
+  stats.batches = batches_.load();
+  stats.updated = updated_.load();
+  stats.removed = removed_.load();
+  return stats;
+}
+
+void* IndexWatcher::thread_loop(void* watcher) {
+  static_cast<IndexWatcher*>(watcher)->run();
+  return nullptr;
+}
+
+void IndexWatcher::run() {
+  using Clock = std::chrono::steady_clock;
+
+  set<string> changed;
+  Clock::time_point first_change;
+  pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {stop_fd_, POLLIN, 0}};
+  while (true) {
+    // Sleep until something happens while nothing is pending, and only
+    // until the tree goes quiet once something is
+    int timeout = -1;
+    if (!changed.empty()) {
+      timeout = kQuietMillis;
+      if (Clock::now() - first_change >= kMaxDelay) {
+        timeout = 0;
+      }
+    }
+
+    int ready = poll(fds, 2, timeout);
+    if (ready == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Index watcher stopped: " << strerror(errno) << "\n";
+      return;
+    }
+    if (fds[1].revents != 0) {
+      return;
+    }
+
+    if (ready > 0) {
+      bool was_empty = changed.empty();
+      if (!read_events(&changed)) {
+        std::cerr << "Index watcher stopped: " << strerror(errno) << "\n";
+        return;
+      }
+      if (was_empty) {
+        first_change = Clock::now();
+      }
+      if (changed.empty() || Clock::now() - first_change < kMaxDelay) {
+        continue;
+      }
+    }
+
+    apply(changed);
+    changed.clear();
+  }
+}
+
+bool IndexWatcher::read_events(set<string>* changed) {
+  alignas(inotify_event) char buffer[64 * 1024];
+  while (true) {
+    ssize_t length = read(inotify_fd_, buffer, sizeof(buffer));
+    if (length == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN;
+    }
+
+    for (char* p = buffer; p < buffer + length;) {
+      const inotify_event* event = reinterpret_cast<inotify_event*>(p);
+      p += sizeof(inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        // Some events were lost, so read the whole tree again
+        std::cerr << "Index watcher missed events, rescanning " << root_dir_
+                  << "\n";
+        changed->insert(files_.begin(), files_.end());
+        watch_tree(root_dir_, changed);
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        // The directory was deleted or is no longer watched
+        dirs_.erase(event->wd);
+        continue;
+      }
+
+      auto it = dirs_.find(event->wd);
+      if (it == dirs_.end() || event->len == 0) {
+        continue;
+      }
+      string path = entry_path(it->second, event->name);
+
+      if (!(event->mask & IN_ISDIR)) {
+        changed->insert(path);
+      } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        watch_tree(path, changed);
+      } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        files_under(path, changed);
+        unwatch_tree(path);
+      }
+    }
+  }
+}
+
+bool IndexWatcher::watch_tree(const string& dir_path, set<string>* files) {
+  // Watch the directory before listing it, so that a file created in
+  // between is either listed or reported
+  int wd = inotify_add_watch(inotify_fd_, dir_path.c_str(), kWatchMask);
+  if (wd == -1) {
+    // A directory that is already gone again needs no watching
+    if (errno != ENOENT) {
+      std::cerr << "Could not watch " << dir_path << ": " << strerror(errno)
+                << "\n";
+    }
+    return false;
+  }
+  dirs_[wd] = dir_path;
+
+  optional<vector<DirEntry>> entries = readdir(dir_path);
+  if (!entries) {
+    return false;
+  }
+
+  bool ok = true;
+  for (const DirEntry& entry : *entries) {
+    if (entry.name == "." || entry.name == "..") {
+      continue;
+    }
+    string path = entry_path(dir_path, entry.name);
+    if (entry.is_dir) {
+      ok = watch_tree(path, files) && ok;
+    } else {
+      files->insert(path);
+    }
+  }
+  return ok;
+}
+
+void IndexWatcher::unwatch_tree(const string& dir_path) {
+  string prefix = entry_path(dir_path, "");
+  for (auto it = dirs_.begin(); it != dirs_.end();) {
+    if (it->second == dir_path || under(it->second, prefix)) {
+      // Fails harmlessly if the directory is already gone
+      inotify_rm_watch(inotify_fd_, it->first);
+      it = dirs_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void IndexWatcher::files_under(const string& dir_path,
+                               set<string>* changed) const {
+  string prefix = entry_path(dir_path, "");
+  for (auto it = files_.lower_bound(prefix);
+       it != files_.end() && under(*it, prefix); ++it) {
+    changed->insert(*it);
+  }
+}
+
+void IndexWatcher::apply(const set<string>& changed) {
+  // Read each changed file before touching the index. A file that is
+  // gone, or is no longer a regular file, is removed from the index.
+  vector<std::pair<const string*, optional<vector<string>>>> changes;
+  for (const string& path : changed) {
+    optional<vector<string>> words;
+    struct stat info{};
+    if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+      words = read_words(path);
+    }
+
+    if (words) {
+      files_.insert(path);
+    } else if (files_.erase(path) == 0) {
+      // It came and went before it was ever indexed
+      continue;
+    }
+    changes.emplace_back(&path, std::move(words));
+  }
+  if (changes.empty()) {
+    return;
+  }
+
+  index_->update([&changes](ShardedIndex* index) {
+    for (const auto& [path, words] : changes) {
+      if (words) {
+        index->update_document(*path, *words);
+      } else {
+        index->remove_document(*path);
+      }
+    }
+  });
+
+  uint64_t updated = std::count_if(
+      changes.begin(), changes.end(),
+      [](const auto& change) { return change.second.has_value(); });
+  batches_++;
+  updated_ += updated;
+  removed_ += changes.size() - updated;
+}
+
+static bool under(const string& path, const string& prefix) {
+  return path.compare(0, prefix.size(), prefix) == 0;
+}
+
+}  // namespace searchserver
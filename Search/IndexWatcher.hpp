@@ -0,0 +1,111 @@
+#ifndef INDEX_WATCHER_HPP_
+#define INDEX_WATCHER_HPP_
+
+#include <pthread.h>
+
+#include <atomic>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include "./IndexSnapshots.hpp"
+
+namespace searchserver {
+
+// An IndexWatcher keeps a crawled index up to date as the files under
+// its root directory change, without crawling the directory again.
+//
+// A background thread watches every directory in the tree with inotify.
+// Files that are written, created, moved or deleted are noted, and once
+// the tree has been quiet for a few milliseconds each of them is read
+// again, or found to be gone, and the index is updated document by
+// document. Directories that appear are watched and their files added;
+// directories that disappear take their files with them.
+//
+// Files are tokenized before the index is touched, and each batch of
+// changes is published as a new snapshot of the index, so queries are
+// never held up by it. Every snapshot has a new generation, so the query
+// cache stops serving answers from before the change.
+class IndexWatcher {
+ public:
+  // Counters of the work done so far
+  struct Stats {
+    uint64_t batches = 0;
+    uint64_t updated = 0;
+    uint64_t removed = 0;
+  };
+
+  // Starts watching a directory tree.
+  //
+  // Arguments:
+  //  - root_dir: the directory the index was crawled from, given the
+  //    same way it was given to crawl_filetree()
+  //  - index: the index to update
+  //
+  // Throws a std::runtime_error if inotify could not be set up or the
+  // tree could not be read.
+  IndexWatcher(const std::string& root_dir, IndexSnapshots* index);
+
+  // stops the watcher thread and closes the inotify instance
+  ~IndexWatcher();
+
+  // Returns the current counters
+  Stats stats() const;
+
+  // disable copying and moving, the thread points back at the watcher
+  IndexWatcher(const IndexWatcher& other) = delete;
+  IndexWatcher& operator=(const IndexWatcher& other) = delete;
+  IndexWatcher(IndexWatcher&& other) = delete;
+  IndexWatcher& operator=(IndexWatcher&& other) = delete;
+
+ private:
+  // This is the thread start routine
+  static void* thread_loop(void* watcher);
+
+  // Waits for changes and applies them until the watcher is stopped
+  void run();
+
+  // Reads every queued inotify event, adding the files they concern to
+  // changed. Returns false if reading failed.
+  bool read_events(std::set<std::string>* changed);
+
+  // Watches a directory and every directory under it, adding the files
+  // found in them to files. Directories that cannot be watched or read
+  // are skipped; returns false if there were any.
+  bool watch_tree(const std::string& dir_path, std::set<std::string>* files);
+
+  // Stops watching every directory under dir_path, including itself
+  void unwatch_tree(const std::string& dir_path);
+
+  // Adds every known file under dir_path to changed
+  void files_under(const std::string& dir_path,
+                   std::set<std::string>* changed) const;
+
+  // Reads the changed files again and updates the index with them
+  void apply(const std::set<std::string>& changed);
+
+  std::string root_dir_;
+  IndexSnapshots* index_;
+
+  int inotify_fd_;
+
+  // Written to when the watcher is destroyed, to wake the thread
+  int stop_fd_;
+
+  pthread_t thread_;
+
+  // The path of the directory each watch descriptor is for, and the
+  // files currently known to be in the tree. Only used by the thread,
+  // after the constructor has filled them in.
+  std::unordered_map<int, std::string> dirs_;
+  std::set<std::string> files_;
+
+  std::atomic<uint64_t> batches_{0};
+  std::atomic<uint64_t> updated_{0};
+  std::atomic<uint64_t> removed_{0};
+};
+
+}  // namespace searchserver
+
+#endif  // INDEX_WATCHER_HPP_
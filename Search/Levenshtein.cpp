@@ -0,0 +1,127 @@
+#include "./Levenshtein.hpp"
+
+#include <algorithm>
+
+namespace searchserver {
+
+LevenshteinAutomaton::LevenshteinAutomaton(std::string_view word,
+                                           uint32_t max_distance)
+    : word_(word), max_distance_(std::min(max_distance, kMaxDistance)) {
+  // Distances are capped at one past the most accepted, so they fit a byte
+  // however long the word is
+  auto limit = static_cast<uint8_t>(max_distance_ + 1);
+  for (size_t j = 0; j <= word_.size(); j++) {
+    rows_.push_back(static_cast<uint8_t>(std::min<size_t>(j, limit)));
+  }
+  for (char c : word_) {
+    in_word_[static_cast<unsigned char>(c)] = true;
+  }
+}
+
+uint32_t LevenshteinAutomaton::distance(std::string_view term) {
+  if (advance(term) != 0) {
+    return max_distance_ + 1;
+  }
+  return last_row()[word_.size()];
+}
+
+void LevenshteinAutomaton::intersect(const TermDictionaryView& dict,
+                                     vector<FuzzyMatch>* matches) {
+  TermCursor cursor(dict, 0);
+  while (!cursor.done()) {
+    std::string_view term = cursor.term();
+    size_t dead = advance(term);
+    if (dead == 0) {
+      uint32_t distance = last_row()[word_.size()];
+      if (distance <= max_distance_) {
+        matches->push_back({cursor.index(), std::string(term), distance});
+      }
+      cursor.next();
+      continue;
+    }
+
+    // No term that starts with the first dead bytes of this one can match,
+    // so move to the first term that starts like a match could
+    read_.resize(dead);
+    rows_.resize((dead + 1) * (word_.size() + 1));
+    if (!skip()) {
+      return;
+    }
+
+    cursor.seek(read_);
+  }
+}
+
+size_t LevenshteinAutomaton::advance(std::string_view term) {
+  size_t width = word_.size() + 1;
+
+  // The rows of the shared prefix are still valid
+  size_t shared = 0;
+  size_t most = std::min(read_.size(), term.size());
+  while (shared < most && read_[shared] == term[shared]) {
+    shared++;
+  }
+  read_.resize(shared);
+  rows_.resize((shared + 1) * width);
+
+  for (size_t i = shared; i < term.size(); i++) {
+    rows_.resize((i + 2) * width);
+    uint8_t best = step(&rows_[i * width],
+                        static_cast<unsigned char>(term[i]),
+                        &rows_[(i + 1) * width]);
+    read_.push_back(term[i]);
+    if (best > max_distance_) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+bool LevenshteinAutomaton::skip() {
+  size_t width = word_.size() + 1;
+  other_.resize(width);
+  while (!read_.empty()) {
+    // Try the bytes after the last one in its place, which is the same
+    // as trying any byte not in the word once
+    auto last = static_cast<unsigned char>(read_.back());
+    read_.pop_back();
+    rows_.resize((read_.size() + 2) * width);
+    const uint8_t* prev = &rows_[read_.size() * width];
+    uint8_t* row = &rows_[(read_.size() + 1) * width];
+    bool other_alive = step(prev, -1, other_.data()) <= max_distance_;
+    for (unsigned c = last + 1; c <= 0xFF; c++) {
+      if (in_word_[c] ? step(prev, static_cast<int>(c), row) <= max_distance_
+                      : other_alive) {
+        if (!in_word_[c]) {
+          std::copy(other_.begin(), other_.end(), row);
+        }
+        read_.push_back(static_cast<char>(c));
+        return true;
+      }
+    }
+    rows_.resize((read_.size() + 1) * width);
+  }
+  return false;
+}
+
+uint8_t LevenshteinAutomaton::step(const uint8_t* prev, int c,
+                                   uint8_t* row) const {
+  auto limit = static_cast<uint8_t>(max_distance_ + 1);
+  row[0] = std::min<uint8_t>(prev[0] + 1, limit);
+  uint8_t best = row[0];
+  for (size_t j = 1; j <= word_.size(); j++) {
+    uint8_t substitute =
+        prev[j - 1] + (static_cast<unsigned char>(word_[j - 1]) == c ? 0 : 1);
+    uint8_t insert = prev[j] + 1;
+    uint8_t remove = row[j - 1] + 1;
+    row[j] = std::min({substitute, insert, remove, limit});
+    best = std::min(best, row[j]);
+  }
+  return best;
+}
+
+const uint8_t* LevenshteinAutomaton::last_row() const {
+  return &rows_[read_.size() * (word_.size() + 1)];
+}
+
+}  // namespace searchserver
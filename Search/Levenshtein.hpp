@@ -0,0 +1,98 @@
+#ifndef LEVENSHTEIN_HPP_
+#define LEVENSHTEIN_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./TermDictionary.hpp"
+
+using std::vector;
+
+namespace searchserver {
+
+// A term of a dictionary that is close to the word an automaton was built
+// for: its number, the term itself, and its edit distance from the word
+struct FuzzyMatch {
+  size_t term;
+  std::string text;
+  uint32_t distance;
+};
+
+// Accepts the strings within an edit distance of a word, counting each
+// insertion, deletion or substitution of a byte as one edit.
+//
+// The state of the automaton after reading a string is the last row of the
+// table of edit distances between the word's prefixes and that string, so
+// it steps through a string one byte at a time, and can tell as soon as a
+// prefix is read that no string starting with it is close enough. That is
+// what lets intersect() skip whole runs of a sorted dictionary instead of
+// checking every term.
+class LevenshteinAutomaton {
+ public:
+  // The largest distance an automaton accepts
+  static constexpr uint32_t kMaxDistance = 2;
+
+  // Arguments:
+  //  - word: the word to match terms against
+  //  - max_distance: the most edits a match may be, at most kMaxDistance
+  LevenshteinAutomaton(std::string_view word, uint32_t max_distance);
+
+  // Returns the edit distance between the word and term, or
+  // max_distance + 1 if it is more than max_distance
+  uint32_t distance(std::string_view term);
+
+  // Finds every term of a dictionary within max_distance of the word.
+  //
+  // Arguments:
+  //  - dict: the dictionary to search
+  //  - matches: where to append the matching terms, in sorted order
+  void intersect(const TermDictionaryView& dict, vector<FuzzyMatch>* matches);
+
+ private:
+  // Steps the automaton through term, reusing the rows of the prefix it
+  // shares with the string read before.
+  //
+  // Returns:
+  //  - 0 if every prefix of term can still lead to a match, or else the
+  //    length of the shortest one that cannot
+  size_t advance(std::string_view term);
+
+  // Moves from a string read with advance() whose last prefix can no
+  // longer match to the smallest string after every string starting with
+  // it whose prefixes can all still match, which a match has to start
+  // with. Returns false if there is none.
+  bool skip();
+
+  // Computes the row for reading byte c after the row prev, where a c of
+  // -1 stands for any byte that is not in the word.
+  //
+  // Returns:
+  //  - the smallest distance in the row, which is more than max_distance_
+  //    if nothing that continues from it can match
+  uint8_t step(const uint8_t* prev, int c, uint8_t* row) const;
+
+  // The row of the last byte read
+  const uint8_t* last_row() const;
+
+  std::string word_;
+  uint32_t max_distance_;
+
+  // Whether each byte occurs in word_. Every byte that does not leads
+  // from a row to the same next row.
+  bool in_word_[256] = {};
+
+  // What has been read so far, and a row of word_.size() + 1 distances
+  // for each prefix of it, starting with the empty one
+  std::string read_;
+  vector<uint8_t> rows_;
+
+  // The row skip() reads any byte not in the word into
+  vector<uint8_t> other_;
+};
+
+}  // namespace searchserver
+
+#endif  // LEVENSHTEIN_HPP_
@@ -0,0 +1,134 @@
+#include "./PhraseQuery.hpp"
+
+#include <algorithm>
+#include <optional>
+
+namespace searchserver {
+
+// The bytes that separate the words of a query: the separators the server
+// splits plain queries on, and the ones the crawler splits files on
+static constexpr std::string_view kSeparators = " +\r\t\v\n,.:;?!";
+
+// The largest k accepted in NEAR/k. Larger values are clamped to it.
+static constexpr uint32_t kMaxDistance = 1000000;
+
+// One piece of a parsed query: either an operand, which is a phrase or a
+// single unquoted word, or a NEAR/k operator
+struct QueryItem {
+  PhraseQuery::Phrase phrase;
+  bool quoted;
+  std::optional<uint32_t> near;
+};
+
+// Returns k if token is NEAR/k for some k of at least 1
+static std::optional<uint32_t> parse_near(std::string_view token);
+
+// Appends the words in text, a part of the query with no quotes in it,
+// to phrase
+static void split_words(std::string_view text, PhraseQuery::Phrase* phrase);
+
+PhraseQuery PhraseQuery::parse(std::string_view query) {
+  // Break the query into operands and operators. Outside of quotes every
+  // word is an item of its own.
+  std::vector<QueryItem> items;
+  size_t pos = 0;
+  while (pos < query.size()) {
+    if (query[pos] == '"') {
+      size_t end = query.find('"', pos + 1);
+      if (end == std::string_view::npos) {
+        end = query.size();
+      }
+      QueryItem item{{}, true, std::nullopt};
+      split_words(query.substr(pos + 1, end - pos - 1), &item.phrase);
+      if (!item.phrase.empty()) {
+        items.push_back(std::move(item));
+      }
+      pos = end + 1;
+      continue;
+    }
+
+    size_t end = query.find_first_of(kSeparators, pos);
+    end = std::min(end, query.find('"', pos));
+    if (end == std::string_view::npos) {
+      end = query.size();
+    }
+    std::string_view token = query.substr(pos, end - pos);
+    if (!token.empty()) {
+      std::optional<uint32_t> near = parse_near(token);
+      if (near) {
+        items.push_back(QueryItem{{}, false, near});
+      } else {
+        items.push_back(QueryItem{{std::string(token)}, false, std::nullopt});
+      }
+    }
+    pos = end == query.size() || query[end] == '"' ? end : end + 1;
+  }
+
+  // Join operands separated by NEAR/k into chains. A chain of a single
+  // unquoted word puts no condition on positions.
+  PhraseQuery result;
+  Constraint chain;
+  bool chain_quoted = false;
+  // The k of a NEAR/k waiting for the operand after it, or 0
+  uint32_t pending = 0;
+  auto flush = [&]() {
+    if (chain.operands.size() > 1 || chain_quoted) {
+      result.constraints.push_back(std::move(chain));
+    }
+    chain = Constraint();
+    chain_quoted = false;
+  };
+  for (QueryItem& item : items) {
+    if (item.near) {
+      // Only an operator right after an operand can join it to the next
+      pending = chain.operands.empty() ? 0 : *item.near;
+      continue;
+    }
+    result.words.insert(result.words.end(), item.phrase.begin(),
+                        item.phrase.end());
+    if (pending == 0) {
+      flush();
+    } else {
+      chain.distances.push_back(pending);
+    }
+    chain.operands.push_back(std::move(item.phrase));
+    chain_quoted = chain_quoted || item.quoted;
+    pending = 0;
+  }
+  flush();
+  return result;
+}
+
+static std::optional<uint32_t> parse_near(std::string_view token) {
+  static constexpr std::string_view kNear = "near/";
+  if (token.size() <= kNear.size() || token.substr(0, kNear.size()) != kNear) {
+    return std::nullopt;
+  }
+  uint32_t k = 0;
+  for (char c : token.substr(kNear.size())) {
+    if (c < '0' || c > '9') {
+      return std::nullopt;
+    }
+    k = std::min(k * 10 + static_cast<uint32_t>(c - '0'), kMaxDistance);
+  }
+  if (k == 0) {
+    return std::nullopt;
+  }
+  return k;
+}
+
+static void split_words(std::string_view text, PhraseQuery::Phrase* phrase) {
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t end = text.find_first_of(kSeparators, pos);
+    if (end == std::string_view::npos) {
+      end = text.size();
+    }
+    if (end > pos) {
+      phrase->emplace_back(text.substr(pos, end - pos));
+    }
+    pos = end + 1;
+  }
+}
+
+}  // namespace searchserver
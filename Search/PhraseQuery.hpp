@@ -0,0 +1,61 @@
+#ifndef PHRASE_QUERY_HPP_
+#define PHRASE_QUERY_HPP_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace searchserver {
+
+// A query that, besides the words every result must contain, can require
+// some of them to appear next to or near each other:
+//
+//   "new york" pizza          "new" followed directly by "york", and pizza
+//   coffee near/3 cake        coffee and cake at most 3 words apart, with
+//                             at most 2 other words between them
+//   "new york" near/5 pizza   the phrase and pizza at most 5 words apart
+//
+// NEAR/k can be chained, as in a near/2 b near/2 c, in which case each
+// operand has to be within its distance of the one before it, in either
+// order. A NEAR/k that does not sit between two operands is ignored.
+struct PhraseQuery {
+  // The words of a phrase, which have to appear one after the other
+  using Phrase = std::vector<std::string>;
+
+  // One condition on the positions of the words in a document: a single
+  // quoted phrase, or a chain of operands joined by NEAR/k, where
+  // distances[i] is the k between operands[i] and operands[i + 1]
+  struct Constraint {
+    std::vector<Phrase> operands;
+    std::vector<uint32_t> distances;
+  };
+
+  // Every word of the query, in the order they appear, which is what
+  // documents are matched against before the constraints are checked
+  std::vector<std::string> words;
+
+  // The constraints, all of which a document has to satisfy
+  std::vector<Constraint> constraints;
+
+  // Returns true if the query has any constraints, and so needs the
+  // positions of its words to be answered
+  bool positional() const { return !constraints.empty(); }
+
+  // Parses a query. Words are separated by spaces, '+' and the same
+  // punctuation the crawler splits files on, and are expected to be
+  // lowercased already. A double quote starts or ends a phrase; one that
+  // is never closed runs to the end of the query. NEAR/k (lowercase, with
+  // k from 1 up) outside of quotes is an operator rather than a word.
+  //
+  // Arguments:
+  //  - query: the decoded query string
+  //
+  // Returns:
+  //  - the parsed query, which has no words if the query had none
+  static PhraseQuery parse(std::string_view query);
+};
+
+}  // namespace searchserver
+
+#endif  // PHRASE_QUERY_HPP_
@@ -0,0 +1,476 @@
+#include "./PostingList.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace searchserver {
+
+// The first byte of every encoded block is either the number of bits its
+// gaps are packed with, or this to mark a block of variable-byte integers
+static const uint8_t kVByteBlock = 0xFF;
+
+// The number of bytes that kPostingBlockSize integers of `bits` bits each
+// take up when bit-packed
+static size_t packed_size(uint32_t bits) {
+  return kPostingBlockSize / 8 * bits;
+}
+
+// Returns the number of bits needed to store the largest of n values
+static uint32_t bits_needed(const uint32_t* values, size_t n);
+
+// Packs kPostingBlockSize integers of `bits` bits each into out in the
+// SIMD-BP128 layout: integer i goes to lane i % 4 of a 128-bit word, and
+// each lane is filled from its least significant bit up before moving on
+// to the same lane of the next word
+static void pack_bits(const uint32_t* in, uint32_t bits, uint8_t* out);
+
+// Turns n gaps into DocIds, in place, by adding each to the DocId before
+// it, starting from base
+static void prefix_sum(DocId* values, size_t n, DocId base);
+
+// Appends v to out as a variable-byte integer
+static void put_vbyte(uint32_t v, vector<uint8_t>* out);
+
+// Reads a variable-byte integer from in, which ends at end.
+//
+// Returns:
+//  - a pointer just past the integer, or null if it runs past the end
+static const uint8_t* get_vbyte(const uint8_t* in, const uint8_t* end,
+                                uint32_t* v);
+
+void PostingList::encode(PostingCodec codec) {
+  size = postings.size();
+  blocks.resize((size + kPostingBlockSize - 1) / kPostingBlockSize);
+  data.clear();
+
+  uint32_t gaps[kPostingBlockSize];
+  uint32_t tfs[kPostingBlockSize];
+  DocId prev = 0;
+  for (size_t b = 0; b < blocks.size(); b++) {
+    size_t start = b * kPostingBlockSize;
+    size_t n = std::min(kPostingBlockSize, size - start);
+    for (size_t i = 0; i < n; i++) {
+      const Posting& p = postings[start + i];
+      gaps[i] = p.doc - prev;
+      tfs[i] = p.tf - 1;
+      prev = p.doc;
+    }
+    blocks[b].last_doc = prev;
+    blocks[b].offset = static_cast<uint32_t>(data.size());
+
+    if (codec == PostingCodec::kBP128 && n == kPostingBlockSize) {
+      uint32_t gap_bits = bits_needed(gaps, n);
+      uint32_t tf_bits = bits_needed(tfs, n);
+      data.push_back(static_cast<uint8_t>(gap_bits));
+      data.push_back(static_cast<uint8_t>(tf_bits));
+      size_t at = data.size();
+      data.resize(at + packed_size(gap_bits) + packed_size(tf_bits));
+      pack_bits(gaps, gap_bits, &data[at]);
+      pack_bits(tfs, tf_bits, &data[at + packed_size(gap_bits)]);
+    } else {
+      // The gaps come first so that the DocIds can be decoded without
+      // the counts
+      data.push_back(kVByteBlock);
+      for (size_t i = 0; i < n; i++) {
+        put_vbyte(gaps[i], &data);
+      }
+      for (size_t i = 0; i < n; i++) {
+        put_vbyte(tfs[i], &data);
+      }
+    }
+  }
+
+  data.shrink_to_fit();
+
+  // Each posting's positions restart from 0, so that a posting's can be
+  // decoded without the ones before it in other blocks
+  position_data.clear();
+  position_starts.clear();
+  if (!positions.empty()) {
+    position_starts.resize(blocks.size());
+    size_t at = 0;
+    for (size_t i = 0; i < size; i++) {
+      if (i % kPostingBlockSize == 0) {
+        position_starts[i / kPostingBlockSize] =
+            static_cast<uint32_t>(position_data.size());
+      }
+      uint32_t prev = 0;
+      for (uint32_t n = 0; n < postings[i].tf; n++, at++) {
+        put_vbyte(positions[at] - prev, &position_data);
+        prev = positions[at];
+      }
+    }
+    position_data.shrink_to_fit();
+  }
+
+  vector<Posting>().swap(postings);
+  vector<uint32_t>().swap(positions);
+}
+
+void PostingList::decode() {
+  PostingCursor cursor(view());
+  postings.reserve(size);
+  vector<uint32_t> doc_positions;
+  while (cursor.doc() != PostingCursor::kEnd) {
+    postings.push_back({cursor.doc(), cursor.tf()});
+    if (!position_data.empty() && cursor.positions(&doc_positions)) {
+      positions.insert(positions.end(), doc_positions.begin(),
+                       doc_positions.end());
+    }
+    cursor.next();
+  }
+  vector<uint8_t>().swap(data);
+  vector<uint8_t>().swap(position_data);
+  vector<uint32_t>().swap(position_starts);
+  size = 0;
+}
+
+PostingListView PostingList::view() const {
+  PostingListView list;
+  list.data = data.data();
+  list.num_bytes = data.size();
+  list.size = size;
+  list.blocks = blocks.data();
+  list.num_blocks = size > 0 ? blocks.size() : 0;
+  list.max_tf = max_tf;
+  list.max_bm25 = max_bm25;
+  if (!position_data.empty()) {
+    list.positions = position_data.data();
+    list.position_bytes = position_data.size();
+    list.position_starts = position_starts.data();
+  }
+  return list;
+}
+
+PostingCursor::PostingCursor(const PostingListView& list) : list_(list) {
+  load_block(0);
+}
+
+void PostingCursor::advance(DocId target) {
+  if (doc_ >= target) {
+    return;
+  }
+
+  if (list_.blocks[block_].last_doc < target) {
+    // Double the step over the skip entries until we overshoot the
+    // target, then binary search the last step. The block that holds the
+    // target lies in (lo, hi].
+    size_t lo = block_;
+    size_t step = 1;
+    size_t hi = lo + step;
+    while (hi < list_.num_blocks && list_.blocks[hi].last_doc < target) {
+      lo = hi;
+      step <<= 1;
+      hi = lo + step;
+    }
+    hi = std::min(hi, list_.num_blocks);
+
+    const BlockMax* it = std::lower_bound(list_.blocks + lo + 1,
+                                          list_.blocks + hi, target,
+                                          [](const BlockMax& b, DocId d) {
+                                            return b.last_doc < d;
+                                          });
+    load_block(static_cast<size_t>(it - list_.blocks));
+    if (doc_ == kEnd) {
+      return;
+    }
+  }
+
+  // The block's last DocId is at least target, so this stays in the block
+  pos_ = static_cast<size_t>(
+      std::lower_bound(docs_ + pos_, docs_ + block_len_, target) - docs_);
+  doc_ = docs_[pos_];
+}
+
+bool PostingCursor::positions(vector<uint32_t>* out) {
+  out->clear();
+  if (list_.positions == nullptr || doc_ == kEnd) {
+    return false;
+  }
+  if (!tfs_decoded_) {
+    decode_tfs();
+  }
+
+  const uint8_t* end = list_.positions + list_.position_bytes;
+  if (position_next_ == nullptr || position_posting_ > pos_) {
+    uint32_t start = list_.position_starts[block_];
+    if (start >= list_.position_bytes) {
+      return false;
+    }
+    position_next_ = list_.positions + start;
+    position_posting_ = 0;
+  }
+
+  // Skip the positions of the postings before this one in the block
+  const uint8_t* in = position_next_;
+  uint32_t value = 0;
+  for (; position_posting_ < pos_; position_posting_++) {
+    for (uint32_t n = 0; n < tfs_[position_posting_] && in != nullptr; n++) {
+      in = get_vbyte(in, end, &value);
+    }
+    if (in == nullptr) {
+      position_next_ = nullptr;
+      return false;
+    }
+  }
+
+  // A corrupt count cannot make this reserve more than the data could hold
+  uint32_t tf = tfs_[pos_];
+  out->reserve(std::min<size_t>(tf, end - in));
+  uint32_t position = 0;
+  for (uint32_t n = 0; n < tf; n++) {
+    in = get_vbyte(in, end, &value);
+    if (in == nullptr) {
+      position_next_ = nullptr;
+      out->clear();
+      return false;
+    }
+    position += value;
+    out->push_back(position);
+  }
+  position_next_ = in;
+  position_posting_ = pos_ + 1;
+  return true;
+}
+
+const BlockMax* PostingCursor::block_for(DocId target) {
+  // Blocks before the decoded one cannot hold target
+  shallow_ = std::max(shallow_, block_);
+  while (shallow_ < list_.num_blocks &&
+         list_.blocks[shallow_].last_doc < target) {
+    shallow_++;
+  }
+  return shallow_ < list_.num_blocks ? &list_.blocks[shallow_] : nullptr;
+}
+
+void PostingCursor::load_block(size_t block) {
+  block_ = std::min(block, list_.num_blocks);
+  block_len_ = 0;
+  pos_ = 0;
+  doc_ = kEnd;
+  tfs_decoded_ = false;
+  position_next_ = nullptr;
+  if (block_ == list_.num_blocks) {
+    return;
+  }
+
+  // Lists from a mapped file are only checked as their blocks are read:
+  // a block that runs past the end of the list's data, or whose DocIds do
+  // not agree with its skip entry, ends the list early
+  const BlockMax& skip = list_.blocks[block_];
+  if (skip.offset >= list_.num_bytes ||
+      skip.last_doc > list_.blocks[list_.num_blocks - 1].last_doc ||
+      block_ * kPostingBlockSize >= list_.size) {
+    block_ = list_.num_blocks;
+    return;
+  }
+  size_t n = std::min(kPostingBlockSize, list_.size - block_ * kPostingBlockSize);
+  const uint8_t* in = list_.data + skip.offset;
+  const uint8_t* end = list_.data + list_.num_bytes;
+  DocId prev = (block_ == 0) ? 0 : list_.blocks[block_ - 1].last_doc;
+
+  uint32_t gap_bits = *in++;
+  if (gap_bits == kVByteBlock) {
+    for (size_t i = 0; i < n && in != nullptr; i++) {
+      uint32_t gap = 0;
+      in = get_vbyte(in, end, &gap);
+      prev += gap;
+      docs_[i] = prev;
+    }
+    tf_bits_ = kVByteBlock;
+  } else if (gap_bits <= 32 && in < end && *in <= 32 &&
+             static_cast<size_t>(end - in) >
+                 packed_size(gap_bits) + packed_size(*in)) {
+    tf_bits_ = *in++;
+    unpack_bits(in, gap_bits, docs_);
+    prefix_sum(docs_, kPostingBlockSize, prev);
+    in += packed_size(gap_bits);
+  } else {
+    in = nullptr;
+  }
+
+  DocId max_doc = 0;
+  for (size_t i = 0; in != nullptr && i < n; i++) {
+    max_doc = std::max(max_doc, docs_[i]);
+  }
+  if (in == nullptr || max_doc != skip.last_doc || docs_[n - 1] != max_doc) {
+    block_ = list_.num_blocks;
+    return;
+  }
+
+  tf_data_ = in;
+  block_len_ = n;
+  doc_ = docs_[0];
+}
+
+void PostingCursor::decode_tfs() {
+  tfs_decoded_ = true;
+  if (tf_bits_ != kVByteBlock) {
+    unpack_bits(tf_data_, tf_bits_, tfs_);
+    for (size_t i = 0; i < block_len_; i++) {
+      tfs_[i]++;
+    }
+    return;
+  }
+
+  const uint8_t* in = tf_data_;
+  const uint8_t* end = list_.data + list_.num_bytes;
+  for (size_t i = 0; i < block_len_; i++) {
+    uint32_t tf = 0;
+    if (in != nullptr) {
+      in = get_vbyte(in, end, &tf);
+    }
+    tfs_[i] = tf + 1;
+  }
+}
+
+#if defined(__SSE2__)
+void unpack_bits(const uint8_t* in, uint32_t bits, uint32_t* out) {
+  if (bits == 0) {
+    std::fill(out, out + kPostingBlockSize, 0);
+    return;
+  }
+
+  // Each 128-bit word holds the next bits of four lanes, so every step
+  // unpacks four integers with a shift and a mask, pulling in the next
+  // word when the current one runs out part way through an integer
+  const auto* src = reinterpret_cast<const __m128i*>(in);
+  auto* dst = reinterpret_cast<__m128i*>(out);
+  const __m128i mask = _mm_set1_epi32(
+      bits == 32 ? -1 : static_cast<int>((1U << bits) - 1));
+  __m128i word = _mm_loadu_si128(src++);
+  uint32_t shift = 0;
+  for (size_t i = 0; i < kPostingBlockSize / 4; i++) {
+    __m128i v = _mm_srl_epi32(word, _mm_cvtsi32_si128(static_cast<int>(shift)));
+    shift += bits;
+    if (shift >= 32) {
+      shift -= 32;
+      if (shift > 0) {
+        word = _mm_loadu_si128(src++);
+        v = _mm_or_si128(v, _mm_sll_epi32(word, _mm_cvtsi32_si128(
+                                                    static_cast<int>(bits - shift))));
+      } else if (i + 1 < kPostingBlockSize / 4) {
+        word = _mm_loadu_si128(src++);
+      }
+    }
+    _mm_storeu_si128(dst + i, _mm_and_si128(v, mask));
+  }
+}
+#else
+void unpack_bits(const uint8_t* in, uint32_t bits, uint32_t* out) {
+  unpack_bits_scalar(in, bits, out);
+}
+#endif
+
+void unpack_bits_scalar(const uint8_t* in, uint32_t bits, uint32_t* out) {
+  if (bits == 0) {
+    std::fill(out, out + kPostingBlockSize, 0);
+    return;
+  }
+
+  uint32_t words[kPostingBlockSize];
+  memcpy(words, in, packed_size(bits));
+  uint32_t mask = (bits == 32) ? UINT32_MAX : (1U << bits) - 1;
+  for (size_t lane = 0; lane < 4; lane++) {
+    size_t word = lane;
+    uint32_t shift = 0;
+    for (size_t i = 0; i < kPostingBlockSize / 4; i++) {
+      uint32_t v = words[word] >> shift;
+      shift += bits;
+      if (shift >= 32) {
+        shift -= 32;
+        word += 4;
+        if (shift > 0) {
+          v |= words[word] << (bits - shift);
+        }
+      }
+      out[4 * i + lane] = v & mask;
+    }
+  }
+}
+
+static void pack_bits(const uint32_t* in, uint32_t bits, uint8_t* out) {
+  uint32_t words[kPostingBlockSize] = {};
+  for (size_t lane = 0; lane < 4 && bits > 0; lane++) {
+    size_t word = lane;
+    uint32_t shift = 0;
+    for (size_t i = 0; i < kPostingBlockSize / 4; i++) {
+      uint32_t v = in[4 * i + lane];
+      words[word] |= v << shift;
+      shift += bits;
+      if (shift >= 32) {
+        shift -= 32;
+        word += 4;
+        if (shift > 0) {
+          words[word] |= v >> (bits - shift);
+        }
+      }
+    }
+  }
+  memcpy(out, words, packed_size(bits));
+}
+
+static uint32_t bits_needed(const uint32_t* values, size_t n) {
+  uint32_t all = 0;
+  for (size_t i = 0; i < n; i++) {
+    all |= values[i];
+  }
+  uint32_t bits = 0;
+  while (bits < 32 && (all >> bits) != 0) {
+    bits++;
+  }
+  return bits;
+}
+
+static void prefix_sum(DocId* values, size_t n, DocId base) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  // Add each lane to the ones after it within a word, then carry the
+  // running total over from the previous word
+  __m128i run = _mm_set1_epi32(static_cast<int>(base));
+  for (; i < n / 4 * 4; i += 4) {
+    auto* p = reinterpret_cast<__m128i*>(values + i);
+    __m128i v = _mm_loadu_si128(p);
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    v = _mm_add_epi32(v, run);
+    _mm_storeu_si128(p, v);
+    run = _mm_shuffle_epi32(v, 0xFF);
+  }
+  if (i > 0) {
+    base = values[i - 1];
+  }
+#endif
+  for (; i < n; i++) {
+    base += values[i];
+    values[i] = base;
+  }
+}
+
+static void put_vbyte(uint32_t v, vector<uint8_t>* out) {
+  while (v >= 0x80) {
+    out->push_back(static_cast<uint8_t>(v | 0x80));
+    v >>= 7;
+  }
+  out->push_back(static_cast<uint8_t>(v));
+}
+
+static const uint8_t* get_vbyte(const uint8_t* in, const uint8_t* end,
+                                uint32_t* v) {
+  uint32_t result = 0;
+  for (uint32_t shift = 0; shift < 32 && in < end; shift += 7) {
+    uint8_t byte = *in++;
+    result |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      *v = result;
+      return in;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace searchserver
@@ -0,0 +1,231 @@
+#ifndef POSTING_LIST_HPP_
+#define POSTING_LIST_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using std::vector;
+
+namespace searchserver {
+
+// Dense integer id given to each document the first time it is recorded.
+// Ids are handed out in increasing order starting at 0.
+using DocId = uint32_t;
+
+// A single entry in a posting list: a document and the number of
+// occurances of the word in that document (its term frequency)
+struct Posting {
+  DocId doc;
+  uint32_t tf;
+};
+
+// The number of postings in each block of an encoded posting list
+constexpr size_t kPostingBlockSize = 128;
+
+// The ways a posting list can be compressed. Either way, each block
+// stores the gaps between consecutive DocIds (starting from the last
+// DocId of the previous block) and each count minus one, so that blocks
+// can be decoded independently of each other.
+enum class PostingCodec {
+  // Every block as variable-byte integers: 7 bits per byte, with the high
+  // bit set on every byte but the last of each number
+  kVByte,
+
+  // Full blocks bit-packed with SIMD-BP128: the gaps, then the counts,
+  // each packed with the fewest bits that fit the largest of the block,
+  // laid out so that SSE2 can unpack four of them per instruction. The
+  // final partial block of a list falls back to variable bytes.
+  kBP128,
+};
+
+// The skip entry of one block of kPostingBlockSize postings: where the
+// block starts, and upper bounds on the scores of its postings. Cursors
+// use these to skip blocks without decoding them, and disjunctive
+// queries to skip blocks that cannot make it into the current top-K.
+struct BlockMax {
+  // The DocId of the last posting in the block
+  DocId last_doc;
+
+  // The largest count in the block
+  uint32_t max_tf;
+
+  // The largest tf / (tf + norm) in the block: the largest BM25 score of
+  // the block before it is multiplied by the word's weight
+  float max_bm25;
+
+  // Where the block's encoding starts in the list's data
+  uint32_t offset;
+};
+
+// A read-only view of the encoded postings of one word and their skip
+// entries. The data may be owned by a PostingList or live in a mapped
+// index file.
+struct PostingListView {
+  const uint8_t* data = nullptr;
+  size_t num_bytes = 0;
+
+  // The number of postings in the list
+  size_t size = 0;
+
+  const BlockMax* blocks = nullptr;
+  size_t num_blocks = 0;
+
+  // The bounds over the whole list, in the same units as BlockMax
+  uint32_t max_tf = 0;
+  float max_bm25 = 0;
+
+  // The encoded positions of the word in each document, if the index
+  // records them, and where each block's positions start in them
+  const uint8_t* positions = nullptr;
+  size_t position_bytes = 0;
+  const uint32_t* position_starts = nullptr;
+};
+
+// All the postings of one word. While an index is being built they are
+// kept as a plain sorted array so words can be recorded cheaply;
+// WordIndex::finalize() then encodes them, which frees the array.
+struct PostingList {
+  // The postings, sorted by DocId, while the list is not encoded
+  vector<Posting> postings;
+
+  // Where the word occurs in each document, counting words from 0, if
+  // the index records positions: the tf positions of the first posting in
+  // increasing order, then those of the second, and so on. Empty
+  // otherwise, or while the list is encoded.
+  vector<uint32_t> positions;
+
+  // The encoded postings and the skip entry of every block
+  vector<uint8_t> data;
+  vector<BlockMax> blocks;
+  size_t size = 0;
+
+  // The encoded positions: each posting's positions as the gaps between
+  // them, as variable-byte integers, in posting order. position_starts
+  // holds where each block's positions start, so the positions of a
+  // posting can be found by decoding only the ones before it in its block.
+  vector<uint8_t> position_data;
+  vector<uint32_t> position_starts;
+
+  // The bounds over the whole list, in the same units as BlockMax
+  uint32_t max_tf = 0;
+  float max_bm25 = 0;
+
+  // Returns true if the list holds encoded postings rather than an array
+  bool encoded() const { return postings.empty() && size > 0; }
+
+  // Compresses the postings with the given codec, and their positions if
+  // there are any, and frees the arrays. Fills in the last_doc and offset
+  // of every block, keeping any score bounds already computed for them.
+  void encode(PostingCodec codec = PostingCodec::kBP128);
+
+  // Decodes the postings and positions back into the arrays so they can
+  // be modified
+  void decode();
+
+  // Returns a view of the encoded list, valid until the list is modified
+  PostingListView view() const;
+};
+
+// Iterates over the postings of an encoded list in DocId order, decoding
+// one block at a time. Besides stepping through postings one at a time,
+// a cursor can skip ahead to a DocId, decoding only the block that holds
+// it, and can look up the block that would hold a DocId without decoding
+// anything.
+class PostingCursor {
+ public:
+  // Stands in for the DocId of a cursor that is past the end of its list
+  static constexpr DocId kEnd = UINT32_MAX;
+
+  PostingCursor() = default;
+  explicit PostingCursor(const PostingListView& list);
+
+  // Returns the number of postings in the list
+  size_t size() const { return list_.size; }
+
+  // Returns the upper bounds over the whole list
+  const PostingListView& list() const { return list_; }
+
+  // Returns the DocId and count of the current posting. doc() is kEnd
+  // once the cursor has moved past the last posting. The counts of a
+  // block are only decoded the first time one of them is asked for.
+  DocId doc() const { return doc_; }
+  uint32_t tf() {
+    if (!tfs_decoded_) {
+      decode_tfs();
+    }
+    return tfs_[pos_];
+  }
+
+  // Moves to the next posting
+  void next() {
+    if (++pos_ < block_len_) {
+      doc_ = docs_[pos_];
+    } else {
+      load_block(block_ + 1);
+    }
+  }
+
+  // Decodes the positions of the current posting, in increasing order,
+  // into out. Positions are decoded from the start of the block the first
+  // time, and from the last posting whose positions were decoded after
+  // that, so visiting some of the postings of a block in order decodes
+  // each position at most once.
+  //
+  // Returns:
+  //  - false if the list has no positions, or they are corrupt
+  bool positions(vector<uint32_t>* out);
+
+  // Moves to the first posting whose DocId is not less than target. The
+  // skip entries are searched with an exponential (galloping) search, so
+  // short skips cost O(log distance), and only the block that holds the
+  // target is decoded.
+  void advance(DocId target);
+
+  // Returns the skip entry of the block that would hold target, without
+  // moving the cursor, or null if target is past the end of the list.
+  // Targets must not decrease between calls.
+  const BlockMax* block_for(DocId target);
+
+ private:
+  // Decodes the DocIds of a block and moves to its first posting. Moves
+  // past the end of the list if there is no such block, or it is corrupt.
+  void load_block(size_t block);
+
+  // Decodes the counts of the current block
+  void decode_tfs();
+
+  PostingListView list_;
+
+  // The decoded block, the current posting in it, and the block last
+  // found by block_for()
+  size_t block_ = 0;
+  size_t block_len_ = 0;
+  size_t pos_ = 0;
+  size_t shallow_ = 0;
+  DocId doc_ = kEnd;
+
+  // Where the counts of the decoded block start, and how they are encoded
+  const uint8_t* tf_data_ = nullptr;
+  uint32_t tf_bits_ = 0;
+  bool tfs_decoded_ = false;
+
+  // Where the positions of posting position_posting_ of the block start,
+  // or null if no positions of the block have been decoded yet
+  const uint8_t* position_next_ = nullptr;
+  size_t position_posting_ = 0;
+
+  DocId docs_[kPostingBlockSize];
+  uint32_t tfs_[kPostingBlockSize];
+};
+
+// Unpacks kPostingBlockSize integers of `bits` bits each, packed in the
+// SIMD-BP128 layout, from in into out. unpack_bits() uses SSE2 when it is
+// available, and otherwise falls back to unpack_bits_scalar(), which
+// produces the same output one integer at a time.
+void unpack_bits(const uint8_t* in, uint32_t bits, uint32_t* out);
+void unpack_bits_scalar(const uint8_t* in, uint32_t bits, uint32_t* out);
+
+}  // namespace searchserver
+
+#endif  // POSTING_LIST_HPP_
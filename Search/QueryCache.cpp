@@ -0,0 +1,154 @@
+#include "./QueryCache.hpp"
+
+#include <algorithm>
+#include <functional>
+
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+namespace searchserver {
+
+// Rough cost of the list node, hash map node and control block that hold
+// each entry, on top of the bytes of its strings and results
+static const size_t kEntryOverhead = 192;
+
+// Returns the approximate number of bytes an entry takes up
+static size_t entry_bytes(const string& key, const CachedQuery& answer);
+
+QueryCache::QueryCache(size_t max_bytes, size_t num_shards)
+    : shards_(new Shard[std::max<size_t>(num_shards, 1)]),
+      num_shards_(std::max<size_t>(num_shards, 1)),
+      max_bytes_(max_bytes),
+      shard_bytes_(max_bytes / num_shards_) {
+  for (size_t i = 0; i < num_shards_; i++) {
+    pthread_mutex_init(&shards_[i].lock, nullptr);
+  }
+}
+
+QueryCache::~QueryCache() {
+  for (size_t i = 0; i < num_shards_; i++) {
+    pthread_mutex_destroy(&shards_[i].lock);
+  }
+}
+
+string QueryCache::make_key(vector<string>* terms, const string& options) {
+  std::sort(terms->begin(), terms->end());
+
+  // Query words never contain spaces, and the options come after a
+  // newline, so different queries cannot build the same key
+  string key;
+  for (const string& term : *terms) {
+    key += term;
+    key += ' ';
+  }
+  key += '\n';
+  key += options;
+  return key;
+}
+
+shared_ptr<const CachedQuery> QueryCache::get(const string& key,
+                                              uint64_t generation) {
+  Shard& shard = shard_for(key);
+  pthread_mutex_lock(&shard.lock);
+
+  shared_ptr<const CachedQuery> answer;
+  if (advance(&shard, generation)) {
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      // Move the entry to the front, as the most recently used
+      shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+      answer = it->second->answer;
+    }
+  }
+
+  if (answer != nullptr) {
+    shard.hits++;
+  } else {
+    shard.misses++;
+  }
+  pthread_mutex_unlock(&shard.lock);
+  return answer;
+}
+
+void QueryCache::put(const string& key, uint64_t generation,
+                     shared_ptr<const CachedQuery> answer) {
+  size_t bytes = entry_bytes(key, *answer);
+  if (bytes > shard_bytes_) {
+    return;
+  }
+
+  Shard& shard = shard_for(key);
+  pthread_mutex_lock(&shard.lock);
+  if (!advance(&shard, generation)) {
+    pthread_mutex_unlock(&shard.lock);
+    return;
+  }
+
+  // Another worker may have answered the same query in the meantime
+  auto it = shard.index.find(key);
+  if (it != shard.index.end()) {
+    erase(&shard, it->second);
+  }
+
+  while (shard.bytes + bytes > shard_bytes_) {
+    erase(&shard, std::prev(shard.entries.end()));
+    shard.evictions++;
+  }
+
+  shard.entries.push_front(Entry{key, std::move(answer), bytes});
+  shard.index.emplace(key, shard.entries.begin());
+  shard.bytes += bytes;
+  pthread_mutex_unlock(&shard.lock);
+}
+
+QueryCache::Stats QueryCache::stats() const {
+  Stats stats;
+  stats.max_bytes = max_bytes_;
+  for (size_t i = 0; i < num_shards_; i++) {
+    Shard& shard = shards_[i];
+    pthread_mutex_lock(&shard.lock);
+    stats.hits += shard.hits;
+    stats.misses += shard.misses;
+    stats.evictions += shard.evictions;
+    stats.entries += shard.entries.size();
+    stats.bytes += shard.bytes;
+    pthread_mutex_unlock(&shard.lock);
+  }
+  return stats;
+}
+
+QueryCache::Shard& QueryCache::shard_for(const string& key) {
+  return shards_[std::hash<string>()(key) % num_shards_];
+}
+
+bool QueryCache::advance(Shard* shard, uint64_t generation) {
+  if (generation < shard->generation) {
+    return false;
+  }
+  if (generation > shard->generation) {
+    shard->entries.clear();
+    shard->index.clear();
+    shard->bytes = 0;
+    shard->generation = generation;
+  }
+  return true;
+}
+
+void QueryCache::erase(Shard* shard, std::list<Entry>::iterator it) {
+  shard->bytes -= it->bytes;
+  shard->index.erase(it->key);
+  shard->entries.erase(it);
+}
+
+static size_t entry_bytes(const string& key, const CachedQuery& answer) {
+  // The key is stored twice, in the entry and in the hash map
+  size_t bytes = kEntryOverhead + 2 * key.size() + answer.query.size() +
+                 (answer.page != nullptr ? answer.page->size() : 0);
+  for (const Result& result : answer.results) {
+    bytes += sizeof(Result) + result.doc_name.size();
+  }
+  return bytes;
+}
+
+}  // namespace searchserver
@@ -0,0 +1,154 @@
+#ifndef QUERY_CACHE_HPP_
+#define QUERY_CACHE_HPP_
+
+#include <pthread.h>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "./Result.hpp"
+
+namespace searchserver {
+
+// The answer to one query: the page of ranked results, and the HTML page
+// that was rendered from them
+struct CachedQuery {
+  // The page of results and the total number of documents that matched
+  std::vector<Result> results;
+  size_t num_results = 0;
+
+  // The query text as the client typed it, which the page echoes back.
+  // Other spellings of the same query share the cached results but not
+  // the page.
+  std::string query;
+
+  // The rendered page, which responses send as their body without
+  // copying it
+  std::shared_ptr<const std::string> page;
+};
+
+// A QueryCache remembers the answers to recent queries, so that popular
+// queries do not have to be looked up and rendered again each time.
+//
+// Answers are kept in least recently used order and evicted once their
+// total size goes over a byte budget. The cache is split into shards,
+// each with its own lock and its own share of the budget, so that
+// concurrent workers rarely wait on each other.
+//
+// Every answer is stored with the generation of the index it was looked
+// up in (see WordIndex::generation()). Looking up or storing an answer
+// for a newer generation drops every older answer in that shard, so a
+// modified or reloaded index never serves stale results.
+class QueryCache {
+ public:
+  // Hit, miss and size counters, summed over all shards
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+    size_t max_bytes = 0;
+  };
+
+  // Creates an empty cache.
+  //
+  // Arguments:
+  //  - max_bytes: the most memory the cached answers may take up in total
+  //  - num_shards: the number of independently locked parts to split the
+  //    cache into
+  explicit QueryCache(size_t max_bytes, size_t num_shards = 16);
+
+  // destroys the shard locks
+  ~QueryCache();
+
+  // Builds the key a query is cached under. The terms are sorted, so the
+  // same words in any order share an entry; options should hold anything
+  // else that changes the answer, such as the ranking and the page.
+  //
+  // Arguments:
+  //  - terms: the lowercased words of the query, sorted in place
+  //  - options: the other query arguments that affect the results
+  //
+  // Returns:
+  //  - the cache key
+  static std::string make_key(std::vector<std::string>* terms,
+                              const std::string& options);
+
+  // Finds the cached answer to a query.
+  //
+  // Arguments:
+  //  - key: the key built by make_key()
+  //  - generation: the generation of the index being queried
+  //
+  // Returns:
+  //  - the answer, or nullptr if it is not cached for this generation
+  std::shared_ptr<const CachedQuery> get(const std::string& key,
+                                         uint64_t generation);
+
+  // Caches the answer to a query, evicting the least recently used
+  // answers if needed to stay within the byte budget. Answers too big to
+  // fit, or looked up in an index older than one the cache has already
+  // seen, are not stored.
+  //
+  // Arguments:
+  //  - key: the key built by make_key()
+  //  - generation: the generation of the index the answer came from
+  //  - answer: the answer to store
+  void put(const std::string& key, uint64_t generation,
+           std::shared_ptr<const CachedQuery> answer);
+
+  // Returns the current counters
+  Stats stats() const;
+
+  // disable copying and moving, the shards hold locks
+  QueryCache(const QueryCache& other) = delete;
+  QueryCache& operator=(const QueryCache& other) = delete;
+  QueryCache(QueryCache&& other) = delete;
+  QueryCache& operator=(QueryCache&& other) = delete;
+
+ private:
+  // A cached answer, along with what is needed to find and evict it
+  struct Entry {
+    std::string key;
+    std::shared_ptr<const CachedQuery> answer;
+    size_t bytes;
+  };
+
+  // One independently locked part of the cache. entries is ordered from
+  // the most recently used answer to the least.
+  struct Shard {
+    pthread_mutex_t lock;
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    uint64_t generation = 0;
+    size_t bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+  };
+
+  // Returns the shard a key belongs to
+  Shard& shard_for(const std::string& key);
+
+  // Drops every entry of a shard if generation is newer than the answers
+  // it holds. Returns false if generation is older, in which case the
+  // shard is left alone. The shard must be locked.
+  static bool advance(Shard* shard, uint64_t generation);
+
+  // Removes an entry from a shard. The shard must be locked.
+  static void erase(Shard* shard, std::list<Entry>::iterator it);
+
+  std::unique_ptr<Shard[]> shards_;
+  size_t num_shards_;
+  size_t max_bytes_;
+  size_t shard_bytes_;
+};
+
+}  // namespace searchserver
+
+#endif  // QUERY_CACHE_HPP_
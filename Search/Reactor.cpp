@@ -0,0 +1,228 @@
+#include "./Reactor.hpp"
+
+#include <sys/epoll.h>  // for epoll_create1(), epoll_ctl(), epoll_wait()
+#include <unistd.h>     // for close()
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+using std::runtime_error;
+using std::string;
+
+namespace searchserver {
+
+// The most events handled per call to epoll_wait()
+static const int kMaxEvents = 256;
+
+// The answer to a request header that cannot be parsed, after which the
+// rest of what the client sent cannot be trusted to start a request
+static const char* const kBadRequest =
+    "HTTP/1.1 400 Bad Request\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+Reactor::Reactor(ServerSocket* server, ThreadPool* pool, Handler handler,
+                 size_t pipeline_depth)
+    : server_(server),
+      pool_(pool),
+      handler_(std::move(handler)),
+      pipeline_depth_(pipeline_depth > 0 ? pipeline_depth : 1),
+      epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {
+  if (epoll_fd_ == -1) {
+    throw runtime_error("epoll_create1() failed: " + string(strerror(errno)));
+  }
+
+  // The listening socket is the only one registered without a Connection
+  struct epoll_event event{};
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = nullptr;
+  if (!server_->set_nonblocking() ||
+      epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, server_->fd(), &event) == -1) {
+    close(epoll_fd_);
+    throw runtime_error("could not watch the listening socket: " +
+                        string(strerror(errno)));
+  }
+}
+
+Reactor::~Reactor() {
+  close(epoll_fd_);
+}
+
+void Reactor::run() {
+  std::array<struct epoll_event, kMaxEvents> events{};
+  while (true) {
+    int num_events = epoll_wait(epoll_fd_, events.data(), kMaxEvents, -1);
+    if (num_events == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw runtime_error("epoll_wait() failed: " + string(strerror(errno)));
+    }
+
+    for (int i = 0; i < num_events; i++) {
+      auto* conn = static_cast<Connection*>(events[i].data.ptr);
+      if (conn == nullptr) {
+        accept_clients();
+      } else if (conn->batch.empty()) {
+        on_readable(conn);
+      } else {
+        // The client has made room for more of a batch it stopped reading
+        pool_->dispatch([conn]() { serve(conn); });
+      }
+    }
+  }
+}
+
+void Reactor::accept_clients() {
+  // The listening socket is edge-triggered too, so accept every client
+  // that is waiting before going back to epoll_wait()
+  while (true) {
+    std::optional<HttpSocket> client = server_->accept_client();
+    if (!client) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+
+    // Responses are written whole, a batch at a time, so there are no
+    // small writes for Nagle's algorithm to coalesce; left on, it holds
+    // each batch back until the client acknowledges the previous one,
+    // which a client that pipelines may delay. Sockets that are not TCP
+    // refuse the option, which is harmless.
+    auto* conn = new Connection{this, std::move(*client)};
+    conn->socket.set_nodelay();
+    if (!conn->socket.set_nonblocking() || !arm(conn, true)) {
+      delete conn;
+    }
+  }
+}
+
+void Reactor::on_readable(Connection* conn) {
+  if (!conn->socket.read_available()) {
+    // Still answer anything the client sent before it stopped sending
+    conn->closing = true;
+  }
+
+  if (conn->socket.has_request()) {
+    pool_->dispatch([conn]() { serve(conn); });
+    return;
+  }
+
+  // A client whose request header does not fit in the largest read
+  // buffer is disconnected, so it cannot make the server buffer without
+  // bound
+  if (conn->closing || conn->socket.buffer_full() || !arm(conn, false)) {
+    delete conn;
+  }
+}
+
+bool Reactor::arm(Connection* conn, bool add, bool writable) {
+  struct epoll_event event{};
+  event.events = (writable ? EPOLLOUT : EPOLLIN) | EPOLLET | EPOLLONESHOT;
+  event.data.ptr = conn;
+  return epoll_ctl(epoll_fd_, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+                   conn->socket.fd(), &event) == 0;
+}
+
+void Reactor::serve(Connection* conn) {
+  Reactor* reactor = conn->reactor;
+  WriteStatus written = WriteStatus::kDone;
+
+  try {
+    // Finish the batch the client stopped reading part way through, if
+    // there is one, before answering anything else it sent. Then answer
+    // every request the client has pipelined so far, in order. None of
+    // these calls block on reading, since the headers are already
+    // buffered. Responses are held back until a batch is full, a file is
+    // to be sent, or the buffered requests run out.
+    written = write_batch(conn);
+    HttpRequest request;
+    while (written == WriteStatus::kDone && !conn->malformed) {
+      RequestStatus status = conn->socket.next_request(&request);
+      if (status == RequestStatus::kIncomplete) {
+        written = flush(conn);
+        break;
+      }
+      if (status == RequestStatus::kMalformed) {
+        conn->batch.emplace_back(kBadRequest);
+        conn->malformed = true;
+        written = flush(conn);
+        break;
+      }
+
+      conn->batch.push_back(reactor->handler_(request));
+      if (conn->batch.size() >= reactor->pipeline_depth_ ||
+          conn->batch.back().file != nullptr) {
+        written = flush(conn);
+      }
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Client handling error: " << e.what() << "\n";
+    delete conn;
+    return;
+  }
+
+  if (written == WriteStatus::kFailed ||
+      (written == WriteStatus::kDone && conn->malformed)) {
+    delete conn;
+    return;
+  }
+
+  // Hand the connection back to the event loop, to wait for room for the
+  // rest of its batch or for its next request, without a read buffer if
+  // it has nothing buffered. Once it is armed the event loop may pick it
+  // up at any moment, so it must not be touched here afterwards.
+  bool blocked = (written == WriteStatus::kBlocked);
+  conn->socket.release_buffer();
+  if ((conn->closing && !blocked) || !reactor->arm(conn, false, blocked)) {
+    delete conn;
+  }
+}
+
+WriteStatus Reactor::flush(Connection* conn) {
+  // Only the last response of a batch can have a file body, since it
+  // ends the batch; everything before its body is gathered into parts
+  conn->parts.clear();
+  conn->next = 0;
+  for (const HttpResponse& response : conn->batch) {
+    conn->parts.push_back({const_cast<char*>(response.bytes.data()),
+                           response.bytes.size()});
+    if (response.body != nullptr) {
+      conn->parts.push_back({const_cast<char*>(response.body->data()),
+                             response.body->size()});
+    }
+  }
+  return write_batch(conn);
+}
+
+WriteStatus Reactor::write_batch(Connection* conn) {
+  if (conn->batch.empty()) {
+    return WriteStatus::kDone;
+  }
+
+  // A file body is sent from where the last attempt left off, which is
+  // kept in the response itself
+  HttpResponse& last = conn->batch.back();
+  bool file = (last.file != nullptr && last.length > 0);
+  WriteStatus status =
+      conn->socket.try_write_parts(&conn->parts, &conn->next, file);
+  if (status == WriteStatus::kDone && file) {
+    status = conn->socket.try_write_file(last.file->fd, &last.offset,
+                                         &last.length);
+  }
+  if (status != WriteStatus::kBlocked) {
+    conn->batch.clear();
+    conn->parts.clear();
+    conn->next = 0;
+  }
+  return status;
+}
+
+}  // namespace searchserver
@@ -0,0 +1,158 @@
+#ifndef REACTOR_HPP_
+#define REACTOR_HPP_
+
+#include <sys/uio.h>  // for struct iovec
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "./FileCache.hpp"
+#include "./HttpSocket.hpp"
+#include "./ServerSocket.hpp"
+#include "./ThreadPool.hpp"
+
+namespace searchserver {
+
+// The answer to a request: either the bytes of a whole response, or a
+// response header followed by a body or by a range of an open file
+struct HttpResponse {
+  // Makes a response of just these bytes, so that handlers can return a
+  // complete response as a string
+  HttpResponse(std::string bytes = "") : bytes(std::move(bytes)) {}
+
+  // Makes a response of a header and a body, which are written together
+  // without being joined first
+  HttpResponse(std::string header, std::shared_ptr<const std::string> body)
+      : bytes(std::move(header)), body(std::move(body)) {}
+
+  // The whole response, or only its header if body or file is set
+  std::string bytes;
+
+  // The body, which may be shared with a cache
+  std::shared_ptr<const std::string> body;
+
+  // The file the body is sent from, and the range of it to send
+  std::shared_ptr<const OpenFile> file;
+  off_t offset = 0;
+  size_t length = 0;
+};
+
+// A Reactor serves the clients of a ServerSocket with one event loop
+// thread and a ThreadPool, instead of one blocked thread per connection.
+//
+// The event loop watches the listening socket and every idle connection
+// with edge-triggered epoll, all in non-blocking mode. It accepts clients
+// and reads whatever they send, and only once a whole request header is
+// buffered does it hand the connection to a worker in the pool. The
+// worker answers every buffered request, then gives the connection back
+// to the event loop along with its read buffer, if it has nothing left in
+// it. Idle keep-alive clients therefore cost a file descriptor each, but
+// no thread and no buffer.
+//
+// Requests that a client pipelines are answered in order, and their
+// responses are gathered into batches that are each written with one
+// system call instead of one per response.
+//
+// Writes never wait for a client to read. When a connection's send
+// buffer fills up, the rest of the batch is kept with the connection,
+// which is watched for room to write instead of for requests, and the
+// worker moves on. Once the client has read enough, a worker finishes the
+// batch and only then answers the requests after it, so a client that
+// reads slowly or not at all holds no worker.
+class Reactor {
+ public:
+  // Answers one request with the response to write back. The request
+  // points into the connection's buffer, so it must not be kept after
+  // the handler returns.
+  using Handler = std::function<HttpResponse(const HttpRequest& request)>;
+
+  // The most responses gathered into one write unless told otherwise
+  static constexpr size_t kDefaultPipelineDepth = 16;
+
+  // Sets up an event loop for the server's clients.
+  //
+  // Arguments:
+  //  - server: the socket to accept clients from
+  //  - pool: the workers that run the handler
+  //  - handler: called on a worker with each request. Requests that
+  //    cannot be parsed are answered with "400 Bad Request" instead.
+  //  - pipeline_depth: the most responses to pipelined requests that are
+  //    held back to be written together. 1 writes each response as soon
+  //    as it is ready. A response with a file body always ends a batch.
+  //
+  // Throws a std::runtime_error if epoll could not be set up.
+  Reactor(ServerSocket* server, ThreadPool* pool, Handler handler,
+          size_t pipeline_depth = kDefaultPipelineDepth);
+
+  // closes the epoll instance
+  ~Reactor();
+
+  // Runs the event loop forever, accepting clients and dispatching their
+  // requests. Throws a std::runtime_error if waiting for events fails.
+  void run();
+
+  // disable copying and moving, connections point back at their reactor
+  Reactor(const Reactor& other) = delete;
+  Reactor& operator=(const Reactor& other) = delete;
+  Reactor(Reactor&& other) = delete;
+  Reactor& operator=(Reactor&& other) = delete;
+
+ private:
+  // A client connection, whether the client has stopped sending, and the
+  // responses that are still to be written to it
+  struct Connection {
+    Reactor* reactor;
+    HttpSocket socket;
+    bool closing = false;
+
+    // Set once a request could not be parsed, after which the connection
+    // is closed as soon as the batch that answers it is written
+    bool malformed = false;
+
+    // The batch being written, which is only non-empty between responses
+    // being answered and the client having read them all, and the pieces
+    // of it from next on that have not been written yet. The part of a
+    // file body still to send is the range left in the last response.
+    std::vector<HttpResponse> batch;
+    std::vector<struct iovec> parts;
+    size_t next = 0;
+  };
+
+  // Accepts every client that is waiting on the listening socket
+  void accept_clients();
+
+  // Reads what a connection's client has sent and dispatches it to the
+  // pool if a whole request has arrived
+  void on_readable(Connection* conn);
+
+  // Watches a connection for the next data from its client, or with
+  // writable set, for room to write the rest of its batch. Each
+  // connection is watched with EPOLLONESHOT, so after an event it is
+  // owned by whoever handles it until it is armed again. Returns false
+  // if epoll refused, in which case the caller still owns it.
+  bool arm(Connection* conn, bool add, bool writable = false);
+
+  // Runs on a worker to finish writing the batch of a Connection, if it
+  // has one, and then answer its buffered requests
+  static void serve(Connection* conn);
+
+  // Starts writing a connection's batch of responses with as few system
+  // calls as possible
+  static WriteStatus flush(Connection* conn);
+
+  // Writes as much of a connection's batch as the client has room for,
+  // and empties it once it is all written
+  static WriteStatus write_batch(Connection* conn);
+
+  ServerSocket* server_;
+  ThreadPool* pool_;
+  Handler handler_;
+  size_t pipeline_depth_;
+  int epoll_fd_;
+};
+
+}  // namespace searchserver
+
+#endif  // REACTOR_HPP_
@@ -0,0 +1,139 @@
+#include "./ReadBuffer.hpp"
+
+#include <cstring>
+
+namespace searchserver {
+
+// The pools every ReadBuffer takes its blocks from. They are never
+// destroyed, so that connections closed during exit can still give their
+// blocks back.
+static BufferPool& small_pool() {
+  static auto* pool = new BufferPool(ReadBuffer::kSmallSize, 64);
+  return *pool;
+}
+
+static BufferPool& large_pool() {
+  static auto* pool = new BufferPool(ReadBuffer::kMaxSize, 16);
+  return *pool;
+}
+
+BufferPool::BufferPool(size_t block_size, size_t blocks_per_slab)
+    : block_size_(block_size),
+      blocks_per_slab_(blocks_per_slab > 0 ? blocks_per_slab : 1),
+      lock_(),
+      in_use_(0) {
+  pthread_mutex_init(&lock_, nullptr);
+}
+
+BufferPool::~BufferPool() {
+  pthread_mutex_destroy(&lock_);
+}
+
+char* BufferPool::acquire() {
+  pthread_mutex_lock(&lock_);
+  if (free_.empty()) {
+    slabs_.emplace_back(new char[block_size_ * blocks_per_slab_]);
+    char* slab = slabs_.back().get();
+    for (size_t i = blocks_per_slab_; i > 0; i--) {
+      free_.push_back(slab + (i - 1) * block_size_);
+    }
+  }
+  char* block = free_.back();
+  free_.pop_back();
+  in_use_++;
+  pthread_mutex_unlock(&lock_);
+  return block;
+}
+
+void BufferPool::release(char* block) {
+  pthread_mutex_lock(&lock_);
+  free_.push_back(block);
+  in_use_--;
+  pthread_mutex_unlock(&lock_);
+}
+
+BufferPool::Stats BufferPool::stats() const {
+  pthread_mutex_lock(&lock_);
+  Stats stats;
+  stats.in_use = in_use_;
+  stats.allocated = slabs_.size() * blocks_per_slab_;
+  pthread_mutex_unlock(&lock_);
+  return stats;
+}
+
+ReadBuffer::ReadBuffer(ReadBuffer&& other) noexcept
+    : block_(other.block_),
+      capacity_(other.capacity_),
+      start_(other.start_),
+      end_(other.end_) {
+  other.block_ = nullptr;
+  other.capacity_ = 0;
+  other.start_ = 0;
+  other.end_ = 0;
+}
+
+ReadBuffer::~ReadBuffer() {
+  release();
+}
+
+bool ReadBuffer::reserve() {
+  if (block_ == nullptr) {
+    block_ = small_pool().acquire();
+    capacity_ = kSmallSize;
+    return true;
+  }
+  if (end_ < capacity_) {
+    return true;
+  }
+
+  size_t buffered = size();
+  if (start_ > 0) {
+    // Reuse the space of the bytes already consumed
+    std::memmove(block_, block_ + start_, buffered);
+  } else if (capacity_ < kMaxSize) {
+    char* bigger = large_pool().acquire();
+    std::memcpy(bigger, block_, buffered);
+    release();
+    block_ = bigger;
+    capacity_ = kMaxSize;
+  } else {
+    return false;
+  }
+  start_ = 0;
+  end_ = buffered;
+  return true;
+}
+
+void ReadBuffer::consume(size_t bytes) {
+  start_ += bytes;
+  if (start_ == end_) {
+    start_ = 0;
+    end_ = 0;
+  }
+}
+
+void ReadBuffer::release_if_empty() {
+  if (size() == 0) {
+    release();
+  }
+}
+
+BufferPool::Stats ReadBuffer::small_stats() {
+  return small_pool().stats();
+}
+
+BufferPool::Stats ReadBuffer::large_stats() {
+  return large_pool().stats();
+}
+
+void ReadBuffer::release() {
+  if (block_ != nullptr) {
+    (capacity_ == kSmallSize ? small_pool() : large_pool()).release(block_);
+  }
+  block_ = nullptr;
+  capacity_ = 0;
+  start_ = 0;
+  end_ = 0;
+}
+
+}  // namespace searchserver
@@ -0,0 +1,137 @@
+#ifndef READ_BUFFER_HPP_
+#define READ_BUFFER_HPP_
+
+#include <pthread.h>
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace searchserver {
+
+// A BufferPool hands out blocks of one fixed size, carved out of larger
+// slabs. Blocks that are given back are reused rather than freed, so a
+// server that keeps taking and returning buffers stops allocating once it
+// has as many as it ever needed at once.
+class BufferPool {
+ public:
+  // How many blocks are handed out, and how many exist in all
+  struct Stats {
+    size_t in_use = 0;
+    size_t allocated = 0;
+  };
+
+  // Creates an empty pool.
+  //
+  // Arguments:
+  //  - block_size: the size of each block
+  //  - blocks_per_slab: how many blocks to allocate at once when the pool
+  //    runs out
+  BufferPool(size_t block_size, size_t blocks_per_slab);
+
+  // frees every slab, so no block may still be in use
+  ~BufferPool();
+
+  // Returns a block, allocating a new slab if none is free
+  char* acquire();
+
+  // Gives back a block returned by acquire()
+  void release(char* block);
+
+  size_t block_size() const { return block_size_; }
+
+  // Returns the current counters
+  Stats stats() const;
+
+  // disable copying and moving, blocks point into the pool's slabs
+  BufferPool(const BufferPool& other) = delete;
+  BufferPool& operator=(const BufferPool& other) = delete;
+  BufferPool(BufferPool&& other) = delete;
+  BufferPool& operator=(BufferPool&& other) = delete;
+
+ private:
+  size_t block_size_;
+  size_t blocks_per_slab_;
+
+  mutable pthread_mutex_t lock_;
+  std::vector<std::unique_ptr<char[]>> slabs_;
+  std::vector<char*> free_;
+  size_t in_use_;
+};
+
+// A ReadBuffer holds the bytes read from a connection that have not been
+// consumed yet. Reads go straight into the free space at its tail, and
+// bytes are consumed from its front by moving an offset, so nothing is
+// copied on the way in.
+//
+// The memory comes from process-wide BufferPools: a buffer starts with a
+// kSmallSize block the first time it is read into, moves to a kMaxSize
+// block if one request does not fit, and can give its block back
+// whenever it is empty, so idle connections hold no memory.
+class ReadBuffer {
+ public:
+  static constexpr size_t kSmallSize = 16 * 1024;
+  static constexpr size_t kMaxSize = 64 * 1024;
+
+  // Creates an empty buffer with no block
+  ReadBuffer() = default;
+
+  // gives the block back to its pool
+  ~ReadBuffer();
+
+  // The bytes buffered and not consumed yet
+  std::string_view data() const {
+    return std::string_view(block_ + start_, end_ - start_);
+  }
+  size_t size() const { return end_ - start_; }
+
+  // Returns true if the buffer holds kMaxSize bytes and cannot take more
+  bool full() const { return size() == kMaxSize; }
+
+  // Makes room to read more after the buffered bytes, taking a block,
+  // moving the buffered bytes to the front of it or moving to a bigger
+  // block as needed. This may move the buffered bytes, so views of them
+  // taken before are no longer valid.
+  //
+  // Returns:
+  //  - false if the buffer is full
+  bool reserve();
+
+  // The free space at the tail, valid after reserve() returned true
+  char* tail() { return block_ + end_; }
+  size_t room() const { return capacity_ - end_; }
+
+  // Adds bytes that were just written into the tail
+  void commit(size_t bytes) { end_ += bytes; }
+
+  // Drops bytes from the front. The bytes stay where they are until the
+  // next reserve(), so views of them remain valid until then.
+  void consume(size_t bytes);
+
+  // Gives the block back to its pool if nothing is buffered
+  void release_if_empty();
+
+  // Returns the counters of the small and large block pools
+  static BufferPool::Stats small_stats();
+  static BufferPool::Stats large_stats();
+
+  // allow moving, the block belongs to whichever buffer holds it last
+  ReadBuffer(ReadBuffer&& other) noexcept;
+  ReadBuffer& operator=(ReadBuffer&& other) = delete;
+  ReadBuffer(const ReadBuffer& other) = delete;
+  ReadBuffer& operator=(const ReadBuffer& other) = delete;
+
+ private:
+  // Gives the block back to the pool it came from
+  void release();
+
+  char* block_ = nullptr;
+  size_t capacity_ = 0;
+  size_t start_ = 0;
+  size_t end_ = 0;
+};
+
+}  // namespace searchserver
+
+#endif  // READ_BUFFER_HPP_
@@ -0,0 +1,495 @@
+#include "./RemoteShards.hpp"
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include "./HttpRequest.hpp"
+#include "./HttpUtils.hpp"
+#include "./ShardedIndex.hpp"
+
+namespace searchserver {
+
+using Clock = std::chrono::steady_clock;
+
+// The magic bytes every encoded page starts with
+static constexpr std::string_view kPageMagic = "SRP1";
+
+// How far a response from a backend has arrived
+enum class ResponseState {
+  // Part of the header or body is still to come
+  kIncomplete,
+
+  // The whole response is in the buffer
+  kComplete,
+
+  // The response is malformed or is not a 200 with a Content-length
+  kBad,
+};
+
+// A request in flight to one backend, which is sent once its connection
+// is made and then read until its answer is whole
+struct Call {
+  int fd = -1;
+  bool connecting = false;
+  string request;
+  size_t sent = 0;
+  string buffer;
+  size_t scanned = 0;
+  bool pending = false;
+  bool answered = false;
+  vector<Result> page;
+  size_t num_results = 0;
+};
+
+// Appends v to out as a variable-byte integer
+static void put_vbyte(uint64_t v, string* out);
+
+// Reads a variable-byte integer from the front of data, advancing it past
+// the integer. Returns false if it runs past the end.
+static bool get_vbyte(std::string_view* data, uint64_t* v);
+
+// Finds the end of the response at the front of buffer.
+//
+// Arguments:
+//  - buffer: what has been read from the backend so far
+//  - scanned: how much of buffer has been searched for the end of the
+//    header, as for find_header_end()
+//  - body: set to the response's body once it is kComplete
+//  - length: set to the length of the whole response once it is
+//    kComplete
+static ResponseState parse_response(const string& buffer, size_t* scanned,
+                                    std::string_view* body, size_t* length);
+
+// Returns true if a pooled connection still looks open: the backend has
+// neither closed it nor sent anything on it since its last answer
+static bool still_open(int fd);
+
+// Starts connecting to a backend with a non-blocking socket, like
+// connect_to_server() but without waiting for the connection to be made.
+//
+// Returns:
+//  - the socket, or -1 if the host could not be resolved or every one of
+//    its addresses refused at once. connecting is set if the connection
+//    is still being made, in which case the socket turns writable once
+//    it has been made or has failed.
+static int start_connect(const Backend& backend, bool* connecting);
+
+// Sends as much of a call's request as its connection takes, first
+// checking that the connection was made if it was still connecting.
+// Returns false if the connection failed.
+static bool send_request(Call* call);
+
+bool parse_backends(std::string_view list, vector<Backend>* backends) {
+  backends->clear();
+  bool more = true;
+  while (more) {
+    size_t comma = list.find(',');
+    std::string_view entry = list.substr(0, comma);
+    more = (comma != std::string_view::npos);
+    if (more) {
+      list.remove_prefix(comma + 1);
+    }
+
+    size_t colon = entry.rfind(':');
+    if (colon == std::string_view::npos || colon == 0) {
+      return false;
+    }
+    std::string_view host = entry.substr(0, colon);
+    std::string_view port = entry.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+      host = host.substr(1, host.size() - 2);
+    }
+    if (host.empty() || port.empty() || port.size() > 5 ||
+        port.find_first_not_of("0123456789") != std::string_view::npos) {
+      return false;
+    }
+    unsigned long port_num = std::strtoul(string(port).c_str(), nullptr, 10);
+    if (port_num == 0 || port_num > 65535) {
+      return false;
+    }
+    backends->push_back({string(host), static_cast<uint16_t>(port_num)});
+  }
+  return true;
+}
+
+string encode_results(const vector<Result>& results, size_t num_results) {
+  string out(kPageMagic);
+  put_vbyte(num_results, &out);
+  put_vbyte(results.size(), &out);
+  for (const Result& result : results) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &result.score, sizeof(bits));
+    for (int shift = 0; shift < 64; shift += 8) {
+      out += static_cast<char>((bits >> shift) & 0xFF);
+    }
+    put_vbyte(static_cast<uint32_t>(std::max(result.rank, 0)), &out);
+    put_vbyte(result.doc_name.size(), &out);
+    out += result.doc_name;
+  }
+  return out;
+}
+
+bool decode_results(std::string_view data, vector<Result>* results,
+                    size_t* num_results) {
+  if (data.substr(0, kPageMagic.size()) != kPageMagic) {
+    return false;
+  }
+  data.remove_prefix(kPageMagic.size());
+
+  uint64_t matches = 0;
+  uint64_t count = 0;
+  if (!get_vbyte(&data, &matches) || !get_vbyte(&data, &count)) {
+    return false;
+  }
+
+  // Every result takes at least 10 bytes, which bounds a corrupt count
+  // before anything is reserved for it
+  if (count > data.size() / 10) {
+    return false;
+  }
+  results->clear();
+  results->reserve(count);
+  for (uint64_t i = 0; i < count; i++) {
+    if (data.size() < 8) {
+      return false;
+    }
+    uint64_t bits = 0;
+    for (int b = 7; b >= 0; b--) {
+      bits = (bits << 8) | static_cast<unsigned char>(data[b]);
+    }
+    data.remove_prefix(8);
+
+    uint64_t rank = 0;
+    uint64_t length = 0;
+    if (!get_vbyte(&data, &rank) || !get_vbyte(&data, &length) ||
+        rank > INT32_MAX || length > data.size()) {
+      return false;
+    }
+    Result result;
+    result.doc_name = string(data.substr(0, length));
+    result.rank = static_cast<int>(rank);
+    std::memcpy(&result.score, &bits, sizeof(bits));
+    results->push_back(std::move(result));
+    data.remove_prefix(length);
+  }
+  *num_results = static_cast<size_t>(matches);
+  return data.empty();
+}
+
+RemoteShards::RemoteShards(vector<Backend> backends, int timeout_ms)
+    : backends_(std::move(backends)),
+      timeout_ms_(std::max(timeout_ms, 1)),
+      lock_(),
+      idle_(backends_.size()),
+      requests_(0),
+      timeouts_(0),
+      errors_(0),
+      connects_(0) {
+  pthread_mutex_init(&lock_, nullptr);
+}
+
+RemoteShards::~RemoteShards() {
+  for (vector<int>& idle : idle_) {
+    for (int fd : idle) {
+      close(fd);
+    }
+  }
+  pthread_mutex_destroy(&lock_);
+}
+
+vector<Result> RemoteShards::lookup(const string& target, size_t k,
+                                    size_t offset, size_t* num_results,
+                                    size_t* num_late, size_t* num_failed) {
+  Clock::time_point deadline =
+      Clock::now() + std::chrono::milliseconds(timeout_ms_);
+
+  // Start connecting to every backend that has no pooled connection, and
+  // send the requests as the connections become writable, so that the
+  // deadline bounds making the connections too
+  vector<Call> calls(backends_.size());
+  size_t pending = 0;
+  for (size_t i = 0; i < backends_.size(); i++) {
+    requests_.fetch_add(1, std::memory_order_relaxed);
+    Call& call = calls[i];
+    call.fd = acquire(i, &call.connecting);
+    if (call.fd == -1) {
+      errors_.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+    call.request = "GET " + target + " HTTP/1.1\r\n"
+                   "Host: " + backends_[i].host + "\r\n"
+                   "\r\n";
+    call.pending = true;
+    pending++;
+  }
+
+  // Send the requests and read the answers as the backends get to them
+  vector<struct pollfd> fds;
+  vector<size_t> owners;
+  while (pending > 0) {
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Clock::now());
+    if (wait.count() <= 0) {
+      break;
+    }
+    fds.clear();
+    owners.clear();
+    for (size_t i = 0; i < calls.size(); i++) {
+      if (calls[i].pending) {
+        bool sending = (calls[i].sent < calls[i].request.size());
+        fds.push_back({calls[i].fd, static_cast<short>(sending ? POLLOUT
+                                                               : POLLIN),
+                       0});
+        owners.push_back(i);
+      }
+    }
+    int ready = poll(fds.data(), fds.size(), static_cast<int>(wait.count()));
+    if (ready == -1 && errno != EINTR) {
+      break;
+    }
+
+    for (size_t j = 0; j < fds.size() && ready > 0; j++) {
+      if (fds[j].revents == 0) {
+        continue;
+      }
+      Call& call = calls[owners[j]];
+      std::string_view body;
+      size_t length = 0;
+      ResponseState state = ResponseState::kBad;
+      if (call.sent < call.request.size()) {
+        bool was_connecting = call.connecting;
+        if (send_request(&call)) {
+          if (was_connecting) {
+            connects_.fetch_add(1, std::memory_order_relaxed);
+          }
+          continue;
+        }
+      } else if (wrapped_read(call.fd, &call.buffer) > 0) {
+        state = parse_response(call.buffer, &call.scanned, &body, &length);
+      }
+      if (state == ResponseState::kIncomplete) {
+        continue;
+      }
+      call.pending = false;
+      pending--;
+      if (state == ResponseState::kComplete &&
+          decode_results(body, &call.page, &call.num_results)) {
+        call.answered = true;
+        // A backend answers one request at a time, so anything after the
+        // answer means the connection is out of step
+        if (length == call.buffer.size()) {
+          release(owners[j], call.fd);
+        } else {
+          close(call.fd);
+        }
+      } else {
+        close(call.fd);
+        errors_.fetch_add(1, std::memory_order_relaxed);
+      }
+      call.fd = -1;
+    }
+  }
+
+  // Whatever has not answered by now, or not even connected, is left out,
+  // and its connection is closed so that a late answer is never read
+  vector<vector<Result>> pages;
+  *num_results = 0;
+  *num_late = 0;
+  *num_failed = 0;
+  for (Call& call : calls) {
+    if (call.pending) {
+      close(call.fd);
+      timeouts_.fetch_add(1, std::memory_order_relaxed);
+      (*num_late)++;
+      continue;
+    }
+    if (!call.answered) {
+      (*num_failed)++;
+      continue;
+    }
+    *num_results += call.num_results;
+    pages.push_back(std::move(call.page));
+  }
+  return ShardedIndex::merge_pages(&pages, k, offset);
+}
+
+RemoteShards::Stats RemoteShards::stats() const {
+  Stats stats;
+  stats.requests = requests_.load(std::memory_order_relaxed);
+  stats.timeouts = timeouts_.load(std::memory_order_relaxed);
+  stats.errors = errors_.load(std::memory_order_relaxed);
+  stats.connects = connects_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+int RemoteShards::acquire(size_t backend, bool* connecting) {
+  *connecting = false;
+  pthread_mutex_lock(&lock_);
+  while (!idle_[backend].empty()) {
+    int fd = idle_[backend].back();
+    idle_[backend].pop_back();
+    pthread_mutex_unlock(&lock_);
+    if (still_open(fd)) {
+      return fd;
+    }
+    close(fd);
+    pthread_mutex_lock(&lock_);
+  }
+  pthread_mutex_unlock(&lock_);
+
+  int fd = start_connect(backends_[backend], connecting);
+  if (fd != -1 && !*connecting) {
+    connects_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return fd;
+}
+
+void RemoteShards::release(size_t backend, int fd) {
+  pthread_mutex_lock(&lock_);
+  idle_[backend].push_back(fd);
+  pthread_mutex_unlock(&lock_);
+}
+
+static void put_vbyte(uint64_t v, string* out) {
+  while (v >= 0x80) {
+    out->push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out->push_back(static_cast<char>(v));
+}
+
+static bool get_vbyte(std::string_view* data, uint64_t* v) {
+  uint64_t result = 0;
+  for (uint32_t shift = 0; shift < 64 && !data->empty(); shift += 7) {
+    auto byte = static_cast<unsigned char>(data->front());
+    data->remove_prefix(1);
+    result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      *v = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+static ResponseState parse_response(const string& buffer, size_t* scanned,
+                                    std::string_view* body, size_t* length) {
+  size_t header_len = find_header_end(buffer, scanned);
+  if (header_len == 0) {
+    return ResponseState::kIncomplete;
+  }
+
+  // The status line is "HTTP/1.1 <status> <reason>"
+  std::string_view header(buffer.data(), header_len);
+  size_t space = header.find(' ');
+  if (space == std::string_view::npos ||
+      header.substr(space + 1, 4) != "200 ") {
+    return ResponseState::kBad;
+  }
+
+  bool found = false;
+  size_t body_len = 0;
+  size_t pos = header.find("\r\n") + 2;
+  while (pos < header.size()) {
+    size_t eol = header.find("\r\n", pos);
+    std::string_view line = header.substr(pos, eol - pos);
+    pos = eol + 2;
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    string name(line.substr(0, colon));
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (name == "content-length") {
+      body_len = std::strtoul(string(line.substr(colon + 1)).c_str(),
+                              nullptr, 10);
+      found = true;
+    }
+  }
+  if (!found) {
+    return ResponseState::kBad;
+  }
+  if (buffer.size() < header_len + body_len) {
+    return ResponseState::kIncomplete;
+  }
+  *body = std::string_view(buffer).substr(header_len, body_len);
+  *length = header_len + body_len;
+  return ResponseState::kComplete;
+}
+
+static bool still_open(int fd) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  return poll(&pfd, 1, 0) == 0;
+}
+
+static int start_connect(const Backend& backend, bool* connecting) {
+  struct addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* results = nullptr;
+  string port = std::to_string(backend.port);
+  if (getaddrinfo(backend.host.c_str(), port.c_str(), &hints, &results) != 0) {
+    return -1;
+  }
+
+  // An address that refuses at once, as a local one with nothing
+  // listening does, is skipped for the next; one that is slow to answer
+  // is waited on until the deadline
+  int fd = -1;
+  for (struct addrinfo* r = results; r != nullptr; r = r->ai_next) {
+    fd = socket(r->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+      continue;
+    }
+    if (connect(fd, r->ai_addr, r->ai_addrlen) == 0) {
+      *connecting = false;
+      break;
+    }
+    if (errno == EINPROGRESS) {
+      *connecting = true;
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(results);
+  return fd;
+}
+
+static bool send_request(Call* call) {
+  if (call->connecting) {
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(call->fd, SOL_SOCKET, SO_ERROR, &error, &len) == -1 ||
+        error != 0) {
+      return false;
+    }
+    call->connecting = false;
+  }
+
+  while (call->sent < call->request.size()) {
+    ssize_t res = send(call->fd, call->request.data() + call->sent,
+                       call->request.size() - call->sent, MSG_NOSIGNAL);
+    if (res == -1 && errno == EINTR) {
+      continue;
+    }
+    if (res == -1) {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    call->sent += static_cast<size_t>(res);
+  }
+  return true;
+}
+
+}  // namespace searchserver
@@ -0,0 +1,143 @@
+#ifndef REMOTE_SHARDS_HPP_
+#define REMOTE_SHARDS_HPP_
+
+#include <pthread.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./Result.hpp"
+
+using std::string;
+using std::vector;
+
+namespace searchserver {
+
+// A searchserver that serves one partition of the documents
+struct Backend {
+  string host;
+  uint16_t port;
+};
+
+// Parses a comma separated list of backends, such as
+// "localhost:9001,10.0.0.2:9001,[::1]:9002".
+//
+// Returns:
+//  - false if the list is empty or any entry has no host or valid port
+bool parse_backends(std::string_view list, vector<Backend>* backends);
+
+// Encodes a page of results in the compact binary form that a backend
+// answers /shard/query with: the magic bytes "SRP1", the number of
+// matches and of results as variable-byte integers, then for each result
+// its score as the 8 little-endian bytes of an IEEE double, its rank as
+// a variable-byte integer, and its document name prefixed by its length.
+string encode_results(const vector<Result>& results, size_t num_results);
+
+// Decodes a page written by encode_results().
+//
+// Returns:
+//  - false if data is truncated or not such a page
+bool decode_results(std::string_view data, vector<Result>* results,
+                    size_t* num_results);
+
+// RemoteShards searches an index whose documents are partitioned between
+// several backend searchservers, as a coordinator that holds no documents
+// of its own.
+//
+// A lookup sends the same /shard/query request to every backend at once
+// and waits for their answers with poll() until a deadline, then merges
+// the pages that arrived in time. Backends that answer late, close the
+// connection or send something that is not a page are left out, so a
+// slow or failed backend costs the results it holds rather than the
+// whole query.
+//
+// Connections are kept alive and pooled per backend between lookups. A
+// pooled connection that the backend has closed meanwhile is noticed
+// before it is reused, and one that timed out is closed, since its late
+// answer would otherwise be read as the answer to the next request.
+// New connections are made without blocking and waited on with the same
+// poll(), so a backend that cannot be connected to before the deadline
+// is left out like one that answers late. Only resolving a backend's
+// host name happens outside the deadline.
+class RemoteShards {
+ public:
+  // The time to wait for the backends, unless the server is started with
+  // --backend-timeout-ms
+  static constexpr int kDefaultTimeoutMs = 500;
+
+  // Counters summed over every backend
+  struct Stats {
+    uint64_t requests = 0;
+    uint64_t timeouts = 0;
+    uint64_t errors = 0;
+    uint64_t connects = 0;
+  };
+
+  // Arguments:
+  //  - backends: the servers that hold the partitions of the index
+  //  - timeout_ms: how long a lookup waits for the backends to answer
+  RemoteShards(vector<Backend> backends, int timeout_ms);
+
+  // Closes every pooled connection
+  ~RemoteShards();
+
+  // Returns the number of backends
+  size_t num_backends() const { return backends_.size(); }
+
+  // Looks up a query on every backend and merges their results.
+  //
+  // Arguments:
+  //  - target: the /shard/query request target to send, which asks each
+  //    backend for its best offset + k results
+  //  - k: the maximum number of results to return
+  //  - offset: the number of best results to skip
+  //  - num_results: set to the number of matches in the backends that
+  //    answered
+  //  - num_late: set to the number of backends that did not answer in
+  //    time, whose results are missing from the page
+  //  - num_failed: set to the number of backends whose results are
+  //    missing because they could not be connected to, closed the
+  //    connection or sent something that is not a page
+  //
+  // Returns:
+  //  - the merged page, best first, with ties in the order of the
+  //    backends
+  vector<Result> lookup(const string& target, size_t k, size_t offset,
+                        size_t* num_results, size_t* num_late,
+                        size_t* num_failed);
+
+  // Returns the counters of the lookups so far
+  Stats stats() const;
+
+  RemoteShards(const RemoteShards& other) = delete;
+  RemoteShards& operator=(const RemoteShards& other) = delete;
+
+ private:
+  // Returns a non-blocking connection to a backend, pooled or new, or -1
+  // if it cannot be connected to. connecting is set if a new connection
+  // is still being made.
+  int acquire(size_t backend, bool* connecting);
+
+  // Returns a connection with nothing left to read to the pool
+  void release(size_t backend, int fd);
+
+  vector<Backend> backends_;
+  int timeout_ms_;
+
+  // The idle connections to each backend, guarded by lock_
+  pthread_mutex_t lock_;
+  vector<vector<int>> idle_;
+
+  std::atomic<uint64_t> requests_;
+  std::atomic<uint64_t> timeouts_;
+  std::atomic<uint64_t> errors_;
+  std::atomic<uint64_t> connects_;
+};
+
+}  // namespace searchserver
+
+#endif  // REMOTE_SHARDS_HPP_
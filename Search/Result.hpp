@@ -0,0 +1,31 @@
+#ifndef RESULT_HPP_
+#define RESULT_HPP_
+
+#include <string>
+
+namespace searchserver {
+
+// A single search result: a document that matched a query, and how well
+// it matched.
+struct Result {
+  // The name of the matching document
+  std::string doc_name;
+
+  // The total number of occurances of the query words in the document
+  int rank;
+
+  // The relevance score the results were ordered by. Depending on the
+  // ranking used for the lookup this is either the same as rank or a
+  // BM25 score.
+  double score = 0.0;
+
+  // Two results are the same if they name the same document with the same
+  // rank, regardless of which ranking function scored them
+  bool operator==(const Result& other) const {
+    return doc_name == other.doc_name && rank == other.rank;
+  }
+};
+
+}  // namespace searchserver
+
+#endif  // RESULT_HPP_
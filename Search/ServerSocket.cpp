@@ -13,7 +13,8 @@
 #include <netdb.h>       // for getaddrinfo()
 #include <sys/socket.h>  // for socket(), getaddrinfo(), etc.
 #include <sys/types.h>   // for socket(), getaddrinfo(), etc.
-#include <unistd.h>      // for close(), fcntl()
+#include <fcntl.h>       // for fcntl()
+#include <unistd.h>      // for close()
 #include <cerrno>        // for errno, used by strerror()
 #include <cstring>       // for memset, strerror()
 #include <iostream>      // for std::cerr, etc.
@@ -108,6 +109,12 @@ ServerSocket::~ServerSocket() {
   listen_sock_fd_ = -1;
 }
 
+bool ServerSocket::set_nonblocking() {
+  int flags = fcntl(listen_sock_fd_, F_GETFL, 0);
+  return flags != -1 &&
+         fcntl(listen_sock_fd_, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
 optional<HttpSocket> ServerSocket::accept_client() const {
   // TODO accept the next client connection and return it as an HttpSocket
   // object nullopt on error
@@ -0,0 +1,71 @@
+/*
+ * Copyright ©2025 Travis McGaha.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Pennsylvania
+ * CIT 5950 for use solely during Spring Semester 2025 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef SERVERSOCKET_HPP_
+#define SERVERSOCKET_HPP_
+
+#include <sys/socket.h>  // for sa_family_t
+
+#include <cstdint>   // for uint16_t
+#include <optional>  // for std::optional
+#include <string>    // for std::string
+
+#include "./HttpSocket.hpp"
+
+namespace searchserver {
+
+// A ServerSocket is a socket listening for clients on a port. Each client
+// that connects is accepted as an HttpSocket.
+class ServerSocket {
+ public:
+  // Creates a socket listening on the given address and port.
+  //
+  // Arguments:
+  //  - family: AF_INET or AF_INET6
+  //  - address: the address to listen on, or "" for any address
+  //  - port: the port to listen on
+  //
+  // Throws a std::runtime_error if the socket could not be set up, or a
+  // std::invalid_argument if the family is not supported.
+  ServerSocket(sa_family_t family, const std::string& address, uint16_t port);
+
+  // Closes the listening socket
+  ~ServerSocket();
+
+  // Accepts the next client to connect.
+  //
+  // Returns:
+  //  - the client's connection, or nullopt on error. On a non-blocking
+  //    socket, nullopt also means that no client is waiting.
+  std::optional<HttpSocket> accept_client() const;
+
+  // Puts the listening socket in non-blocking mode, so that an event loop
+  // can accept clients as they arrive.
+  //
+  // Returns:
+  //  - false if the mode could not be changed
+  bool set_nonblocking();
+
+  // Returns the listening socket's file descriptor
+  int fd() const { return listen_sock_fd_; }
+
+  // disable copying, the socket belongs to one object
+  ServerSocket(const ServerSocket& other) = delete;
+  ServerSocket& operator=(const ServerSocket& other) = delete;
+
+ private:
+  uint16_t port_;
+  int listen_sock_fd_;
+};
+
+}  // namespace searchserver
+
+#endif  // SERVERSOCKET_HPP_
@@ -0,0 +1,311 @@
+#include "./ShardedIndex.hpp"
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+namespace searchserver {
+
+// Counts down the shards being searched on the query threads, so that the
+// calling thread can wait for the last of them
+class Latch {
+ public:
+  explicit Latch(size_t count) : count_(count), lock_(), done_() {
+    pthread_mutex_init(&lock_, nullptr);
+    pthread_cond_init(&done_, nullptr);
+  }
+
+  ~Latch() {
+    pthread_cond_destroy(&done_);
+    pthread_mutex_destroy(&lock_);
+  }
+
+  void count_down() {
+    pthread_mutex_lock(&lock_);
+    if (--count_ == 0) {
+      pthread_cond_signal(&done_);
+    }
+    pthread_mutex_unlock(&lock_);
+  }
+
+  void wait() {
+    pthread_mutex_lock(&lock_);
+    while (count_ > 0) {
+      pthread_cond_wait(&done_, &lock_);
+    }
+    pthread_mutex_unlock(&lock_);
+  }
+
+  Latch(const Latch& other) = delete;
+  Latch& operator=(const Latch& other) = delete;
+
+ private:
+  size_t count_;
+  pthread_mutex_t lock_;
+  pthread_cond_t done_;
+};
+
+// Returns offset + k, the number of results a page ends after, or
+// SIZE_MAX if that overflows
+static size_t page_end(size_t offset, size_t k);
+
+// Merges pages that are each ordered best first by score, with ties in
+// the order of the pages, calling take(page, i) for the i-th item of a
+// page for each item that lands from offset to offset + k
+template <typename Item, typename Take>
+static void merge_sorted(const vector<vector<Item>>& pages, size_t k,
+                         size_t offset, Take take);
+
+ShardedIndex::ShardedIndex(WordIndex index) : shards_(), pool_(nullptr) {
+  shards_.push_back(std::move(index));
+}
+
+ShardedIndex::ShardedIndex(vector<WordIndex> shards, ThreadPool* pool)
+    : shards_(std::move(shards)), pool_(pool) {}
+
+size_t ShardedIndex::shard_of(std::string_view doc_name, size_t num_shards) {
+  // FNV-1a, which unlike std::hash is the same in every build, so a
+  // document stays in its shard from one run to the next
+  uint64_t hash = 14695981039346656037ULL;
+  for (char c : doc_name) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ULL;
+  }
+  return static_cast<size_t>(hash % num_shards);
+}
+
+size_t ShardedIndex::num_docs() {
+  size_t total = 0;
+  for (WordIndex& shard : shards_) {
+    total += shard.num_docs();
+  }
+  return total;
+}
+
+bool ShardedIndex::has_positions() const {
+  return shards_[0].has_positions();
+}
+
+void ShardedIndex::finalize() {
+  for (WordIndex& shard : shards_) {
+    shard.finalize();
+  }
+}
+
+uint64_t ShardedIndex::generation() {
+  // Every finalize takes a generation larger than any taken before, so
+  // the largest of the shards changes whenever any of them does
+  uint64_t generation = 0;
+  for (WordIndex& shard : shards_) {
+    generation = std::max(generation, shard.generation());
+  }
+  return generation;
+}
+
+void ShardedIndex::update_document(const string& doc_name,
+                                   const vector<string>& words) {
+  shards_[shard_of(doc_name, shards_.size())].update_document(doc_name, words);
+}
+
+void ShardedIndex::remove_document(const string& doc_name) {
+  shards_[shard_of(doc_name, shards_.size())].remove_document(doc_name);
+}
+
+vector<Result> ShardedIndex::lookup_query(const vector<string>& query,
+                                          size_t k, size_t offset,
+                                          size_t* num_matches,
+                                          Ranking ranking) {
+  if (shards_.size() == 1) {
+    return shards_[0].lookup_query(query, k, offset, num_matches, ranking);
+  }
+  vector<vector<Hit>> pages(shards_.size());
+  vector<size_t> matches(shards_.size(), 0);
+  vector<size_t> postings;
+  bool parallel = worth_fanning_out(query, &postings);
+  for_each_shard(parallel, postings, [&](size_t i) {
+    pages[i] = shards_[i].top_query(query, page_end(offset, k), &matches[i],
+                                    ranking);
+  });
+  if (num_matches != nullptr) {
+    *num_matches = 0;
+    for (size_t count : matches) {
+      *num_matches += count;
+    }
+  }
+  return name_page(pages, k, offset);
+}
+
+vector<Result> ShardedIndex::lookup_any(const vector<string>& query,
+                                        size_t k, size_t offset,
+                                        Ranking ranking, size_t* num_scored) {
+  if (shards_.size() == 1) {
+    return shards_[0].lookup_any(query, k, offset, ranking, num_scored);
+  }
+  vector<vector<Hit>> pages(shards_.size());
+  vector<size_t> scored(shards_.size(), 0);
+  vector<size_t> postings;
+  bool parallel = worth_fanning_out(query, &postings);
+  for_each_shard(parallel, postings, [&](size_t i) {
+    pages[i] = shards_[i].top_any(query, page_end(offset, k), ranking,
+                                  &scored[i]);
+  });
+  if (num_scored != nullptr) {
+    *num_scored = 0;
+    for (size_t count : scored) {
+      *num_scored += count;
+    }
+  }
+  return name_page(pages, k, offset);
+}
+
+vector<Result> ShardedIndex::lookup_phrases(const PhraseQuery& query,
+                                            size_t k, size_t offset,
+                                            size_t* num_matches,
+                                            Ranking ranking) {
+  if (shards_.size() == 1) {
+    return shards_[0].lookup_phrases(query, k, offset, num_matches, ranking);
+  }
+  vector<vector<Hit>> pages(shards_.size());
+  vector<size_t> matches(shards_.size(), 0);
+  vector<size_t> postings;
+  bool parallel = worth_fanning_out(query.words, &postings);
+  for_each_shard(parallel, postings, [&](size_t i) {
+    pages[i] = shards_[i].top_phrases(query, page_end(offset, k),
+                                      &matches[i], ranking);
+  });
+  if (num_matches != nullptr) {
+    *num_matches = 0;
+    for (size_t count : matches) {
+      *num_matches += count;
+    }
+  }
+  return name_page(pages, k, offset);
+}
+
+vector<Suggestion> ShardedIndex::suggest(std::string_view prefix, size_t k) {
+  if (shards_.size() == 1) {
+    return shards_[0].suggest(prefix, k);
+  }
+
+  // Ask each shard for a few more words than are needed, so that a word
+  // just short of the top k in one shard can still make it overall
+  size_t per_shard = k + k / 2 + 10;
+  std::unordered_map<string, size_t> num_docs;
+  for (WordIndex& shard : shards_) {
+    for (Suggestion& suggestion : shard.suggest(prefix, per_shard)) {
+      num_docs[std::move(suggestion.word)] += suggestion.num_docs;
+    }
+  }
+  vector<Suggestion> best;
+  for (auto& [word, docs] : num_docs) {
+    best.push_back({word, docs});
+  }
+  auto more_docs = [](const Suggestion& a, const Suggestion& b) {
+    return a.num_docs > b.num_docs ||
+           (a.num_docs == b.num_docs && a.word < b.word);
+  };
+  size_t keep = std::min(best.size(), k);
+  std::partial_sort(best.begin(), best.begin() + keep, best.end(), more_docs);
+  best.resize(keep);
+  return best;
+}
+
+template <typename Lookup>
+void ShardedIndex::for_each_shard(bool parallel,
+                                  const vector<size_t>& postings,
+                                  const Lookup& lookup) {
+  // A shard with none of the words has nothing to find, which for a
+  // query of rare words is most of them
+  vector<size_t> searched;
+  for (size_t i = 0; i < shards_.size(); i++) {
+    if (postings[i] > 0) {
+      searched.push_back(i);
+    }
+  }
+  if (!parallel || pool_ == nullptr || searched.size() < 2) {
+    for (size_t i : searched) {
+      lookup(i);
+    }
+    return;
+  }
+
+  // The calling thread searches the first shard rather than wait idle
+  Latch latch(searched.size() - 1);
+  for (size_t j = 1; j < searched.size(); j++) {
+    pool_->dispatch([&lookup, &latch, i = searched[j]]() {
+      lookup(i);
+      latch.count_down();
+    });
+  }
+  lookup(searched[0]);
+  latch.wait();
+}
+
+bool ShardedIndex::worth_fanning_out(const vector<string>& words,
+                                     vector<size_t>* postings) {
+  postings->clear();
+  size_t total = 0;
+  for (WordIndex& shard : shards_) {
+    postings->push_back(shard.num_postings(words));
+    total += std::min(postings->back(), kMinParallelPostings);
+  }
+  return pool_ != nullptr && total >= kMinParallelPostings;
+}
+
+vector<Result> ShardedIndex::merge_pages(vector<vector<Result>>* pages,
+                                         size_t k, size_t offset) {
+  vector<Result> merged;
+  merge_sorted(*pages, k, offset, [&merged, pages](size_t page, size_t i) {
+    merged.push_back(std::move((*pages)[page][i]));
+  });
+  return merged;
+}
+
+vector<Result> ShardedIndex::name_page(const vector<vector<Hit>>& pages,
+                                       size_t k, size_t offset) {
+  vector<Result> results;
+  merge_sorted(pages, k, offset, [&](size_t shard, size_t i) {
+    const Hit& hit = pages[shard][i];
+    Result r;
+    r.doc_name = shards_[shard].doc_name(hit.doc);
+    r.rank = hit.rank;
+    r.score = hit.score;
+    results.push_back(std::move(r));
+  });
+  return results;
+}
+
+static size_t page_end(size_t offset, size_t k) {
+  return (offset > SIZE_MAX - k) ? SIZE_MAX : offset + k;
+}
+
+template <typename Item, typename Take>
+static void merge_sorted(const vector<vector<Item>>& pages, size_t k,
+                         size_t offset, Take take) {
+  // Take the best of the pages' next items over and over, the earliest
+  // page's on ties, which orders them like a stable sort of all of them
+  // would without touching the items past the end of the page
+  vector<size_t> next(pages.size(), 0);
+  size_t end = page_end(offset, k);
+  for (size_t taken = 0; taken < end; taken++) {
+    size_t best = pages.size();
+    for (size_t i = 0; i < pages.size(); i++) {
+      if (next[i] < pages[i].size() &&
+          (best == pages.size() ||
+           pages[i][next[i]].score > pages[best][next[best]].score)) {
+        best = i;
+      }
+    }
+    if (best == pages.size()) {
+      return;
+    }
+    if (taken >= offset) {
+      take(best, next[best]);
+    }
+    next[best]++;
+  }
+}
+
+}  // namespace searchserver
@@ -0,0 +1,135 @@
+#ifndef SHARDED_INDEX_HPP_
+#define SHARDED_INDEX_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./PhraseQuery.hpp"
+#include "./Result.hpp"
+#include "./ThreadPool.hpp"
+#include "./WordIndex.hpp"
+
+namespace searchserver {
+
+// A ShardedIndex splits the documents of a search index between several
+// WordIndexes, the shards, so that one query can be searched on several
+// cores at once. Each document belongs to the shard shard_of() picks
+// from its name, which is also where updates to it go.
+//
+// A lookup runs on every shard that has any of the query's words: the
+// first on the calling thread and the rest on a query thread pool, then
+// the pages of the shards are merged. Queries whose posting lists are
+// too short to be worth the fan-out are searched one shard after another
+// on the calling thread.
+//
+// Each shard ranks with BM25 statistics of its own documents, so scores
+// can differ slightly from those of a single index over every document.
+// Documents are spread evenly by the hash of their names, which keeps
+// the statistics of the shards close to each other.
+class ShardedIndex {
+ public:
+  // The total length of the posting lists of a query's words below which
+  // a lookup is searched on the calling thread
+  static constexpr size_t kMinParallelPostings = 16384;
+
+  // Serves a single index, on the calling thread
+  explicit ShardedIndex(WordIndex index);
+
+  // Serves a set of shards.
+  //
+  // Arguments:
+  //  - shards: the shards, where every document is in the one that
+  //    shard_of() picks for it
+  //  - pool: the threads to search the shards on, which has to outlive
+  //    the index and its copies, or null to search them on the calling
+  //    thread
+  ShardedIndex(vector<WordIndex> shards, ThreadPool* pool);
+
+  // Returns the shard out of num_shards that a document belongs to. The
+  // same name always maps to the same shard.
+  static size_t shard_of(std::string_view doc_name, size_t num_shards);
+
+  // Merges the pages several shards found into one: the best offset + k
+  // results of all of them, ordered by score with ties in the order of
+  // the shards, without the first offset.
+  //
+  // Arguments:
+  //  - pages: the best offset + k results of each shard, best first,
+  //    which are moved from
+  //  - k: the maximum number of results to return
+  //  - offset: the number of best results to skip
+  static vector<Result> merge_pages(vector<vector<Result>>* pages, size_t k,
+                                    size_t offset);
+
+  // Returns the number of shards
+  size_t num_shards() const { return shards_.size(); }
+
+  // Returns the number of documents in all of the shards
+  size_t num_docs();
+
+  // Returns true if the shards record the position of every word
+  bool has_positions() const;
+
+  // Finalizes every shard, see WordIndex::finalize()
+  void finalize();
+
+  // Returns a number that identifies the current contents of every
+  // shard, see WordIndex::generation(). It changes whenever any shard is
+  // finalized.
+  uint64_t generation();
+
+  // Replaces or removes a document in the shard it belongs to, see
+  // WordIndex::update_document() and WordIndex::remove_document()
+  void update_document(const string& doc_name, const vector<string>& words);
+  void remove_document(const string& doc_name);
+
+  // The lookups of WordIndex, run on every shard. Each shard finds its
+  // best offset + k documents, and these are merged by score, with ties
+  // in the order of the shards, so pages never overlap. Only the
+  // documents on the page returned are named.
+  vector<Result> lookup_query(const vector<string>& query, size_t k,
+                              size_t offset, size_t* num_matches = nullptr,
+                              Ranking ranking = Ranking::kBM25);
+  vector<Result> lookup_any(const vector<string>& query, size_t k,
+                            size_t offset, Ranking ranking = Ranking::kBM25,
+                            size_t* num_scored = nullptr);
+  vector<Result> lookup_phrases(const PhraseQuery& query, size_t k,
+                                size_t offset, size_t* num_matches = nullptr,
+                                Ranking ranking = Ranking::kBM25);
+
+  // Finds the words that start with a prefix in the most documents of
+  // all the shards, see WordIndex::suggest(). Each shard only offers the
+  // words in the most of its own documents, so a word that is common
+  // overall but never among the most common of any one shard can be
+  // missed.
+  vector<Suggestion> suggest(std::string_view prefix, size_t k);
+
+ private:
+  // Calls lookup(shard) for the number of every shard that has any
+  // postings of the query's words, on the query threads if parallel is
+  // true and there is a pool, and returns once every call has
+  template <typename Lookup>
+  void for_each_shard(bool parallel, const vector<size_t>& postings,
+                      const Lookup& lookup);
+
+  // Returns true if a query with these words is worth searching on
+  // several threads, and sets (*postings)[i] to the total length of
+  // their posting lists in shard i, see WordIndex::num_postings()
+  bool worth_fanning_out(const vector<string>& words,
+                         vector<size_t>* postings);
+
+  // Merges the best hits each shard found into one page of results like
+  // merge_pages(), naming only the documents on the page
+  vector<Result> name_page(const vector<vector<Hit>>& pages, size_t k,
+                           size_t offset);
+
+  vector<WordIndex> shards_;
+  ThreadPool* pool_;
+};
+
+}  // namespace searchserver
+
+#endif  // SHARDED_INDEX_HPP_
@@ -0,0 +1,244 @@
+#include "./TermDictionary.hpp"
+
+#include <algorithm>
+
+namespace searchserver {
+
+// Appends v to out as a variable-byte integer
+static void put_vbyte(uint32_t v, vector<uint8_t>* out);
+
+// Reads a variable-byte integer from in, which ends at end.
+//
+// Returns:
+//  - a pointer just past the integer, or null if it runs past the end
+static const uint8_t* get_vbyte(const uint8_t* in, const uint8_t* end,
+                                uint32_t* v);
+
+// Returns the first term of a block, read in place, or an empty view with
+// a null data pointer if the block is corrupt
+static std::string_view first_term(const TermDictionaryView& dict,
+                                   size_t block);
+
+// Returns the number of the last block from lo up to hi whose first term
+// is not greater than term, or num_blocks if every block from lo starts
+// after it
+static size_t find_block(const TermDictionaryView& dict,
+                         std::string_view term, size_t lo, size_t hi);
+
+// Returns the number of the first term of a block that is not less than
+// term, or the first term of the next block if there is none, and sets
+// found to whether it equals term
+static size_t search_block(const TermDictionaryView& dict, size_t block,
+                           std::string_view term, bool* found);
+
+void TermDictionary::build(const vector<std::string_view>& terms) {
+  data.clear();
+  blocks.clear();
+  size = terms.size();
+
+  std::string_view prev;
+  for (size_t i = 0; i < terms.size(); i++) {
+    std::string_view term = terms[i];
+    if (i % kTermBlockSize == 0) {
+      blocks.push_back(static_cast<uint32_t>(data.size()));
+      put_vbyte(static_cast<uint32_t>(term.size()), &data);
+      data.insert(data.end(), term.begin(), term.end());
+    } else {
+      size_t shared = 0;
+      size_t most = std::min(prev.size(), term.size());
+      while (shared < most && prev[shared] == term[shared]) {
+        shared++;
+      }
+      put_vbyte(static_cast<uint32_t>(shared), &data);
+      put_vbyte(static_cast<uint32_t>(term.size() - shared), &data);
+      data.insert(data.end(), term.begin() + shared, term.end());
+    }
+    prev = term;
+  }
+  data.shrink_to_fit();
+  blocks.shrink_to_fit();
+}
+
+TermDictionaryView TermDictionary::view() const {
+  TermDictionaryView dict;
+  dict.data = data.data();
+  dict.num_bytes = data.size();
+  dict.blocks = blocks.data();
+  dict.num_blocks = blocks.size();
+  dict.size = size;
+  return dict;
+}
+
+size_t TermDictionaryView::find(std::string_view term) const {
+  size_t block = find_block(*this, term, 0, num_blocks);
+  if (block == num_blocks) {
+    return size;
+  }
+  bool found = false;
+  size_t i = search_block(*this, block, term, &found);
+  return found ? i : size;
+}
+
+size_t TermDictionaryView::lower_bound(std::string_view term) const {
+  size_t block = find_block(*this, term, 0, num_blocks);
+  if (block == num_blocks) {
+    return 0;
+  }
+  bool found = false;
+  return search_block(*this, block, term, &found);
+}
+
+TermCursor::TermCursor(const TermDictionaryView& dict, size_t first)
+    : dict_(dict), index_(first) {
+  if (done()) {
+    return;
+  }
+
+  // Decode the block's terms up to the one asked for
+  start_block(first / kTermBlockSize);
+  while (!done() && index_ < first) {
+    next();
+  }
+}
+
+void TermCursor::next() {
+  if (done()) {
+    return;
+  }
+  index_++;
+  if (done()) {
+    return;
+  }
+  if (index_ % kTermBlockSize != 0) {
+    decode(false);
+    return;
+  }
+
+  // Blocks are read from where their start says, so that a corrupt one
+  // cannot throw off the blocks after it
+  start_block(index_ / kTermBlockSize);
+}
+
+void TermCursor::seek(std::string_view term) {
+  if (done() || term_ >= term) {
+    return;
+  }
+
+  // Find the last block that starts at or before term. The current block
+  // does, so only the blocks after it are searched.
+  size_t block = index_ / kTermBlockSize;
+  size_t lo = block;
+  size_t hi = block + 1;
+  for (size_t step = 1; hi < dict_.num_blocks && first_term(dict_, hi) <= term;
+       step *= 2) {
+    lo = hi;
+    hi = std::min(lo + step, dict_.num_blocks);
+  }
+  if (lo != block) {
+    start_block(find_block(dict_, term, lo, hi));
+  }
+  while (!done() && term_ < term) {
+    next();
+  }
+}
+
+void TermCursor::start_block(size_t block) {
+  if (block >= dict_.num_blocks || dict_.blocks[block] >= dict_.num_bytes) {
+    index_ = dict_.size;
+    return;
+  }
+  index_ = block * kTermBlockSize;
+  pos_ = dict_.data + dict_.blocks[block];
+  decode(true);
+}
+
+void TermCursor::decode(bool first) {
+  const uint8_t* end = dict_.data + dict_.num_bytes;
+  uint32_t shared = 0;
+  uint32_t length = 0;
+  const uint8_t* in = pos_;
+  if (!first) {
+    in = get_vbyte(in, end, &shared);
+  }
+  if (in != nullptr) {
+    in = get_vbyte(in, end, &length);
+  }
+  if (in == nullptr || shared > term_.size() ||
+      length > static_cast<size_t>(end - in)) {
+    index_ = dict_.size;
+    return;
+  }
+  term_.resize(shared);
+  term_.append(reinterpret_cast<const char*>(in), length);
+  pos_ = in + length;
+}
+
+static std::string_view first_term(const TermDictionaryView& dict,
+                                   size_t block) {
+  if (dict.blocks[block] >= dict.num_bytes) {
+    return {};
+  }
+  const uint8_t* end = dict.data + dict.num_bytes;
+  uint32_t length = 0;
+  const uint8_t* in = get_vbyte(dict.data + dict.blocks[block], end, &length);
+  if (in == nullptr || length > static_cast<size_t>(end - in)) {
+    return {};
+  }
+  return {reinterpret_cast<const char*>(in), length};
+}
+
+static size_t find_block(const TermDictionaryView& dict,
+                         std::string_view term, size_t lo, size_t hi) {
+  // The first block whose first term is greater than term, then the one
+  // before it. Corrupt blocks compare as empty terms.
+  size_t start = lo;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (first_term(dict, mid) <= term) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo == start ? dict.num_blocks : lo - 1;
+}
+
+static size_t search_block(const TermDictionaryView& dict, size_t block,
+                           std::string_view term, bool* found) {
+  *found = false;
+  size_t first = block * kTermBlockSize;
+  size_t end = std::min(first + kTermBlockSize, dict.size);
+  for (TermCursor cursor(dict, first); !cursor.done() && cursor.index() < end;
+       cursor.next()) {
+    int order = cursor.term().compare(term);
+    if (order >= 0) {
+      *found = (order == 0);
+      return cursor.index();
+    }
+  }
+  return end;
+}
+
+static void put_vbyte(uint32_t v, vector<uint8_t>* out) {
+  while (v >= 0x80) {
+    out->push_back(static_cast<uint8_t>(v | 0x80));
+    v >>= 7;
+  }
+  out->push_back(static_cast<uint8_t>(v));
+}
+
+static const uint8_t* get_vbyte(const uint8_t* in, const uint8_t* end,
+                                uint32_t* v) {
+  uint32_t result = 0;
+  for (uint32_t shift = 0; shift < 32 && in < end; shift += 7) {
+    uint8_t byte = *in++;
+    result |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      *v = result;
+      return in;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace searchserver
@@ -0,0 +1,108 @@
+#ifndef TERM_DICTIONARY_HPP_
+#define TERM_DICTIONARY_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using std::vector;
+
+namespace searchserver {
+
+// The number of terms in each block of a term dictionary
+constexpr size_t kTermBlockSize = 16;
+
+// A read-only view of a sorted set of terms, front-coded in blocks of
+// kTermBlockSize: the first term of each block is stored whole, and each
+// term after it as the length of the prefix it shares with the term
+// before it and the bytes that follow, all lengths as variable-byte
+// integers. Terms are numbered from 0 in sorted order, which is how an
+// index file finds the posting list of each one.
+//
+// A lookup binary searches the first terms of the blocks, which are
+// compared in place, then decodes at most one block. The data may be
+// owned by a TermDictionary or live in a mapped index file, so every
+// length is checked against the end of the data as it is decoded, and a
+// corrupt block reads as if its terms were missing.
+struct TermDictionaryView {
+  const uint8_t* data = nullptr;
+  size_t num_bytes = 0;
+
+  // Where each block starts in data
+  const uint32_t* blocks = nullptr;
+  size_t num_blocks = 0;
+
+  // The number of terms
+  size_t size = 0;
+
+  // Looks up a term.
+  //
+  // Returns:
+  //  - the number of the term, or size if it is not in the dictionary
+  size_t find(std::string_view term) const;
+
+  // Returns the number of the first term that is not less than term, or
+  // size if there is none
+  size_t lower_bound(std::string_view term) const;
+};
+
+// A term dictionary built in memory, which owns the data of its view
+struct TermDictionary {
+  vector<uint8_t> data;
+  vector<uint32_t> blocks;
+  size_t size = 0;
+
+  // Replaces the contents of the dictionary.
+  //
+  // Arguments:
+  //  - terms: the terms, sorted and without repeats
+  void build(const vector<std::string_view>& terms);
+
+  // Returns a view of the dictionary, valid until it is modified
+  TermDictionaryView view() const;
+};
+
+// Steps through the terms of a dictionary in sorted order, decoding each
+// one from the one before it
+class TermCursor {
+ public:
+  // Starts at the term numbered first, or past the end if there is none
+  TermCursor(const TermDictionaryView& dict, size_t first);
+
+  // Returns true once the cursor has moved past the last term
+  bool done() const { return index_ >= dict_.size; }
+
+  // Returns the number of the current term, and the term itself, which
+  // is only valid until the cursor moves
+  size_t index() const { return index_; }
+  std::string_view term() const { return term_; }
+
+  // Moves to the next term
+  void next();
+
+  // Moves forward to the first term that is not less than term, if the
+  // cursor is not there already. The blocks ahead are searched by
+  // doubling the distance to the next one tried, so a nearby term is
+  // found in a few steps, and only the block it is in is decoded.
+  void seek(std::string_view term);
+
+ private:
+  // Moves to the first term of a block, or past the end if the block is
+  // missing or corrupt
+  void start_block(size_t block);
+
+  // Decodes the term at pos_, which is the first of its block if first
+  // is true. Moves past the end if it is corrupt.
+  void decode(bool first);
+
+  TermDictionaryView dict_;
+  size_t index_;
+  const uint8_t* pos_ = nullptr;
+  std::string term_;
+};
+
+}  // namespace searchserver
+
+#endif  // TERM_DICTIONARY_HPP_
@@ -9,22 +9,58 @@
  * author.
  */
 
-#include <unistd.h>
+#include <linux/futex.h>  // for FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#include <sys/syscall.h>  // for SYS_futex
+#include <unistd.h>       // for syscall()
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>    // for _mm_pause()
+#endif
+
+#include <climits>
 #include <iostream>
 
 #include "./ThreadPool.hpp"
 
 namespace searchserver {
 
-// This is the thread start routine, i.e., the function that threads
-// are born into.
-void *thread_loop(void *t_pool);
+// How many times an idle worker checks the queue again before going to
+// sleep. Under load the next task usually arrives within a few
+// microseconds, and catching it here saves a futex wait and wake.
+static const int kSpinsBeforeSleep = 128;
+
+// waiters_ counts sleeping workers in its high half and the wake-ups
+// sent to them in its low half
+static const uint64_t kOneSleeper = uint64_t{1} << 32;
+static uint32_t num_sleepers(uint64_t waiters) { return waiters >> 32; }
+static uint32_t num_wakeups(uint64_t waiters) { return waiters & 0xFFFFFFFF; }
+
+// Tells the CPU that this thread is spinning
+static void cpu_relax();
+
+ThreadPool::ThreadPool(size_t num_threads, size_t queue_capacity)
+    : num_threads_(num_threads),
+      mask_(0),
+      tail_(0),
+      head_(0),
+      overflow_lock_(),
+      overflow_(),
+      overflow_size_(0),
+      epoch_(0),
+      waiters_(0),
+      killthreads_(false),
+      thread_vec_(num_threads) {
+  size_t capacity = 2;
+  while (capacity < queue_capacity) {
+    capacity *= 2;
+  }
+  mask_ = capacity - 1;
+  cells_.reset(new Cell[capacity]);
+  for (size_t i = 0; i < capacity; i++) {
+    cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+  pthread_mutex_init(&overflow_lock_, nullptr);
 
-ThreadPool::ThreadPool(size_t num_threads) : q_lock_(), q_cond_(), work_queue_(), killthreads_(false), num_threads_(num_threads), thread_vec_(num_threads) {
-  // Initialize lock and condition
-  pthread_mutex_init(&q_lock_, nullptr);
-  pthread_cond_init(&q_cond_, nullptr);
-  
   // Create the worker threads
   for (size_t i = 0; i < num_threads; i++) {
     int result = pthread_create(&thread_vec_[i], nullptr, thread_loop, this);
@@ -35,96 +71,186 @@ ThreadPool::ThreadPool(size_t num_threads) : q_lock_(), q_cond_(), work_queue_()
 }
 
 ThreadPool:: ~ThreadPool() {
-  // Signal all threads to exit
-  pthread_mutex_lock(&q_lock_);
-  killthreads_ = true;
-  
-  // Wake up all threads so they can check the killthreads_ flag
-  pthread_cond_broadcast(&q_cond_);
-  pthread_mutex_unlock(&q_lock_);
-  
+  // Signal all threads to exit once they have emptied the queue, and
+  // wake up all of them so they can check the killthreads_ flag
+  killthreads_.store(true);
+  wake(INT_MAX);
+
   // Wait for all threads to finish
   for (size_t i = 0; i < num_threads_; i++) {
     pthread_join(thread_vec_[i], nullptr);
   }
-  
+
   // Do any remaining tasks in queue
-  while (!work_queue_.empty()) {
-    Task task = work_queue_.front();
-    work_queue_.pop_front();
-    task.func_(task.arg_);
+  Task task;
+  while (try_pop(&task)) {
+    task();
   }
-  
-  // Destroy the mutex and condition variable
-  pthread_mutex_destroy(&q_lock_);
-  pthread_cond_destroy(&q_cond_);
+
+  pthread_mutex_destroy(&overflow_lock_);
 }
 
 // Enqueue a Task for dispatch.
 void ThreadPool::dispatch(Task t) {
-  // Lock before accessing the queue
-  pthread_mutex_lock(&q_lock_);
-  
-  // Add task to queue
-  work_queue_.push_back(t);
-  
-  // Signal all waiting threads there is work
-  pthread_cond_broadcast(&q_cond_);
-  
-  // Unlock
-  pthread_mutex_unlock(&q_lock_);
+  if (!try_push(&t)) {
+    pthread_mutex_lock(&overflow_lock_);
+    overflow_.push_back(std::move(t));
+    overflow_size_.fetch_add(1);
+    pthread_mutex_unlock(&overflow_lock_);
+  }
+
+  // Pairs with the fence in wait_for_work(): either that worker sees
+  // the new task when it checks the queue again, or this sees it
+  // counted in waiters_ and wakes it
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  uint64_t waiters = waiters_.load(std::memory_order_relaxed);
+  while (num_wakeups(waiters) < num_sleepers(waiters)) {
+    if (waiters_.compare_exchange_weak(waiters, waiters + 1)) {
+      wake(1);
+      return;
+    }
+  }
 }
 
 // This is the main loop that all worker threads are born into.  They
-// wait for a signal on the work queue condition variable, then they
-// grab work off the queue.  Threads return (i.e., kill themselves)
-// when they notice that killthreads_ is true.
-void *thread_loop(void *t_pool) {
-    ThreadPool *pool = static_cast<ThreadPool*>(t_pool);
-    
-    pthread_mutex_lock(&pool->q_lock_);
-
-    while (true) {
-        // Check if should exit
-        if (pool->killthreads_ && pool->work_queue_.empty()) {
-            pthread_mutex_unlock(&pool->q_lock_);
-            return nullptr;
-        }
-
-        // Wait for work if queue is empty
-        while (pool->work_queue_.empty() && !pool->killthreads_) {
-            pthread_cond_wait(&pool->q_cond_, &pool->q_lock_);
-        }
-        
-        // Check again if need to exit
-        if (pool->killthreads_ && pool->work_queue_.empty()) {
-            pthread_mutex_unlock(&pool->q_lock_);
-            return nullptr;
-        }
-        
-        // If no work and exit is true
-        if (pool->work_queue_.empty()) {
-            pthread_mutex_unlock(&pool->q_lock_);
-            return nullptr;
-        }
-        
-        // Work to do so get task from front of queue
-        ThreadPool::Task task = pool->work_queue_.front();
-        pool->work_queue_.pop_front();
-        
-        // Unlock before executing task
-        pthread_mutex_unlock(&pool->q_lock_);
-        
-        // Execute the task
-        task.func_(task.arg_);
-        
-        // Lock again for next iteration
-        pthread_mutex_lock(&pool->q_lock_);
+// grab work off the queue, and sleep when there is none.  Threads
+// return (i.e., kill themselves) when they notice that killthreads_ is
+// true and the queue is empty.
+void* ThreadPool::thread_loop(void* t_pool) {
+  ThreadPool* pool = static_cast<ThreadPool*>(t_pool);
+
+  Task task;
+  while (true) {
+    bool found = pool->try_pop(&task);
+    for (int i = 0; !found && i < kSpinsBeforeSleep; i++) {
+      cpu_relax();
+      found = pool->try_pop(&task);
+    }
+    if (!found && !pool->wait_for_work(&task)) {
+      return nullptr;
+    }
+
+    // Execute the task, then destroy it before waiting for the next
+    // one, so nothing it owns outlives it
+    task();
+    task = Task();
+  }
+}
+
+bool ThreadPool::try_push(Task* t) {
+  size_t pos = tail_.load(std::memory_order_relaxed);
+  Cell* cell = nullptr;
+  while (true) {
+    cell = &cells_[pos & mask_];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      // The slot is free; claim it unless another producer got there
+      // first, in which case pos is updated to where it moved on to
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // The slot still holds the task from one lap ago: the ring is full
+      return false;
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);
     }
+  }
+
+  cell->task = std::move(*t);
+  cell->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool ThreadPool::try_pop(Task* t) {
+  size_t pos = head_.load(std::memory_order_relaxed);
+  Cell* cell = nullptr;
+  while (true) {
+    cell = &cells_[pos & mask_];
+    size_t seq = cell->seq.load(std::memory_order_acquire);
+    auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+    if (diff == 0) {
+      if (head_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // The slot has not been filled yet: the ring is empty, but there
+      // may be tasks that spilled over
+      if (overflow_size_.load(std::memory_order_relaxed) == 0) {
+        return false;
+      }
+      pthread_mutex_lock(&overflow_lock_);
+      bool found = !overflow_.empty();
+      if (found) {
+        *t = std::move(overflow_.front());
+        overflow_.pop_front();
+        overflow_size_.fetch_sub(1);
+      }
+      pthread_mutex_unlock(&overflow_lock_);
+      return found;
+    } else {
+      pos = head_.load(std::memory_order_relaxed);
+    }
+  }
+
+  *t = std::move(cell->task);
+  // Hand the slot back to producers for the next lap around the ring
+  cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+  return true;
+}
+
+bool ThreadPool::wait_for_work(Task* t) {
+  while (true) {
+    // Announce the intent to sleep before checking the queue one last
+    // time. A dispatch after the check bumps epoch_, which makes the
+    // futex wait return at once instead of sleeping through it.
+    uint32_t epoch = epoch_.load(std::memory_order_acquire);
+    waiters_.fetch_add(kOneSleeper);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (try_pop(t)) {
+      stop_waiting();
+      return true;
+    }
+    if (killthreads_.load()) {
+      stop_waiting();
+      return false;
+    }
+
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_),
+            FUTEX_WAIT_PRIVATE, epoch, nullptr, nullptr, 0);
+    stop_waiting();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (try_pop(t)) {
+      return true;
+    }
+  }
+}
+
+void ThreadPool::stop_waiting() {
+  // Every wake-up makes at least one sleeper leave, so taking one here
+  // never leaves a sleeper counted as woken while it sleeps on
+  uint64_t waiters = waiters_.load(std::memory_order_relaxed);
+  uint64_t left = 0;
+  do {
+    left = waiters - kOneSleeper - (num_wakeups(waiters) > 0 ? 1 : 0);
+  } while (!waiters_.compare_exchange_weak(waiters, left));
+}
+
+void ThreadPool::wake(int count) {
+  epoch_.fetch_add(1, std::memory_order_release);
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAKE_PRIVATE,
+          count, nullptr, nullptr, 0);
+}
 
-    
-    pthread_mutex_unlock(&pool->q_lock_);
-    return nullptr;
+static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#endif
 }
 
 }  // namespace searchserver
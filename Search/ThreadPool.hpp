@@ -16,19 +16,31 @@ extern "C" {
   #include <pthread.h>  // for the pthread threading/mutex functions
 }
 
-#include <cstdint>  // for uint32_t, etc.
-#include <deque>    // for std::deque
-#include <vector>   // for std::vector
+#include <atomic>       // for std::atomic
+#include <cstddef>      // for std::max_align_t
+#include <cstdint>      // for uint32_t, etc.
+#include <deque>        // for std::deque
+#include <memory>       // for std::unique_ptr
+#include <new>          // for placement new
+#include <type_traits>  // for std::decay_t, etc.
+#include <utility>      // for std::move, std::forward
+#include <vector>       // for std::vector
 
 namespace searchserver {
 
 // A ThreadPool is, well, a pool of threads. ;)  A ThreadPool is an
 // abstraction that allows customers to dispatch tasks to a set of
 // worker threads.  Tasks are queued, and as a worker thread becomes
-// available, it pulls a task off the queue and invokes a function
-// pointer in the task to process it.  When it is done processing the
-// task, the thread returns to the pool to receive and process the next
-// available task.
+// available, it pulls a task off the queue and invokes it.  When it is
+// done processing the task, the thread returns to the pool to receive
+// and process the next available task.
+//
+// The queue is a bounded lock-free ring buffer that any number of
+// threads can push to and pop from at once, so dispatching never waits
+// on a lock held by a worker. If the ring fills up, tasks spill into a
+// locked overflow queue instead of being refused. Idle workers sleep on
+// a futex, and each dispatch wakes at most one of them, rather than
+// every idle worker racing for the same task.
 class ThreadPool {
  public:
   // Construct a new ThreadPool with a certain number of worker
@@ -37,50 +49,134 @@ class ThreadPool {
   // Arguments:
   //
   //  - num_threads:  the number of threads in the pool.
-  explicit ThreadPool(size_t num_threads);
+  //  - queue_capacity: the number of tasks the lock-free queue holds
+  //    before spilling into the overflow queue, rounded up to a power
+  //    of two
+  explicit ThreadPool(size_t num_threads, size_t queue_capacity = 1024);
 
   // destructs the theadpool
   // makes sure any threads are joined in
   // if there is any work left in the queue, the destructor will process them.
   ~ThreadPool();
 
-  // This inner struct defines what a Task is.  A worker thread will
-  // pull a task off the task queue and invoke the thread_task_fn
-  // function pointer inside of it, passing it the task_arg as an
-  // argument.
-  //
-  // argument is a void* to support "generic" arguments similar to pthread
-  // (Note: there are nicer ways to handle this in C++ but this is probably
-  //  simpler for what we have covered in class)
+  // The old style of task: a function pointer that is passed a void*
+  // argument, similar to pthread
   typedef void (*thread_task_fn)(void *arg);
 
-  struct Task {
-    // The dispatch function.
-    thread_task_fn func_;
-    void* arg_;
-  };
+  // A Task is a piece of work for a worker thread: any callable object
+  // that takes no arguments, such as a lambda. Tasks can only be moved,
+  // so a lambda may capture move-only values like a std::unique_ptr.
+  // Small callables are stored inside the Task itself, so dispatching
+  // them does not allocate.
+  class Task {
+   public:
+    // An empty task, which must not be invoked
+    Task() = default;
 
-  // Customers use dispatch() to enqueue a Task for dispatch to a
-  // worker thread.
-  void dispatch(Task t);
+    // A task that calls func(arg)
+    Task(thread_task_fn func, void* arg)
+        : Task([func, arg]() { func(arg); }) {}
 
-  // The following fields are public so that
-  // the worker threads can easily get access to these
+    // A task that calls f()
+    template <typename F,
+              typename = std::enable_if_t<
+                  !std::is_same_v<std::decay_t<F>, Task> &&
+                  std::is_invocable_v<std::decay_t<F>&>>>
+    Task(F&& f) {  // NOLINT(google-explicit-constructor)
+      using Fn = std::decay_t<F>;
+      if constexpr (fits_inline<Fn>()) {
+        new (storage_) Fn(std::forward<F>(f));
+        ops_ = &kInlineOps<Fn>;
+      } else {
+        *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(f));
+        ops_ = &kHeapOps<Fn>;
+      }
+    }
 
-  // A lock and condition variable that worker threads and the
-  // dispatch function use to guard the Task queue.
-  pthread_mutex_t q_lock_;
-  pthread_cond_t  q_cond_;
+    Task(Task&& other) noexcept { take(&other); }
 
-  // The queue of Tasks waiting to be dispatched to a worker thread.
-  std::deque<Task> work_queue_;
+    Task& operator=(Task&& other) noexcept {
+      if (this != &other) {
+        reset();
+        take(&other);
+      }
+      return *this;
+    }
 
-  // This should be set to "true" when it is time for the worker
-  // threads to kill themselves, i.e., when the ThreadPool is
-  // destroyed.  A worker thread will check this variable before
-  // picking up its next piece of work; if it is true, the worker
-  // threads will kill themselves off.
-  bool killthreads_;
+    ~Task() { reset(); }
+
+    // Returns true unless the task is empty
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    // Runs the task
+    void operator()() { ops_->invoke(storage_); }
+
+    // disable copying, a task may own move-only state
+    Task(const Task& other) = delete;
+    Task& operator=(const Task& other) = delete;
+
+   private:
+    // How to run, move and destroy the callable held in storage_
+    struct Ops {
+      void (*invoke)(void* storage);
+      void (*move)(void* from, void* to);
+      void (*destroy)(void* storage);
+    };
+
+    static constexpr size_t kInlineSize = 3 * sizeof(void*);
+
+    // Callables that are small enough, and cannot throw while being
+    // moved, are stored in place; anything else goes on the heap
+    template <typename Fn>
+    static constexpr bool fits_inline() {
+      return sizeof(Fn) <= kInlineSize &&
+             alignof(Fn) <= alignof(std::max_align_t) &&
+             std::is_nothrow_move_constructible_v<Fn>;
+    }
+
+    template <typename Fn>
+    static constexpr Ops kInlineOps = {
+        [](void* s) { (*static_cast<Fn*>(s))(); },
+        [](void* from, void* to) {
+          new (to) Fn(std::move(*static_cast<Fn*>(from)));
+          static_cast<Fn*>(from)->~Fn();
+        },
+        [](void* s) { static_cast<Fn*>(s)->~Fn(); },
+    };
+
+    template <typename Fn>
+    static constexpr Ops kHeapOps = {
+        [](void* s) { (**static_cast<Fn**>(s))(); },
+        [](void* from, void* to) {
+          *static_cast<Fn**>(to) = *static_cast<Fn**>(from);
+        },
+        [](void* s) { delete *static_cast<Fn**>(s); },
+    };
+
+    // Moves other's callable into this empty task, leaving other empty
+    void take(Task* other) {
+      if (other->ops_ != nullptr) {
+        other->ops_->move(other->storage_, storage_);
+        ops_ = other->ops_;
+        other->ops_ = nullptr;
+      }
+    }
+
+    // Destroys the callable, leaving the task empty
+    void reset() {
+      if (ops_ != nullptr) {
+        ops_->destroy(storage_);
+        ops_ = nullptr;
+      }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize]{};
+    const Ops* ops_ = nullptr;
+  };
+
+  // Customers use dispatch() to enqueue a Task for dispatch to a
+  // worker thread.
+  void dispatch(Task t);
 
   // This variable stores how many threads exist.
   uint32_t num_threads_;
@@ -92,6 +188,66 @@ class ThreadPool {
   ThreadPool(ThreadPool&& other) = delete;
 
  private:
+  // One slot of the ring buffer. seq tells producers and consumers
+  // whose turn it is to use the slot: it is the position a producer may
+  // fill it at, then that position plus one once it holds a task.
+  struct alignas(64) Cell {
+    std::atomic<size_t> seq;
+    Task task;
+  };
+
+  // This is the thread start routine, i.e., the function that threads
+  // are born into.
+  static void* thread_loop(void* t_pool);
+
+  // Adds a task to the ring buffer. Returns false if it is full.
+  bool try_push(Task* t);
+
+  // Takes the oldest task from the ring buffer, or failing that from
+  // the overflow queue. Returns false if there is no task.
+  bool try_pop(Task* t);
+
+  // Puts the calling worker to sleep until a task may be available.
+  // Returns false if the pool is shutting down and there is no work
+  // left, in which case the worker should exit.
+  bool wait_for_work(Task* t);
+
+  // Marks the calling worker as no longer sleeping, taking one of the
+  // wake-ups sent to sleepers if there are any
+  void stop_waiting();
+
+  // Bumps the epoch and wakes up to count sleeping workers
+  void wake(int count);
+
+  // The ring buffer, and the positions the next task will be pushed to
+  // and popped from. Each position is on its own cache line, so
+  // producers and consumers do not slow each other down.
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+  alignas(64) std::atomic<size_t> tail_;
+  alignas(64) std::atomic<size_t> head_;
+
+  // Tasks that did not fit in the ring buffer, and how many there are,
+  // so that workers only take the lock when there are some
+  alignas(64) pthread_mutex_t overflow_lock_;
+  std::deque<Task> overflow_;
+  std::atomic<size_t> overflow_size_;
+
+  // An eventcount for idle workers to sleep on. epoch_ is the futex
+  // word, bumped to wake them. waiters_ packs two counts: in the high
+  // half the workers that are sleeping or about to, and in the low half
+  // the wake-ups sent to them that have not been taken yet. dispatch()
+  // only wakes a worker if some sleeper has not been sent one already,
+  // so a burst of tasks does not make a system call per task.
+  alignas(64) std::atomic<uint32_t> epoch_;
+  std::atomic<uint64_t> waiters_;
+
+  // This should be set to "true" when it is time for the worker
+  // threads to kill themselves, i.e., when the ThreadPool is
+  // destroyed.  A worker thread checks this variable once the queue is
+  // empty; if it is true, the worker thread will kill itself off.
+  std::atomic<bool> killthreads_;
+
   // The pthreads pthread_t structures representing each thread.
   std::vector<pthread_t> thread_vec_;
 };
@@ -0,0 +1,144 @@
+#include "./Tokenizer.hpp"
+
+#include <fcntl.h>   // for open()
+#include <unistd.h>  // for read(), close()
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+
+namespace searchserver {
+
+// The bytes that separate words
+static constexpr std::string_view kDelimiters = " \r\t\v\n,.:;?!";
+
+// kIsDelimiter[c] is true if byte c separates words, and kLowercase[c] is
+// the lowercase of c, which only changes ASCII letters like tolower() in
+// the "C" locale
+static constexpr std::array<bool, 256> kIsDelimiter = [] {
+  std::array<bool, 256> table{};
+  for (char c : kDelimiters) {
+    table[static_cast<unsigned char>(c)] = true;
+  }
+  return table;
+}();
+
+static constexpr std::array<char, 256> kLowercase = [] {
+  std::array<char, 256> table{};
+  for (int c = 0; c < 256; c++) {
+    table[c] = static_cast<char>((c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c);
+  }
+  return table;
+}();
+
+static bool is_delimiter(char c) {
+  return kIsDelimiter[static_cast<unsigned char>(c)];
+}
+
+Tokenizer::Tokenizer(size_t chunk_size)
+    : fd_(-1),
+      buffer_(new char[chunk_size > 0 ? chunk_size : 1]),
+      capacity_(chunk_size > 0 ? chunk_size : 1),
+      pos_(0),
+      end_(0),
+      eof_(true) {}
+
+Tokenizer::Tokenizer(Tokenizer&& other) noexcept
+    : fd_(other.fd_),
+      buffer_(std::move(other.buffer_)),
+      capacity_(other.capacity_),
+      pos_(other.pos_),
+      end_(other.end_),
+      eof_(other.eof_) {
+  other.fd_ = -1;
+}
+
+Tokenizer::~Tokenizer() {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+bool Tokenizer::open(const std::string& path) {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+  pos_ = 0;
+  end_ = 0;
+  fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  eof_ = (fd_ == -1);
+  return fd_ != -1;
+}
+
+bool Tokenizer::next(std::string_view* word) {
+  char* buffer = buffer_.get();
+  while (true) {
+    // Skip to the start of the next word, reading more of the file if
+    // the buffer runs out first
+    while (pos_ < end_ && is_delimiter(buffer[pos_])) {
+      pos_++;
+    }
+    if (pos_ == end_) {
+      if (!refill(pos_)) {
+        return false;
+      }
+      buffer = buffer_.get();
+      continue;
+    }
+
+    // Lowercase the word in place until its end. If it runs past the
+    // bytes read so far, keep what there is of it and read more.
+    size_t start = pos_;
+    while (true) {
+      while (pos_ < end_ && !is_delimiter(buffer[pos_])) {
+        buffer[pos_] = kLowercase[static_cast<unsigned char>(buffer[pos_])];
+        pos_++;
+      }
+      if (pos_ < end_) {
+        break;
+      }
+      bool more = refill(start);
+      buffer = buffer_.get();
+      start = 0;
+      if (!more) {
+        break;
+      }
+    }
+
+    *word = std::string_view(buffer + start, pos_ - start);
+    return true;
+  }
+}
+
+bool Tokenizer::refill(size_t keep_from) {
+  size_t kept = end_ - keep_from;
+  if (kept == capacity_ && !eof_) {
+    // One word fills the whole buffer
+    std::unique_ptr<char[]> bigger(new char[capacity_ * 2]);
+    std::memcpy(bigger.get(), buffer_.get(), capacity_);
+    buffer_ = std::move(bigger);
+    capacity_ *= 2;
+  } else if (kept > 0) {
+    std::memmove(buffer_.get(), buffer_.get() + keep_from, kept);
+  }
+  pos_ -= keep_from;
+  end_ = kept;
+  if (eof_) {
+    return false;
+  }
+
+  while (true) {
+    ssize_t bytes = read(fd_, buffer_.get() + end_, capacity_ - end_);
+    if (bytes == -1 && errno == EINTR) {
+      continue;
+    }
+    if (bytes <= 0) {
+      eof_ = true;
+      return false;
+    }
+    end_ += bytes;
+    return true;
+  }
+}
+
+}  // namespace searchserver
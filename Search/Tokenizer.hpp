@@ -0,0 +1,76 @@
+#ifndef TOKENIZER_HPP_
+#define TOKENIZER_HPP_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace searchserver {
+
+// A Tokenizer splits a file into the words the index records for it:
+// runs of bytes between the delimiters " \r\t\v\n,.:;?!", lowercased.
+//
+// The file is read a chunk at a time into a buffer that is reused for
+// every file the tokenizer opens, and words are lowercased in place and
+// handed out as views into it, so tokenizing does not allocate. Bytes
+// are classified with lookup tables rather than by searching the
+// delimiter string for each of them.
+class Tokenizer {
+ public:
+  // The size of the buffer a file is read into. A word longer than this
+  // makes the buffer grow to hold it.
+  static constexpr size_t kDefaultChunkSize = 64 * 1024;
+
+  // Creates a tokenizer with no file open
+  explicit Tokenizer(size_t chunk_size = kDefaultChunkSize);
+
+  // closes the open file, if any
+  ~Tokenizer();
+
+  // Opens a file to tokenize, closing the previous one.
+  //
+  // Arguments:
+  //  - path: the file to open
+  //
+  // Returns:
+  //  - false if the file could not be opened
+  bool open(const std::string& path);
+
+  // Finds the next word in the open file.
+  //
+  // Arguments:
+  //  - word: set to the next word, lowercased. It points into the
+  //    tokenizer's buffer, so it is only valid until the next call.
+  //
+  // Returns:
+  //  - false once there are no more words, or reading the file failed
+  bool next(std::string_view* word);
+
+  // disable copying, the tokenizer owns its file descriptor
+  Tokenizer(const Tokenizer& other) = delete;
+  Tokenizer& operator=(const Tokenizer& other) = delete;
+  Tokenizer(Tokenizer&& other) noexcept;
+  Tokenizer& operator=(Tokenizer&& other) = delete;
+
+ private:
+  // Moves the bytes from keep_from on to the front of the buffer, and
+  // reads more of the file after them. Positions in the buffer are moved
+  // back by keep_from, even if nothing more could be read, in which case
+  // it returns false.
+  bool refill(size_t keep_from);
+
+  int fd_;
+  std::unique_ptr<char[]> buffer_;
+  size_t capacity_;
+
+  // The position of the next byte to look at and the end of the bytes
+  // read so far, and whether the whole file has been read
+  size_t pos_;
+  size_t end_;
+  bool eof_;
+};
+
+}  // namespace searchserver
+
+#endif  // TOKENIZER_HPP_
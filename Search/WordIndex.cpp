@@ -1,107 +1,1702 @@
 #include "./WordIndex.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "./Levenshtein.hpp"
 
 namespace searchserver {
 
+// BM25 parameters: k1 controls how quickly repeated occurances of a word
+// stop adding to the score, and b how strongly scores are normalized by
+// document length
+static const double kBM25K1 = 1.2;
+static const double kBM25B = 0.75;
+
+// How far the average document length may move away from the one the
+// lengths were last normalized against, as a fraction of it, before
+// finalize() renormalizes every document
+static const double kMaxLengthDrift = 0.1;
+
+// The generation the next finalized or loaded index is given. It is
+// shared by every index so that generations are never reused.
+static std::atomic<uint64_t> next_generation{1};
+
+// Ranks every posting by its raw count, so a document's score is the
+// total number of occurances of the query words in it
+class TermFrequencyScorer {
+ public:
+  double score(size_t /* term */, DocId /* doc */, uint32_t tf) const {
+    return tf;
+  }
+};
+
+// Ranks postings with Okapi BM25. The per-word weight and the
+// per-document length normalization are computed up front, so scoring
+// a posting is a multiply, an add and a divide.
+class BM25Scorer {
+ public:
+  BM25Scorer(size_t num_docs, const float* norms)
+      : num_docs_(static_cast<double>(num_docs)), norms_(norms) {}
+
+  BM25Scorer(const vector<PostingListView>& lists, size_t num_docs,
+             const float* norms)
+      : BM25Scorer(num_docs, norms) {
+    for (const PostingListView& list : lists) {
+      add_term(list.size);
+    }
+  }
+
+  // Adds the next query word, which is found in df documents
+  void add_term(size_t df) {
+    auto n = static_cast<double>(df);
+    double idf = std::log(1.0 + (num_docs_ - n + 0.5) / (n + 0.5));
+    weights_.push_back(idf * (kBM25K1 + 1.0));
+  }
+
+  double score(size_t term, DocId doc, uint32_t tf) const {
+    return weights_[term] * tf / (tf + static_cast<double>(norms_[doc]));
+  }
+
+  double weight(size_t term) const { return weights_[term]; }
+
+ private:
+  double num_docs_;
+  const float* norms_;
+  vector<double> weights_;
+};
+
+// Returns the average of a list of document lengths
+static double average_length(const vector<uint32_t>& doc_lens);
+
+// Returns the BM25 length normalization of a document of length len, in
+// a collection whose average document length is avg_len
+static float bm25_norm(uint32_t len, double avg_len);
+
+// Recomputes the block maxima and score bounds of a posting list from
+// the normalization of every document, then compresses the list
+static void summarize(PostingList* list, const float* norms);
+
+// Merges lists into one: every document in any of them, with the sum of
+// its counts, and all of its positions if every list has positions. The
+// merged list is then summarized with norms like any other.
+static void union_lists(const vector<PostingListView>& lists,
+                        const float* norms, PostingList* out);
+
+// Picks the limit words in the most documents out of the words an
+// expanded query word stands for, and merges their lists into a new list
+// kept in expansions. A single word's list is used as it is.
+//
+// Returns:
+//  - false if there are no words
+static bool merge_words(vector<std::pair<string, PostingListView>>* words,
+                        size_t limit, const float* norms,
+                        PostingListView* list,
+                        std::list<PostingList>* expansions);
+
+// Parses a fuzzy query word: one that ends in '~', optionally followed by
+// the most edits a match may be. Without it, words of up to 2 bytes have
+// to match exactly, words of up to 5 may be 1 edit away and longer words 2.
+//
+// Returns:
+//  - true, with word set to the rest of it and max_distance to the most
+//    edits, if it is a fuzzy word
+static bool parse_fuzzy(const string& query_word, std::string_view* word,
+                        uint32_t* max_distance);
+
+// Returns tf / (tf + norm) as a float that is never less than the value
+// BM25Scorer computes from the same inputs in double precision, so that it
+// can safely be used as an upper bound
+static float bm25_bound(uint32_t tf, float norm);
+
+// Returns offset + k, the number of hits a page ends after, or SIZE_MAX
+// if that overflows
+static size_t page_end(size_t offset, size_t k);
+
+// Converts a list of hits in DocId order into Results sorted by score in
+// descending order. Documents with equal score stay in DocId order.
+// doc_name(id) gives the name of each document.
+template <typename DocName>
+static vector<Result> to_results(DocName doc_name, vector<Hit>& hits);
+
+// Intersects the given posting lists, which must be ordered from the
+// shortest to the longest, calling emit(hit) in DocId order for every
+// document found in all of them. The i-th list's postings are scored as
+// term i by the scorer.
+template <typename Scorer, typename Emit>
+static void intersect(const vector<PostingListView>& lists,
+                      const Scorer& scorer, Emit emit);
+
+// Intersects the given posting lists like above, but only emits the
+// documents for which accept(&cursors) returns true. accept is called
+// with every list's cursor on the document, so it can look at the
+// positions of the words in it.
+template <typename Scorer, typename Accept, typename Emit>
+static void intersect(const vector<PostingListView>& lists,
+                      const Scorer& scorer, Accept accept, Emit emit);
+
+// Returns the number of positions stored for the first n postings of a
+// list, which is where the positions of the n-th posting start
+static size_t positions_before(const vector<Posting>& postings, size_t n);
+
+// Sorts the postings of a list by DocId, moving each posting's positions
+// along with it
+static void sort_postings(PostingList* list);
+
+// Checks the phrase and proximity constraints of a query against the
+// positions of its words in one document at a time. The positions of each
+// word are only decoded the first time a constraint needs them for the
+// document.
+class PhraseMatcher {
+ public:
+  // slots[i] is the index of the cursor of query.words[i] in the cursors
+  // passed to operator()
+  PhraseMatcher(const PhraseQuery& query, const vector<size_t>& slots);
+
+  // Returns true if the document every cursor is on satisfies every
+  // constraint of the query
+  bool operator()(vector<PostingCursor>* cursors);
+
+ private:
+  // One operand of a constraint: the cursor slot of each of its words
+  using Operand = vector<size_t>;
+  struct Constraint {
+    vector<Operand> operands;
+    vector<uint32_t> distances;
+  };
+
+  // Returns the positions of the word in the given slot in the current
+  // document, decoding them if this is the first time they are needed
+  const vector<uint32_t>& positions(size_t slot);
+
+  // Sets starts to the positions in the current document at which every
+  // word of the operand appears in order, one after the other
+  void phrase_starts(const Operand& operand, vector<uint32_t>* starts);
+
+  // Returns true if the operands of a constraint can be found one after
+  // the other, each within its distance of the one before it
+  bool matches(const Constraint& constraint);
+
+  vector<Constraint> constraints_;
+  vector<PostingCursor>* cursors_ = nullptr;
+  vector<vector<uint32_t>> positions_;
+  vector<bool> decoded_;
+  vector<uint32_t> starts_;
+  vector<uint32_t> next_starts_;
+};
+
+// Keeps the best `capacity` hits pushed into it in a bounded heap.
+// Higher scores are better, and lower DocIds win ties.
+class TopK {
+ public:
+  // Only reserves room for as many hits as the lookup can find, at most
+  // max_hits, so that a page far past the end of the results does not
+  // allocate for all of the hits before it
+  TopK(size_t capacity, size_t max_hits) : capacity_(capacity) {
+    heap_.reserve(std::min(capacity, max_hits));
+  }
+
+  void push(const Hit& hit) {
+    if (capacity_ == 0) {
+      return;
+    }
+    if (heap_.size() < capacity_) {
+      heap_.push_back(hit);
+      std::push_heap(heap_.begin(), heap_.end(), better);
+    } else if (better(hit, heap_.front())) {
+      // The front of the heap is the worst hit kept so far
+      std::pop_heap(heap_.begin(), heap_.end(), better);
+      heap_.back() = hit;
+      std::push_heap(heap_.begin(), heap_.end(), better);
+    }
+  }
+
+  // Returns true once capacity hits are kept, from which point a new hit
+  // has to beat worst() to get in
+  bool full() const { return heap_.size() >= capacity_; }
+  const Hit& worst() const { return heap_.front(); }
+
+  // Returns the kept hits from best to worst, emptying the heap
+  vector<Hit> take() {
+    std::sort_heap(heap_.begin(), heap_.end(), better);
+    return std::move(heap_);
+  }
+
+ private:
+  static bool better(const Hit& a, const Hit& b) {
+    return a.score > b.score || (a.score == b.score && a.doc < b.doc);
+  }
+
+  size_t capacity_;
+  vector<Hit> heap_;
+};
+
+// Converts the best hits of a lookup, best first, into the Results of one
+// page, skipping the best offset of them
+template <typename DocName>
+static vector<Result> page_results(DocName doc_name, const vector<Hit>& best,
+                                   size_t offset);
+
+// One query word's cursor while evaluating lookup_any
+struct WandCursor {
+  PostingCursor postings;
+  // The index of the word in the scorer
+  size_t term;
+  // The weight of the word, and the upper bound on the score of any of
+  // its postings
+  double weight;
+  double max_score;
+};
+
+// Fraction by which score thresholds are lowered before comparing them
+// with upper bounds, so rounding in the bounds can never make Block-Max
+// WAND skip a document that belongs in the top-K
+static const double kBoundSlack = 1e-9;
+
+// Evaluates a disjunctive query with Block-Max WAND, pushing every
+// document that could make it into top. Cursors must start at the
+// beginning of their lists.
+template <typename Scorer>
+static void block_max_wand(vector<WandCursor>* cursors, Ranking ranking,
+                           const Scorer& scorer, TopK* top,
+                           size_t* num_scored);
+
 WordIndex::WordIndex() = default;
 
+WordIndex::WordIndex(bool positions) : positions_(positions) {}
+
 size_t WordIndex::num_words() {
-  return word_map.size();
+  return file_ ? file_->num_terms() : word_map.size();
+}
+
+size_t WordIndex::num_docs() {
+  return file_ ? file_->num_docs() : docs_.size();
+}
+
+bool WordIndex::has_positions() const {
+  return file_ ? file_->has_positions() : positions_;
+}
+
+void WordIndex::finalize() {
+  if (file_) {
+    // Index files are always written from a finalized index
+    return;
+  }
+
+  if (!rebuild_all_) {
+    finalize_changes();
+    return;
+  }
+
+  // BM25 normalizes each document's length against the average length
+  // of the collection. Fold that into one float per document now so the
+  // query loop never has to recompute it.
+  avg_len_ = average_length(doc_lens_);
+  norms_.resize(doc_lens_.size());
+  for (size_t i = 0; i < doc_lens_.size(); i++) {
+    norms_[i] = bm25_norm(doc_lens_[i], avg_len_);
+  }
+
+  // Summarize each block of every posting list by the largest score any
+  // of its postings could get, for lookup_any to skip blocks with, then
+  // compress the list
+  for (auto& [word, list] : word_map) {
+    summarize(&list, norms_.data());
+  }
+  build_terms();
+  changed_words_.clear();
+  changed_docs_.clear();
+  rebuild_all_ = false;
+  stats_stale_ = false;
+  generation_ = next_generation++;
+}
+
+void WordIndex::finalize_changes() {
+  // The documents that changed are normalized against the average length
+  // the rest were, so the lists that did not change keep valid bounds.
+  // Once the collection has drifted too far from that average, start
+  // over with a full finalize.
+  double avg_len = average_length(doc_lens_);
+  if (std::abs(avg_len - avg_len_) > kMaxLengthDrift * avg_len_) {
+    rebuild_all_ = true;
+    finalize();
+    return;
+  }
+
+  norms_.resize(doc_lens_.size());
+  for (DocId doc : changed_docs_) {
+    norms_[doc] = bm25_norm(doc_lens_[doc], avg_len_);
+  }
+  for (const string& word : changed_words_) {
+    auto it = word_map.find(word);
+    if (it != word_map.end()) {
+      summarize(&it->second, norms_.data());
+    }
+  }
+
+  // Rebuild the dictionary once the words it is missing or still has
+  // after they were removed add up to an eighth of it
+  if ((new_terms_.size() + removed_terms_) * 8 > terms_.size) {
+    build_terms();
+  }
+  changed_words_.clear();
+  changed_docs_.clear();
+  stats_stale_ = false;
+  generation_ = next_generation++;
+}
+
+uint64_t WordIndex::generation() {
+  if (stats_stale_) {
+    finalize();
+  }
+  return generation_;
+}
+
+bool WordIndex::save(const string& path) {
+  if (file_) {
+    unmap();
+  }
+  if (stats_stale_) {
+    finalize();
+  }
+
+  IndexFileWriter out(path);
+  if (!out.ok()) {
+    return false;
+  }
+  IndexFileHeader header{};
+  header.flags = positions_ ? kIndexHasPositions : 0;
+  header.num_docs = docs_.size();
+  header.num_terms = word_map.size();
+
+  // The document table
+  vector<uint64_t> offsets;
+  string names;
+  offsets.reserve(docs_.size() + 1);
+  for (const string& name : docs_) {
+    offsets.push_back(names.size());
+    names += name;
+  }
+  offsets.push_back(names.size());
+  header.doc_offsets =
+      out.write(offsets.data(), offsets.size() * sizeof(uint64_t));
+  header.doc_names = out.write(names.data(), names.size());
+  header.doc_lens =
+      out.write(doc_lens_.data(), doc_lens_.size() * sizeof(uint32_t));
+  header.norms = out.write(norms_.data(), norms_.size() * sizeof(float));
+
+  // The words, sorted so that a loaded index can binary search them in
+  // place, and where each one's postings and blocks start
+  vector<const std::pair<const string, PostingList>*> terms;
+  terms.reserve(word_map.size());
+  for (const auto& entry : word_map) {
+    terms.push_back(&entry);
+  }
+  std::sort(terms.begin(), terms.end(), [](const auto* a, const auto* b) {
+    return a->first < b->first;
+  });
+
+  vector<std::string_view> words;
+  vector<TermEntry> entries;
+  words.reserve(terms.size());
+  entries.reserve(terms.size());
+  for (const auto* term : terms) {
+    const PostingList& list = term->second;
+    words.push_back(term->first);
+
+    TermEntry entry{};
+    entry.blocks = header.num_blocks;
+    entry.postings = header.posting_bytes;
+    entry.num_postings = static_cast<uint32_t>(list.size);
+    entry.max_tf = list.max_tf;
+    entry.max_bm25 = list.max_bm25;
+    entry.num_bytes = static_cast<uint32_t>(list.data.size());
+    entry.positions = header.position_bytes;
+    entry.position_bytes = static_cast<uint32_t>(list.position_data.size());
+    entries.push_back(entry);
+
+    header.num_postings += list.size;
+    header.num_blocks += list.blocks.size();
+    header.posting_bytes += list.data.size();
+    header.position_bytes += list.position_data.size();
+  }
+  TermDictionary dict;
+  dict.build(words);
+  header.term_bytes = dict.data.size();
+  header.term_blocks =
+      out.write(dict.blocks.data(), dict.blocks.size() * sizeof(uint32_t));
+  header.terms = out.write(dict.data.data(), dict.data.size());
+  header.entries =
+      out.write(entries.data(), entries.size() * sizeof(TermEntry));
+
+  // Every encoded list and then every list's skip entries, back to back
+  // in the same order as the words
+  header.postings = out.write(nullptr, 0);
+  for (const auto* term : terms) {
+    const vector<uint8_t>& data = term->second.data;
+    out.append(data.data(), data.size());
+  }
+  header.blocks = out.write(nullptr, 0);
+  for (const auto* term : terms) {
+    const vector<BlockMax>& blocks = term->second.blocks;
+    out.append(blocks.data(), blocks.size() * sizeof(BlockMax));
+  }
+
+  // Then the positions, with one start for every skip entry
+  if (positions_) {
+    header.positions = out.write(nullptr, 0);
+    for (const auto* term : terms) {
+      const vector<uint8_t>& data = term->second.position_data;
+      out.append(data.data(), data.size());
+    }
+    header.position_starts = out.write(nullptr, 0);
+    for (const auto* term : terms) {
+      const PostingList& list = term->second;
+      vector<uint32_t> starts = list.position_starts;
+      starts.resize(list.blocks.size(), 0);
+      out.append(starts.data(), starts.size() * sizeof(uint32_t));
+    }
+  }
+
+  return out.finish(&header);
+}
+
+std::optional<WordIndex> WordIndex::load(const string& path) {
+  std::shared_ptr<const IndexFile> file = IndexFile::open(path);
+  if (file == nullptr) {
+    return std::nullopt;
+  }
+
+  WordIndex index;
+  index.file_ = std::move(file);
+  index.generation_ = next_generation++;
+  return index;
+}
+
+void WordIndex::unmap() {
+  std::shared_ptr<const IndexFile> file = std::move(file_);
+  file_.reset();
+  positions_ = file->has_positions();
+
+  for (DocId doc = 0; doc < file->num_docs(); doc++) {
+    doc_id(string(file->doc_name(doc)));
+  }
+  doc_lens_.assign(file->doc_lens(), file->doc_lens() + file->num_docs());
+  norms_.assign(file->norms(), file->norms() + file->num_docs());
+
+  // The file's dictionary is already sorted, so it is kept as is
+  TermDictionaryView dict = file->terms();
+  terms_.data.assign(dict.data, dict.data + dict.num_bytes);
+  terms_.blocks.assign(dict.blocks, dict.blocks + dict.num_blocks);
+  terms_.size = dict.size;
+  new_terms_.clear();
+  removed_terms_ = 0;
+
+  word_map.reserve(file->num_terms());
+  for (TermCursor cursor(dict, 0); !cursor.done(); cursor.next()) {
+    size_t i = cursor.index();
+    PostingListView view = file->postings(i);
+    PostingList& list = word_map[string(cursor.term())];
+    list.data.assign(view.data, view.data + view.num_bytes);
+    list.size = view.size;
+    list.blocks.assign(view.blocks, view.blocks + view.num_blocks);
+    list.max_tf = view.max_tf;
+    list.max_bm25 = view.max_bm25;
+    if (view.positions != nullptr) {
+      list.position_data.assign(view.positions,
+                                view.positions + view.position_bytes);
+      list.position_starts.assign(view.position_starts,
+                                  view.position_starts + view.num_blocks);
+    }
+  }
+
+  // The file was written from a finalized index, so later changes can
+  // be finalized incrementally against the lengths it was normalized by
+  avg_len_ = average_length(doc_lens_);
+  rebuild_all_ = false;
+  stats_stale_ = false;
+}
+
+DocId WordIndex::doc_id(const string& doc_name) {
+  // The crawler records every word of a document before moving on to
+  // the next one, so the most recent document is by far the common case
+  if (!docs_.empty() && docs_.back() == doc_name) {
+    return static_cast<DocId>(docs_.size() - 1);
+  }
+
+  auto it = doc_ids_.find(doc_name);
+  if (it != doc_ids_.end()) {
+    return it->second;
+  }
+
+  DocId id = static_cast<DocId>(docs_.size());
+  docs_.push_back(doc_name);
+  doc_ids_.emplace(doc_name, id);
+  doc_lens_.push_back(0);
+  return id;
 }
 
-void WordIndex::record(const string& word, const string& doc_name) {
-  // Increment the count for this word in this document
-  word_map[word][doc_name]++;
+std::string_view WordIndex::doc_name(DocId doc) const {
+  return file_ ? file_->doc_name(doc) : std::string_view(docs_[doc]);
+}
+
+const float* WordIndex::norms() const {
+  return file_ ? file_->norms() : norms_.data();
+}
+
+void WordIndex::record(std::string_view word, const string& doc_name) {
+  if (file_) {
+    unmap();
+  }
+
+  // Words are recorded in the order they appear, so the number recorded
+  // so far is the position of this one
+  DocId doc = doc_id(doc_name);
+  uint32_t position = doc_lens_[doc]++;
+  stats_stale_ = true;
+  rebuild_all_ = true;
+  if (!doc_words_.words.empty()) {
+    doc_words_.words.clear();
+  }
+  auto entry = word_map.find(word);
+  if (entry == word_map.end()) {
+    entry = word_map.emplace(string(word), PostingList()).first;
+  }
+  add_posting(&entry->second, doc, position);
+}
+
+void WordIndex::add_posting(PostingList* list, DocId doc, uint32_t position) {
+  if (list->encoded()) {
+    list->decode();
+  }
+  vector<Posting>& postings = list->postings;
+
+  // Documents are usually recorded in id order, so the posting for this
+  // document is either the last one in the list or a new one at the end
+  if (postings.empty() || postings.back().doc <= doc) {
+    if (postings.empty() || postings.back().doc < doc) {
+      postings.push_back({doc, 1});
+    } else {
+      postings.back().tf++;
+    }
+    if (positions_) {
+      list->positions.push_back(position);
+    }
+    return;
+  }
+
+  // Otherwise find where the document belongs to keep the list sorted.
+  // Its positions go after any it already has, which are all earlier.
+  auto it = std::lower_bound(postings.begin(), postings.end(), doc,
+                             [](const Posting& p, DocId d) {
+                               return p.doc < d;
+                             });
+  bool found = it != postings.end() && it->doc == doc;
+  if (positions_) {
+    size_t at = positions_before(postings, it - postings.begin() + found);
+    list->positions.insert(list->positions.begin() + at, position);
+  }
+  if (found) {
+    it->tf++;
+  } else {
+    postings.insert(it, {doc, 1});
+  }
+}
+
+void WordIndex::merge(vector<WordIndex>* parts,
+                      const vector<string>& doc_order) {
+  for (WordIndex& part : *parts) {
+    if (part.file_) {
+      part.unmap();
+    }
+  }
+
+  // Number the documents that were recorded by some part, in order
+  for (const string& name : doc_order) {
+    for (const WordIndex& part : *parts) {
+      if (part.doc_ids_.find(name) != part.doc_ids_.end()) {
+        doc_id(name);
+        break;
+      }
+    }
+  }
+
+  for (WordIndex& part : *parts) {
+    // Translate the part's DocIds into ours
+    vector<DocId> ids(part.docs_.size());
+    for (size_t i = 0; i < part.docs_.size(); i++) {
+      ids[i] = doc_ids_.at(part.docs_[i]);
+      doc_lens_[ids[i]] = part.doc_lens_[i];
+    }
+
+    for (auto& [word, list] : part.word_map) {
+      if (list.encoded()) {
+        list.decode();
+      }
+      for (Posting& p : list.postings) {
+        p.doc = ids[p.doc];
+      }
+
+      // Most words of a large crawl only show up in one part, so their
+      // list can be moved over rather than copied
+      auto [it, inserted] = word_map.try_emplace(word);
+      vector<Posting>& postings = it->second.postings;
+      vector<uint32_t>& positions = it->second.positions;
+      if (inserted) {
+        postings = std::move(list.postings);
+        positions = std::move(list.positions);
+      } else {
+        postings.insert(postings.end(), list.postings.begin(),
+                        list.postings.end());
+        positions.insert(positions.end(), list.positions.begin(),
+                         list.positions.end());
+      }
+    }
+    part = WordIndex();
+  }
+
+  // A part numbers its documents in the order its worker crawled them,
+  // which need not be the order of doc_order, so even a list moved over
+  // from one part can be out of order once renumbered. Lists built from
+  // more than one part also have to be interleaved. Each document is only
+  // in one part, so there are no duplicates to combine.
+  for (auto& [word, list] : word_map) {
+    sort_postings(&list);
+  }
+  doc_words_.words.clear();
+  stats_stale_ = true;
+  rebuild_all_ = true;
+}
+
+void WordIndex::update_document(const string& doc_name,
+                                const vector<string>& words) {
+  if (file_) {
+    unmap();
+  }
+  track_documents();
+
+  DocId doc = doc_id(doc_name);
+  doc_words_.words.resize(docs_.size());
+  remove_postings(doc);
+
+  std::unordered_map<string, uint32_t> counts;
+  for (const string& word : words) {
+    counts[word]++;
+  }
+
+  // The position of each word is its index in words
+  std::unordered_map<string, vector<uint32_t>> where;
+  if (positions_) {
+    for (size_t i = 0; i < words.size(); i++) {
+      where[words[i]].push_back(static_cast<uint32_t>(i));
+    }
+  }
+  vector<WordEntry*>& doc_words = doc_words_.words[doc];
+  doc_words.reserve(counts.size());
+  for (const auto& [word, tf] : counts) {
+    auto [it_entry, inserted] = word_map.try_emplace(word);
+    if (inserted && terms_.view().find(word) == terms_.size) {
+      new_terms_.insert(
+          std::lower_bound(new_terms_.begin(), new_terms_.end(), word), word);
+    }
+    WordEntry& entry = *it_entry;
+    PostingList& list = entry.second;
+    if (list.encoded()) {
+      list.decode();
+    }
+    auto it = std::lower_bound(list.postings.begin(), list.postings.end(), doc,
+                               [](const Posting& p, DocId d) {
+                                 return p.doc < d;
+                               });
+    if (positions_) {
+      const vector<uint32_t>& positions = where[word];
+      size_t at = positions_before(list.postings, it - list.postings.begin());
+      list.positions.insert(list.positions.begin() + at, positions.begin(),
+                            positions.end());
+    }
+    list.postings.insert(it, {doc, tf});
+    doc_words.push_back(&entry);
+    changed_words_.insert(word);
+  }
+
+  doc_lens_[doc] = static_cast<uint32_t>(words.size());
+  changed_docs_.push_back(doc);
+  stats_stale_ = true;
+}
+
+void WordIndex::remove_document(const string& doc_name) {
+  if (file_) {
+    unmap();
+  }
+  auto it = doc_ids_.find(doc_name);
+  if (it == doc_ids_.end()) {
+    return;
+  }
+  track_documents();
+
+  DocId doc = it->second;
+  remove_postings(doc);
+  doc_lens_[doc] = 0;
+  changed_docs_.push_back(doc);
+  stats_stale_ = true;
+}
+
+void WordIndex::track_documents() {
+  if (!doc_words_.words.empty() || docs_.empty()) {
+    return;
+  }
+  doc_words_.words.resize(docs_.size());
+  for (WordEntry& entry : word_map) {
+    const PostingList& list = entry.second;
+    if (!list.encoded()) {
+      for (const Posting& p : list.postings) {
+        doc_words_.words[p.doc].push_back(&entry);
+      }
+      continue;
+    }
+    for (PostingCursor cursor(list.view());
+         cursor.doc() != PostingCursor::kEnd; cursor.next()) {
+      doc_words_.words[cursor.doc()].push_back(&entry);
+    }
+  }
+}
+
+void WordIndex::remove_postings(DocId doc) {
+  if (doc >= doc_words_.words.size()) {
+    return;
+  }
+  for (WordEntry* entry : doc_words_.words[doc]) {
+    PostingList& list = entry->second;
+    if (list.encoded()) {
+      list.decode();
+    }
+    auto it = std::lower_bound(list.postings.begin(), list.postings.end(), doc,
+                               [](const Posting& p, DocId d) {
+                                 return p.doc < d;
+                               });
+    if (it != list.postings.end() && it->doc == doc) {
+      if (!list.positions.empty()) {
+        size_t at = positions_before(list.postings, it - list.postings.begin());
+        list.positions.erase(list.positions.begin() + at,
+                             list.positions.begin() + at + it->tf);
+      }
+      list.postings.erase(it);
+    }
+
+    // Only this document was in a list that is now empty, so nothing
+    // else points at it
+    if (list.postings.empty()) {
+      changed_words_.erase(entry->first);
+      word_map.erase(word_map.find(entry->first));
+      removed_terms_++;
+    } else {
+      changed_words_.insert(entry->first);
+    }
+  }
+  doc_words_.words[doc].clear();
 }
 
 vector<Result> WordIndex::lookup_word(const string& word) {
-  vector<Result> result;
-  
+  if (stats_stale_) {
+    finalize();
+  }
+
   // Check if the word exists in index
-  auto it = word_map.find(word);
-  if (it != word_map.end()) {
-    // For each document containing this word
-    for (const auto& doc_count_pair : it->second) {
-      // Create a Result with the document name and count
-      Result r;
-      r.doc_name = doc_count_pair.first;
-      r.rank = doc_count_pair.second;
-      result.push_back(r);
-    }
-    
-    // Sort results by rank in descending order
-    std::sort(result.begin(), result.end(),
-              [](const Result& a, const Result& b) {
-                return a.rank > b.rank;
-              });
+  PostingListView list;
+  std::list<PostingList> expansions;
+  if (!find_list(word, &list, &expansions)) {
+    return {};
+  }
+
+  vector<Hit> hits;
+  hits.reserve(list.size);
+  for (PostingCursor cursor(list); cursor.doc() != PostingCursor::kEnd;
+       cursor.next()) {
+    uint32_t tf = cursor.tf();
+    hits.push_back({cursor.doc(), static_cast<int>(tf), static_cast<double>(tf)});
   }
-  return result;
+  return to_results([this](DocId doc) { return doc_name(doc); }, hits);
 }
 
 vector<Result> WordIndex::lookup_query(const vector<string>& query) {
   if (query.empty()) {
     return {};
   }
-  
+
   if (query.size() == 1) {
     // If only one word then use lookup_word
     return lookup_word(query[0]);
   }
-  
-  // Get documents containing the first word
-  std::unordered_map<string, int> doc_ranks;
-  auto first_word_results = lookup_word(query[0]);
-  for (const auto& result : first_word_results) {
-    doc_ranks[result.doc_name] = result.rank;
-  }
-  
-  // For each additional word, keep only documents that also contain this word
-  for (size_t i = 1; i < query.size(); i++) {
-    auto word_results = lookup_word(query[i]);
-    
-    // Create a map of documents containing this word
-    std::unordered_map<string, int> word_docs;
-    for (const auto& result : word_results) {
-      word_docs[result.doc_name] = result.rank;
-    }
-    
-    // Remove documents that don't contain this word
-    std::vector<string> to_remove;
-    for (const auto& [doc, _] : doc_ranks) {
-      if (word_docs.find(doc) == word_docs.end()) {
-        to_remove.push_back(doc);
-      }
-    }
-    
-    for (const auto& doc : to_remove) {
-      doc_ranks.erase(doc);
-    }
-    
-    // Update ranks for remaining documents
-    for (auto& [doc, rank] : doc_ranks) {
-      if (word_docs.find(doc) != word_docs.end()) {
-        rank += word_docs[doc];
-      }
-    }
-  }
-  
-  // Convert map to vector of Results
+  if (stats_stale_) {
+    finalize();
+  }
+
+  vector<PostingListView> lists;
+  std::list<PostingList> expansions;
+  if (!query_lists(query, &lists, &expansions)) {
+    return {};
+  }
+
+  vector<Hit> hits;
+  intersect(lists, TermFrequencyScorer(),
+            [&hits](const Hit& hit) { hits.push_back(hit); });
+  return to_results([this](DocId doc) { return doc_name(doc); }, hits);
+}
+
+vector<Result> WordIndex::lookup_query(const vector<string>& query, size_t k,
+                                       size_t offset, size_t* num_matches,
+                                       Ranking ranking) {
+  vector<Hit> best =
+      top_query(query, page_end(offset, k), num_matches, ranking);
+  return page_results([this](DocId doc) { return doc_name(doc); }, best,
+                      offset);
+}
+
+vector<Result> WordIndex::lookup_any(const vector<string>& query, size_t k,
+                                     size_t offset, Ranking ranking,
+                                     size_t* num_scored) {
+  vector<Hit> best = top_any(query, page_end(offset, k), ranking, num_scored);
+  return page_results([this](DocId doc) { return doc_name(doc); }, best,
+                      offset);
+}
+
+vector<Result> WordIndex::lookup_phrases(const PhraseQuery& query, size_t k,
+                                         size_t offset, size_t* num_matches,
+                                         Ranking ranking) {
+  vector<Hit> best =
+      top_phrases(query, page_end(offset, k), num_matches, ranking);
+  return page_results([this](DocId doc) { return doc_name(doc); }, best,
+                      offset);
+}
+
+vector<Hit> WordIndex::top_query(const vector<string>& query, size_t n,
+                                 size_t* num_matches, Ranking ranking) {
+  if (num_matches != nullptr) {
+    *num_matches = 0;
+  }
+  if (stats_stale_) {
+    finalize();
+  }
+
+  vector<PostingListView> lists;
+  std::list<PostingList> expansions;
+  if (query.empty() || !query_lists(query, &lists, &expansions)) {
+    return {};
+  }
+
+  // Keep only the best n hits, so a page costs O(matches * log(n))
+  // rather than a sort of all matches. A document matches only if it is
+  // in the shortest list.
+  size_t matches = 0;
+  size_t shortest = lists[0].size;
+  for (const PostingListView& list : lists) {
+    shortest = std::min(shortest, list.size);
+  }
+  TopK top(n, shortest);
+  auto emit = [&top, &matches](const Hit& hit) {
+    top.push(hit);
+    matches++;
+  };
+
+  if (ranking == Ranking::kBM25) {
+    intersect(lists, BM25Scorer(lists, num_docs(), norms()), emit);
+  } else {
+    intersect(lists, TermFrequencyScorer(), emit);
+  }
+  if (num_matches != nullptr) {
+    *num_matches = matches;
+  }
+  return top.take();
+}
+
+vector<Hit> WordIndex::top_any(const vector<string>& query, size_t n,
+                               Ranking ranking, size_t* num_scored) {
+  size_t scored = 0;
+  if (num_scored != nullptr) {
+    *num_scored = 0;
+  }
+  if (n == 0) {
+    return {};
+  }
+  if (stats_stale_) {
+    finalize();
+  }
+
+  // Start a cursor on the posting list of every query word in the index.
+  // Words that are missing simply do not contribute to any document.
+  BM25Scorer bm25(num_docs(), norms());
+  vector<WandCursor> cursors;
+  std::list<PostingList> expansions;
+  for (const string& word : query) {
+    PostingListView list;
+    if (!find_list(word, &list, &expansions) || list.size == 0) {
+      continue;
+    }
+    WandCursor cursor{PostingCursor(list), cursors.size(), 1.0, 0};
+    if (ranking == Ranking::kBM25) {
+      bm25.add_term(list.size);
+      cursor.weight = bm25.weight(cursor.term);
+      cursor.max_score = cursor.weight * list.max_bm25;
+    } else {
+      cursor.max_score = list.max_tf;
+    }
+    cursors.push_back(cursor);
+  }
+
+  size_t candidates = 0;
+  for (const WandCursor& cursor : cursors) {
+    candidates += cursor.postings.size();
+  }
+  TopK top(n, candidates);
+  if (ranking == Ranking::kBM25) {
+    block_max_wand(&cursors, ranking, bm25, &top, &scored);
+  } else {
+    block_max_wand(&cursors, ranking, TermFrequencyScorer(), &top, &scored);
+  }
+  if (num_scored != nullptr) {
+    *num_scored = scored;
+  }
+  return top.take();
+}
+
+vector<Hit> WordIndex::top_phrases(const PhraseQuery& query, size_t n,
+                                   size_t* num_matches, Ranking ranking) {
+  if (!query.positional() || !has_positions()) {
+    return top_query(query.words, n, num_matches, ranking);
+  }
+  if (num_matches != nullptr) {
+    *num_matches = 0;
+  }
+  if (stats_stale_) {
+    finalize();
+  }
+
+  // Gather the lists in query order, then order them from the shortest
+  // to the longest like query_lists(), remembering where each word's
+  // cursor ends up
+  vector<PostingListView> by_word;
+  std::list<PostingList> expansions;
+  for (const string& word : query.words) {
+    PostingListView list;
+    if (!find_list(word, &list, &expansions)) {
+      return {};
+    }
+    by_word.push_back(list);
+  }
+  vector<size_t> order(by_word.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&by_word](size_t a, size_t b) {
+    return by_word[a].size < by_word[b].size;
+  });
+  vector<PostingListView> lists;
+  vector<size_t> slots(by_word.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    lists.push_back(by_word[order[i]]);
+    slots[order[i]] = i;
+  }
+
+  size_t matches = 0;
+  TopK top(n, lists[0].size);
+  auto emit = [&top, &matches](const Hit& hit) {
+    top.push(hit);
+    matches++;
+  };
+  PhraseMatcher matcher(query, slots);
+  auto accept = [&matcher](vector<PostingCursor>* cursors) {
+    return matcher(cursors);
+  };
+
+  if (ranking == Ranking::kBM25) {
+    intersect(lists, BM25Scorer(lists, num_docs(), norms()), accept, emit);
+  } else {
+    intersect(lists, TermFrequencyScorer(), accept, emit);
+  }
+  if (num_matches != nullptr) {
+    *num_matches = matches;
+  }
+  return top.take();
+}
+
+vector<Suggestion> WordIndex::suggest(std::string_view prefix, size_t k) {
+  if (stats_stale_) {
+    finalize();
+  }
+
+  vector<Suggestion> best;
+  for_each_prefix(prefix, [&best](std::string_view word,
+                                  const PostingListView& list) {
+    best.push_back({string(word), list.size});
+  });
+  auto more_docs = [](const Suggestion& a, const Suggestion& b) {
+    return a.num_docs > b.num_docs ||
+           (a.num_docs == b.num_docs && a.word < b.word);
+  };
+  if (best.size() > k) {
+    std::partial_sort(best.begin(), best.begin() + k, best.end(), more_docs);
+    best.resize(k);
+  } else {
+    std::sort(best.begin(), best.end(), more_docs);
+  }
+  return best;
+}
+
+size_t WordIndex::num_postings(const vector<string>& query) {
+  if (stats_stale_) {
+    finalize();
+  }
+
+  size_t total = 0;
+  std::list<PostingList> expansions;
+  for (const string& word : query) {
+    std::string_view fuzzy;
+    uint32_t max_distance = 0;
+    if ((word.size() > 1 && word.back() == '*') ||
+        parse_fuzzy(word, &fuzzy, &max_distance)) {
+      return std::numeric_limits<size_t>::max();
+    }
+    PostingListView list;
+    if (find_list(word, &list, &expansions)) {
+      total += list.size;
+    }
+  }
+  return total;
+}
+
+template <typename Visit>
+void WordIndex::for_each_prefix(std::string_view prefix, Visit visit) const {
+  auto has_prefix = [prefix](std::string_view word) {
+    return word.substr(0, prefix.size()) == prefix;
+  };
+
+  if (file_) {
+    TermDictionaryView dict = file_->terms();
+    for (TermCursor cursor(dict, dict.lower_bound(prefix));
+         !cursor.done() && has_prefix(cursor.term()); cursor.next()) {
+      visit(cursor.term(), file_->postings(cursor.index()));
+    }
+    return;
+  }
+
+  // The dictionary may still hold words that have since been removed, so
+  // every word is looked up in word_map too
+  TermDictionaryView dict = terms_.view();
+  for (TermCursor cursor(dict, dict.lower_bound(prefix));
+       !cursor.done() && has_prefix(cursor.term()); cursor.next()) {
+    auto it = word_map.find(cursor.term());
+    if (it != word_map.end()) {
+      visit(cursor.term(), it->second.view());
+    }
+  }
+  for (auto word = std::lower_bound(new_terms_.begin(), new_terms_.end(),
+                                    prefix);
+       word != new_terms_.end() && has_prefix(*word); ++word) {
+    auto it = word_map.find(*word);
+    if (it != word_map.end()) {
+      visit(*word, it->second.view());
+    }
+  }
+}
+
+template <typename Visit>
+void WordIndex::for_each_fuzzy(std::string_view word, uint32_t max_distance,
+                               Visit visit) const {
+  LevenshteinAutomaton automaton(word, max_distance);
+  vector<FuzzyMatch> matches;
+  if (file_) {
+    automaton.intersect(file_->terms(), &matches);
+    for (const FuzzyMatch& match : matches) {
+      visit(match.text, file_->postings(match.term));
+    }
+    return;
+  }
+
+  // Like for_each_prefix(), words of the dictionary may have been removed
+  // since, and the words added since are checked one by one
+  automaton.intersect(terms_.view(), &matches);
+  for (const FuzzyMatch& match : matches) {
+    auto it = word_map.find(match.text);
+    if (it != word_map.end()) {
+      visit(match.text, it->second.view());
+    }
+  }
+  for (const string& added : new_terms_) {
+    auto it = word_map.find(added);
+    if (it != word_map.end() && automaton.distance(added) <= max_distance) {
+      visit(added, it->second.view());
+    }
+  }
+}
+
+void WordIndex::build_terms() {
+  vector<std::string_view> words;
+  words.reserve(word_map.size());
+  for (const auto& [word, list] : word_map) {
+    words.push_back(word);
+  }
+  std::sort(words.begin(), words.end());
+  terms_.build(words);
+  new_terms_.clear();
+  removed_terms_ = 0;
+}
+
+bool WordIndex::find_list(const string& word, PostingListView* list,
+                          std::list<PostingList>* expansions) const {
+  if (word.size() > 1 && word.back() == '*') {
+    // Merge the lists of the words in the most documents, so that the
+    // cost of a short prefix stays bounded
+    std::string_view prefix(word.data(), word.size() - 1);
+    vector<std::pair<string, PostingListView>> words;
+    for_each_prefix(prefix, [&words](std::string_view w,
+                                     const PostingListView& l) {
+      words.emplace_back(string(w), l);
+    });
+    return merge_words(&words, kMaxPrefixTerms, norms(), list, expansions);
+  }
+
+  std::string_view fuzzy;
+  uint32_t max_distance = 0;
+  if (parse_fuzzy(word, &fuzzy, &max_distance)) {
+    // Only the closest words count, so a word that is spelled right
+    // matches just itself. Each distance costs much more to search than
+    // the one before, so the search stops at the first that finds any.
+    vector<std::pair<string, PostingListView>> words;
+    for (uint32_t distance = 0; distance <= max_distance && words.empty();
+         distance++) {
+      for_each_fuzzy(fuzzy, distance,
+                     [&words](std::string_view w, const PostingListView& l) {
+                       words.emplace_back(string(w), l);
+                     });
+    }
+    return merge_words(&words, kMaxFuzzyTerms, norms(), list, expansions);
+  }
+
+  if (file_) {
+    size_t term = file_->find(word);
+    if (term == file_->num_terms()) {
+      return false;
+    }
+    *list = file_->postings(term);
+    return true;
+  }
+
+  auto it = word_map.find(word);
+  if (it == word_map.end()) {
+    return false;
+  }
+  *list = it->second.view();
+  return true;
+}
+
+bool WordIndex::query_lists(const vector<string>& query,
+                            vector<PostingListView>* lists,
+                            std::list<PostingList>* expansions) const {
+  // Gather the posting list of every query word. A missing word means
+  // no document can contain the whole query.
+  lists->clear();
+  lists->reserve(query.size());
+  for (const string& word : query) {
+    PostingListView list;
+    if (!find_list(word, &list, expansions)) {
+      return false;
+    }
+    lists->push_back(list);
+  }
+
+  // Intersect from the rarest word to the most common one so the
+  // shortest list drives the search and the longer lists are only
+  // probed at the documents that survive so far
+  std::stable_sort(lists->begin(), lists->end(),
+                   [](const PostingListView& a, const PostingListView& b) {
+                     return a.size < b.size;
+                   });
+  return true;
+}
+
+template <typename Scorer, typename Emit>
+static void intersect(const vector<PostingListView>& lists,
+                      const Scorer& scorer, Emit emit) {
+  intersect(lists, scorer,
+            [](vector<PostingCursor>* /* cursors */) { return true; }, emit);
+}
+
+template <typename Scorer, typename Accept, typename Emit>
+static void intersect(const vector<PostingListView>& lists,
+                      const Scorer& scorer, Accept accept, Emit emit) {
+  vector<PostingCursor> cursors(lists.begin(), lists.end());
+  PostingCursor& lead = cursors[0];
+
+  while (lead.doc() != PostingCursor::kEnd) {
+    DocId doc = lead.doc();
+    int rank = static_cast<int>(lead.tf());
+    double score = scorer.score(0, doc, lead.tf());
+    bool match = true;
+
+    for (size_t i = 1; i < cursors.size(); i++) {
+      PostingCursor& cursor = cursors[i];
+      cursor.advance(doc);
+      if (cursor.doc() == PostingCursor::kEnd) {
+        // This list is exhausted, so nothing after doc can match
+        return;
+      }
+      if (cursor.doc() != doc) {
+        // Skip the lead list ahead to the next document this list has
+        lead.advance(cursor.doc());
+        match = false;
+        break;
+      }
+      rank += static_cast<int>(cursor.tf());
+      score += scorer.score(i, doc, cursor.tf());
+    }
+
+    if (match) {
+      if (accept(&cursors)) {
+        emit(Hit{doc, rank, score});
+      }
+      lead.next();
+    }
+  }
+}
+
+static size_t positions_before(const vector<Posting>& postings, size_t n) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    count += postings[i].tf;
+  }
+  return count;
+}
+
+static void sort_postings(PostingList* list) {
+  vector<Posting>& postings = list->postings;
+  auto by_doc = [](const Posting& a, const Posting& b) {
+    return a.doc < b.doc;
+  };
+  if (std::is_sorted(postings.begin(), postings.end(), by_doc)) {
+    return;
+  }
+  if (list->positions.empty()) {
+    std::sort(postings.begin(), postings.end(), by_doc);
+    return;
+  }
+
+  // Sort the order of the postings, then copy both arrays in that order
+  vector<size_t> starts(postings.size());
+  size_t start = 0;
+  for (size_t i = 0; i < postings.size(); i++) {
+    starts[i] = start;
+    start += postings[i].tf;
+  }
+  vector<size_t> order(postings.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&postings](size_t a, size_t b) {
+    return postings[a].doc < postings[b].doc;
+  });
+
+  vector<Posting> sorted;
+  vector<uint32_t> positions;
+  sorted.reserve(postings.size());
+  positions.reserve(list->positions.size());
+  for (size_t i : order) {
+    sorted.push_back(postings[i]);
+    auto first = list->positions.begin() + starts[i];
+    positions.insert(positions.end(), first, first + postings[i].tf);
+  }
+  postings = std::move(sorted);
+  list->positions = std::move(positions);
+}
+
+PhraseMatcher::PhraseMatcher(const PhraseQuery& query,
+                             const vector<size_t>& slots)
+    : positions_(slots.size()), decoded_(slots.size(), false) {
+  // Every word of a constraint is one of query.words; repeated words
+  // share the cursor of their first occurance
+  auto slot = [&query, &slots](const string& word) {
+    auto it = std::find(query.words.begin(), query.words.end(), word);
+    return slots[it - query.words.begin()];
+  };
+  for (const PhraseQuery::Constraint& c : query.constraints) {
+    Constraint constraint;
+    for (const PhraseQuery::Phrase& phrase : c.operands) {
+      Operand operand;
+      for (const string& word : phrase) {
+        operand.push_back(slot(word));
+      }
+      constraint.operands.push_back(std::move(operand));
+    }
+    constraint.distances = c.distances;
+    constraints_.push_back(std::move(constraint));
+  }
+}
+
+bool PhraseMatcher::operator()(vector<PostingCursor>* cursors) {
+  cursors_ = cursors;
+  std::fill(decoded_.begin(), decoded_.end(), false);
+  for (const Constraint& constraint : constraints_) {
+    if (!matches(constraint)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const vector<uint32_t>& PhraseMatcher::positions(size_t slot) {
+  if (!decoded_[slot]) {
+    // Corrupt positions read as none, so the document does not match
+    (*cursors_)[slot].positions(&positions_[slot]);
+    decoded_[slot] = true;
+  }
+  return positions_[slot];
+}
+
+void PhraseMatcher::phrase_starts(const Operand& operand,
+                                  vector<uint32_t>* starts) {
+  *starts = positions(operand[0]);
+
+  // Keep the starts s at which word j is found at s + j, walking both
+  // sorted lists together
+  for (size_t j = 1; j < operand.size() && !starts->empty(); j++) {
+    const vector<uint32_t>& next = positions(operand[j]);
+    size_t kept = 0;
+    size_t n = 0;
+    for (uint32_t s : *starts) {
+      uint64_t want = uint64_t{s} + j;
+      while (n < next.size() && next[n] < want) {
+        n++;
+      }
+      if (n == next.size()) {
+        break;
+      }
+      if (next[n] == want) {
+        (*starts)[kept++] = s;
+      }
+    }
+    starts->resize(kept);
+  }
+}
+
+bool PhraseMatcher::matches(const Constraint& constraint) {
+  phrase_starts(constraint.operands[0], &starts_);
+
+  // Keep the starts of each operand that are within its distance of a
+  // start kept for the operand before it, on either side, without
+  // overlapping it. NEAR/1 means the two are next to each other.
+  for (size_t i = 1; i < constraint.operands.size() && !starts_.empty(); i++) {
+    auto prev_len = static_cast<int64_t>(constraint.operands[i - 1].size());
+    auto len = static_cast<int64_t>(constraint.operands[i].size());
+    auto distance = static_cast<int64_t>(constraint.distances[i - 1]);
+
+    phrase_starts(constraint.operands[i], &next_starts_);
+    size_t kept = 0;
+    for (uint32_t start : next_starts_) {
+      auto p = static_cast<int64_t>(start);
+      // The previous operand either ends in [p - distance, p - 1], or
+      // starts in [p + len, p + len - 1 + distance]
+      auto near = [this](int64_t lo, int64_t hi) {
+        if (hi < 0 || lo > UINT32_MAX) {
+          return false;
+        }
+        auto it = std::lower_bound(
+            starts_.begin(), starts_.end(),
+            static_cast<uint32_t>(std::max<int64_t>(lo, 0)));
+        return it != starts_.end() && *it <= hi;
+      };
+      if (near(p - distance - prev_len + 1, p - prev_len) ||
+          near(p + len, p + len - 1 + distance)) {
+        next_starts_[kept++] = start;
+      }
+    }
+    next_starts_.resize(kept);
+    starts_.swap(next_starts_);
+  }
+  return !starts_.empty();
+}
+
+static double average_length(const vector<uint32_t>& doc_lens) {
+  double total_len = 0;
+  for (uint32_t len : doc_lens) {
+    total_len += len;
+  }
+  return doc_lens.empty() ? 0 : total_len / doc_lens.size();
+}
+
+static float bm25_norm(uint32_t len, double avg_len) {
+  double rel_len = avg_len > 0 ? len / avg_len : 1.0;
+  return static_cast<float>(kBM25K1 * (1.0 - kBM25B + kBM25B * rel_len));
+}
+
+static void summarize(PostingList* list, const float* norms) {
+  // Lists that were already compressed have to be decoded first, since
+  // the bounds depend on every document's length
+  if (list->encoded()) {
+    list->decode();
+  }
+  list->blocks.clear();
+  list->max_tf = 0;
+  list->max_bm25 = 0;
+  for (size_t start = 0; start < list->postings.size();
+       start += kPostingBlockSize) {
+    size_t end = std::min(start + kPostingBlockSize, list->postings.size());
+    BlockMax block{list->postings[end - 1].doc, 0, 0, 0};
+    for (size_t i = start; i < end; i++) {
+      const Posting& p = list->postings[i];
+      block.max_tf = std::max(block.max_tf, p.tf);
+      block.max_bm25 = std::max(block.max_bm25, bm25_bound(p.tf, norms[p.doc]));
+    }
+    list->blocks.push_back(block);
+    list->max_tf = std::max(list->max_tf, block.max_tf);
+    list->max_bm25 = std::max(list->max_bm25, block.max_bm25);
+  }
+  list->encode(PostingCodec::kBP128);
+}
+
+static void union_lists(const vector<PostingListView>& lists,
+                        const float* norms, PostingList* out) {
+  // A heap of the cursors that are not done, with the lowest DocId on top
+  vector<PostingCursor> cursors(lists.begin(), lists.end());
+  auto later = [&cursors](size_t a, size_t b) {
+    return cursors[a].doc() > cursors[b].doc();
+  };
+  vector<size_t> heap;
+  bool positions = true;
+  for (size_t i = 0; i < cursors.size(); i++) {
+    positions = positions && lists[i].positions != nullptr;
+    if (cursors[i].doc() != PostingCursor::kEnd) {
+      heap.push_back(i);
+    }
+  }
+  std::make_heap(heap.begin(), heap.end(), later);
+
+  vector<uint32_t> doc_positions;
+  vector<uint32_t> word_positions;
+  while (!heap.empty()) {
+    DocId doc = cursors[heap.front()].doc();
+    uint32_t tf = 0;
+    doc_positions.clear();
+    while (!heap.empty() && cursors[heap.front()].doc() == doc) {
+      std::pop_heap(heap.begin(), heap.end(), later);
+      PostingCursor& cursor = cursors[heap.back()];
+      tf += cursor.tf();
+      if (positions) {
+        positions = cursor.positions(&word_positions);
+        doc_positions.insert(doc_positions.end(), word_positions.begin(),
+                             word_positions.end());
+      }
+      cursor.next();
+      if (cursor.doc() != PostingCursor::kEnd) {
+        std::push_heap(heap.begin(), heap.end(), later);
+      } else {
+        heap.pop_back();
+      }
+    }
+    out->postings.push_back({doc, tf});
+
+    // Different words are never at the same position
+    if (positions) {
+      std::sort(doc_positions.begin(), doc_positions.end());
+      out->positions.insert(out->positions.end(), doc_positions.begin(),
+                            doc_positions.end());
+    }
+  }
+  if (!positions) {
+    out->positions.clear();
+  }
+  summarize(out, norms);
+}
+
+static bool merge_words(vector<std::pair<string, PostingListView>>* words,
+                        size_t limit, const float* norms,
+                        PostingListView* list,
+                        std::list<PostingList>* expansions) {
+  if (words->empty()) {
+    return false;
+  }
+  if (words->size() == 1) {
+    *list = (*words)[0].second;
+    return true;
+  }
+  auto more_docs = [](const auto& a, const auto& b) {
+    return a.second.size > b.second.size ||
+           (a.second.size == b.second.size && a.first < b.first);
+  };
+  size_t keep = std::min(words->size(), limit);
+  std::partial_sort(words->begin(), words->begin() + keep, words->end(),
+                    more_docs);
+  vector<PostingListView> lists;
+  for (size_t i = 0; i < keep; i++) {
+    lists.push_back((*words)[i].second);
+  }
+  expansions->emplace_back();
+  union_lists(lists, norms, &expansions->back());
+  *list = expansions->back().view();
+  return true;
+}
+
+static bool parse_fuzzy(const string& query_word, std::string_view* word,
+                        uint32_t* max_distance) {
+  size_t tilde = query_word.rfind('~');
+  if (tilde == string::npos || tilde == 0) {
+    return false;
+  }
+  std::string_view distance(query_word);
+  distance.remove_prefix(tilde + 1);
+  *word = std::string_view(query_word.data(), tilde);
+  if (distance.empty()) {
+    *max_distance = (word->size() <= 2) ? 0 : (word->size() <= 5) ? 1 : 2;
+    return true;
+  }
+  if (distance.size() != 1 || distance[0] < '0' ||
+      static_cast<uint32_t>(distance[0] - '0') >
+          LevenshteinAutomaton::kMaxDistance) {
+    return false;
+  }
+  *max_distance = static_cast<uint32_t>(distance[0] - '0');
+  return true;
+}
+
+static size_t page_end(size_t offset, size_t k) {
+  return (offset > SIZE_MAX - k) ? SIZE_MAX : offset + k;
+}
+
+static float bm25_bound(uint32_t tf, float norm) {
+  auto bound = static_cast<float>(tf / (tf + static_cast<double>(norm)));
+  return std::nextafter(bound, std::numeric_limits<float>::infinity());
+}
+
+template <typename Scorer>
+static void block_max_wand(vector<WandCursor>* cursors, Ranking ranking,
+                           const Scorer& scorer, TopK* top,
+                           size_t* num_scored) {
+  // Cursors hold a decoded block each, so sort pointers to them
+  vector<WandCursor*> cs;
+  for (WandCursor& cursor : *cursors) {
+    cs.push_back(&cursor);
+  }
+  auto block_bound = [ranking](const WandCursor& c,
+                               const BlockMax* block) -> double {
+    if (block == nullptr) {
+      return 0;
+    }
+    return ranking == Ranking::kBM25 ? c.weight * block->max_bm25
+                                     : static_cast<double>(block->max_tf);
+  };
+  vector<const BlockMax*> blocks(cs.size());
+
+  while (true) {
+    std::sort(cs.begin(), cs.end(),
+              [](const WandCursor* a, const WandCursor* b) {
+                return a->postings.doc() < b->postings.doc();
+              });
+
+    // Until the heap is full every document gets in, so nothing can be
+    // skipped. Afterwards a document has to score strictly above the worst
+    // hit kept, since it loses ties to the lower DocIds already kept.
+    double threshold = -1;
+    if (top->full()) {
+      threshold = top->worst().score;
+      threshold -= threshold * kBoundSlack;
+    }
+
+    // The pivot is the first cursor at which the words seen so far could
+    // add up to more than the threshold. No document before the pivot's
+    // can, since only the cursors before the pivot contain it.
+    double bound = 0;
+    size_t pivot = cs.size();
+    for (size_t i = 0;
+         i < cs.size() && cs[i]->postings.doc() != PostingCursor::kEnd; i++) {
+      bound += cs[i]->max_score;
+      if (bound > threshold) {
+        pivot = i;
+        break;
+      }
+    }
+    if (pivot == cs.size()) {
+      return;
+    }
+    DocId doc = cs[pivot]->postings.doc();
+    while (pivot + 1 < cs.size() && cs[pivot + 1]->postings.doc() == doc) {
+      pivot++;
+    }
+
+    // Tighten the bound with the maxima of the blocks that would hold doc
+    double block_sum = 0;
+    for (size_t i = 0; i <= pivot; i++) {
+      blocks[i] = cs[i]->postings.block_for(doc);
+      block_sum += block_bound(*cs[i], blocks[i]);
+    }
+
+    if (block_sum > threshold) {
+      if (cs[0]->postings.doc() == doc) {
+        // Every cursor up to the pivot is on doc, so score it fully
+        Hit hit{doc, 0, 0};
+        for (size_t i = 0; i <= pivot; i++) {
+          uint32_t tf = cs[i]->postings.tf();
+          hit.rank += static_cast<int>(tf);
+          hit.score += scorer.score(cs[i]->term, doc, tf);
+          cs[i]->postings.next();
+        }
+        *num_scored += pivot + 1;
+        top->push(hit);
+      } else {
+        // Bring the cursors that are behind up to the pivot document
+        for (size_t i = 0; i < pivot && cs[i]->postings.doc() < doc; i++) {
+          cs[i]->postings.advance(doc);
+        }
+      }
+    } else {
+      // Nothing up to the end of the current blocks can make it, so jump
+      // every cursor up to the pivot past them, or to the next cursor's
+      // document if that comes first
+      DocId next = PostingCursor::kEnd;
+      if (pivot + 1 < cs.size()) {
+        next = cs[pivot + 1]->postings.doc();
+      }
+      for (size_t i = 0; i <= pivot; i++) {
+        if (blocks[i] != nullptr) {
+          next = std::min(next, blocks[i]->last_doc + 1);
+        }
+      }
+      for (size_t i = 0; i <= pivot; i++) {
+        cs[i]->postings.advance(next);
+      }
+    }
+  }
+}
+
+template <typename DocName>
+static vector<Result> page_results(DocName doc_name, const vector<Hit>& best,
+                                   size_t offset) {
   vector<Result> results;
-  for (const auto& [doc, rank] : doc_ranks) {
+  results.reserve(best.size() - std::min(offset, best.size()));
+  for (size_t i = offset; i < best.size(); i++) {
     Result r;
-    r.doc_name = doc;
-    r.rank = rank;
-    results.push_back(r);
-  }
-  
-  // Sort by rank in descending order
-  std::sort(results.begin(), results.end(), 
-            [](const Result& a, const Result& b) {
-              return a.rank > b.rank;
-            });
-  
+    r.doc_name = doc_name(best[i].doc);
+    r.rank = best[i].rank;
+    r.score = best[i].score;
+    results.push_back(std::move(r));
+  }
+  return results;
+}
+
+template <typename DocName>
+static vector<Result> to_results(DocName doc_name, vector<Hit>& hits) {
+  // Sort by score in descending order
+  std::stable_sort(hits.begin(), hits.end(),
+                   [](const Hit& a, const Hit& b) {
+                     return a.score > b.score;
+                   });
+
+  vector<Result> results;
+  results.reserve(hits.size());
+  for (const Hit& hit : hits) {
+    Result r;
+    r.doc_name = doc_name(hit.doc);
+    r.rank = hit.rank;
+    r.score = hit.score;
+    results.push_back(std::move(r));
+  }
   return results;
 }
 
-}  // namespace searchserver
\ No newline at end of file
+}  // namespace searchserver
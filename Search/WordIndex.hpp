@@ -1,40 +1,184 @@
 #ifndef WORD_INDEX_H_
 #define WORD_INDEX_H_
 
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <optional>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <string>
+#include <string_view>
 
+#include "./IndexFile.hpp"
+#include "./PhraseQuery.hpp"
+#include "./PostingList.hpp"
 #include "./Result.hpp"
+#include "./TermDictionary.hpp"
 
 using std::string;
 using std::vector;
 
 namespace searchserver {
 
+// The functions that can be used to order the results of a query
+enum class Ranking {
+  // Okapi BM25: weighs rare words above common ones and normalizes for
+  // document length, so long documents do not dominate the results
+  kBM25,
+
+  // The total number of occurances of the query words in the document
+  kTermFrequency,
+};
+
+// A word of the index suggested to complete a prefix, and the number of
+// documents it is in
+struct Suggestion {
+  string word;
+  size_t num_docs;
+};
+
+// A document a lookup found, before it is named: its total count of the
+// query words, and the score given to it by the ranking function
+struct Hit {
+  DocId doc;
+  int rank;
+  double score;
+};
+
 // A WordIndex is used to keep track of which documents contain certain words
 // and how many occurances there are of that word in the document
+//
+// An index is either built in memory by recording words into it, or
+// loaded from an index file written by save(). A loaded index answers
+// lookups straight from the mapped file; recording into it first copies
+// the whole index into memory.
 class WordIndex {
  public:
+  // The most words a prefix query such as "foo*" stands for: the ones
+  // found in the most documents
+  static constexpr size_t kMaxPrefixTerms = 128;
+
+  // The most words a fuzzy query word such as "foo~" stands for: the ones
+  // found in the most documents out of the closest to it
+  static constexpr size_t kMaxFuzzyTerms = 32;
 
   // Constructs an empty WordIndex that stores
   // no words or documents to start
   WordIndex();
 
+  // Constructs an empty WordIndex that also records where each word
+  // occurs in each document if positions is true, which lets it answer
+  // phrase and proximity queries at the cost of a larger index
+  explicit WordIndex(bool positions);
+
   // default destructor
   ~WordIndex() = default;
 
   // Returns the number of unique words recorded in the index
   size_t num_words();
+
+  // Returns the number of unique documents recorded in the index
+  size_t num_docs();
+
+  // Returns true if the index records the position of every word, as
+  // lookup_phrases() needs
+  bool has_positions() const;
+
+  // Precomputes the per-document lengths and collection statistics used
+  // to rank results with BM25, and the per-word and per-block score upper
+  // bounds used by lookup_any, then compresses every posting list into
+  // blocks of delta-encoded DocIds. crawl_filetree calls this once every
+  // document has been recorded; if more words are recorded afterwards,
+  // the next lookup recomputes them first.
+  void finalize();
+
+  // Returns a number that identifies the current contents of the index.
+  // It changes whenever the index is finalized or loaded, so anything
+  // computed from a lookup can be cached under it and thrown away once
+  // it no longer matches. No two indexes in a process share a
+  // generation unless one is a copy of the other. Finalizes the index
+  // first if needed.
+  uint64_t generation();
   
   // Record an occurance of a document having the specified word show up in it
   // 
   // Arguments:
-  //  - word: the word found in the specified document
+  //  - word: the word found in the specified document. It is only copied
+  //    the first time the word is recorded, so it may point into a
+  //    buffer that is about to be reused.
   //  - doc_name: the name of the document the word occurance showed up in
   //
   // Returns: None
-  void record(const string& word, const string& doc_name);
+  void record(std::string_view word, const string& doc_name);
+
+  // Replaces everything recorded for a document with a new list of its
+  // words, as when the file changed on disk. The document keeps its
+  // DocId, or is added if it is new.
+  //
+  // Unlike record(), the next finalize() only rebuilds the posting lists
+  // of the words the document used to contain or now contains, and
+  // normalizes lengths against the average document length from the
+  // last full finalize(), so a small change costs milliseconds however
+  // large the index is. A full finalize() still happens once the average
+  // length drifts by more than 10%.
+  //
+  // Arguments:
+  //  - doc_name: the document to replace
+  //  - words: every word in the document, in any order, with repeats
+  //
+  // Returns: None
+  void update_document(const string& doc_name, const vector<string>& words);
+
+  // Removes every posting of a document, as when the file was deleted.
+  // Its name stays in the document table with no words, so that it
+  // keeps its DocId if it is added again. Like update_document(), only
+  // the posting lists the document was in are rebuilt.
+  //
+  // Arguments:
+  //  - doc_name: the document to remove; nothing happens if it is not
+  //    in the index
+  //
+  // Returns: None
+  void remove_document(const string& doc_name);
+
+  // Writes the index to a file that load() can map back in. Finalizes the
+  // index first if needed.
+  //
+  // Arguments:
+  //  - path: the file to write
+  //
+  // Returns:
+  //  - true if the whole file was written
+  bool save(const string& path);
+
+  // Maps an index file written by save() and serves lookups directly
+  // from the mapped pages, so loading takes constant time regardless of
+  // the size of the index.
+  //
+  // Arguments:
+  //  - path: the file to load
+  //
+  // Returns:
+  //  - the loaded index, or nullopt if the file could not be mapped or is
+  //    not a valid index file
+  static std::optional<WordIndex> load(const string& path);
+
+  // Moves every document and posting of a set of partial indexes into
+  // this index, which must be empty. The parts must have been built from
+  // disjoint sets of documents. Documents are given DocIds in the order
+  // their names appear in doc_order, so the result is the same as if the
+  // documents had been recorded into a single index in that order.
+  //
+  // Arguments:
+  //  - parts: the partial indexes, which are left empty
+  //  - doc_order: the names of the documents in the order to number
+  //    them; names that no part recorded are skipped
+  //
+  // Returns: None
+  void merge(vector<WordIndex>* parts, const vector<string>& doc_order);
 
   // Lookup a word in the index, getting a list of all documents that contain the word
   // and a rank which is the number of occurances of that word in the document
@@ -58,6 +202,113 @@ class WordIndex {
   //    number of recorded occurances of the each query word in that document.
   vector<Result> lookup_query(const vector<string>& query);
 
+  // Lookup a query like above, but only return one page of the ranked
+  // results: the k best documents after skipping the best offset ones.
+  // Only offset + k results are ever kept while scanning, so the cost of
+  // ranking does not grow with the number of matching documents.
+  //
+  // Results are ordered by score in descending order, with ties broken by
+  // the order the documents were first recorded in, so consecutive pages
+  // never overlap.
+  //
+  // Arguments:
+  //  - query: the words we are looking up results for
+  //  - k: the maximum number of results to return
+  //  - offset: the number of best results to skip
+  //  - num_matches: if not null, set to the total number of documents
+  //    that matched the query
+  //  - ranking: the function used to score and order the results
+  //
+  // Returns:
+  //  - At most k results, as described for lookup_query above. Each
+  //    result's score is set by the chosen ranking.
+  vector<Result> lookup_query(const vector<string>& query, size_t k,
+                              size_t offset, size_t* num_matches = nullptr,
+                              Ranking ranking = Ranking::kBM25);
+
+  // Lookup a query, getting one page of the documents that contain any of
+  // the words in the query, ranked by the sum of the scores of the words
+  // they contain. Uses Block-Max WAND: postings are only scored if the
+  // upper bounds of their word and block show they could still make it
+  // into the top offset + k, so common words rarely need a full scan.
+  //
+  // Arguments:
+  //  - query: the words we are looking up results for
+  //  - k: the maximum number of results to return
+  //  - offset: the number of best results to skip
+  //  - ranking: the function used to score and order the results
+  //  - num_scored: if not null, set to the number of postings that were
+  //    scored, as opposed to skipped
+  //
+  // Returns:
+  //  - At most k results, ordered like the paged lookup_query. Each
+  //    result's rank is the total number of occurances of the query words
+  //    in the document.
+  vector<Result> lookup_any(const vector<string>& query, size_t k,
+                            size_t offset, Ranking ranking = Ranking::kBM25,
+                            size_t* num_scored = nullptr);
+
+  // Lookup a query with phrases and proximity operators, getting one page
+  // of the documents that contain every word of the query and satisfy
+  // every one of its constraints. Documents are first found by
+  // intersecting the posting lists like the paged lookup_query, and
+  // positions are only decoded for the documents that survive that, and
+  // only for the words the constraints use.
+  //
+  // If the query has no constraints, or the index does not record
+  // positions, this is the paged lookup_query of query.words.
+  //
+  // Arguments:
+  //  - query: the parsed query
+  //  - k: the maximum number of results to return
+  //  - offset: the number of best results to skip
+  //  - num_matches: if not null, set to the total number of documents
+  //    that matched the query
+  //  - ranking: the function used to score and order the results
+  //
+  // Returns:
+  //  - At most k results, ordered and scored like the paged lookup_query
+  vector<Result> lookup_phrases(const PhraseQuery& query, size_t k,
+                                size_t offset, size_t* num_matches = nullptr,
+                                Ranking ranking = Ranking::kBM25);
+
+  // The paged lookups above, returning the best n documents as hits,
+  // best first, without naming them. A ShardedIndex merges these from
+  // every shard and names only the documents of the page it returns.
+  vector<Hit> top_query(const vector<string>& query, size_t n,
+                        size_t* num_matches = nullptr,
+                        Ranking ranking = Ranking::kBM25);
+  vector<Hit> top_any(const vector<string>& query, size_t n,
+                      Ranking ranking = Ranking::kBM25,
+                      size_t* num_scored = nullptr);
+  vector<Hit> top_phrases(const PhraseQuery& query, size_t n,
+                          size_t* num_matches = nullptr,
+                          Ranking ranking = Ranking::kBM25);
+
+  // Returns the name of a document
+  std::string_view doc_name(DocId doc) const;
+
+  // Lookup the words of the index that start with a prefix, getting the
+  // ones found in the most documents. The words are found in the sorted
+  // term dictionary, so the cost grows with the number that start with
+  // the prefix rather than the size of the vocabulary.
+  //
+  // Arguments:
+  //  - prefix: what the words start with
+  //  - k: the maximum number of words to return
+  //
+  // Returns:
+  //  - At most k words, from the one in the most documents down, with
+  //    ties in sorted order
+  vector<Suggestion> suggest(std::string_view prefix, size_t k);
+
+  // Returns the total length of the posting lists of the words of a
+  // query, which bounds the number of postings a lookup of it goes
+  // through. Words like "foo*" and "foo~", which stand for words that
+  // would have to be looked up first, count as more than any index has.
+  // Like the lookups, finalizes the index first if it has changed.
+  size_t num_postings(const vector<string>& query);
+
   // default move, delete copy
   WordIndex(const WordIndex& other) = default;
   WordIndex& operator=(const WordIndex& other) = default;
@@ -65,8 +316,151 @@ class WordIndex {
   WordIndex& operator=(WordIndex&& other) = default;
 
  private:
-  // Map from words to another map of document names and their counts
-  std::unordered_map<string, std::unordered_map<string, int>> word_map;
+  // Returns the DocId of the named document, adding it to the
+  // document table if it has not been seen before
+  DocId doc_id(const string& doc_name);
+
+  // Finds the posting list of a word. Returns false if the word is not
+  // in the index.
+  //
+  // A word that ends in '*' stands for the kMaxPrefixTerms words in the
+  // most documents that start with the rest of it. Their posting lists
+  // are merged into one, which is kept in expansions for as long as the
+  // view of it is used. Returns false if no word starts with the prefix.
+  // expansions is a list so that a lookup with no such words, which is
+  // most of them, allocates nothing for it.
+  //
+  // A word that ends in '~', optionally followed by the most edits from
+  // 0 to 2, stands in the same way for the kMaxFuzzyTerms words in the
+  // most documents that are the fewest edits away from the rest of it.
+  // Without a number, how many edits are allowed depends on the length
+  // of the word.
+  bool find_list(const string& word, PostingListView* list,
+                 std::list<PostingList>* expansions) const;
+
+  // Collects the posting list of every word in the query into lists,
+  // ordered from the shortest list to the longest, keeping any merged
+  // lists of prefixes in expansions. Returns false if any word is not in
+  // the index, in which case nothing can match.
+  bool query_lists(const vector<string>& query,
+                   vector<PostingListView>* lists,
+                   std::list<PostingList>* expansions) const;
+
+  // Calls visit(word, list) for every word of the index that starts with
+  // prefix, with its posting list, in no particular order
+  template <typename Visit>
+  void for_each_prefix(std::string_view prefix, Visit visit) const;
+
+  // Calls visit(word, list) for every word of the index at most
+  // max_distance edits away from word, with its posting list, in no
+  // particular order
+  template <typename Visit>
+  void for_each_fuzzy(std::string_view word, uint32_t max_distance,
+                      Visit visit) const;
+
+  // Rebuilds terms_ from the words of word_map
+  void build_terms();
+
+  // Adds an occurance of a word at a position in a document to the word's
+  // posting list
+  void add_posting(PostingList* list, DocId doc, uint32_t position);
+
+  // Returns the BM25 length normalization of every document
+  const float* norms() const;
+
+  // Copies an index that was loaded from a file into memory, so that it
+  // can be modified
+  void unmap();
+
+  // A word and its posting list, as stored in word_map
+  using WordEntry = std::pair<const string, PostingList>;
+
+  // Builds doc_words_ from the posting lists, if it is not built yet
+  void track_documents();
+
+  // Removes a document's postings from every list it is in, marking the
+  // lists to be rebuilt and erasing the ones left empty
+  void remove_postings(DocId doc);
+
+  // Rebuilds only the posting lists and document normalizations that
+  // update_document() and remove_document() changed
+  void finalize_changes();
+
+  // Document table: docs_[id] is the name of the document with that id,
+  // and doc_ids_ maps a name back to its id. Each document name is
+  // stored here once instead of once per word it contains.
+  vector<string> docs_;
+  std::unordered_map<string, DocId> doc_ids_;
+
+  // The number of words recorded for each document, and the BM25 length
+  // normalization computed from it by finalize(). stats_stale_ is set
+  // whenever a word is recorded after the last finalize().
+  vector<uint32_t> doc_lens_;
+  vector<float> norms_;
+  bool stats_stale_ = false;
+
+  // Set by record() and merge(), whose changes are only tracked by
+  // stats_stale_, so the next finalize() has to rebuild every list.
+  // Otherwise finalize() only rebuilds what changed_words_ and
+  // changed_docs_ name, normalizing against avg_len_, the average
+  // document length at the last full finalize().
+  bool rebuild_all_ = true;
+  double avg_len_ = 0;
+  std::unordered_set<string> changed_words_;
+  vector<DocId> changed_docs_;
+
+  // For each DocId, the words whose posting lists contain the document,
+  // so that its postings can be found and removed without searching
+  // every list. Built on the first update_document() or
+  // remove_document(), and dropped by anything else that adds postings.
+  // The pointers are only valid for the index they were taken from, so
+  // a copied index starts without them and rebuilds them when needed.
+  struct DocWords {
+    DocWords() = default;
+    DocWords(const DocWords& /* other */) {}
+    DocWords& operator=(const DocWords& /* other */) {
+      words.clear();
+      return *this;
+    }
+    DocWords(DocWords&& other) = default;
+    DocWords& operator=(DocWords&& other) = default;
+
+    vector<vector<WordEntry*>> words;
+  };
+  DocWords doc_words_;
+
+  // Set to a new value by every finalize() and load(), see generation()
+  uint64_t generation_ = 0;
+
+  // Whether record() and update_document() keep the position of every
+  // word in the posting lists, see PostingList::positions
+  bool positions_ = false;
+
+  // Hashes strings and string_views alike, so that word_map can be
+  // searched for a string_view without building a string from it
+  struct WordHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view word) const {
+      return std::hash<std::string_view>()(word);
+    }
+  };
+
+  // Map from words to their posting lists. Each list is kept sorted by
+  // DocId, with one entry per document, and compressed by finalize().
+  std::unordered_map<string, PostingList, WordHash, std::equal_to<>> word_map;
+
+  // The words of word_map in sorted order, for prefix lookups, as of the
+  // last full finalize(). Words that update_document() adds afterwards
+  // are kept in new_terms_, in sorted order, and words it removes stay
+  // in terms_ but not in word_map, counted by removed_terms_, until
+  // enough have changed for finalize() to rebuild terms_.
+  TermDictionary terms_;
+  vector<string> new_terms_;
+  size_t removed_terms_ = 0;
+
+  // The index file this index was loaded from, if any. While it is set,
+  // every member above is empty and all lookups read from the file.
+  std::shared_ptr<const IndexFile> file_;
 };
 
 }
@@ -0,0 +1,176 @@
+// A fuzz test of find_header_end() and HttpRequest::parse().
+//
+// Each input is treated as bytes a client sent. The end of the first
+// header is found in one call and again with the input arriving in
+// pieces, and both must agree with a plain search for "\r\n\r\n". The
+// header is then parsed, and everything the parser hands back must lie
+// inside the header and be well formed.
+//
+// Built with libFuzzer (-fsanitize=fuzzer -DUSE_LIBFUZZER) this is just
+// the entry point. Otherwise it has its own main, which mutates a few
+// valid requests at random and runs each result through the same checks:
+//
+//   ./fuzz_request [iterations] [seed]
+//
+// The Makefile builds it with AddressSanitizer and UBSan either way.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./HttpRequest.hpp"
+
+using searchserver::find_header_end;
+using searchserver::HttpRequest;
+
+// Aborts with a message if a check fails, so that the fuzzer saves the
+// input that caused it
+static void check(bool condition, const char* what) {
+  if (!condition) {
+    std::fprintf(stderr, "check failed: %s\n", what);
+    std::abort();
+  }
+}
+
+// Returns true if part is a view into whole
+static bool inside(std::string_view part, std::string_view whole) {
+  return part.empty() || (part.data() >= whole.data() &&
+                          part.data() + part.size() <=
+                              whole.data() + whole.size());
+}
+
+static void check_request(const HttpRequest& request, std::string_view header) {
+  check(request.header() == header, "header() is the parsed header");
+  check(!request.method().empty() && !request.target().empty() &&
+            !request.version().empty(),
+        "request line has three parts");
+  for (std::string_view part : {request.method(), request.target(),
+                                request.path(), request.query(),
+                                request.version()}) {
+    check(inside(part, header), "request line part inside header");
+    check(part.find_first_of(" \r\n") == std::string_view::npos,
+          "request line part has no spaces or line breaks");
+  }
+  check(request.num_headers() <= HttpRequest::kMaxHeaders, "header count");
+
+  for (size_t i = 0; i < request.num_headers(); i++) {
+    const searchserver::HttpHeader& field = request.header(i);
+    check(inside(field.name, header) && inside(field.value, header),
+          "field inside header");
+    check(!field.name.empty() &&
+              field.name.find_first_of(":\r\n") == std::string_view::npos,
+          "field name well formed");
+    check(field.value.find_first_of("\r\n") == std::string_view::npos,
+          "field value has no line breaks");
+
+    // Looking a field up by name finds the first one with that name
+    std::optional<std::string_view> found = request.find_header(field.name);
+    check(found.has_value(), "field can be found by name");
+    check(inside(*found, header), "found field inside header");
+  }
+
+  for (std::string_view name : {"terms", "n", "page", "rank", "mode", ""}) {
+    std::optional<std::string_view> value = request.arg(name);
+    if (value) {
+      check(!value->empty() && inside(*value, request.query()),
+            "argument inside query");
+      check(value->find('&') == std::string_view::npos,
+            "argument has no separator");
+    }
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  std::string_view input(reinterpret_cast<const char*>(data), size);
+  size_t expected = input.find("\r\n\r\n");
+  expected = (expected == std::string_view::npos) ? 0 : expected + 4;
+
+  size_t scanned = 0;
+  size_t length = find_header_end(input, &scanned);
+  check(length == expected, "one-shot scan finds the first terminator");
+
+  // Feed the input in pieces whose sizes come from the input itself, so
+  // the fuzzer can steer where the terminator is split
+  scanned = 0;
+  size_t arrived = 0;
+  size_t resumed = 0;
+  size_t step = 0;
+  while (arrived < size && resumed == 0) {
+    arrived += std::min<size_t>(size - arrived,
+                                1 + data[step++ % size] % 37);
+    resumed = find_header_end(input.substr(0, arrived), &scanned);
+    check(scanned <= arrived, "scan stays inside the data");
+  }
+  check(resumed == expected, "resumed scan finds the first terminator");
+
+  if (length != 0) {
+    std::string_view header = input.substr(0, length);
+    HttpRequest request;
+    if (request.parse(header)) {
+      check_request(request, header);
+    }
+  }
+  return 0;
+}
+
+#ifndef USE_LIBFUZZER
+
+// Requests the mutations start from
+static const char* const kSeeds[] = {
+    "GET / HTTP/1.1\r\n\r\n",
+    "GET /query?terms=struct+int&n=5&page=2&rank=tf HTTP/1.1\r\n"
+    "Host: localhost\r\nRange: bytes=0-99\r\n\r\n",
+    "GET /static/a%20b.txt HTTP/1.0\r\nConnection:  keep-alive \r\n"
+    "X-Empty:\r\n\r\nGET /stats HTTP/1.1\r\n\r\n",
+    "POST /query?mode=any&terms=&terms=x&=y&z HTTP/1.1\r\n"
+    "Content-Length: 0\r\n\r\n",
+};
+
+// Bytes that are likely to matter to the parser
+static const char kInteresting[] = "\r\n :?&=%+\t";
+
+int main(int argc, char* argv[]) {
+  size_t iterations = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+  std::mt19937_64 rng((argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 1);
+
+  std::string input;
+  for (size_t i = 0; i < iterations; i++) {
+    input = kSeeds[rng() % (sizeof(kSeeds) / sizeof(kSeeds[0]))];
+    size_t mutations = 1 + rng() % 8;
+    for (size_t m = 0; m < mutations && !input.empty(); m++) {
+      size_t pos = rng() % input.size();
+      switch (rng() % 6) {
+        case 0:  // flip a byte
+          input[pos] = static_cast<char>(rng());
+          break;
+        case 1:  // insert an interesting byte
+          input.insert(pos, 1, kInteresting[rng() % (sizeof(kInteresting) - 1)]);
+          break;
+        case 2:  // delete a run of bytes
+          input.erase(pos, 1 + rng() % 8);
+          break;
+        case 3:  // duplicate a run of bytes
+          input.insert(pos, input.substr(pos, 1 + rng() % 64));
+          break;
+        case 4:  // cut the input short
+          input.resize(pos);
+          break;
+        default:  // add many fields
+          input.insert(pos, std::string(1 + rng() % 100, 'h') + ": v\r\n");
+          break;
+      }
+    }
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(input.data()),
+                           input.size());
+  }
+  std::printf("%zu inputs checked\n", iterations);
+  return EXIT_SUCCESS;
+}
+
+#endif  // USE_LIBFUZZER
@@ -0,0 +1,81 @@
+// Builds the search index of a directory ahead of time and writes it to an
+// index file, which searchserver can then map with --index instead of
+// crawling the directory every time it starts.
+//
+// Usage: ./indexbuilder [--crawl-threads <n>] [--positions] <directory>
+//                       <index file>
+//
+// --positions also records where each word occurs in each document, which
+// phrase and NEAR/k queries need, at the cost of a larger index file.
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "./CrawlFileTree.hpp"
+#include "./WordIndex.hpp"
+
+using namespace searchserver;
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ms(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Parses a count made only of decimal digits, returning false for
+// anything else, including a sign or a value too large for a size_t
+static bool parse_count(const std::string& str, size_t* value) {
+  const char* end = str.data() + str.size();
+  auto [ptr, ec] = std::from_chars(str.data(), end, *value);
+  return ec == std::errc() && ptr == end;
+}
+
+int main(int argc, char* argv[]) {
+  size_t crawl_threads = 1;
+  bool positions = false;
+  bool valid = true;
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--crawl-threads" && i + 1 < argc) {
+      valid = parse_count(argv[++i], &crawl_threads) && valid;
+      crawl_threads = std::max<size_t>(crawl_threads, 1);
+    } else if (arg == "--positions") {
+      positions = true;
+    } else {
+      positional.push_back(arg);
+    }
+  }
+  if (!valid || positional.size() != 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--crawl-threads <n>] [--positions] <directory>"
+              << " <index file>\n";
+    return EXIT_FAILURE;
+  }
+
+  Clock::time_point start = Clock::now();
+  auto index_opt = crawl_filetree(positional[0], crawl_threads, positions);
+  if (!index_opt) {
+    std::cerr << "Failed to build search index\n";
+    return EXIT_FAILURE;
+  }
+  double crawl_ms = elapsed_ms(start);
+
+  start = Clock::now();
+  if (!index_opt->save(positional[1])) {
+    std::cerr << "Failed to write " << positional[1] << "\n";
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "Indexed " << index_opt->num_docs() << " documents and "
+            << index_opt->num_words() << " words in " << crawl_ms
+            << " ms, wrote " << positional[1] << " in " << elapsed_ms(start)
+            << " ms\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,1641 @@
+// Microbenchmarks for the search engine's kernels.
+//
+// Usage: ./microbench <benchmark> [arguments...]
+//
+//  wand <directory> <query file> [k]
+//    Crawls the directory, then runs every line of the query file as a
+//    disjunctive (mode=any) query for the top k results with each ranking.
+//    Reports how many postings Block-Max WAND scored compared with the
+//    number an exhaustive evaluation would score, and the time taken.
+//
+//  codecs <index file>
+//    Loads every posting list of an index file written by indexbuilder
+//    and re-encodes it with each PostingCodec. Reports the size of the
+//    postings and the speed of decoding them in full, compared with a
+//    plain array of Postings, then the speed of unpacking a bit-packed
+//    block with SSE2 and with the scalar fallback at several bit widths.
+//
+//  threadpool [tasks]
+//    Dispatches tiny tasks from several producer threads at once to
+//    pools of several sizes, and reports the throughput of ThreadPool
+//    next to a pool built like the original one: a std::deque guarded by
+//    one mutex, with a broadcast on every dispatch. Then measures the
+//    round trip of dispatching a single task and waiting for it to run,
+//    which is dominated by the cost of waking a worker.
+//
+//  tokenize <directory> [passes]
+//    Reads every file under the directory, then tokenizes them all with
+//    the streaming Tokenizer and with the original approach of reading
+//    the whole file, calling split() and lowercasing a copy of each
+//    token. Reports tokens per second and megabytes per second for
+//    tokenizing alone, and for recording the words into a WordIndex.
+//
+//  httpparse [requests]
+//    Parses a stream of pipelined, browser-sized request headers with
+//    HttpRequest and with the original approach of searching the buffer
+//    for "\r\n\r\n", copying the header out, splitting its first line
+//    and running URLParser over the target. Reports requests per second
+//    and megabytes per second. Then times finding the end of a large
+//    header that arrives a few hundred bytes at a time, searching the
+//    whole buffer on every arrival against resuming the scan.
+//
+//  socketio [rounds]
+//    Sends batches of pipelined requests over a socket pair and reads
+//    them into an HttpSocket, whose pooled buffer is read into directly,
+//    next to the original loop of reading 1KB at a time and appending a
+//    temporary string to the buffer. Then writes responses with a 5KB
+//    body, joined to their header first and with one gathering write of
+//    both. Reports requests and responses per second.
+//
+//  pipeline [requests]
+//    Runs a Reactor on a loopback port with a handler that answers every
+//    request with the same small page, and a client that pipelines
+//    requests 1, 8 and 32 at a time, waiting for each batch of responses
+//    before sending the next. Each depth is run against a reactor that
+//    writes every response on its own (--pipeline-depth 1) and one that
+//    gathers up to that many into one write. Reports requests per second.
+//
+//  kernels [--docs <n>] [--vocab <n>] [--seed <n>] [--min-ms <n>] [--json]
+//    Makes up a corpus of n documents (default 2000) whose words are
+//    drawn with a Zipf distribution from a vocabulary of made up words
+//    (default 20000), the same every run for the same seed. Times
+//    WordIndex::record over the whole corpus, then lookup_word and
+//    lookup_query on the index built from it, with queries of 1 to 5
+//    common words, rare words or a mix of both, both for every match and
+//    for the first page of 20. Then split, escape_html, decode_URI and
+//    URLParser::parse on document text, result snippets and query URLs.
+//    Each kernel runs for at least --min-ms milliseconds (default 100).
+//    Reports nanoseconds, heap allocations and bytes allocated per
+//    operation, counted by this program's replacement operator new, as
+//    a table or, with --json, as one JSON object with a line per kernel
+//    for comparing two builds with diff.
+//
+//  terms [--vocab <n>] [--seed <n>] [--min-ms <n>]
+//    Makes up a vocabulary of n words (default 1000000) and holds it in
+//    an unordered_map, as the in-memory index does, and in a front-coded
+//    TermDictionary, as an index file does. Reports the bytes each takes,
+//    then the time to look up words that are there and words that are
+//    not, and to list every word with a prefix of 2 to 4 letters, which
+//    the map can only do by scanning all of its words. Then finds the
+//    words 1 and 2 edits away from misspelled words with a Levenshtein
+//    automaton, run over the dictionary and over every word in turn.
+//
+//  shards [--docs <n>] [--vocab <n>] [--shards <n>] [--seed <n>] [--min-ms <n>]
+//    Makes up a corpus like kernels does (default 50000 documents) and
+//    writes it out to a temporary directory, which it crawls with one
+//    thread into one WordIndex and into a ShardedIndex of n shards
+//    (default 4) searched on a pool of n threads. Checks that both find
+//    the same documents for every query, then times the first page of
+//    20 for queries of 1 to 3 common or rare words, all of the words and
+//    any of them, and reports the speedup of the shards. Queries of rare
+//    words are too small to fan out, so they show what the shards cost a
+//    query that stays on the calling thread.
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <optional>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "./CrawlFileTree.hpp"
+#include "./HttpRequest.hpp"
+#include "./HttpSocket.hpp"
+#include "./HttpUtils.hpp"
+#include "./IndexFile.hpp"
+#include "./Levenshtein.hpp"
+#include "./PostingList.hpp"
+#include "./Reactor.hpp"
+#include "./ServerSocket.hpp"
+#include "./ShardedIndex.hpp"
+#include "./TermDictionary.hpp"
+#include "./ThreadPool.hpp"
+#include "./Tokenizer.hpp"
+#include "./WordIndex.hpp"
+
+using namespace searchserver;
+
+using Clock = std::chrono::steady_clock;
+
+// Heap allocations made through operator new since the program started.
+// The forms of new and delete that are not replaced here are implemented
+// by the standard library on top of these, so the counters see every
+// allocation C++ code makes.
+static std::atomic<uint64_t> g_allocs{0};
+static std::atomic<uint64_t> g_alloc_bytes{0};
+
+void* operator new(size_t size) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  void* block = std::malloc(size > 0 ? size : 1);
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  return block;
+}
+
+void operator delete(void* block) noexcept {
+  std::free(block);
+}
+
+void operator delete(void* block, size_t /* size */) noexcept {
+  std::free(block);
+}
+
+static double elapsed_ms(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+static int bench_wand(int argc, char* argv[]) {
+  if (argc < 4) {
+    std::cerr << "Usage: " << argv[0] << " wand <directory> <query file> [k]\n";
+    return EXIT_FAILURE;
+  }
+  size_t k = (argc > 4) ? std::strtoul(argv[4], nullptr, 10) : 10;
+
+  auto index_opt = crawl_filetree(argv[2]);
+  if (!index_opt) {
+    std::cerr << "Failed to build search index\n";
+    return EXIT_FAILURE;
+  }
+  WordIndex& index = *index_opt;
+
+  vector<vector<string>> queries;
+  std::ifstream query_file(argv[3]);
+  string line;
+  while (std::getline(query_file, line)) {
+    vector<string> terms = split(line, " ");
+    if (!terms.empty()) {
+      queries.push_back(std::move(terms));
+    }
+  }
+
+  // An exhaustive evaluation scores every posting of every query word
+  size_t exhaustive = 0;
+  for (const auto& terms : queries) {
+    for (const string& term : terms) {
+      exhaustive += index.lookup_word(term).size();
+    }
+  }
+
+  std::cout << queries.size() << " queries, top " << k << ", "
+            << index.num_docs() << " documents\n";
+  for (Ranking ranking : {Ranking::kBM25, Ranking::kTermFrequency}) {
+    size_t scored = 0;
+    Clock::time_point start = Clock::now();
+    for (const auto& terms : queries) {
+      size_t num_scored = 0;
+      index.lookup_any(terms, k, 0, ranking, &num_scored);
+      scored += num_scored;
+    }
+    double ms = elapsed_ms(start);
+
+    std::cout << (ranking == Ranking::kBM25 ? "bm25" : "tf  ")
+              << "  scored " << scored << " of " << exhaustive
+              << " postings (" << (exhaustive ? 100.0 * scored / exhaustive : 0)
+              << "%), " << ms << " ms\n";
+  }
+  return EXIT_SUCCESS;
+}
+
+// Prints one line of the codecs benchmark: the size of the postings and
+// of their skip entries, and the decoding speed
+static void report_codec(const string& name, size_t bytes, size_t skip_bytes,
+                         size_t postings, double ms) {
+  std::cout << name << "  " << bytes / 1024 << " KB + " << skip_bytes / 1024
+            << " KB skips, " << static_cast<double>(bytes) / postings
+            << " bytes/posting, decode " << postings / (ms * 1000.0)
+            << " M postings/s\n";
+}
+
+static int bench_codecs(int argc, char* argv[]) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " codecs <index file>\n";
+    return EXIT_FAILURE;
+  }
+  std::shared_ptr<const IndexFile> file = IndexFile::open(argv[2]);
+  if (!file) {
+    std::cerr << "Failed to open index file " << argv[2] << "\n";
+    return EXIT_FAILURE;
+  }
+
+  vector<vector<Posting>> lists(file->num_terms());
+  size_t num_postings = 0;
+  for (size_t i = 0; i < file->num_terms(); i++) {
+    for (PostingCursor cursor(file->postings(i));
+         cursor.doc() != PostingCursor::kEnd; cursor.next()) {
+      lists[i].push_back({cursor.doc(), cursor.tf()});
+    }
+    num_postings += lists[i].size();
+  }
+  std::cout << lists.size() << " lists, " << num_postings << " postings\n";
+
+  // The sum of every DocId and count, so the decoding can't be optimized out
+  uint64_t checksum = 0;
+  Clock::time_point start = Clock::now();
+  for (const vector<Posting>& list : lists) {
+    for (const Posting& p : list) {
+      checksum += p.doc + p.tf;
+    }
+  }
+  report_codec("raw   ", num_postings * sizeof(Posting), 0, num_postings,
+               elapsed_ms(start));
+
+  for (PostingCodec codec : {PostingCodec::kVByte, PostingCodec::kBP128}) {
+    vector<PostingList> encoded(lists.size());
+    size_t bytes = 0;
+    size_t skip_bytes = 0;
+    for (size_t i = 0; i < lists.size(); i++) {
+      encoded[i].postings = lists[i];
+      encoded[i].encode(codec);
+      bytes += encoded[i].data.size();
+      skip_bytes += encoded[i].blocks.size() * sizeof(BlockMax);
+    }
+
+    uint64_t sum = 0;
+    start = Clock::now();
+    for (const PostingList& list : encoded) {
+      for (PostingCursor cursor(list.view());
+           cursor.doc() != PostingCursor::kEnd; cursor.next()) {
+        sum += cursor.doc() + cursor.tf();
+      }
+    }
+    report_codec(codec == PostingCodec::kVByte ? "vbyte " : "bp128 ", bytes,
+                 skip_bytes, num_postings, elapsed_ms(start));
+    if (sum != checksum) {
+      std::cerr << "Decoded postings do not match\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Any bytes are a valid packing, so unpack random ones
+  const int kRounds = 200000;
+  std::mt19937 rng(5950);
+  uint8_t packed[kPostingBlockSize * 4];
+  for (uint8_t& byte : packed) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  uint32_t simd[kPostingBlockSize];
+  uint32_t scalar[kPostingBlockSize];
+  std::cout << "unpack (M integers/s)  bits  sse2  scalar\n";
+  for (uint32_t bits : {1, 2, 4, 8, 12, 16, 24, 32}) {
+    unpack_bits(packed, bits, simd);
+    unpack_bits_scalar(packed, bits, scalar);
+    if (memcmp(simd, scalar, sizeof(simd)) != 0) {
+      std::cerr << "SSE2 and scalar unpacking disagree at " << bits << " bits\n";
+      return EXIT_FAILURE;
+    }
+
+    double ms[2];
+    for (int pass = 0; pass < 2; pass++) {
+      start = Clock::now();
+      for (int i = 0; i < kRounds; i++) {
+        // Vary the input so each round depends on the one before it
+        packed[0] = static_cast<uint8_t>(i);
+        if (pass == 0) {
+          unpack_bits(packed, bits, simd);
+          packed[1] ^= static_cast<uint8_t>(simd[kPostingBlockSize - 1]);
+        } else {
+          unpack_bits_scalar(packed, bits, scalar);
+          packed[1] ^= static_cast<uint8_t>(scalar[kPostingBlockSize - 1]);
+        }
+      }
+      ms[pass] = elapsed_ms(start);
+    }
+    double ints = static_cast<double>(kRounds) * kPostingBlockSize / 1000.0;
+    std::cout << "                        " << bits << "  " << ints / ms[0]
+              << "  " << ints / ms[1] << "\n";
+  }
+  return EXIT_SUCCESS;
+}
+
+// A thread pool built like the original ThreadPool, as a baseline: one
+// mutex guards a std::deque of tasks, and every dispatch broadcasts to
+// all of the idle workers, which then fight over the lock
+class LockedPool {
+ public:
+  typedef void (*thread_task_fn)(void* arg);
+  struct Task {
+    thread_task_fn func_;
+    void* arg_;
+  };
+
+  explicit LockedPool(size_t num_threads) : threads_(num_threads) {
+    pthread_mutex_init(&lock_, nullptr);
+    pthread_cond_init(&cond_, nullptr);
+    for (pthread_t& thread : threads_) {
+      pthread_create(&thread, nullptr, loop, this);
+    }
+  }
+
+  ~LockedPool() {
+    pthread_mutex_lock(&lock_);
+    done_ = true;
+    pthread_cond_broadcast(&cond_);
+    pthread_mutex_unlock(&lock_);
+    for (pthread_t thread : threads_) {
+      pthread_join(thread, nullptr);
+    }
+    pthread_mutex_destroy(&lock_);
+    pthread_cond_destroy(&cond_);
+  }
+
+  void dispatch(Task task) {
+    pthread_mutex_lock(&lock_);
+    queue_.push_back(task);
+    pthread_cond_broadcast(&cond_);
+    pthread_mutex_unlock(&lock_);
+  }
+
+ private:
+  static void* loop(void* arg) {
+    auto* pool = static_cast<LockedPool*>(arg);
+    pthread_mutex_lock(&pool->lock_);
+    while (true) {
+      while (pool->queue_.empty() && !pool->done_) {
+        pthread_cond_wait(&pool->cond_, &pool->lock_);
+      }
+      if (pool->queue_.empty()) {
+        pthread_mutex_unlock(&pool->lock_);
+        return nullptr;
+      }
+      Task task = pool->queue_.front();
+      pool->queue_.pop_front();
+      pthread_mutex_unlock(&pool->lock_);
+      task.func_(task.arg_);
+      pthread_mutex_lock(&pool->lock_);
+    }
+  }
+
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_;
+  std::deque<Task> queue_;
+  bool done_ = false;
+  std::vector<pthread_t> threads_;
+};
+
+// The task run by the threadpool benchmark: counts itself as done
+static void count_task(void* arg) {
+  static_cast<std::atomic<size_t>*>(arg)->fetch_add(1, std::memory_order_relaxed);
+}
+
+// Waits for a counter to reach a target, yielding so that the workers
+// can run even on a single core
+static void wait_for_count(const std::atomic<size_t>& counter, size_t target) {
+  while (counter.load(std::memory_order_relaxed) < target) {
+    sched_yield();
+  }
+}
+
+// Dispatches tasks_per_producer tasks from each of num_producers threads
+// at once, and returns the time until every task has run in ms
+template <typename Pool>
+static double run_contention(size_t num_workers, size_t num_producers,
+                             size_t tasks_per_producer) {
+  std::atomic<size_t> done{0};
+  Pool pool(num_workers);
+  Clock::time_point start = Clock::now();
+
+  vector<pthread_t> producers(num_producers);
+  struct Producer {
+    Pool* pool;
+    std::atomic<size_t>* done;
+    size_t tasks;
+  } producer{&pool, &done, tasks_per_producer};
+  for (pthread_t& thread : producers) {
+    pthread_create(&thread, nullptr, [](void* arg) -> void* {
+      auto* p = static_cast<Producer*>(arg);
+      for (size_t i = 0; i < p->tasks; i++) {
+        p->pool->dispatch(typename Pool::Task{count_task, p->done});
+      }
+      return nullptr;
+    }, &producer);
+  }
+  for (pthread_t thread : producers) {
+    pthread_join(thread, nullptr);
+  }
+  wait_for_count(done, num_producers * tasks_per_producer);
+  return elapsed_ms(start);
+}
+
+// Dispatches one task at a time and waits for it to run, returning the
+// average round trip in microseconds
+template <typename Pool>
+static double run_round_trips(size_t num_workers, size_t rounds) {
+  std::atomic<size_t> done{0};
+  Pool pool(num_workers);
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < rounds; i++) {
+    pool.dispatch(typename Pool::Task{count_task, &done});
+    wait_for_count(done, i + 1);
+  }
+  return elapsed_ms(start) * 1000.0 / rounds;
+}
+
+static int bench_threadpool(int argc, char* argv[]) {
+  size_t tasks = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 200000;
+
+  std::cout << "contention (M tasks/s)  workers  producers  threadpool  locked\n";
+  for (size_t workers : {1, 4, 8}) {
+    for (size_t producers : {1, 4}) {
+      size_t per_producer = tasks / producers;
+      double total = static_cast<double>(per_producer * producers) / 1000.0;
+      double ms_pool = run_contention<ThreadPool>(workers, producers, per_producer);
+      double ms_locked = run_contention<LockedPool>(workers, producers, per_producer);
+      std::cout << "                        " << workers << "  " << producers
+                << "  " << total / ms_pool << "  " << total / ms_locked << "\n";
+    }
+  }
+
+  size_t rounds = std::max<size_t>(tasks / 20, 1);
+  std::cout << "round trip (us)         workers  threadpool  locked\n";
+  for (size_t workers : {1, 4, 8}) {
+    std::cout << "                        " << workers << "  "
+              << run_round_trips<ThreadPool>(workers, rounds) << "  "
+              << run_round_trips<LockedPool>(workers, rounds) << "\n";
+  }
+  return EXIT_SUCCESS;
+}
+
+// Appends the path of every file under a directory to files
+static void list_files(const string& dir_path, vector<string>* files) {
+  auto entries = readdir(dir_path);
+  if (!entries) {
+    return;
+  }
+  for (const auto& entry : *entries) {
+    if (entry.name == "." || entry.name == "..") {
+      continue;
+    }
+    string path = entry_path(dir_path, entry.name);
+    if (entry.is_dir) {
+      list_files(path, files);
+    } else {
+      files->push_back(path);
+    }
+  }
+}
+
+// Tokenizes a file the way the crawler originally did, passing each
+// lowercased token to on_word
+template <typename F>
+static void split_file(const string& path, F&& on_word) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    return;
+  }
+  string content((std::istreambuf_iterator<char>(file)),
+                 std::istreambuf_iterator<char>());
+  vector<string> tokens = split(content, " \r\t\v\n,.:;?!");
+  for (string token : tokens) {
+    if (token.empty()) {
+      continue;
+    }
+    std::transform(token.begin(), token.end(), token.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    on_word(token);
+  }
+}
+
+// Prints one line of the tokenize benchmark
+static void report_tokenize(const string& name, size_t tokens, size_t bytes,
+                            double ms) {
+  std::cout << name << "  " << tokens / ms / 1000.0 << " M tokens/s  "
+            << bytes / ms / 1000.0 << " MB/s\n";
+}
+
+static int bench_tokenize(int argc, char* argv[]) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " tokenize <directory> [passes]\n";
+    return EXIT_FAILURE;
+  }
+  size_t passes = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 3;
+
+  vector<string> files;
+  list_files(argv[2], &files);
+  size_t bytes = 0;
+  for (const string& path : files) {
+    struct stat info{};
+    if (stat(path.c_str(), &info) == 0) {
+      bytes += info.st_size;
+    }
+  }
+  bytes *= passes;
+
+  // Read everything once so that every run finds the files cached
+  size_t tokens = 0;
+  for (const string& path : files) {
+    split_file(path, [&tokens](const string&) { tokens++; });
+  }
+  tokens *= passes;
+  std::cout << files.size() << " files, " << bytes / passes << " bytes, "
+            << tokens / passes << " tokens, " << passes << " passes\n";
+
+  // Adds up the token lengths, so that the compiler cannot drop the
+  // work, and checks that both tokenizers found the same ones
+  size_t checksum = 0;
+
+  Clock::time_point start = Clock::now();
+  for (size_t pass = 0; pass < passes; pass++) {
+    for (const string& path : files) {
+      split_file(path, [&checksum](const string& word) {
+        checksum += word.size();
+      });
+    }
+  }
+  report_tokenize("split     ", tokens, bytes, elapsed_ms(start));
+
+  start = Clock::now();
+  Tokenizer tokenizer;
+  for (size_t pass = 0; pass < passes; pass++) {
+    for (const string& path : files) {
+      if (!tokenizer.open(path)) {
+        continue;
+      }
+      std::string_view word;
+      while (tokenizer.next(&word)) {
+        checksum -= word.size();
+      }
+    }
+  }
+  report_tokenize("tokenizer ", tokens, bytes, elapsed_ms(start));
+
+  // The same, recording every word into an index
+  start = Clock::now();
+  for (size_t pass = 0; pass < passes; pass++) {
+    WordIndex index;
+    for (const string& path : files) {
+      split_file(path, [&index, &path](const string& word) {
+        index.record(word, path);
+      });
+    }
+  }
+  report_tokenize("split+record     ", tokens, bytes, elapsed_ms(start));
+
+  start = Clock::now();
+  for (size_t pass = 0; pass < passes; pass++) {
+    WordIndex index;
+    for (const string& path : files) {
+      if (!tokenizer.open(path)) {
+        continue;
+      }
+      std::string_view word;
+      while (tokenizer.next(&word)) {
+        index.record(word, path);
+      }
+    }
+  }
+  report_tokenize("tokenizer+record ", tokens, bytes, elapsed_ms(start));
+
+  if (checksum != 0) {
+    std::cerr << "The tokenizers found different words\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Makes a request header like the ones a browser sends for a query
+static string make_request(size_t i) {
+  return "GET /query?terms=struct+int+" + std::to_string(i) +
+         "&rank=bm25&n=20&page=" + std::to_string(i % 5 + 1) +
+         " HTTP/1.1\r\n"
+         "Host: localhost:5950\r\n"
+         "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) "
+         "Gecko/20100101 Firefox/128.0\r\n"
+         "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+         "*/*;q=0.8\r\n"
+         "Accept-Language: en-US,en;q=0.5\r\n"
+         "Accept-Encoding: gzip, deflate, br\r\n"
+         "Referer: http://localhost:5950/\r\n"
+         "Connection: keep-alive\r\n"
+         "Upgrade-Insecure-Requests: 1\r\n"
+         "\r\n";
+}
+
+// Parses the next request out of buffer the way HttpSocket and the
+// request handler originally did, returning what the handler looked at
+static size_t old_parse(string* buffer) {
+  size_t header_end = buffer->find("\r\n\r\n");
+  string header = buffer->substr(0, header_end + 4);
+  buffer->erase(0, header_end + 4);
+
+  string first_line = header.substr(0, header.find("\r\n"));
+  vector<string> components = split(first_line, " ");
+  URLParser parser;
+  parser.parse(components[1]);
+  std::map<string, string> args = parser.args();
+
+  string lower = header;
+  std::transform(lower.begin(), lower.end(), lower.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  size_t range = lower.find("\r\nrange:");
+  return parser.path().size() + args["terms"].size() +
+         (range == string::npos ? 0 : 1);
+}
+
+static int bench_httpparse(int argc, char* argv[]) {
+  size_t num_requests =
+      (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 200000;
+
+  // Requests are parsed out of one pipelined stream in batches, as the
+  // server would find them buffered on a busy keep-alive connection
+  static const size_t kBatch = 64;
+  string stream;
+  for (size_t i = 0; i < kBatch; i++) {
+    stream += make_request(i);
+  }
+  size_t rounds = std::max<size_t>(num_requests / kBatch, 1);
+  num_requests = rounds * kBatch;
+  size_t bytes = stream.size() * rounds;
+  std::cout << num_requests << " requests of about " << stream.size() / kBatch
+            << " bytes\n";
+
+  // Adds up what each parser found, so that the compiler cannot drop the
+  // work, and checks that both found the same
+  size_t checksum = 0;
+
+  Clock::time_point start = Clock::now();
+  for (size_t round = 0; round < rounds; round++) {
+    string buffer = stream;
+    for (size_t i = 0; i < kBatch; i++) {
+      checksum += old_parse(&buffer);
+    }
+  }
+  double ms = elapsed_ms(start);
+  std::cout << "find+split+URLParser  " << num_requests / ms / 1000.0
+            << " M requests/s  " << bytes / ms / 1000.0 << " MB/s\n";
+
+  start = Clock::now();
+  HttpRequest request;
+  for (size_t round = 0; round < rounds; round++) {
+    std::string_view buffer = stream;
+    for (size_t i = 0; i < kBatch; i++) {
+      size_t scanned = 0;
+      size_t length = find_header_end(buffer, &scanned);
+      if (length == 0 || !request.parse(buffer.substr(0, length))) {
+        std::cerr << "HttpRequest failed to parse a request\n";
+        return EXIT_FAILURE;
+      }
+      buffer.remove_prefix(length);
+      checksum -= request.path().size() + request.arg("terms")->size() +
+                  (request.find_header("range") ? 1 : 0);
+    }
+  }
+  ms = elapsed_ms(start);
+  std::cout << "HttpRequest           " << num_requests / ms / 1000.0
+            << " M requests/s  " << bytes / ms / 1000.0 << " MB/s\n";
+
+  if (checksum != 0) {
+    std::cerr << "The parsers found different requests\n";
+    return EXIT_FAILURE;
+  }
+
+  // A 48KB header, mostly cookies, arriving 512 bytes at a time
+  string large = "GET / HTTP/1.1\r\n";
+  while (large.size() < 48 * 1024) {
+    large += "Cookie: session=" + string(200, 'x') + "\r\n";
+  }
+  large += "\r\n";
+  static const size_t kPiece = 512;
+  size_t repeats = 200;
+
+  start = Clock::now();
+  for (size_t r = 0; r < repeats; r++) {
+    string buffer;
+    for (size_t pos = 0; pos < large.size(); pos += kPiece) {
+      buffer.append(large, pos, kPiece);
+      if (buffer.find("\r\n\r\n") != string::npos) {
+        checksum += buffer.size();
+      }
+    }
+  }
+  ms = elapsed_ms(start);
+  std::cout << "large header, find on every read    " << ms * 1000.0 / repeats
+            << " us/header\n";
+
+  start = Clock::now();
+  for (size_t r = 0; r < repeats; r++) {
+    string buffer;
+    size_t scanned = 0;
+    for (size_t pos = 0; pos < large.size(); pos += kPiece) {
+      buffer.append(large, pos, kPiece);
+      if (find_header_end(buffer, &scanned) != 0) {
+        checksum -= buffer.size();
+      }
+    }
+  }
+  ms = elapsed_ms(start);
+  std::cout << "large header, resumed scan          " << ms * 1000.0 / repeats
+            << " us/header\n";
+
+  if (checksum != 0) {
+    std::cerr << "The scans found different header ends\n";
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Reads whatever is waiting on a socket and throws it away
+static void drain(int fd) {
+  static char sink[256 * 1024];
+  while (read(fd, sink, sizeof(sink)) == static_cast<ssize_t>(sizeof(sink))) {
+  }
+}
+
+static int bench_socketio(int argc, char* argv[]) {
+  size_t rounds = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 5000;
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    std::cerr << "socketpair() failed: " << strerror(errno) << "\n";
+    return EXIT_FAILURE;
+  }
+  struct sockaddr addr{};
+  addr.sa_family = AF_UNIX;
+  HttpSocket socket(fds[0], sizeof(addr), &addr);
+  int peer = fds[1];
+  if (!socket.set_nonblocking()) {
+    std::cerr << "could not make the socket non-blocking\n";
+    return EXIT_FAILURE;
+  }
+
+  // A batch small enough to sit in the socket's buffer whole
+  static const size_t kBatch = 32;
+  string stream;
+  for (size_t i = 0; i < kBatch; i++) {
+    stream += make_request(i);
+  }
+  size_t num_requests = rounds * kBatch;
+  std::cout << num_requests << " requests in batches of " << kBatch << " ("
+            << stream.size() << " bytes)\n";
+
+  // The original loop: read 1KB into the stack, append a temporary
+  // string of it to the buffer, and search it for whole headers, which
+  // are copied out and parsed like the new loop parses them in place
+  size_t found = 0;
+  HttpRequest request;
+  Clock::time_point start = Clock::now();
+  string buffer;
+  for (size_t round = 0; round < rounds; round++) {
+    if (write(peer, stream.data(), stream.size()) !=
+        static_cast<ssize_t>(stream.size())) {
+      return EXIT_FAILURE;
+    }
+    std::array<char, 1024> chunk{};
+    ssize_t res;
+    while ((res = read(fds[0], chunk.data(), chunk.size())) > 0) {
+      buffer += string(chunk.data(), res);
+    }
+    size_t end;
+    while ((end = buffer.find("\r\n\r\n")) != string::npos) {
+      string header = buffer.substr(0, end + 4);
+      buffer.erase(0, end + 4);
+      found += request.parse(header) ? 1 : 0;
+    }
+  }
+  double ms = elapsed_ms(start);
+  std::cout << "1KB reads + append    " << num_requests / ms / 1000.0
+            << " M requests/s\n";
+
+  start = Clock::now();
+  for (size_t round = 0; round < rounds; round++) {
+    if (write(peer, stream.data(), stream.size()) !=
+        static_cast<ssize_t>(stream.size())) {
+      return EXIT_FAILURE;
+    }
+    socket.read_available();
+    while (socket.next_request(&request) == RequestStatus::kComplete) {
+      found--;
+    }
+    socket.release_buffer();
+  }
+  ms = elapsed_ms(start);
+  std::cout << "pooled ReadBuffer     " << num_requests / ms / 1000.0
+            << " M requests/s\n";
+  if (found != 0) {
+    std::cerr << "The readers found different numbers of requests\n";
+    return EXIT_FAILURE;
+  }
+
+  // Responses with a page-sized body, drained after every batch
+  string body(5000, 'x');
+  string header = "HTTP/1.1 200 OK\r\nContent-length: " +
+                  std::to_string(body.size()) + "\r\n\r\n";
+  start = Clock::now();
+  for (size_t round = 0; round < rounds; round++) {
+    for (size_t i = 0; i < kBatch; i++) {
+      socket.write_response(header + body);
+    }
+    drain(peer);
+  }
+  ms = elapsed_ms(start);
+  std::cout << "join + write          " << num_requests / ms / 1000.0
+            << " M responses/s\n";
+
+  start = Clock::now();
+  for (size_t round = 0; round < rounds; round++) {
+    for (size_t i = 0; i < kBatch; i++) {
+      socket.write_response(header, body);
+    }
+    drain(peer);
+  }
+  ms = elapsed_ms(start);
+  std::cout << "gathered write        " << num_requests / ms / 1000.0
+            << " M responses/s\n";
+
+  close(peer);
+  return EXIT_SUCCESS;
+}
+
+// Runs a reactor's event loop, which never returns
+static void* reactor_thread(void* reactor) {
+  static_cast<Reactor*>(reactor)->run();
+  return nullptr;
+}
+
+// Starts a reactor with the given pipeline depth on a loopback port,
+// answering every request with response. The reactor runs until the
+// benchmark exits, so it and its sockets are never freed.
+static uint16_t start_reactor(size_t pipeline_depth,
+                              const HttpResponse& response) {
+  auto* server = new ServerSocket(AF_INET6, "::1", 0);
+  auto* pool = new ThreadPool(1);
+  auto* reactor = new Reactor(
+      server, pool, [response](const HttpRequest&) { return response; },
+      pipeline_depth);
+  pthread_t thread;
+  pthread_create(&thread, nullptr, reactor_thread, reactor);
+  pthread_detach(thread);
+
+  struct sockaddr_in6 addr{};
+  socklen_t addr_len = sizeof(addr);
+  getsockname(server->fd(), reinterpret_cast<struct sockaddr*>(&addr),
+              &addr_len);
+  return ntohs(addr.sin6_port);
+}
+
+// Sends num_requests requests to a port depth at a time, reading all the
+// responses to each batch before sending the next, and returns the time
+// taken in milliseconds, or a negative number if the connection failed
+static double run_pipeline(uint16_t port, size_t depth, size_t num_requests,
+                           size_t response_size) {
+  int fd = socket(AF_INET6, SOCK_STREAM, 0);
+  struct sockaddr_in6 addr{};
+  addr.sin6_family = AF_INET6;
+  addr.sin6_port = htons(port);
+  addr.sin6_addr = in6addr_loopback;
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ==
+      -1) {
+    close(fd);
+    return -1;
+  }
+
+  string batch;
+  for (size_t i = 0; i < depth; i++) {
+    batch += "GET /query?terms=struct HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  }
+  std::vector<char> replies(depth * response_size);
+
+  Clock::time_point start = Clock::now();
+  for (size_t sent = 0; sent < num_requests; sent += depth) {
+    if (write(fd, batch.data(), batch.size()) !=
+        static_cast<ssize_t>(batch.size())) {
+      close(fd);
+      return -1;
+    }
+    size_t received = 0;
+    while (received < replies.size()) {
+      ssize_t res = read(fd, replies.data() + received,
+                         replies.size() - received);
+      if (res <= 0) {
+        close(fd);
+        return -1;
+      }
+      received += static_cast<size_t>(res);
+    }
+  }
+  double ms = elapsed_ms(start);
+  close(fd);
+  return ms;
+}
+
+static int bench_pipeline(int argc, char* argv[]) {
+  size_t num_requests =
+      (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 64000;
+
+  auto page = std::make_shared<const string>(512, 'x');
+  HttpResponse response("HTTP/1.1 200 OK\r\nContent-length: " +
+                            std::to_string(page->size()) + "\r\n\r\n",
+                        page);
+  size_t response_size = response.bytes.size() + page->size();
+
+  std::cout << num_requests << " requests per run, " << response_size
+            << " byte responses\n";
+  for (size_t depth : {1, 8, 32}) {
+    for (size_t server_depth : {static_cast<size_t>(1), depth}) {
+      uint16_t port = start_reactor(server_depth, response);
+      size_t requests = num_requests / depth * depth;
+      double ms = run_pipeline(port, depth, requests, response_size);
+      if (ms < 0) {
+        std::cerr << "The connection to the reactor failed\n";
+        return EXIT_FAILURE;
+      }
+      std::cout << "client depth " << std::setw(2) << depth
+                << ", server depth " << std::setw(2) << server_depth << "  "
+                << requests / ms / 1000.0 << " M requests/s\n";
+      if (depth == 1) {
+        break;
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// Adds up results the kernels return, so that the compiler cannot drop
+// the work
+static volatile size_t g_sink = 0;
+
+// The cost of one operation of a kernel
+struct KernelResult {
+  string name;
+  uint64_t ops = 0;
+  double ns_per_op = 0;
+  double allocs_per_op = 0;
+  double bytes_per_op = 0;
+};
+
+// Runs rounds of a kernel until at least min_ms milliseconds have passed.
+//
+// Arguments:
+//  - name: the name to report the kernel under
+//  - ops_per_round: how many operations one call of round performs
+//  - min_ms: the least time to spend, after one round of warmup
+//  - round: performs ops_per_round operations
+//
+// Returns:
+//  - the time, allocations and bytes allocated per operation
+template <typename Round>
+static KernelResult time_kernel(const string& name, size_t ops_per_round,
+                                double min_ms, Round round) {
+  round();
+
+  uint64_t rounds = 0;
+  uint64_t allocs = g_allocs.load(std::memory_order_relaxed);
+  uint64_t bytes = g_alloc_bytes.load(std::memory_order_relaxed);
+  Clock::time_point start = Clock::now();
+  double ms = 0;
+  do {
+    round();
+    rounds++;
+    ms = elapsed_ms(start);
+  } while (ms < min_ms);
+  allocs = g_allocs.load(std::memory_order_relaxed) - allocs;
+  bytes = g_alloc_bytes.load(std::memory_order_relaxed) - bytes;
+
+  KernelResult result;
+  result.name = name;
+  result.ops = rounds * ops_per_round;
+  auto ops = static_cast<double>(result.ops);
+  result.ns_per_op = ms * 1e6 / ops;
+  result.allocs_per_op = static_cast<double>(allocs) / ops;
+  result.bytes_per_op = static_cast<double>(bytes) / ops;
+  return result;
+}
+
+// A synthetic corpus: documents of words drawn with a Zipf distribution
+// from a vocabulary of made up words, the same for the same seed
+struct Corpus {
+  vector<string> vocabulary;
+  vector<string> doc_names;
+  vector<vector<uint32_t>> docs;
+  vector<string> texts;
+
+  // The most and least common words that are in at least one document
+  vector<string> common;
+  vector<string> rare;
+};
+
+// Makes up vocab_size words of 3 to 10 lowercase letters, with no repeats
+static vector<string> make_vocabulary(size_t vocab_size,
+                                      std::mt19937_64* rng) {
+  vector<string> vocabulary;
+  std::unordered_set<string> seen;
+  while (vocabulary.size() < vocab_size) {
+    string word(3 + (*rng)() % 8, 'a');
+    for (char& c : word) {
+      c = static_cast<char>('a' + (*rng)() % 26);
+    }
+    if (seen.insert(word).second) {
+      vocabulary.push_back(std::move(word));
+    }
+  }
+  return vocabulary;
+}
+
+static Corpus make_corpus(size_t num_docs, size_t vocab_size, uint64_t seed) {
+  Corpus corpus;
+  std::mt19937_64 rng(seed);
+  corpus.vocabulary = make_vocabulary(vocab_size, &rng);
+
+  // The word of rank r is drawn with probability proportional to 1 / r
+  vector<double> cdf(vocab_size);
+  double total = 0;
+  for (size_t r = 0; r < vocab_size; r++) {
+    total += 1.0 / static_cast<double>(r + 1);
+    cdf[r] = total;
+  }
+  std::uniform_real_distribution<double> uniform(0, total);
+
+  // Documents of 50 to 500 words, written out as text with punctuation
+  // and line breaks for split() to deal with
+  vector<size_t> doc_freq(vocab_size, 0);
+  vector<size_t> last_doc(vocab_size, SIZE_MAX);
+  for (size_t d = 0; d < num_docs; d++) {
+    corpus.doc_names.push_back("corpus/doc" + std::to_string(d) + ".txt");
+    vector<uint32_t> doc(50 + rng() % 451);
+    string text;
+    size_t line = 0;
+    for (size_t i = 0; i < doc.size(); i++) {
+      size_t rank = std::upper_bound(cdf.begin(), cdf.end(), uniform(rng)) -
+                    cdf.begin();
+      rank = std::min(rank, vocab_size - 1);
+      doc[i] = static_cast<uint32_t>(rank);
+      if (last_doc[rank] != d) {
+        last_doc[rank] = d;
+        doc_freq[rank]++;
+      }
+
+      const string& word = corpus.vocabulary[rank];
+      text += word;
+      line += word.size() + 1;
+      if (rng() % 12 == 0) {
+        text += '.';
+      }
+      if (line > 72) {
+        text += '\n';
+        line = 0;
+      } else {
+        text += ' ';
+      }
+    }
+    corpus.docs.push_back(std::move(doc));
+    corpus.texts.push_back(std::move(text));
+  }
+
+  // Rare words are in 1 to 3 documents; the vocabulary is in rank order,
+  // so the first words are the common ones
+  for (size_t r = 0; r < vocab_size; r++) {
+    if (doc_freq[r] == 0) {
+      continue;
+    }
+    if (corpus.common.size() < 32) {
+      corpus.common.push_back(corpus.vocabulary[r]);
+    } else if (doc_freq[r] <= 3) {
+      corpus.rare.push_back(corpus.vocabulary[r]);
+    }
+  }
+  if (corpus.rare.empty()) {
+    corpus.rare.push_back(corpus.vocabulary.back());
+  }
+  return corpus;
+}
+
+// Makes queries of num_words words: common, rare, or each word either
+static vector<vector<string>> make_queries(const Corpus& corpus,
+                                           size_t num_words,
+                                           const string& mix,
+                                           std::mt19937_64* rng) {
+  vector<vector<string>> queries(256);
+  for (vector<string>& query : queries) {
+    for (size_t i = 0; i < num_words; i++) {
+      bool common = (mix == "common") || (mix == "mixed" && (*rng)() % 2 == 0);
+      const vector<string>& words = common ? corpus.common : corpus.rare;
+      query.push_back(words[(*rng)() % words.size()]);
+    }
+  }
+  return queries;
+}
+
+static void print_kernels_table(const vector<KernelResult>& results) {
+  std::cout << std::left << std::setw(28) << "kernel" << std::right
+            << std::setw(12) << "ns/op" << std::setw(12) << "allocs/op"
+            << std::setw(12) << "bytes/op" << "\n";
+  for (const KernelResult& result : results) {
+    std::cout << std::left << std::setw(28) << result.name << std::right
+              << std::fixed << std::setprecision(1) << std::setw(12)
+              << result.ns_per_op << std::setprecision(2) << std::setw(12)
+              << result.allocs_per_op << std::setprecision(1) << std::setw(12)
+              << result.bytes_per_op << "\n";
+  }
+}
+
+// Prints the results as one JSON object, one kernel per line, so that
+// the output of two builds can be compared with diff
+static void print_kernels_json(const vector<KernelResult>& results,
+                               size_t num_docs, size_t vocab_size,
+                               size_t num_words, uint64_t seed) {
+  std::cout << "{\n  \"benchmark\": \"kernels\",\n"
+            << "  \"corpus\": {\"docs\": " << num_docs
+            << ", \"vocabulary\": " << vocab_size << ", \"words\": "
+            << num_words << ", \"seed\": " << seed << "},\n"
+            << "  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const KernelResult& result = results[i];
+    std::cout << "    {\"name\": \"" << result.name << "\", \"ops\": "
+              << result.ops << std::fixed << std::setprecision(2)
+              << ", \"ns_per_op\": " << result.ns_per_op
+              << ", \"allocs_per_op\": " << result.allocs_per_op
+              << ", \"bytes_per_op\": " << result.bytes_per_op << "}"
+              << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  std::cout << "  ]\n}\n";
+}
+
+static int bench_kernels(int argc, char* argv[]) {
+  size_t num_docs = 2000;
+  size_t vocab_size = 20000;
+  uint64_t seed = 1;
+  double min_ms = 100;
+  bool json = false;
+  for (int i = 2; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--docs" && i + 1 < argc) {
+      num_docs = std::max(std::strtoul(argv[++i], nullptr, 10), 1UL);
+    } else if (arg == "--vocab" && i + 1 < argc) {
+      vocab_size = std::max(std::strtoul(argv[++i], nullptr, 10), 1UL);
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seed = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--min-ms" && i + 1 < argc) {
+      min_ms = std::strtod(argv[++i], nullptr);
+    } else if (arg == "--json") {
+      json = true;
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " kernels [--docs <n>] [--vocab <n>] [--seed <n>]"
+                   " [--min-ms <n>] [--json]\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  Corpus corpus = make_corpus(num_docs, vocab_size, seed);
+  size_t num_words = 0;
+  for (const auto& doc : corpus.docs) {
+    num_words += doc.size();
+  }
+  if (!json) {
+    std::cout << num_docs << " documents, " << num_words << " words from a "
+              << vocab_size << " word vocabulary, seed " << seed << "\n";
+  }
+
+  vector<KernelResult> results;
+
+  // Recording every word of the corpus into an empty index
+  results.push_back(time_kernel("record", num_words, min_ms, [&corpus]() {
+    WordIndex index;
+    for (size_t d = 0; d < corpus.docs.size(); d++) {
+      for (uint32_t word : corpus.docs[d]) {
+        index.record(corpus.vocabulary[word], corpus.doc_names[d]);
+      }
+    }
+    g_sink = g_sink + index.num_words();
+  }));
+
+  WordIndex index;
+  for (size_t d = 0; d < corpus.docs.size(); d++) {
+    for (uint32_t word : corpus.docs[d]) {
+      index.record(corpus.vocabulary[word], corpus.doc_names[d]);
+    }
+  }
+  index.finalize();
+
+  std::mt19937_64 rng(seed);
+  for (const string mix : {"common", "rare"}) {
+    vector<vector<string>> queries = make_queries(corpus, 1, mix, &rng);
+    results.push_back(time_kernel(
+        "lookup_word/" + mix, queries.size(), min_ms, [&]() {
+          for (const vector<string>& query : queries) {
+            g_sink = g_sink + index.lookup_word(query[0]).size();
+          }
+        }));
+  }
+
+  // Every matching document, and the first page of 20 as the server asks
+  for (size_t num_terms = 1; num_terms <= 5; num_terms++) {
+    for (const string mix : {"common", "rare", "mixed"}) {
+      vector<vector<string>> queries =
+          make_queries(corpus, num_terms, mix, &rng);
+      string suffix = "/" + std::to_string(num_terms) + "/" + mix;
+      results.push_back(time_kernel(
+          "lookup_query" + suffix, queries.size(), min_ms, [&]() {
+            for (const vector<string>& query : queries) {
+              g_sink = g_sink + index.lookup_query(query).size();
+            }
+          }));
+      results.push_back(time_kernel(
+          "lookup_query_top20" + suffix, queries.size(), min_ms, [&]() {
+            for (const vector<string>& query : queries) {
+              g_sink = g_sink + index.lookup_query(query, 20, 0).size();
+            }
+          }));
+    }
+  }
+
+  // One document's text per call
+  results.push_back(time_kernel(
+      "split", corpus.texts.size(), min_ms, [&corpus]() {
+        for (const string& text : corpus.texts) {
+          g_sink = g_sink + split(text, " .\n").size();
+        }
+      }));
+
+  // Result snippets with a few characters that have to be escaped, and
+  // the query URLs the result pages link to, with some escapes of their
+  // own
+  static const char kSpecial[] = "<>&\"'";
+  vector<string> snippets;
+  vector<string> targets;
+  for (size_t i = 0; i < 256; i++) {
+    const string& text = corpus.texts[i % corpus.texts.size()];
+    string snippet = text.substr(0, 200);
+    for (size_t pos = rng() % 17; pos < snippet.size(); pos += 17) {
+      snippet[pos] = kSpecial[rng() % (sizeof(kSpecial) - 1)];
+    }
+    snippets.push_back(std::move(snippet));
+
+    vector<vector<string>> query = make_queries(corpus, 1 + i % 3, "mixed",
+                                                &rng);
+    string terms = query[0][0];
+    for (size_t w = 1; w < query[0].size(); w++) {
+      terms += (w % 2 == 0) ? "%20" : "+";
+      terms += query[0][w];
+    }
+    targets.push_back("/query?terms=" + terms + "%21&rank=bm25&n=20&page=" +
+                      std::to_string(1 + i % 5));
+  }
+
+  results.push_back(time_kernel(
+      "escape_html", snippets.size(), min_ms, [&snippets]() {
+        for (const string& snippet : snippets) {
+          g_sink = g_sink + escape_html(snippet).size();
+        }
+      }));
+  results.push_back(time_kernel(
+      "decode_URI", targets.size(), min_ms, [&targets]() {
+        for (const string& target : targets) {
+          g_sink = g_sink + decode_URI(target).size();
+        }
+      }));
+  results.push_back(time_kernel(
+      "URLParser::parse", targets.size(), min_ms, [&targets]() {
+        for (const string& target : targets) {
+          URLParser parser;
+          parser.parse(target);
+          g_sink = g_sink + parser.path().size();
+        }
+      }));
+
+  if (json) {
+    print_kernels_json(results, num_docs, vocab_size, num_words, seed);
+  } else {
+    print_kernels_table(results);
+  }
+  return EXIT_SUCCESS;
+}
+
+static int bench_terms(int argc, char* argv[]) {
+  size_t vocab_size = 1000000;
+  uint64_t seed = 1;
+  double min_ms = 100;
+  for (int i = 2; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--vocab" && i + 1 < argc) {
+      vocab_size = std::max(std::strtoul(argv[++i], nullptr, 10), 1UL);
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seed = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--min-ms" && i + 1 < argc) {
+      min_ms = std::strtod(argv[++i], nullptr);
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " terms [--vocab <n>] [--seed <n>] [--min-ms <n>]\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Half of the words are held back, to look up words that are missing
+  std::mt19937_64 rng(seed);
+  vector<string> words = make_vocabulary(vocab_size * 2, &rng);
+  vector<string> missing(words.begin() + vocab_size, words.end());
+  words.resize(vocab_size);
+
+  // Each word maps to its number, as the map of an index maps each word
+  // to its posting list; the bytes are whatever the map allocates
+  uint64_t bytes = g_alloc_bytes.load(std::memory_order_relaxed);
+  std::unordered_map<string, uint32_t> map;
+  for (size_t i = 0; i < words.size(); i++) {
+    map.emplace(words[i], static_cast<uint32_t>(i));
+  }
+  uint64_t map_bytes = g_alloc_bytes.load(std::memory_order_relaxed) - bytes;
+
+  vector<string> sorted = words;
+  std::sort(sorted.begin(), sorted.end());
+  TermDictionary dict;
+  dict.build(vector<std::string_view>(sorted.begin(), sorted.end()));
+  size_t dict_bytes = dict.data.size() + dict.blocks.size() * sizeof(uint32_t);
+  TermDictionaryView view = dict.view();
+
+  size_t text_bytes = 0;
+  for (const string& word : words) {
+    text_bytes += word.size();
+  }
+  std::cout << vocab_size << " words of " << text_bytes << " bytes, seed "
+            << seed << "\n"
+            << "  unordered_map   " << std::setw(12) << map_bytes
+            << " bytes\n"
+            << "  TermDictionary  " << std::setw(12) << dict_bytes
+            << " bytes\n\n";
+
+  vector<string> hits;
+  vector<string> misses;
+  vector<string> prefixes;
+  for (size_t i = 0; i < 4096; i++) {
+    hits.push_back(words[rng() % words.size()]);
+    misses.push_back(missing[rng() % missing.size()]);
+    if (i < 256) {
+      prefixes.push_back(hits.back().substr(0, 2 + i % 3));
+    }
+  }
+
+  vector<KernelResult> results;
+  for (const auto& [name, queries] :
+       {std::make_pair("hit", &hits), std::make_pair("miss", &misses)}) {
+    results.push_back(time_kernel(
+        string("find/") + name + "/unordered_map", queries->size(), min_ms,
+        [&]() {
+          for (const string& word : *queries) {
+            g_sink = g_sink + (map.find(word) != map.end());
+          }
+        }));
+    results.push_back(time_kernel(
+        string("find/") + name + "/TermDictionary", queries->size(), min_ms,
+        [&]() {
+          for (const string& word : *queries) {
+            g_sink = g_sink + view.find(word);
+          }
+        }));
+  }
+
+  // Every word with the prefix, counted. The map has to compare every one
+  // of its words, so it gets a few prefixes only.
+  results.push_back(time_kernel(
+      "prefix/unordered_map", 4, min_ms, [&]() {
+        for (size_t i = 0; i < 4; i++) {
+          std::string_view prefix = prefixes[i];
+          for (const auto& entry : map) {
+            g_sink = g_sink + (entry.first.compare(0, prefix.size(),
+                                                   prefix) == 0);
+          }
+        }
+      }));
+  results.push_back(time_kernel(
+      "prefix/TermDictionary", prefixes.size(), min_ms, [&]() {
+        for (const string& prefix : prefixes) {
+          for (TermCursor cursor(view, view.lower_bound(prefix));
+               !cursor.done() && cursor.term().substr(0, prefix.size()) ==
+                                     prefix;
+               cursor.next()) {
+            g_sink = g_sink + 1;
+          }
+        }
+      }));
+
+  // Words with one random edit, as a typo would make them. Scanning checks
+  // every word, so it gets a few of them only.
+  vector<string> typos;
+  for (size_t i = 0; i < 256; i++) {
+    string word = hits[i];
+    size_t pos = rng() % word.size();
+    auto letter = static_cast<char>('a' + rng() % 26);
+    switch (rng() % 3) {
+      case 0:
+        word[pos] = letter;
+        break;
+      case 1:
+        word.insert(word.begin() + static_cast<std::ptrdiff_t>(pos), letter);
+        break;
+      default:
+        word.erase(pos, 1);
+        break;
+    }
+    typos.push_back(std::move(word));
+  }
+  for (uint32_t distance = 1; distance <= 2; distance++) {
+    string suffix = "/" + std::to_string(distance);
+    results.push_back(time_kernel(
+        "fuzzy" + suffix + "/scan", 4, min_ms, [&]() {
+          for (size_t i = 0; i < 4; i++) {
+            LevenshteinAutomaton automaton(typos[i], distance);
+            for (const string& word : sorted) {
+              g_sink = g_sink + (automaton.distance(word) <= distance);
+            }
+          }
+        }));
+    results.push_back(time_kernel(
+        "fuzzy" + suffix + "/TermDictionary", typos.size(), min_ms, [&]() {
+          vector<FuzzyMatch> matches;
+          for (const string& typo : typos) {
+            LevenshteinAutomaton automaton(typo, distance);
+            matches.clear();
+            automaton.intersect(view, &matches);
+            g_sink = g_sink + matches.size();
+          }
+        }));
+  }
+
+  print_kernels_table(results);
+  return EXIT_SUCCESS;
+}
+
+// Returns the names of every document a query matches, sorted, where
+// match_any matches documents with any of the words rather than all
+static vector<string> matching_docs(ShardedIndex* index,
+                                    const vector<string>& query,
+                                    bool match_any) {
+  size_t all = index->num_docs();
+  vector<Result> results = match_any ? index->lookup_any(query, all, 0)
+                                     : index->lookup_query(query, all, 0);
+  vector<string> names;
+  for (const Result& result : results) {
+    names.push_back(result.doc_name);
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+static int bench_shards(int argc, char* argv[]) {
+  size_t num_docs = 50000;
+  size_t vocab_size = 50000;
+  size_t num_shards = 4;
+  uint64_t seed = 1;
+  double min_ms = 200;
+  for (int i = 2; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--docs" && i + 1 < argc) {
+      num_docs = std::max(std::strtoul(argv[++i], nullptr, 10), 1UL);
+    } else if (arg == "--vocab" && i + 1 < argc) {
+      vocab_size = std::max(std::strtoul(argv[++i], nullptr, 10), 1UL);
+    } else if (arg == "--shards" && i + 1 < argc) {
+      num_shards = std::max(std::strtoul(argv[++i], nullptr, 10), 2UL);
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seed = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--min-ms" && i + 1 < argc) {
+      min_ms = std::strtod(argv[++i], nullptr);
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " shards [--docs <n>] [--vocab <n>] [--shards <n>]"
+                   " [--seed <n>] [--min-ms <n>]\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Index the corpus from files, as the server does, with the one crawl
+  // thread both kinds of index are built with by default
+  Corpus corpus = make_corpus(num_docs, vocab_size, seed);
+  char dir_template[] = "/tmp/microbench-shards-XXXXXX";
+  if (mkdtemp(dir_template) == nullptr) {
+    std::cerr << "Failed to create a temporary directory\n";
+    return EXIT_FAILURE;
+  }
+  string dir = dir_template;
+  for (size_t d = 0; d < corpus.texts.size(); d++) {
+    std::ofstream(dir + "/doc" + std::to_string(d) + ".txt")
+        << corpus.texts[d];
+  }
+  std::optional<WordIndex> whole = crawl_filetree(dir, 1);
+  std::optional<vector<WordIndex>> shards =
+      crawl_filetree_shards(dir, 1, num_shards);
+  for (size_t d = 0; d < corpus.texts.size(); d++) {
+    unlink((dir + "/doc" + std::to_string(d) + ".txt").c_str());
+  }
+  rmdir(dir.c_str());
+  if (!whole || !shards) {
+    std::cerr << "Failed to crawl " << dir << "\n";
+    return EXIT_FAILURE;
+  }
+  ThreadPool pool(num_shards);
+  ShardedIndex single(std::move(*whole));
+  ShardedIndex sharded(std::move(*shards), &pool);
+  std::cout << num_docs << " documents from a " << vocab_size
+            << " word vocabulary in 1 and " << num_shards << " shards, seed "
+            << seed << "\n";
+
+  std::cout << std::left << std::setw(28) << "query" << std::right
+            << std::setw(14) << "1 shard us" << std::setw(14)
+            << (std::to_string(num_shards) + " shards us") << std::setw(10)
+            << "speedup" << "\n";
+  std::mt19937_64 rng(seed);
+  for (const string mode : {"all", "any"}) {
+    for (const string mix : {"common", "rare"}) {
+      for (size_t num_terms = 1; num_terms <= 3; num_terms++) {
+        vector<vector<string>> queries =
+            make_queries(corpus, num_terms, mix, &rng);
+        string name = mode + "/" + std::to_string(num_terms) + "/" + mix;
+
+        // Scores differ between the two, since each shard ranks with the
+        // statistics of its own documents, but the matches may not
+        for (size_t i = 0; i < std::min<size_t>(queries.size(), 32); i++) {
+          if (matching_docs(&single, queries[i], mode == "any") !=
+              matching_docs(&sharded, queries[i], mode == "any")) {
+            std::cerr << name << ": the shards match other documents than "
+                      << "the single index\n";
+            return EXIT_FAILURE;
+          }
+        }
+
+        auto run = [&](ShardedIndex* index) {
+          for (const vector<string>& query : queries) {
+            if (mode == "all") {
+              g_sink = g_sink + index->lookup_query(query, 20, 0).size();
+            } else {
+              g_sink = g_sink + index->lookup_any(query, 20, 0).size();
+            }
+          }
+        };
+        KernelResult one = time_kernel("", queries.size(), min_ms,
+                                       [&]() { run(&single); });
+        KernelResult many = time_kernel("", queries.size(), min_ms,
+                                        [&]() { run(&sharded); });
+        std::cout << std::left << std::setw(28) << name << std::right
+                  << std::fixed << std::setprecision(1) << std::setw(14)
+                  << one.ns_per_op / 1000 << std::setw(14)
+                  << many.ns_per_op / 1000 << std::setw(9)
+                  << std::setprecision(2) << one.ns_per_op / many.ns_per_op
+                  << "x\n";
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+  string bench = (argc > 1) ? argv[1] : "";
+  if (bench == "wand") {
+    return bench_wand(argc, argv);
+  }
+  if (bench == "codecs") {
+    return bench_codecs(argc, argv);
+  }
+  if (bench == "threadpool") {
+    return bench_threadpool(argc, argv);
+  }
+  if (bench == "tokenize") {
+    return bench_tokenize(argc, argv);
+  }
+  if (bench == "httpparse") {
+    return bench_httpparse(argc, argv);
+  }
+  if (bench == "socketio") {
+    return bench_socketio(argc, argv);
+  }
+  if (bench == "pipeline") {
+    return bench_pipeline(argc, argv);
+  }
+  if (bench == "kernels") {
+    return bench_kernels(argc, argv);
+  }
+  if (bench == "terms") {
+    return bench_terms(argc, argv);
+  }
+  if (bench == "shards") {
+    return bench_shards(argc, argv);
+  }
+
+  std::cerr << "Usage: " << argv[0] << " <benchmark> [arguments...]\n"
+            << "Benchmarks: wand, codecs, threadpool, tokenize, httpparse, socketio,"
+            << " pipeline, kernels, terms,"
+            << " shards\n";
+  return EXIT_FAILURE;
+}
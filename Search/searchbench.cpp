@@ -0,0 +1,541 @@
+// A load generator for searchserver. It opens keep-alive connections to a
+// running server, sends queries over each of them for a while, and
+// reports the throughput and the distribution of response latencies, so
+// that changes to the server's hot path can be compared run against run.
+//
+// Usage: ./searchbench [options] <host> <port>
+//
+//  --queries <file>
+//    Replays a query log. Each line is either a request target, such as
+//    /query?terms=struct+int&mode=any, or the words of a query, which are
+//    sent as /query?terms=<words>. Each connection starts at a different
+//    line and wraps around at the end of the file.
+//
+//  --vocab <index file>
+//    Makes up queries from the words of an index file written by
+//    indexbuilder instead. Words are ranked by how many documents they
+//    are in and picked with a Zipf distribution over that rank, so that
+//    common words are asked for far more often than rare ones, as they
+//    are in real query logs.
+//
+//  --zipf <exponent>        the skew of the Zipf distribution (default 1)
+//  --terms <k>              made up queries have 1 to k words (default 2)
+//  --connections <n>        connections to open, one thread each (default 8)
+//  --duration <seconds>     how long to measure for (default 10)
+//  --warmup <seconds>       how long to send before measuring (default 1)
+//  --seed <n>               seeds the choice of made up queries (default 1)
+//
+//  --rate <requests/s>
+//    Sends requests on a fixed schedule, spread evenly over the
+//    connections, instead of sending the next request on a connection as
+//    soon as the last response arrives (--rate 0, the default). Latency is
+//    then measured from when each request was due to be sent, so a server
+//    that stalls is charged for the requests it held back too, not only
+//    for the one it was answering.
+//
+// Latencies are kept in a Histogram, so the percentiles reported are
+// within 1% of the exact ones.
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "./Histogram.hpp"
+#include "./HttpRequest.hpp"
+#include "./HttpUtils.hpp"
+#include "./IndexFile.hpp"
+
+using namespace searchserver;
+
+using std::string;
+using std::vector;
+
+using Clock = std::chrono::steady_clock;
+
+// What to send and for how long, from the command line
+struct BenchOptions {
+  string host;
+  uint16_t port = 0;
+  string query_file;
+  string vocab_file;
+  double zipf = 1.0;
+  size_t max_terms = 2;
+  size_t connections = 8;
+  double duration = 10;
+  double warmup = 1;
+  double rate = 0;
+  uint64_t seed = 1;
+};
+
+// The queries to send: either the targets of a query log, or words to
+// make queries from and the Zipf distribution to pick them with
+struct QuerySource {
+  vector<string> targets;
+  vector<string> words;
+  vector<double> cdf;
+  size_t max_terms = 0;
+};
+
+// One connection and the thread that drives it
+struct Worker {
+  const BenchOptions* options = nullptr;
+  const QuerySource* source = nullptr;
+  size_t id = 0;
+  Clock::time_point start;
+  Clock::time_point measure_start;
+  Clock::time_point end;
+
+  // Filled in by the thread
+  Histogram latencies;
+  uint64_t completed = 0;
+  uint64_t failed_status = 0;
+  uint64_t errors = 0;
+};
+
+// Reads the command line into options. Returns false if it is not valid.
+static bool parse_args(int argc, char* argv[], BenchOptions* options);
+
+// Prints the usage of the program
+static void usage(const char* name);
+
+// Reads the targets of a query log. Returns false if the file cannot be
+// read or has no queries.
+static bool load_query_log(const string& path, QuerySource* source);
+
+// Reads the words of an index file, ranks them by how many documents
+// they are in, and builds the cumulative Zipf distribution over the
+// ranks. Returns false if the file cannot be opened or has no words.
+static bool load_vocabulary(const string& path, double exponent,
+                            QuerySource* source);
+
+// Percent-encodes a query argument
+static string encode_query_arg(std::string_view arg);
+
+// Returns the target of the next query a worker sends
+static string next_target(const QuerySource& source, size_t* next_line,
+                          std::mt19937_64* rng);
+
+// Reads one response from fd, keeping whatever follows it in buffer.
+//
+// Arguments:
+//  - fd: the connection
+//  - buffer: bytes already read from the connection, which are read into
+//  - status: set to the status code of the response
+//
+// Returns:
+//  - false if the connection failed or closed, or the response could
+//    not be parsed
+static bool read_response(int fd, string* buffer, int* status);
+
+// The thread of one Worker
+static void* run_worker(void* arg);
+
+// Formats nanoseconds as milliseconds
+static string format_ms(uint64_t ns);
+
+int main(int argc, char* argv[]) {
+  BenchOptions options;
+  if (!parse_args(argc, argv, &options)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  QuerySource source;
+  if (!options.query_file.empty()) {
+    if (!load_query_log(options.query_file, &source)) {
+      std::cerr << "No queries in " << options.query_file << "\n";
+      return EXIT_FAILURE;
+    }
+  } else if (!load_vocabulary(options.vocab_file, options.zipf, &source)) {
+    std::cerr << "Could not read the words of " << options.vocab_file << "\n";
+    return EXIT_FAILURE;
+  }
+  source.max_terms = options.max_terms;
+
+  // A server that goes away shows up as failed writes, which are counted
+  // as connection errors, rather than ending the program
+  signal(SIGPIPE, SIG_IGN);
+
+  // Every worker runs on the same schedule, starting once they have all
+  // been created
+  auto to_clock = [](double seconds) {
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(seconds));
+  };
+  Clock::time_point start = Clock::now() + std::chrono::milliseconds(100);
+  Clock::time_point measure_start = start + to_clock(options.warmup);
+  Clock::time_point end = measure_start + to_clock(options.duration);
+
+  vector<Worker> workers(options.connections);
+  vector<pthread_t> threads(options.connections);
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].options = &options;
+    workers[i].source = &source;
+    workers[i].id = i;
+    workers[i].start = start;
+    workers[i].measure_start = measure_start;
+    workers[i].end = end;
+    if (pthread_create(&threads[i], nullptr, run_worker, &workers[i]) != 0) {
+      std::cerr << "Could not start thread " << i << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  Histogram latencies;
+  uint64_t completed = 0;
+  uint64_t failed_status = 0;
+  uint64_t errors = 0;
+  for (size_t i = 0; i < workers.size(); i++) {
+    pthread_join(threads[i], nullptr);
+    latencies.merge(workers[i].latencies);
+    completed += workers[i].completed;
+    failed_status += workers[i].failed_status;
+    errors += workers[i].errors;
+  }
+
+  std::cout << options.connections << " connections, ";
+  if (options.rate > 0) {
+    std::cout << "open loop at " << options.rate << " requests/s, ";
+  } else {
+    std::cout << "closed loop, ";
+  }
+  std::cout << options.duration << " s after " << options.warmup
+            << " s of warmup, "
+            << (options.query_file.empty() ? "Zipf queries from "
+                                           : "queries from ")
+            << (options.query_file.empty() ? options.vocab_file
+                                           : options.query_file)
+            << "\n";
+
+  double qps = static_cast<double>(completed) / options.duration;
+  std::cout << std::fixed << std::setprecision(1) << "  requests: "
+            << completed << " (" << qps << " requests/s), " << failed_status
+            << " not 200 OK, " << errors << " connection errors\n";
+  std::cout << "  latency:  mean " << format_ms(std::llround(latencies.mean()))
+            << ", min " << format_ms(latencies.min()) << ", max "
+            << format_ms(latencies.max()) << "\n";
+  std::cout << "  p50 " << format_ms(latencies.percentile(50)) << "  p90 "
+            << format_ms(latencies.percentile(90)) << "  p99 "
+            << format_ms(latencies.percentile(99)) << "  p99.9 "
+            << format_ms(latencies.percentile(99.9)) << "\n";
+  if (options.rate > 0 && qps < options.rate * 0.95) {
+    std::cout << "  the server did not keep up with the requested rate\n";
+  }
+  return (completed > 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool parse_args(int argc, char* argv[], BenchOptions* options) {
+  vector<string> positional;
+  try {
+    for (int i = 1; i < argc; i++) {
+      string arg = argv[i];
+      bool has_value = (i + 1 < argc);
+      if (arg == "--queries" && has_value) {
+        options->query_file = argv[++i];
+      } else if (arg == "--vocab" && has_value) {
+        options->vocab_file = argv[++i];
+      } else if (arg == "--zipf" && has_value) {
+        options->zipf = std::stod(argv[++i]);
+      } else if (arg == "--terms" && has_value) {
+        options->max_terms = std::max(std::stoul(argv[++i]), 1UL);
+      } else if (arg == "--connections" && has_value) {
+        options->connections = std::max(std::stoul(argv[++i]), 1UL);
+      } else if (arg == "--duration" && has_value) {
+        options->duration = std::stod(argv[++i]);
+      } else if (arg == "--warmup" && has_value) {
+        options->warmup = std::max(std::stod(argv[++i]), 0.0);
+      } else if (arg == "--rate" && has_value) {
+        options->rate = std::max(std::stod(argv[++i]), 0.0);
+      } else if (arg == "--seed" && has_value) {
+        options->seed = std::stoull(argv[++i]);
+      } else if (arg.starts_with("--")) {
+        return false;
+      } else {
+        positional.push_back(arg);
+      }
+    }
+    if (positional.size() != 2) {
+      return false;
+    }
+    options->host = positional[0];
+    unsigned long port = std::stoul(positional[1]);
+    if (port == 0 || port > UINT16_MAX) {
+      return false;
+    }
+    options->port = static_cast<uint16_t>(port);
+  } catch (const std::exception&) {
+    return false;
+  }
+
+  // Exactly one source of queries
+  return options->duration > 0 &&
+         options->query_file.empty() != options->vocab_file.empty();
+}
+
+static void usage(const char* name) {
+  std::cerr << "Usage: " << name
+            << " (--queries <file> | --vocab <index file>) [--zipf <exponent>]"
+               " [--terms <k>]\n"
+               "       [--connections <n>] [--duration <seconds>]"
+               " [--warmup <seconds>]\n"
+               "       [--rate <requests/s>] [--seed <n>] <host> <port>\n";
+}
+
+static bool load_query_log(const string& path, QuerySource* source) {
+  std::ifstream file(path);
+  string line;
+  while (std::getline(file, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty()) {
+      continue;
+    }
+    if (line[0] == '/') {
+      source->targets.push_back(line);
+    } else {
+      source->targets.push_back("/query?terms=" + encode_query_arg(line));
+    }
+  }
+  return !source->targets.empty();
+}
+
+static bool load_vocabulary(const string& path, double exponent,
+                            QuerySource* source) {
+  std::shared_ptr<const IndexFile> file = IndexFile::open(path);
+  if (file == nullptr || file->num_terms() == 0) {
+    return false;
+  }
+
+  // Rank the words from the most documents to the fewest
+  vector<string> terms;
+  vector<std::pair<size_t, size_t>> ranked;
+  terms.reserve(file->num_terms());
+  ranked.reserve(file->num_terms());
+  for (TermCursor cursor(file->terms(), 0); !cursor.done(); cursor.next()) {
+    ranked.emplace_back(file->postings(cursor.index()).size, terms.size());
+    terms.emplace_back(cursor.term());
+  }
+  if (terms.empty()) {
+    return false;
+  }
+  std::stable_sort(ranked.begin(), ranked.end(),
+                   [](const auto& a, const auto& b) { return a.first > b.first; });
+
+  // The word of rank r is picked with probability proportional to
+  // 1 / r^exponent; cdf[r - 1] is the total weight of ranks 1 to r
+  double total = 0;
+  source->words.reserve(ranked.size());
+  source->cdf.reserve(ranked.size());
+  for (size_t r = 0; r < ranked.size(); r++) {
+    source->words.push_back(std::move(terms[ranked[r].second]));
+    total += 1.0 / std::pow(static_cast<double>(r + 1), exponent);
+    source->cdf.push_back(total);
+  }
+  return true;
+}
+
+static string encode_query_arg(std::string_view arg) {
+  static const char* const kHex = "0123456789ABCDEF";
+  string encoded;
+  for (unsigned char c : arg) {
+    if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      encoded += static_cast<char>(c);
+    } else if (c == ' ') {
+      encoded += '+';
+    } else {
+      encoded += '%';
+      encoded += kHex[c >> 4];
+      encoded += kHex[c & 0xF];
+    }
+  }
+  return encoded;
+}
+
+static string next_target(const QuerySource& source, size_t* next_line,
+                          std::mt19937_64* rng) {
+  if (!source.targets.empty()) {
+    const string& target = source.targets[*next_line];
+    *next_line = (*next_line + 1) % source.targets.size();
+    return target;
+  }
+
+  std::uniform_real_distribution<double> uniform(0, source.cdf.back());
+  size_t num_terms = 1 + (*rng)() % source.max_terms;
+  string target = "/query?terms=";
+  for (size_t i = 0; i < num_terms; i++) {
+    auto it = std::upper_bound(source.cdf.begin(), source.cdf.end(),
+                               uniform(*rng));
+    size_t rank = std::min<size_t>(it - source.cdf.begin(),
+                                   source.words.size() - 1);
+    if (i > 0) {
+      target += '+';
+    }
+    target += encode_query_arg(source.words[rank]);
+  }
+  return target;
+}
+
+static bool read_response(int fd, string* buffer, int* status) {
+  // Read until the whole header has arrived
+  size_t scanned = 0;
+  size_t header_len = find_header_end(*buffer, &scanned);
+  while (header_len == 0) {
+    if (wrapped_read(fd, buffer) == 0) {
+      return false;
+    }
+    header_len = find_header_end(*buffer, &scanned);
+  }
+
+  // The status line is "HTTP/1.1 <status> <reason>"
+  std::string_view header(buffer->data(), header_len);
+  size_t space = header.find(' ');
+  if (space == std::string_view::npos) {
+    return false;
+  }
+  *status = std::atoi(header.data() + space + 1);
+
+  // Every response from searchserver has a Content-Length
+  size_t body_len = 0;
+  bool found = false;
+  size_t pos = header.find("\r\n") + 2;
+  while (pos < header.size()) {
+    size_t eol = header.find("\r\n", pos);
+    std::string_view line = header.substr(pos, eol - pos);
+    pos = eol + 2;
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    string name(line.substr(0, colon));
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (name == "content-length") {
+      body_len = std::strtoul(string(line.substr(colon + 1)).c_str(),
+                              nullptr, 10);
+      found = true;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+
+  while (buffer->size() < header_len + body_len) {
+    if (wrapped_read(fd, buffer) == 0) {
+      return false;
+    }
+  }
+  buffer->erase(0, header_len + body_len);
+  return true;
+}
+
+static void* run_worker(void* arg) {
+  auto* worker = static_cast<Worker*>(arg);
+  const BenchOptions& options = *worker->options;
+  const QuerySource& source = *worker->source;
+
+  std::mt19937_64 rng(options.seed + worker->id);
+  size_t next_line = source.targets.empty()
+                         ? 0
+                         : worker->id * source.targets.size() /
+                               options.connections;
+
+  // With a fixed rate, each connection sends every interval, and the
+  // connections are staggered across one interval so that the requests
+  // are spread evenly
+  bool open_loop = (options.rate > 0);
+  Clock::duration interval{};
+  Clock::time_point due = worker->start;
+  if (open_loop) {
+    interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(
+            static_cast<double>(options.connections) / options.rate));
+    due += interval * worker->id / options.connections;
+  }
+
+  std::this_thread::sleep_until(worker->start);
+  int fd = -1;
+  string buffer;
+  while (true) {
+    Clock::time_point sent;
+    if (open_loop) {
+      // A server that falls behind the schedule is not given extra time
+      // to catch up; requests still due at the end are never sent
+      if (due >= worker->end || Clock::now() >= worker->end) {
+        break;
+      }
+      std::this_thread::sleep_until(due);
+      sent = due;
+      due += interval;
+    } else {
+      sent = Clock::now();
+      if (sent >= worker->end) {
+        break;
+      }
+    }
+
+    if (fd == -1) {
+      if (!connect_to_server(options.host, options.port, &fd)) {
+        worker->errors++;
+        fd = -1;
+        usleep(100000);
+        continue;
+      }
+      buffer.clear();
+    }
+
+    string request = "GET " + next_target(source, &next_line, &rng) +
+                     " HTTP/1.1\r\nHost: " + options.host + "\r\n\r\n";
+    int status = 0;
+    if (wrapped_write(fd, request) != request.size() ||
+        !read_response(fd, &buffer, &status)) {
+      // Start over on a new connection
+      worker->errors++;
+      close(fd);
+      fd = -1;
+      continue;
+    }
+
+    // Responses that arrive after the warmup are measured, however long
+    // ago their requests were due
+    Clock::time_point received = Clock::now();
+    if (received >= worker->measure_start) {
+      auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          received - sent);
+      worker->latencies.record(static_cast<uint64_t>(latency.count()));
+      worker->completed++;
+      if (status != 200) {
+        worker->failed_status++;
+      }
+    }
+  }
+
+  if (fd != -1) {
+    close(fd);
+  }
+  return nullptr;
+}
+
+static string format_ms(uint64_t ns) {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(3)
+      << static_cast<double>(ns) / 1e6 << " ms";
+  return out.str();
+}
@@ -1,15 +1,30 @@
+#include <signal.h>
+
 #include <algorithm>
+#include <cctype>
 #include <cstdlib>
-#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include "CrawlFileTree.hpp"
+#include "FileCache.hpp"
+#include "HttpRequest.hpp"
 #include "HttpSocket.hpp"
 #include "HttpUtils.hpp"
+#include "IndexSnapshots.hpp"
+#include "IndexWatcher.hpp"
+#include "PhraseQuery.hpp"
+#include "QueryCache.hpp"
+#include "Reactor.hpp"
+#include "ReadBuffer.hpp"
+#include "RemoteShards.hpp"
 #include "ServerSocket.hpp"
 #include "ThreadPool.hpp"
 #include "WordIndex.hpp"
@@ -33,208 +48,857 @@ const char* const SEARCH_TEMPLATE_STR = R"(
 </center><p>
 )";
 
-//Create HTTP responses
-std::string generate_html_response(const std::string& content, int status = 200) {
+// Number of results shown per page of a query, unless the request
+// asks for a different amount with "&n=", and the most it may ask for
+static const size_t kDefaultPageSize = 20;
+static const size_t kMaxPageSize = 100;
+
+// Number of words suggested to complete a prefix, unless the request asks
+// for a different amount with "&n=", and the most it may ask for
+static const size_t kDefaultSuggestions = 10;
+static const size_t kMaxSuggestions = 50;
+
+// The deepest result a page of a query may reach, which bounds the
+// pages a client can ask for and the results a backend returns for one
+// /shard/query
+static const size_t kMaxResults = 10000;
+
+// Reads a non-negative integer argument from the query string, returning
+// default_value if it is missing or malformed
+size_t parse_count(const HttpRequest& request, std::string_view name,
+                   size_t default_value) {
+  std::optional<std::string_view> arg = request.arg(name);
+  if (!arg) {
+    return default_value;
+  }
+  std::string digits = decode_URI(std::string(*arg));
+  char* end = nullptr;
+  unsigned long value = std::strtoul(digits.c_str(), &end, 10);
+  if (digits.empty() || *end != '\0' || digits[0] == '-') {
+    return default_value;
+  }
+  return static_cast<size_t>(value);
+}
+
+// Percent-encodes a string so it can be placed in a query string argument
+std::string encode_query_arg(const std::string& arg) {
+  static const char* const kHex = "0123456789ABCDEF";
+  std::string encoded;
+  for (unsigned char c : arg) {
+    if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      encoded += static_cast<char>(c);
+    } else {
+      encoded += '%';
+      encoded += kHex[c >> 4];
+      encoded += kHex[c & 0xF];
+    }
+  }
+  return encoded;
+}
+
+//Create HTTP responses. Only the header is built here; the body is
+// written after it as it is, without joining the two.
+HttpResponse generate_html_response(std::shared_ptr<const std::string> content,
+                                    int status = 200) {
   std::string status_text = (status == 200) ? "OK" : "Not Found";
-  std::string response =
+  std::string header =
       "HTTP/1.1 " + std::to_string(status) + " " + status_text + "\r\n"
-      "Content-length: " + std::to_string(content.size()) + "\r\n"
-      "\r\n" + content;
-  return response;
+      "Content-length: " + std::to_string(content->size()) + "\r\n"
+      "\r\n";
+  return HttpResponse(std::move(header), std::move(content));
 }
 
-std::string generate_plain_response(const std::string& content) {
-  std::string response =
+HttpResponse generate_plain_response(std::string content,
+                                     const std::string& type = "text/plain") {
+  std::string header =
       "HTTP/1.1 200 OK\r\n"
-      "Content-type: text/plain\r\n"
+      "Content-type: " + type + "\r\n"
       "Content-length: " + std::to_string(content.size()) + "\r\n"
-      "\r\n" + content;
+      "\r\n";
+  return HttpResponse(std::move(header),
+                      std::make_shared<const std::string>(std::move(content)));
+}
+
+// How a "Range:" header asks for part of a file
+enum class RangeRequest {
+  // The header is missing, malformed or asks for several ranges, so the
+  // whole file is sent
+  kWhole,
+
+  // The header asks for one range that overlaps the file
+  kPartial,
+
+  // The header asks for a range entirely past the end of the file
+  kUnsatisfiable,
+};
+
+// Parses a string made only of decimal digits, returning false if it is
+// empty, has any other character or does not fit in a size_t
+bool parse_digits(std::string_view str, size_t* value) {
+  if (str.empty() || str.size() > 19 ||
+      str.find_first_not_of("0123456789") != std::string_view::npos) {
+    return false;
+  }
+  *value = 0;
+  for (char c : str) {
+    *value = *value * 10 + static_cast<size_t>(c - '0');
+  }
+  return true;
+}
+
+// Parses the value of a "Range:" header, such as "bytes=0-99",
+// "bytes=100-" or "bytes=-100", against a file of the given size.
+//
+// Arguments:
+//  - value: the header's value
+//  - size: the size of the file
+//  - offset, length: set to the range to send if it is kPartial
+//
+// Returns:
+//  - how much of the file to send
+RangeRequest parse_range(std::string_view value, size_t size,
+                         size_t* offset, size_t* length) {
+  static constexpr std::string_view kUnit = "bytes=";
+  if (value.substr(0, kUnit.size()) != kUnit ||
+      value.find(',') != std::string_view::npos) {
+    return RangeRequest::kWhole;
+  }
+  size_t dash = value.find('-', kUnit.size());
+  if (dash == std::string_view::npos) {
+    return RangeRequest::kWhole;
+  }
+  std::string_view first_str = value.substr(kUnit.size(), dash - kUnit.size());
+  std::string_view last_str = value.substr(dash + 1);
+
+  size_t first = 0;
+  size_t last = 0;
+  if (first_str.empty()) {
+    // "-n" asks for the last n bytes
+    if (!parse_digits(last_str, &last)) {
+      return RangeRequest::kWhole;
+    }
+    if (last == 0 || size == 0) {
+      return RangeRequest::kUnsatisfiable;
+    }
+    *length = std::min(last, size);
+    *offset = size - *length;
+    return RangeRequest::kPartial;
+  }
+
+  if (!parse_digits(first_str, &first)) {
+    return RangeRequest::kWhole;
+  }
+  if (last_str.empty()) {
+    last = size - 1;
+  } else if (!parse_digits(last_str, &last) || last < first) {
+    return RangeRequest::kWhole;
+  }
+  if (first >= size) {
+    return RangeRequest::kUnsatisfiable;
+  }
+  last = std::min(last, size - 1);
+  *offset = first;
+  *length = last - first + 1;
+  return RangeRequest::kPartial;
+}
+
+// Builds the response that sends a static file, or the single range of
+// it that the request asks for. Only the header is built here; the body
+// is sent straight from the file.
+HttpResponse generate_file_response(const HttpRequest& request,
+                                    std::shared_ptr<const OpenFile> file) {
+  size_t size = static_cast<size_t>(file->size());
+  size_t offset = 0;
+  size_t length = size;
+
+  RangeRequest range = RangeRequest::kWhole;
+  std::optional<std::string_view> range_header = request.find_header("range");
+  if (range_header) {
+    range = parse_range(*range_header, size, &offset, &length);
+  }
+
+  if (range == RangeRequest::kUnsatisfiable) {
+    return HttpResponse(
+        "HTTP/1.1 416 Range Not Satisfiable\r\n"
+        "Content-Range: bytes */" + std::to_string(size) + "\r\n"
+        "Content-length: 0\r\n"
+        "\r\n");
+  }
+
+  HttpResponse response(
+      std::string(range == RangeRequest::kPartial
+                      ? "HTTP/1.1 206 Partial Content\r\n"
+                        "Content-Range: bytes " + std::to_string(offset) +
+                            "-" + std::to_string(offset + length - 1) + "/" +
+                            std::to_string(size) + "\r\n"
+                      : "HTTP/1.1 200 OK\r\n") +
+      "Content-type: text/plain\r\n"
+      "Accept-Ranges: bytes\r\n"
+      "Content-length: " + std::to_string(length) + "\r\n"
+      "\r\n");
+  response.file = std::move(file);
+  response.offset = static_cast<off_t>(offset);
+  response.length = length;
   return response;
 }
 
-std::string generate_404_response() {
-  std::string content = "<html><body><h1>404 Not Found</h1></body></html>";
-  return generate_html_response(content, 404);
+HttpResponse generate_404_response() {
+  static const auto kContent = std::make_shared<const std::string>(
+      "<html><body><h1>404 Not Found</h1></body></html>");
+  return generate_html_response(kContent, 404);
 }
 
-// Handle the request
-std::string handle_request(const std::string& request_header, WordIndex& index, const std::string& root_dir) {
-  // Extract first line of the request
-  size_t firstLineEnd = request_header.find("\r\n");
-  if (firstLineEnd == std::string::npos) {
-    return generate_404_response();
+// Renders the page of results for a query.
+//
+// Arguments:
+//  - query: the query as the client typed it, lowercased
+//  - results: the page of ranked results
+//  - num_results: the total number of matches, unless match_any is set
+//  - ranking, match_any, fuzzy: how the results were looked up
+//  - page, page_size: which page of the results this is
+//  - late_shards: the number of backends whose results are missing
+//    because they did not answer in time
+//  - failed_shards: the number of backends whose results are missing
+//    because they refused the connection or failed to answer
+//  - unchecked_phrases: whether the query's phrases and NEAR/k were
+//    ignored because the index does not record word positions
+//
+// Returns:
+//  - the HTML page
+std::shared_ptr<const std::string> render_results(const std::string& query,
+                           const std::vector<Result>& results,
+                           size_t num_results, Ranking ranking,
+                           bool match_any, bool fuzzy, size_t page,
+                           size_t page_size, size_t late_shards = 0,
+                           size_t failed_shards = 0,
+                           bool unchecked_phrases = false) {
+  size_t offset = (page - 1) * page_size;
+
+  std::stringstream html;
+  html << SEARCH_TEMPLATE_STR;
+  html << "<p><br>\n";
+  if (match_any) {
+    html << "Results " << offset + 1 << "-" << offset + results.size()
+         << " for any of <b>" << escape_html(query) << "</b>\n";
+  } else {
+    html << num_results << " results found for <b>" << escape_html(query) << "</b>\n";
   }
-  
-  std::string firstLine = request_header.substr(0, firstLineEnd);
-  
-  //Parse the request line
-  std::vector<std::string> components = split(firstLine, " ");
-  if (components.size() < 3) {
-    return generate_404_response();
+  if (failed_shards > 0) {
+    html << "<br><i>Partial results: " << failed_shards
+         << " index shard(s) could not be reached or failed to answer</i>\n";
+  }
+  if (late_shards > 0) {
+    html << "<br><i>Partial results: " << late_shards
+         << " index shard(s) did not answer in time</i>\n";
+  }
+  if (unchecked_phrases) {
+    html << "<br><i>Phrases and NEAR/k were not checked: the index does "
+            "not record word positions, so these are the documents with "
+            "every word</i>\n";
+  }
+  html << "<p>\n\n<ul>\n";
+
+  for (const auto& result : results) {
+    html << " <li> <a href=\"/static/" << escape_html(result.doc_name) << "\">"
+         << escape_html(result.doc_name) << "</a> [";
+    if (ranking == Ranking::kBM25) {
+      html << std::fixed << std::setprecision(3) << result.score;
+    } else {
+      html << result.rank;
+    }
+    html << "]<br>\n";
+  }
+
+  html << "</ul>\n";
+
+  // Links to the neighbouring pages, if there are any
+  std::string page_url = "/query?terms=" + encode_query_arg(query) +
+                         "&rank=" + (ranking == Ranking::kBM25 ? "bm25" : "tf") +
+                         (match_any ? "&mode=any" : "") +
+                         (fuzzy ? "&fuzzy=1" : "") +
+                         "&n=" + std::to_string(page_size) + "&page=";
+  if (page > 1) {
+    html << "<a href=\"" << escape_html(page_url + std::to_string(page - 1))
+         << "\">Previous</a>\n";
+  }
+  bool more = match_any ? (results.size() == page_size)
+                        : (offset + results.size() < num_results);
+  if (more && page < kMaxResults / page_size) {
+    html << "<a href=\"" << escape_html(page_url + std::to_string(page + 1))
+         << "\">Next</a>\n";
+  }
+
+  html << "</body>\n</html>\n";
+  return std::make_shared<const std::string>(html.str());
+}
+
+// Renders the counters of the query and file caches, of the connection
+// read buffers, and of the index watcher and backends if there are any,
+// as a plain text page
+HttpResponse render_stats(const QueryCache* cache, const FileCache* files,
+                         const IndexWatcher* watcher,
+                         const RemoteShards* remote) {
+  std::stringstream text;
+  if (cache != nullptr) {
+    QueryCache::Stats stats = cache->stats();
+    uint64_t lookups = stats.hits + stats.misses;
+    text << "hits " << stats.hits << "\n"
+         << "misses " << stats.misses << "\n"
+         << "hit_rate " << std::fixed << std::setprecision(3)
+         << (lookups > 0 ? static_cast<double>(stats.hits) / lookups : 0.0) << "\n"
+         << "evictions " << stats.evictions << "\n"
+         << "entries " << stats.entries << "\n"
+         << "bytes " << stats.bytes << "\n"
+         << "max_bytes " << stats.max_bytes << "\n";
+  } else {
+    text << "cache disabled\n";
+  }
+
+  FileCache::Stats file_stats = files->stats();
+  text << "file_hits " << file_stats.hits << "\n"
+       << "file_misses " << file_stats.misses << "\n"
+       << "open_files " << file_stats.open_files << "\n";
+
+  BufferPool::Stats small = ReadBuffer::small_stats();
+  BufferPool::Stats large = ReadBuffer::large_stats();
+  text << "read_buffers " << small.in_use + large.in_use << "\n"
+       << "read_buffer_bytes "
+       << small.allocated * ReadBuffer::kSmallSize +
+              large.allocated * ReadBuffer::kMaxSize
+       << "\n";
+
+  if (watcher != nullptr) {
+    IndexWatcher::Stats watch_stats = watcher->stats();
+    text << "reindex_batches " << watch_stats.batches << "\n"
+         << "reindexed_files " << watch_stats.updated << "\n"
+         << "removed_files " << watch_stats.removed << "\n";
+  }
+
+  if (remote != nullptr) {
+    RemoteShards::Stats remote_stats = remote->stats();
+    text << "backends " << remote->num_backends() << "\n"
+         << "backend_requests " << remote_stats.requests << "\n"
+         << "backend_timeouts " << remote_stats.timeouts << "\n"
+         << "backend_errors " << remote_stats.errors << "\n"
+         << "backend_connects " << remote_stats.connects << "\n";
+  }
+  return generate_plain_response(text.str());
+}
+
+// Marks every word of a query that is not a prefix or already fuzzy with
+// a trailing '~', which WordIndex expands to the words closest to it
+void make_fuzzy(std::vector<std::string>* words) {
+  for (std::string& word : *words) {
+    if (!word.empty() && word.back() != '*' &&
+        word.find('~') == std::string::npos) {
+      word += '~';
+    }
+  }
+}
+
+// Escapes a string so it can be placed between double quotes in JSON
+std::string escape_json(std::string_view text) {
+  static const char* const kHex = "0123456789abcdef";
+  std::string escaped;
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+      escaped += static_cast<char>(c);
+    } else if (c < 0x20) {
+      escaped += "\\u00";
+      escaped += kHex[c >> 4];
+      escaped += kHex[c & 0xF];
+    } else {
+      escaped += static_cast<char>(c);
+    }
+  }
+  return escaped;
+}
+
+// Renders the words suggested for a prefix as a JSON array of objects,
+// each with the word and the number of documents it is in
+HttpResponse render_suggestions(const std::vector<Suggestion>& suggestions) {
+  std::string json = "[";
+  for (size_t i = 0; i < suggestions.size(); i++) {
+    json += (i > 0) ? ", " : "";
+    json += "{\"word\": \"" + escape_json(suggestions[i].word) +
+            "\", \"docs\": " + std::to_string(suggestions[i].num_docs) + "}";
+  }
+  json += "]\n";
+  return generate_plain_response(std::move(json), "application/json");
+}
+
+// A query as a request for /query or /shard/query asks for it
+struct QueryArgs {
+  // The query as the client typed it, lowercased, and the words it is
+  // looked up by
+  std::string query;
+  std::vector<std::string> terms;
+
+  // The quoted phrases and NEAR/k of the query, if it has any
+  PhraseQuery phrases;
+
+  Ranking ranking = Ranking::kBM25;
+  bool match_any = false;
+  bool fuzzy = false;
+
+  // Whether the phrases and NEAR/k are checked, which matching any of
+  // the words does not do
+  bool positional = false;
+};
+
+// Reads the query a request asks for from its "terms", "rank", "mode"
+// and "fuzzy" arguments. Returns false if it has no terms.
+bool parse_query_args(const HttpRequest& request, QueryArgs* args) {
+  std::optional<std::string_view> terms = request.arg("terms");
+  if (!terms) {
+    return false;
+  }
+  args->query = decode_URI(std::string(*terms));
+
+  // Make query to lowercase and  split into terms
+  std::transform(args->query.begin(), args->query.end(), args->query.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  args->terms = split(args->query, " +");
+
+  // Quoted phrases and NEAR/k are operators rather than words, so a
+  // query that uses them is looked up by the words they join
+  args->phrases = PhraseQuery::parse(args->query);
+  if (args->phrases.positional()) {
+    args->terms = args->phrases.words;
+  }
+
+  // "fuzzy=1" also matches the words closest to each query word that
+  // is not in the index, allowing for a typo or two
+  std::optional<std::string_view> fuzzy = request.arg("fuzzy");
+  args->fuzzy = (fuzzy && *fuzzy == "1");
+  if (args->fuzzy) {
+    make_fuzzy(&args->terms);
+    make_fuzzy(&args->phrases.words);
+    for (PhraseQuery::Constraint& constraint : args->phrases.constraints) {
+      for (PhraseQuery::Phrase& operand : constraint.operands) {
+        make_fuzzy(&operand);
+      }
+    }
+  }
+
+  // Rank with BM25 unless the request asks for raw term counts
+  std::optional<std::string_view> rank = request.arg("rank");
+  args->ranking = (rank && *rank == "tf") ? Ranking::kTermFrequency
+                                          : Ranking::kBM25;
+
+  // "mode=any" matches documents containing any of the words rather
+  // than all of them. Its top-K search skips most of the matches, so
+  // the total number of them is not known.
+  std::optional<std::string_view> mode = request.arg("mode");
+  args->match_any = (mode && *mode == "any");
+
+  // Matching every word also checks the phrases and NEAR/k of the
+  // query, if it has any. Any match ignores them.
+  args->positional = !args->match_any && args->phrases.positional();
+  return true;
+}
+
+// Looks up a page of the results of a query in an index.
+//
+// Arguments:
+//  - index: the index to search
+//  - args: the query
+//  - k, offset: the page, as the number of results and how many of the
+//    best results come before it
+//  - num_results: set to the number of matches, unless args asks for a
+//    match of any word
+std::vector<Result> run_query(ShardedIndex& index, const QueryArgs& args,
+                              size_t k, size_t offset, size_t* num_results) {
+  if (args.match_any) {
+    return index.lookup_any(args.terms, k, offset, args.ranking);
+  }
+  if (args.positional) {
+    return index.lookup_phrases(args.phrases, k, offset, num_results,
+                                args.ranking);
+  }
+  return index.lookup_query(args.terms, k, offset, num_results, args.ranking);
+}
+
+// Returns the /shard/query target that asks a backend for the best k
+// results of a query. The query is sent as the client typed it, so the
+// backend parses it the same way.
+std::string make_shard_target(const QueryArgs& args, size_t k) {
+  return "/shard/query?terms=" + encode_query_arg(args.query) +
+         "&rank=" + (args.ranking == Ranking::kBM25 ? "bm25" : "tf") +
+         (args.match_any ? "&mode=any" : "") +
+         (args.fuzzy ? "&fuzzy=1" : "") + "&k=" + std::to_string(k);
+}
+
+// Everything a request may be answered from
+struct ServerState {
+  // The published index, and the watcher that updates it, if any. A
+  // coordinator has neither, and looks queries up on remote instead.
+  IndexSnapshots* index;
+  IndexWatcher* watcher;
+  RemoteShards* remote;
+
+  // Static files are opened through files, and query answers are cached
+  // in cache, unless it is null
+  FileCache* files;
+  QueryCache* cache;
+};
+
+// Handle the request
+HttpResponse handle_request(const HttpRequest& request,
+                            const ServerState& state) {
+  FileCache* files = state.files;
+  QueryCache* cache = state.cache;
+
+  // The path is only copied when it has escapes to decode
+  std::string_view path = request.path();
+  std::string decoded_path;
+  if (path.find_first_of("%+") != std::string_view::npos) {
+    decoded_path = decode_URI(std::string(path));
+    path = decoded_path;
   }
-  
-  std::string method = components[0];
-  std::string fullUri = components[1];
-  std::string version = components[2];
-  
-  // Parse the  URL
-  URLParser url_parser;
-  url_parser.parse(fullUri);
-  std::string path = url_parser.path();
 
   // Home page
   if (path == "/" || path.empty()) {
-    return generate_html_response(SEARCH_TEMPLATE_STR);
+    static const auto kHomePage =
+        std::make_shared<const std::string>(SEARCH_TEMPLATE_STR);
+    return generate_html_response(kHomePage);
   }
   
   // Query  handling
-  if (path == "/query") {
-    if (url_parser.args().find("terms") != url_parser.args().end()) {
-      std::string query = url_parser.args()["terms"];
-      
-      // Make query to lowercase and  split into terms
-      std::transform(query.begin(), query.end(), query.begin(),
-                    [](unsigned char c) { return std::tolower(c); });
-      
-      std::vector<std::string> query_terms = split(query, " +");
+  if (path == "/query" || path == "/shard/query") {
+    QueryArgs args;
+    if (!parse_query_args(request, &args)) {
+      return generate_404_response();
+    }
+
+    // A coordinator's backends, or a coordinator above this one, ask for
+    // the best k results in binary, to merge with those of the others
+    if (path == "/shard/query") {
+      size_t k = parse_count(request, "k", kDefaultPageSize);
+      k = std::min(std::max<size_t>(k, 1), kMaxResults);
+      size_t num_results = 0;
+      size_t num_late = 0;
+      size_t num_failed = 0;
       std::vector<Result> results;
-      
-      if (query_terms.size() > 1) {
-        results = index.lookup_query(query_terms);
-      } else if (!query.empty()) {
-        results = index.lookup_word(query);
+      if (state.remote != nullptr) {
+        results = state.remote->lookup(make_shard_target(args, k), k, 0,
+                                       &num_results, &num_late, &num_failed);
+      } else {
+        IndexSnapshots::Reader index(*state.index);
+        results = run_query(*index, args, k, 0, &num_results);
       }
+      return generate_plain_response(encode_results(results, num_results),
+                                     "application/octet-stream");
+    }
+
+    // Only rank and render the requested page of results
+    size_t page_size = parse_count(request, "n", kDefaultPageSize);
+    page_size = std::min(std::max<size_t>(page_size, 1), kMaxPageSize);
+    size_t page = std::max<size_t>(parse_count(request, "page", 1), 1);
+    page = std::min(page, kMaxResults / page_size);
+    size_t offset = (page - 1) * page_size;
+
+    // The backends each find the best results up to the end of the page,
+    // and whichever of them answer in time are merged. There is no index
+    // generation to cache their answers under, so they never are.
+    if (state.remote != nullptr) {
+      size_t num_results = 0;
+      size_t num_late = 0;
+      size_t num_failed = 0;
+      std::vector<Result> results = state.remote->lookup(
+          make_shard_target(args, offset + page_size),
+          page_size, offset, &num_results, &num_late, &num_failed);
+      return generate_html_response(
+          render_results(args.query, results, num_results, args.ranking,
+                         args.match_any, args.fuzzy, page, page_size,
+                         num_late, num_failed));
+    }
 
-      std::stringstream html;
-      html << SEARCH_TEMPLATE_STR;
-      html << "<p><br>\n";
-      html << results.size() << " results found for <b>" << escape_html(query) << "</b>\n";
-      html << "<p>\n\n<ul>\n";
-      
-      for (const auto& result : results) {
-        html << " <li> <a href=\"/static/" << escape_html(result.doc_name) << "\">"
-             << escape_html(result.doc_name) << "</a> [" << result.rank
-             << "]<br>\n";
+    // Pin one snapshot of the index, so that the generation and the
+    // answer come from the same version of it even if the watcher
+    // publishes a new one meanwhile
+    IndexSnapshots::Reader index(*state.index);
+    uint64_t generation = index->generation();
+
+    // An index built without positions cannot check phrases or NEAR/k,
+    // so the query is looked up by its words alone, and the page says so
+    bool unchecked_phrases = args.positional && !index->has_positions();
+    if (unchecked_phrases) {
+      args.positional = false;
+    }
+
+    // The same words in any order have the same answer, so the terms
+    // are sorted into the cache key and looked up in that order too.
+    // Phrases do depend on the order, so the whole query goes in too.
+    std::string key = QueryCache::make_key(
+        &args.terms,
+        std::string(args.ranking == Ranking::kBM25 ? "bm25" : "tf") +
+            (args.match_any ? " any" : " all") + " n=" +
+            std::to_string(page_size) + " page=" + std::to_string(page) +
+            (args.positional ? " exact=" + args.query : ""));
+    if (cache != nullptr) {
+      std::shared_ptr<const CachedQuery> hit = cache->get(key, generation);
+      if (hit != nullptr) {
+        if (hit->query == args.query) {
+          return generate_html_response(hit->page);
+        }
+        return generate_html_response(
+            render_results(args.query, hit->results, hit->num_results,
+                           args.ranking, args.match_any, args.fuzzy, page,
+                           page_size, 0, 0, unchecked_phrases));
       }
-      
-      html << "</ul>\n</body>\n</html>\n";
-      return generate_html_response(html.str());
     }
-    return generate_404_response();
+
+    auto answer = std::make_shared<CachedQuery>();
+    answer->query = args.query;
+    answer->results = run_query(*index, args, page_size, offset,
+                                &answer->num_results);
+    answer->page = render_results(args.query, answer->results,
+                                  answer->num_results, args.ranking,
+                                  args.match_any, args.fuzzy, page, page_size,
+                                  0, 0, unchecked_phrases);
+    HttpResponse response = generate_html_response(answer->page);
+    if (cache != nullptr) {
+      cache->put(key, generation, std::move(answer));
+    }
+    return response;
+  }
+
+  // Words that complete a prefix, for autocompletion: the ones in the
+  // most documents first
+  if (path == "/suggest") {
+    std::optional<std::string_view> arg = request.arg("prefix");
+    if (!arg) {
+      return generate_404_response();
+    }
+    std::string prefix = decode_URI(std::string(*arg));
+    std::transform(prefix.begin(), prefix.end(), prefix.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    size_t count = parse_count(request, "n", kDefaultSuggestions);
+    count = std::min(std::max<size_t>(count, 1), kMaxSuggestions);
+
+    // An empty prefix would have every word of the index to rank
+    // A coordinator has no words of its own to suggest
+    std::vector<Suggestion> suggestions;
+    if (!prefix.empty() && state.index != nullptr) {
+      IndexSnapshots::Reader index(*state.index);
+      suggestions = index->suggest(prefix, count);
+    }
+    return render_suggestions(suggestions);
+  }
+
+  // Query and file cache counters
+  if (path == "/stats") {
+    return render_stats(cache, files, state.watcher, state.remote);
   }
 
   // Handle  static files
   if (path.find("/static/") == 0) {
     // Extract the path after "/static/"
-    std::string file_path = path.substr(8);
-    
-    // Try to open the file directly
-    std::ifstream file(file_path);
-    if (file) {
-      std::string content((std::istreambuf_iterator<char>(file)),
-                        std::istreambuf_iterator<char>());
-      return generate_plain_response(content);
-    }
-    
-    
-    std::string full_path = root_dir;
-    // Remove trailing slash from root_dir
-    if (!full_path.empty() && full_path.back() == '/') {
-      full_path.pop_back();
-    }
-    // Remove leading slash from file_path
-    if (!file_path.empty() && file_path.front() == '/') {
-      file_path = file_path.substr(1);
-    }
-    full_path += "/" + file_path;
-    
-    std::ifstream file2(full_path);
-    if (file2) {
-      std::string content((std::istreambuf_iterator<char>(file2)),
-                        std::istreambuf_iterator<char>());
-      return generate_plain_response(content);
-    }
-    
-    if (file_path.size() >= 2 && file_path.substr(0, 2) == "./") {
-      std::string alt_path = file_path.substr(2);
-      std::ifstream file3(alt_path);
-      if (file3) {
-        std::string content((std::istreambuf_iterator<char>(file3)),
-                          std::istreambuf_iterator<char>());
-        return generate_plain_response(content);
-      }
+    std::shared_ptr<const OpenFile> file =
+        files->open(std::string(path.substr(8)));
+    if (file == nullptr) {
+      return generate_404_response();
     }
-    
-    return generate_404_response();
+    return generate_file_response(request, std::move(file));
   }
 
   return generate_404_response();
 }
 
-// Make client handling struct for threads
-struct ClientContext {
-  HttpSocket client;
-  WordIndex* index;
-  std::string root_dir;
+// Options that can be given on the command line before the port and
+// directory
+struct ServerOptions {
+  // The number of threads used to crawl the directory at startup
+  size_t crawl_threads = 1;
 
-  ClientContext(HttpSocket&& c, WordIndex* idx, const std::string& dir)
-      : client(std::move(c)), index(idx), root_dir(dir) {}
-};
+  // The number of shards the crawled documents are split between, each
+  // of which a large query searches on a thread of its own
+  size_t shards = 1;
 
-// Client handler function
-void client_handler(void* arg) {
-  std::unique_ptr<ClientContext> ctx(static_cast<ClientContext*>(arg));
+  // The searchservers holding the partitions of the index, as
+  // "host:port,host:port...", which makes this server a coordinator that
+  // forwards queries to them rather than crawling the directory, and how
+  // long it waits for their answers
+  std::string backends;
+  int backend_timeout_ms = RemoteShards::kDefaultTimeoutMs;
 
-  try {
-    while (auto request = ctx->client.next_request()) {
-      std::string response = handle_request(*request, *ctx->index, ctx->root_dir);
-      if (!ctx->client.write_response(response)) {
-        break;
+  // An index file written by indexbuilder to map instead of crawling the
+  // directory, which is then only used to serve /static files
+  std::string index_file;
+
+  // Whether the crawl records the position of every word, which phrase
+  // and NEAR/k queries need. An index file has positions if indexbuilder
+  // was run with --positions.
+  bool positions = false;
+
+  // The memory budget of the query result cache in megabytes, where 0
+  // turns the cache off
+  size_t cache_mb = 64;
+
+  // The most static files to keep open for reuse
+  size_t open_files = 256;
+
+  // Whether to keep the index up to date as files in the directory change
+  bool watch = false;
+
+  // The most responses to a client's pipelined requests that are written
+  // together
+  size_t pipeline_depth = Reactor::kDefaultPipelineDepth;
+};
+
+// Parses the command line into options and positional arguments.
+// Returns false if an option is unknown, is missing its value, or takes
+// a count and was given anything other than one.
+bool parse_args(int argc, char* argv[], ServerOptions* options,
+                std::vector<std::string>* positional) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.rfind("--", 0) != 0) {
+      positional->push_back(arg);
+      continue;
+    }
+    if (arg == "--watch") {
+      options->watch = true;
+      continue;
+    }
+    if (arg == "--positions") {
+      options->positions = true;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      return false;
+    }
+    std::string value = argv[++i];
+    size_t count = 0;
+    if (arg == "--backends") {
+      options->backends = value;
+    } else if (arg == "--index") {
+      options->index_file = value;
+    } else if (!parse_digits(value, &count)) {
+      // Every other option takes a count
+      return false;
+    } else if (arg == "--crawl-threads") {
+      options->crawl_threads = std::max<size_t>(count, 1);
+    } else if (arg == "--shards") {
+      options->shards = std::max<size_t>(count, 1);
+    } else if (arg == "--backend-timeout-ms") {
+      options->backend_timeout_ms = static_cast<int>(
+          std::clamp<size_t>(count, 1, std::numeric_limits<int>::max()));
+    } else if (arg == "--cache-mb") {
+      // The budget is kept in bytes, which must fit in a size_t
+      if (count > (SIZE_MAX >> 20)) {
+        return false;
       }
+      options->cache_mb = count;
+    } else if (arg == "--open-files") {
+      options->open_files = count;
+    } else if (arg == "--pipeline-depth") {
+      options->pipeline_depth = std::max<size_t>(count, 1);
+    } else {
+      return false;
     }
-  } catch (const std::exception& e) {
-    std::cerr << "Client handling error: " << e.what() << "\n";
   }
+  return true;
 }
 
 int main(int argc, char* argv[]) {
-  if (argc != 3) {
-    std::cerr << "Usage: " << argv[0] << " <port> <directory>\n";
+  ServerOptions options;
+  std::vector<std::string> positional;
+  std::vector<Backend> backends;
+  size_t port_arg = 0;
+  if (!parse_args(argc, argv, &options, &positional) || positional.size() != 2 ||
+      !parse_digits(positional[0], &port_arg) || port_arg == 0 ||
+      port_arg > UINT16_MAX ||
+      (options.shards > 1 && !options.index_file.empty()) ||
+      (!options.backends.empty() &&
+       (!parse_backends(options.backends, &backends) ||
+        !options.index_file.empty() || options.shards > 1 || options.watch))) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--crawl-threads <n>] [--shards <n>] [--index <index file>]"
+              << " [--backends <host:port,...>] [--backend-timeout-ms <n>]"
+              << " [--cache-mb <n>]"
+              << " [--open-files <n>] [--pipeline-depth <n>] [--watch]"
+              << " [--positions]"
+              << " <port> <directory>\n";
     return EXIT_FAILURE;
   }
 
-  const uint16_t port = static_cast<uint16_t>(std::stoi(argv[1]));
-  const std::string root_dir = argv[2];
+  const auto port = static_cast<uint16_t>(port_arg);
+  const std::string root_dir = positional[1];
 
-  // Build search index
-  auto index_opt = crawl_filetree(root_dir);
-  if (!index_opt) {
+  // Build search index, or map a prebuilt one. The shards of a sharded
+  // index are searched on threads of their own, which are only ever
+  // given lookups to run so that a query never waits behind a request.
+  std::optional<IndexSnapshots> index;
+  std::unique_ptr<ThreadPool> query_pool;
+  std::unique_ptr<RemoteShards> remote;
+  if (!backends.empty()) {
+    // A coordinator only serves /static files from the directory, which
+    // finds the backends' documents if they share a file system with it
+    remote = std::make_unique<RemoteShards>(std::move(backends),
+                                            options.backend_timeout_ms);
+  } else if (!options.index_file.empty()) {
+    std::optional<WordIndex> index_opt = WordIndex::load(options.index_file);
+    if (index_opt) {
+      index.emplace(ShardedIndex(std::move(*index_opt)));
+    }
+  } else if (options.shards > 1) {
+    std::optional<std::vector<WordIndex>> shards = crawl_filetree_shards(
+        root_dir, options.crawl_threads, options.shards, options.positions);
+    if (shards) {
+      query_pool = std::make_unique<ThreadPool>(options.shards);
+      index.emplace(ShardedIndex(std::move(*shards), query_pool.get()));
+    }
+  } else {
+    std::optional<WordIndex> index_opt = crawl_filetree(
+        root_dir, options.crawl_threads, options.positions);
+    if (index_opt) {
+      index.emplace(ShardedIndex(std::move(*index_opt)));
+    }
+  }
+  if (!index && !remote) {
     std::cerr << "Failed to build search index\n";
     return EXIT_FAILURE;
   }
-  WordIndex index = std::move(*index_opt);
+
+  std::unique_ptr<QueryCache> cache;
+  if (options.cache_mb > 0) {
+    cache = std::make_unique<QueryCache>(options.cache_mb << 20);
+  }
+  FileCache files(root_dir, options.open_files);
+
+  // A client that disconnects while a file is being sent to it must not
+  // kill the server; the failed write is handled instead
+  signal(SIGPIPE, SIG_IGN);
 
   try {
+    // Watch the directory for changes, publishing a new snapshot of the
+    // index after each batch of them
+    std::unique_ptr<IndexWatcher> watcher;
+    if (options.watch) {
+      watcher = std::make_unique<IndexWatcher>(root_dir, &*index);
+    }
+    ServerState state{index ? &*index : nullptr, watcher.get(), remote.get(),
+                      &files, cache.get()};
+
     // Set up the server
     ServerSocket server(AF_INET6, "::", port);
     std::cout << "Accepting connections...\n";
 
     ThreadPool pool(4);
 
-    // Main server loop
-    while (true) {
-      auto client_opt = server.accept_client();
-      if (!client_opt) {
-        continue;
-      }
-
-      // Create client struc and dispatch to thread pool
-      ClientContext* ctx = new ClientContext(std::move(*client_opt), &index, root_dir);
-      ThreadPool::Task task{};
-      task.func_ = client_handler;
-      task.arg_ = ctx;
-      pool.dispatch(task);
-    }
+    // Main server loop. The reactor only hands a connection to the pool
+    // once a whole request has arrived, so idle clients do not hold up
+    // the workers.
+    Reactor reactor(
+        &server, &pool,
+        [&state](const HttpRequest& request) {
+          return handle_request(request, state);
+        },
+        options.pipeline_depth);
+    reactor.run();
   } catch (const std::exception& e) {
     std::cerr << "Server error: " << e.what() << "\n";
     return EXIT_FAILURE;
@@ -0,0 +1,98 @@
+#include <unistd.h>  // for getpid()
+
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "./catch.hpp"
+#include "./CrawlFileTree.hpp"
+
+using std::string;
+using std::vector;
+using searchserver::crawl_filetree;
+using searchserver::Result;
+using searchserver::WordIndex;
+
+// The number of distinct words in the files written by write_tree()
+static const size_t kNumWords = 50;
+
+// Writes a tree of random text files under root, nested a few
+// directories deep, including an empty directory and an empty file
+static void write_tree(const std::filesystem::path& root);
+
+TEST_CASE("ParallelCrawlMatchesSerial", "[CrawlFileTree]") {
+  std::filesystem::path root = std::filesystem::temp_directory_path() /
+                               ("test_crawlfiletree_" +
+                                std::to_string(getpid()));
+  std::filesystem::remove_all(root);
+  write_tree(root);
+
+  std::optional<WordIndex> serial = crawl_filetree(root.string());
+  REQUIRE(serial.has_value());
+  REQUIRE(serial->num_docs() > 100);
+
+  for (size_t num_threads : {2, 4}) {
+    INFO("threads " << num_threads);
+    std::optional<WordIndex> parallel =
+        crawl_filetree(root.string(), num_threads);
+    REQUIRE(parallel.has_value());
+    REQUIRE(parallel->num_docs() == serial->num_docs());
+    REQUIRE(parallel->num_words() == serial->num_words());
+
+    // The documents are numbered in the same order, so even ties come
+    // back in the same order
+    for (size_t word = 0; word < kNumWords; word++) {
+      string text = "word" + std::to_string(word);
+      string next = "word" + std::to_string((word + 1) % kNumWords);
+      string far = "word" + std::to_string((word * 7 + 3) % kNumWords);
+      REQUIRE(parallel->lookup_query({text}) == serial->lookup_query({text}));
+      REQUIRE(parallel->lookup_query({text, next}) ==
+              serial->lookup_query({text, next}));
+      REQUIRE(parallel->lookup_query({text, next, far}) ==
+              serial->lookup_query({text, next, far}));
+
+      vector<Result> a = parallel->lookup_query({text, far}, 10, 2);
+      vector<Result> b = serial->lookup_query({text, far}, 10, 2);
+      REQUIRE(a == b);
+      for (size_t i = 0; i < a.size(); i++) {
+        REQUIRE(a[i].score == b[i].score);
+      }
+    }
+  }
+
+  REQUIRE_FALSE(crawl_filetree((root / "missing").string()).has_value());
+  REQUIRE_FALSE(crawl_filetree((root / "missing").string(), 4).has_value());
+  std::filesystem::remove_all(root);
+}
+
+static void write_tree(const std::filesystem::path& root) {
+  std::mt19937 rng(6);
+  std::geometric_distribution<size_t> pick(0.15);
+  std::filesystem::create_directories(root / "empty");
+  std::ofstream(root / "blank.txt");
+
+  for (size_t dir = 0; dir < 12; dir++) {
+    std::filesystem::path path = root / ("dir" + std::to_string(dir));
+    for (size_t depth = 0; depth < dir % 4; depth++) {
+      path /= "sub" + std::to_string(depth);
+    }
+    std::filesystem::create_directories(path);
+
+    for (size_t file = 0; file < 15; file++) {
+      std::ofstream out(path / ("file" + std::to_string(file) + ".txt"));
+      size_t len = 1 + rng() % 200;
+      for (size_t i = 0; i < len; i++) {
+        // Mixed case and punctuation, which the crawler folds and
+        // splits on
+        string word = "word" + std::to_string(pick(rng) % kNumWords);
+        if (rng() % 5 == 0) {
+          word[0] = 'W';
+        }
+        out << word << (rng() % 8 == 0 ? ".\n" : " ");
+      }
+    }
+  }
+}
@@ -0,0 +1,241 @@
+#include <unistd.h>  // for getpid()
+
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "./catch.hpp"
+#include "./IndexFile.hpp"
+#include "./PhraseQuery.hpp"
+#include "./WordIndex.hpp"
+
+using std::string;
+using std::vector;
+using searchserver::IndexFileHeader;
+using searchserver::PhraseQuery;
+using searchserver::Ranking;
+using searchserver::Result;
+using searchserver::WordIndex;
+
+// The number of distinct words recorded by build_index()
+static const size_t kNumWords = 30;
+
+// Builds an index of 400 random documents, each a sequence of words
+// where word i is picked roughly twice as often as word i + 1
+static WordIndex build_index(bool positions);
+
+// Returns a path in the temporary directory that no other test uses
+static string temp_path(const string& name);
+
+// Reads a whole file into a string, or writes one out
+static string read_file(const string& path);
+static void write_file(const string& path, const string& contents);
+
+// Returns the header at the start of the contents of an index file
+static IndexFileHeader header_of(const string& contents);
+
+// Requires every kind of lookup to give the same results from two indexes
+static void require_same_lookups(WordIndex* expected, WordIndex* actual);
+
+TEST_CASE("SaveLoadRoundTrip", "[IndexFile]") {
+  for (bool positions : {false, true}) {
+    INFO("positions " << positions);
+    WordIndex built = build_index(positions);
+    string path = temp_path("roundtrip");
+    REQUIRE(built.save(path));
+
+    std::optional<WordIndex> loaded = WordIndex::load(path);
+    REQUIRE(loaded.has_value());
+    REQUIRE(loaded->has_positions() == positions);
+    require_same_lookups(&built, &*loaded);
+
+    // Saving a loaded index writes the same file back out
+    string again = temp_path("again");
+    REQUIRE(loaded->save(again));
+    REQUIRE(read_file(again) == read_file(path));
+
+    // Recording into a loaded index copies it out of the mapping first,
+    // which leaves the file alone
+    loaded->record("w0", "extra.txt");
+    loaded->record("brandnew", "extra.txt");
+    REQUIRE(loaded->lookup_word("brandnew") ==
+            vector<Result>{{"extra.txt", 1}});
+    REQUIRE(loaded->lookup_word("w0").size() ==
+            built.lookup_word("w0").size() + 1);
+    REQUIRE(read_file(again) == read_file(path));
+
+    std::filesystem::remove(path);
+    std::filesystem::remove(again);
+  }
+
+  // An empty index round-trips too
+  WordIndex empty;
+  string path = temp_path("empty");
+  REQUIRE(empty.save(path));
+  std::optional<WordIndex> loaded = WordIndex::load(path);
+  REQUIRE(loaded.has_value());
+  REQUIRE(loaded->num_docs() == 0);
+  REQUIRE(loaded->lookup_word("w0").empty());
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("RejectsCorruptFiles", "[IndexFile]") {
+  WordIndex built = build_index(true);
+  string path = temp_path("good");
+  REQUIRE(built.save(path));
+  const string good = read_file(path);
+  const IndexFileHeader header = header_of(good);
+  std::filesystem::remove(path);
+
+  REQUIRE_FALSE(WordIndex::load(temp_path("missing")).has_value());
+
+  // Each variant of the file is written out and must fail to load
+  auto rejects = [](const string& contents) {
+    string bad = temp_path("bad");
+    write_file(bad, contents);
+    bool loaded = WordIndex::load(bad).has_value();
+    std::filesystem::remove(bad);
+    return !loaded;
+  };
+  auto with_header = [&good](const IndexFileHeader& h) {
+    string contents = good;
+    memcpy(&contents[0], &h, sizeof(h));
+    return contents;
+  };
+
+  REQUIRE(rejects(""));
+  REQUIRE(rejects(good.substr(0, sizeof(IndexFileHeader) - 1)));
+  REQUIRE(rejects(good.substr(0, good.size() / 2)));
+  REQUIRE(rejects(good.substr(0, good.size() - 1)));
+  REQUIRE(rejects(good + '\0'));
+
+  IndexFileHeader h = header;
+  h.magic[0] = 'X';
+  REQUIRE(rejects(with_header(h)));
+
+  h = header;
+  h.version++;
+  REQUIRE(rejects(with_header(h)));
+
+  // Sections that start past the end of the file, are misaligned, or
+  // hold more than fits in the file
+  h = header;
+  h.entries = h.file_size + 8;
+  REQUIRE(rejects(with_header(h)));
+  h = header;
+  h.blocks += 4;
+  REQUIRE(rejects(with_header(h)));
+  h = header;
+  h.num_terms = h.file_size;
+  REQUIRE(rejects(with_header(h)));
+  h = header;
+  h.num_docs = UINT64_MAX / 2;
+  REQUIRE(rejects(with_header(h)));
+  h = header;
+  h.posting_bytes = h.file_size;
+  REQUIRE(rejects(with_header(h)));
+
+  // Garbage in the postings is only found while decoding them, and
+  // reads as missing postings rather than crashing
+  string garbled = good;
+  std::mt19937 rng(7);
+  for (size_t i = 0; i < header.posting_bytes; i++) {
+    garbled[header.postings + i] = static_cast<char>(rng());
+  }
+  string bad = temp_path("garbled");
+  write_file(bad, garbled);
+  std::optional<WordIndex> loaded = WordIndex::load(bad);
+  REQUIRE(loaded.has_value());
+  for (size_t word = 0; word < kNumWords; word++) {
+    string text = "w" + std::to_string(word);
+    REQUIRE(loaded->lookup_word(text).size() <= loaded->num_docs());
+    REQUIRE(loaded->lookup_any({text, "w0"}, 10, 0).size() <= 10);
+    loaded->lookup_phrases(PhraseQuery::parse("\"" + text + " w1\""), 10, 0);
+  }
+  std::filesystem::remove(bad);
+}
+
+static WordIndex build_index(bool positions) {
+  WordIndex index(positions);
+  std::mt19937 rng(5950);
+  std::geometric_distribution<size_t> pick(0.5);
+  for (size_t doc = 0; doc < 400; doc++) {
+    string name = "dir/doc" + std::to_string(doc) + ".txt";
+    size_t len = 1 + rng() % 60;
+    for (size_t i = 0; i < len; i++) {
+      index.record("w" + std::to_string(pick(rng) % kNumWords), name);
+    }
+  }
+  index.finalize();
+  return index;
+}
+
+static string temp_path(const string& name) {
+  return (std::filesystem::temp_directory_path() /
+          ("test_indexfile_" + std::to_string(getpid()) + "_" + name))
+      .string();
+}
+
+static string read_file(const string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return string(std::istreambuf_iterator<char>(in),
+                std::istreambuf_iterator<char>());
+}
+
+static void write_file(const string& path, const string& contents) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+}
+
+static IndexFileHeader header_of(const string& contents) {
+  IndexFileHeader header;
+  REQUIRE(contents.size() >= sizeof(header));
+  memcpy(&header, contents.data(), sizeof(header));
+  return header;
+}
+
+static void require_same_lookups(WordIndex* expected, WordIndex* actual) {
+  REQUIRE(actual->num_docs() == expected->num_docs());
+  REQUIRE(actual->num_words() == expected->num_words());
+  REQUIRE(actual->lookup_word("missing").empty());
+
+  for (size_t word = 0; word < kNumWords; word++) {
+    string text = "w" + std::to_string(word);
+    string next = "w" + std::to_string((word + 1) % kNumWords);
+    REQUIRE(actual->lookup_word(text) == expected->lookup_word(text));
+    REQUIRE(actual->lookup_query({text, next}) ==
+            expected->lookup_query({text, next}));
+    for (Ranking ranking : {Ranking::kBM25, Ranking::kTermFrequency}) {
+      vector<Result> a = actual->lookup_query({text, "w0"}, 10, 3, nullptr,
+                                              ranking);
+      vector<Result> b = expected->lookup_query({text, "w0"}, 10, 3, nullptr,
+                                                ranking);
+      REQUIRE(a == b);
+      for (size_t i = 0; i < a.size(); i++) {
+        REQUIRE(a[i].score == b[i].score);
+      }
+      REQUIRE(actual->lookup_any({text, next}, 10, 0, ranking) ==
+              expected->lookup_any({text, next}, 10, 0, ranking));
+    }
+
+    PhraseQuery phrase = PhraseQuery::parse("\"" + text + " " + next + "\"");
+    size_t actual_matches = 0;
+    size_t expected_matches = 0;
+    REQUIRE(actual->lookup_phrases(phrase, 20, 0, &actual_matches) ==
+            expected->lookup_phrases(phrase, 20, 0, &expected_matches));
+    REQUIRE(actual_matches == expected_matches);
+  }
+
+  vector<searchserver::Suggestion> a = actual->suggest("w1", 5);
+  vector<searchserver::Suggestion> b = expected->suggest("w1", 5);
+  REQUIRE(a.size() == b.size());
+  for (size_t i = 0; i < a.size(); i++) {
+    REQUIRE(a[i].word == b[i].word);
+    REQUIRE(a[i].num_docs == b[i].num_docs);
+  }
+}
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./catch.hpp"
+#include "./Levenshtein.hpp"
+#include "./WordIndex.hpp"
+
+using std::string;
+using std::vector;
+using searchserver::FuzzyMatch;
+using searchserver::LevenshteinAutomaton;
+using searchserver::Result;
+using searchserver::TermDictionary;
+using searchserver::WordIndex;
+
+// Returns the edit distance between two strings with the textbook
+// dynamic program
+static uint32_t edit_distance(std::string_view a, std::string_view b);
+
+// Returns a random string of up to max_len bytes from the first
+// alphabet_size lowercase letters
+static string random_word(std::mt19937* rng, size_t max_len,
+                          size_t alphabet_size);
+
+TEST_CASE("DistanceMatchesBruteForce", "[Levenshtein]") {
+  std::mt19937 rng(23);
+  for (int i = 0; i < 300; i++) {
+    string word = random_word(&rng, 8, 5);
+    for (uint32_t max_distance = 0;
+         max_distance <= LevenshteinAutomaton::kMaxDistance; max_distance++) {
+      LevenshteinAutomaton automaton(word, max_distance);
+      for (int j = 0; j < 20; j++) {
+        string term = random_word(&rng, 10, 6);
+        INFO("word " << word << " term " << term);
+        uint32_t expected = std::min(edit_distance(word, term),
+                                     max_distance + 1);
+        REQUIRE(automaton.distance(term) == expected);
+        REQUIRE(automaton.distance(word) == 0);
+      }
+    }
+  }
+}
+
+TEST_CASE("IntersectDictionaryMatchesBruteForce", "[Levenshtein]") {
+  std::mt19937 rng(2);
+  // A dictionary dense enough that most words have neighbours
+  vector<string> terms;
+  for (int i = 0; i < 4000; i++) {
+    terms.push_back(random_word(&rng, 7, 4));
+  }
+  terms.push_back("zzzzzz");
+  std::sort(terms.begin(), terms.end());
+  terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+  vector<std::string_view> views(terms.begin(), terms.end());
+  TermDictionary dict;
+  dict.build(views);
+
+  vector<string> words{"", "a", "abcd", "zzzz", "dcba", "aaaaaaa", "xyz"};
+  for (int i = 0; i < 60; i++) {
+    words.push_back(random_word(&rng, 8, 5));
+  }
+  for (const string& word : words) {
+    for (uint32_t max_distance = 0;
+         max_distance <= LevenshteinAutomaton::kMaxDistance; max_distance++) {
+      INFO("word " << word << " max_distance " << max_distance);
+      vector<FuzzyMatch> expected;
+      for (size_t t = 0; t < terms.size(); t++) {
+        uint32_t distance = edit_distance(word, terms[t]);
+        if (distance <= max_distance) {
+          expected.push_back({t, terms[t], distance});
+        }
+      }
+
+      vector<FuzzyMatch> matches;
+      LevenshteinAutomaton(word, max_distance).intersect(dict.view(), &matches);
+      REQUIRE(matches.size() == expected.size());
+      for (size_t m = 0; m < matches.size(); m++) {
+        REQUIRE(matches[m].term == expected[m].term);
+        REQUIRE(matches[m].text == expected[m].text);
+        REQUIRE(matches[m].distance == expected[m].distance);
+      }
+    }
+  }
+
+  // An empty dictionary has no matches
+  TermDictionary empty;
+  empty.build({});
+  vector<FuzzyMatch> matches;
+  LevenshteinAutomaton("abc", 2).intersect(empty.view(), &matches);
+  REQUIRE(matches.empty());
+}
+
+TEST_CASE("FuzzyLookup", "[Levenshtein]") {
+  WordIndex index;
+  index.record("apple", "a.txt");
+  index.record("apple", "a.txt");
+  index.record("ample", "b.txt");
+  index.record("maple", "c.txt");
+  index.record("cat", "d.txt");
+  index.record("cot", "e.txt");
+
+  // Only the closest words count: a word spelled right matches itself
+  vector<Result> expected{{"a.txt", 2}};
+  REQUIRE(index.lookup_word("apple~") == expected);
+  REQUIRE(index.lookup_word("apple~2") == expected);
+  expected = {{"a.txt", 2}, {"b.txt", 1}};
+  REQUIRE(index.lookup_word("abple~1") == expected);
+  expected = {{"a.txt", 2}, {"c.txt", 1}};
+  REQUIRE(index.lookup_word("mpple~2") == expected);
+  expected = {{"a.txt", 2}, {"b.txt", 1}, {"c.txt", 1}};
+  REQUIRE(index.lookup_word("aple~1") == expected);
+
+  // Words of two letters allow no edits unless asked to, and distances
+  // past the largest the automaton supports are plain words
+  REQUIRE(index.lookup_word("ct~").empty());
+  expected = {{"d.txt", 1}, {"e.txt", 1}};
+  REQUIRE(index.lookup_word("ct~1") == expected);
+  REQUIRE(index.lookup_word("cut~") == expected);
+  REQUIRE(index.lookup_word("cut~3").empty());
+  REQUIRE(index.lookup_word("~1").empty());
+}
+
+static uint32_t edit_distance(std::string_view a, std::string_view b) {
+  vector<uint32_t> prev(b.size() + 1);
+  vector<uint32_t> row(b.size() + 1);
+  for (size_t j = 0; j <= b.size(); j++) {
+    prev[j] = static_cast<uint32_t>(j);
+  }
+  for (size_t i = 1; i <= a.size(); i++) {
+    row[0] = static_cast<uint32_t>(i);
+    for (size_t j = 1; j <= b.size(); j++) {
+      uint32_t substitute = prev[j - 1] + (a[i - 1] == b[j - 1] ? 0 : 1);
+      row[j] = std::min({prev[j] + 1, row[j - 1] + 1, substitute});
+    }
+    std::swap(prev, row);
+  }
+  return prev[b.size()];
+}
+
+static string random_word(std::mt19937* rng, size_t max_len,
+                          size_t alphabet_size) {
+  string word((*rng)() % (max_len + 1), 'a');
+  for (char& c : word) {
+    c = static_cast<char>('a' + (*rng)() % alphabet_size);
+  }
+  return word;
+}
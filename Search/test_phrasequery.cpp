@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "./catch.hpp"
+#include "./PhraseQuery.hpp"
+#include "./WordIndex.hpp"
+
+using std::string;
+using std::vector;
+using searchserver::PhraseQuery;
+using searchserver::Result;
+using searchserver::WordIndex;
+
+// Records the words of text, separated by single spaces, into a document
+static void record_text(WordIndex* index, const string& doc,
+                        const string& text);
+
+// Returns the names of every document that matches a query, sorted
+static vector<string> matching_docs(WordIndex* index, const string& query);
+
+TEST_CASE("ParseWords", "[PhraseQuery]") {
+  PhraseQuery query = PhraseQuery::parse("apple  pear+plum, fig.");
+  REQUIRE(query.words == vector<string>{"apple", "pear", "plum", "fig"});
+  REQUIRE_FALSE(query.positional());
+
+  REQUIRE(PhraseQuery::parse("").words.empty());
+  REQUIRE(PhraseQuery::parse("  + ").words.empty());
+  REQUIRE(PhraseQuery::parse("\"\"").words.empty());
+  REQUIRE_FALSE(PhraseQuery::parse("\" \" apple").positional());
+}
+
+TEST_CASE("ParsePhrases", "[PhraseQuery]") {
+  PhraseQuery query = PhraseQuery::parse("\"new york\" pizza");
+  REQUIRE(query.words == vector<string>{"new", "york", "pizza"});
+  REQUIRE(query.constraints.size() == 1);
+  REQUIRE(query.constraints[0].operands ==
+          vector<PhraseQuery::Phrase>{{"new", "york"}});
+  REQUIRE(query.constraints[0].distances.empty());
+
+  // A quoted single word is still a constraint, and a quote splits the
+  // word it touches
+  query = PhraseQuery::parse("big\"apple\"pie");
+  REQUIRE(query.words == vector<string>{"big", "apple", "pie"});
+  REQUIRE(query.constraints.size() == 1);
+  REQUIRE(query.constraints[0].operands ==
+          vector<PhraseQuery::Phrase>{{"apple"}});
+
+  // Two phrases are two constraints
+  query = PhraseQuery::parse("\"a b\" \"c d\"");
+  REQUIRE(query.constraints.size() == 2);
+  REQUIRE(query.constraints[1].operands ==
+          vector<PhraseQuery::Phrase>{{"c", "d"}});
+}
+
+TEST_CASE("ParseUnterminatedQuote", "[PhraseQuery]") {
+  PhraseQuery query = PhraseQuery::parse("pizza \"new york city");
+  REQUIRE(query.words == vector<string>{"pizza", "new", "york", "city"});
+  REQUIRE(query.constraints.size() == 1);
+  REQUIRE(query.constraints[0].operands ==
+          vector<PhraseQuery::Phrase>{{"new", "york", "city"}});
+
+  query = PhraseQuery::parse("pizza \"");
+  REQUIRE(query.words == vector<string>{"pizza"});
+  REQUIRE_FALSE(query.positional());
+}
+
+TEST_CASE("ParseNear", "[PhraseQuery]") {
+  PhraseQuery query = PhraseQuery::parse("coffee near/3 cake");
+  REQUIRE(query.words == vector<string>{"coffee", "cake"});
+  REQUIRE(query.constraints.size() == 1);
+  REQUIRE(query.constraints[0].operands ==
+          vector<PhraseQuery::Phrase>{{"coffee"}, {"cake"}});
+  REQUIRE(query.constraints[0].distances == vector<uint32_t>{3});
+
+  query = PhraseQuery::parse("\"new york\" near/5 pizza near/2 slice");
+  REQUIRE(query.words ==
+          vector<string>{"new", "york", "pizza", "slice"});
+  REQUIRE(query.constraints.size() == 1);
+  REQUIRE(query.constraints[0].operands ==
+          vector<PhraseQuery::Phrase>{{"new", "york"}, {"pizza"}, {"slice"}});
+  REQUIRE(query.constraints[0].distances == vector<uint32_t>{5, 2});
+
+  // Operators with nothing on one side are ignored
+  query = PhraseQuery::parse("near/3 apple pear near/2");
+  REQUIRE(query.words == vector<string>{"apple", "pear"});
+  REQUIRE_FALSE(query.positional());
+
+  // Only lowercase near/k with k of at least 1 is an operator, and large
+  // distances are clamped
+  query = PhraseQuery::parse("a near/0 b NEAR/2 c near/ d near/x e");
+  REQUIRE(query.words == vector<string>{"a", "near/0", "b", "NEAR/2", "c",
+                                        "near/", "d", "near/x", "e"});
+  REQUIRE_FALSE(query.positional());
+  query = PhraseQuery::parse("a near/99999999999 b");
+  REQUIRE(query.constraints.size() == 1);
+  REQUIRE(query.constraints[0].distances == vector<uint32_t>{1000000});
+
+  // Inside quotes near/k is just a word
+  query = PhraseQuery::parse("\"a near/2 b\"");
+  REQUIRE(query.constraints[0].operands ==
+          vector<PhraseQuery::Phrase>{{"a", "near/2", "b"}});
+}
+
+TEST_CASE("LookupPhrases", "[PhraseQuery]") {
+  WordIndex index(true);
+  record_text(&index, "a.txt", "the best new york pizza in new york");
+  record_text(&index, "b.txt", "york new pizza");
+  record_text(&index, "c.txt", "new jersey and york pizza");
+  record_text(&index, "d.txt", "coffee with a slice of cake");
+  record_text(&index, "e.txt", "cake then coffee then more coffee");
+  record_text(&index, "f.txt", "the the");
+
+  REQUIRE(matching_docs(&index, "\"new york\"") == vector<string>{"a.txt"});
+  REQUIRE(matching_docs(&index, "\"york new\"") == vector<string>{"b.txt"});
+  REQUIRE(matching_docs(&index, "\"new york pizza\"") ==
+          vector<string>{"a.txt"});
+  REQUIRE(matching_docs(&index, "\"york pizza\"") ==
+          vector<string>{"a.txt", "c.txt"});
+  REQUIRE(matching_docs(&index, "\"pizza new\"").empty());
+  REQUIRE(matching_docs(&index, "\"the the\"") == vector<string>{"f.txt"});
+  REQUIRE(matching_docs(&index, "\"new york\" missing").empty());
+
+  // NEAR/k matches in either order, at most k words apart
+  REQUIRE(matching_docs(&index, "new near/1 york") ==
+          vector<string>{"a.txt", "b.txt"});
+  REQUIRE(matching_docs(&index, "new near/2 york") ==
+          vector<string>{"a.txt", "b.txt"});
+  REQUIRE(matching_docs(&index, "new near/3 york") ==
+          vector<string>{"a.txt", "b.txt", "c.txt"});
+  REQUIRE(matching_docs(&index, "coffee near/2 cake") ==
+          vector<string>{"e.txt"});
+  REQUIRE(matching_docs(&index, "coffee near/5 cake") ==
+          vector<string>{"d.txt", "e.txt"});
+  REQUIRE(matching_docs(&index, "\"new york\" near/1 pizza") ==
+          vector<string>{"a.txt"});
+  REQUIRE(matching_docs(&index, "jersey near/2 york near/1 pizza") ==
+          vector<string>{"c.txt"});
+  REQUIRE(matching_docs(&index, "jersey near/1 york near/1 pizza").empty());
+
+  // Without constraints it is a plain conjunctive lookup, counting
+  // every occurance of the words
+  size_t num_matches = 0;
+  vector<Result> results = index.lookup_phrases(
+      PhraseQuery::parse("new york"), 10, 0, &num_matches);
+  REQUIRE(num_matches == 3);
+  REQUIRE(results == index.lookup_query({"new", "york"}, 10, 0));
+  results = index.lookup_phrases(PhraseQuery::parse("\"new york\""), 10, 0,
+                                 &num_matches);
+  REQUIRE(num_matches == 1);
+  REQUIRE(results == vector<Result>{{"a.txt", 4}});
+}
+
+static void record_text(WordIndex* index, const string& doc,
+                        const string& text) {
+  size_t pos = 0;
+  while (pos <= text.size()) {
+    size_t end = std::min(text.find(' ', pos), text.size());
+    index->record(text.substr(pos, end - pos), doc);
+    pos = end + 1;
+  }
+}
+
+static vector<string> matching_docs(WordIndex* index, const string& query) {
+  size_t num_matches = 0;
+  vector<string> docs;
+  for (const Result& r : index->lookup_phrases(PhraseQuery::parse(query), 100,
+                                               0, &num_matches)) {
+    docs.push_back(r.doc_name);
+  }
+  REQUIRE(num_matches == docs.size());
+  std::sort(docs.begin(), docs.end());
+  return docs;
+}
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "./catch.hpp"
+#include "./PostingList.hpp"
+
+using std::vector;
+using searchserver::DocId;
+using searchserver::Posting;
+using searchserver::PostingCodec;
+using searchserver::PostingCursor;
+using searchserver::PostingList;
+using searchserver::kPostingBlockSize;
+
+// Builds a list of n postings whose DocIds are up to max_gap apart and
+// whose counts are up to max_tf, with positions if positions is true
+static PostingList random_list(std::mt19937* rng, size_t n, uint32_t max_gap,
+                               uint32_t max_tf, bool positions);
+
+// Requires a cursor over the encoded list to step through exactly the
+// given postings and positions
+static void require_postings(const PostingList& list,
+                             const vector<Posting>& postings,
+                             const vector<uint32_t>& positions);
+
+TEST_CASE("CodecRoundTrip", "[PostingList]") {
+  std::mt19937 rng(8);
+  // Sizes around the block boundaries, gaps from dense to ones that need
+  // 31 bits, and counts that need more than a byte
+  for (size_t n : {1, 2, 127, 128, 129, 256, 1000}) {
+    for (uint32_t max_gap : {1U, 3U, 1000U, 1U << 22}) {
+      for (uint32_t max_tf : {1U, 5U, 70000U}) {
+        for (PostingCodec codec : {PostingCodec::kVByte, PostingCodec::kBP128}) {
+          INFO("n " << n << " max_gap " << max_gap << " max_tf " << max_tf);
+          bool positions = max_tf < 100;
+          PostingList list = random_list(&rng, n, max_gap, max_tf, positions);
+          vector<Posting> postings = list.postings;
+          vector<uint32_t> doc_positions = list.positions;
+
+          list.encode(codec);
+          REQUIRE(list.encoded());
+          REQUIRE(list.postings.empty());
+          REQUIRE(list.size == n);
+          REQUIRE(list.blocks.size() ==
+                  (n + kPostingBlockSize - 1) / kPostingBlockSize);
+          for (size_t b = 0; b < list.blocks.size(); b++) {
+            size_t last = std::min(n, (b + 1) * kPostingBlockSize) - 1;
+            REQUIRE(list.blocks[b].last_doc == postings[last].doc);
+          }
+          require_postings(list, postings, doc_positions);
+
+          // Decoding gives back the arrays, which encode the same way
+          vector<uint8_t> data = list.data;
+          list.decode();
+          REQUIRE_FALSE(list.encoded());
+          REQUIRE(list.postings.size() == n);
+          for (size_t i = 0; i < n; i++) {
+            REQUIRE(list.postings[i].doc == postings[i].doc);
+            REQUIRE(list.postings[i].tf == postings[i].tf);
+          }
+          REQUIRE(list.positions == doc_positions);
+          list.encode(codec);
+          REQUIRE(list.data == data);
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("BP128SmallerThanVByte", "[PostingList]") {
+  std::mt19937 rng(128);
+  PostingList vbyte = random_list(&rng, 4096, 4, 3, false);
+  PostingList bp128 = vbyte;
+  vbyte.encode(PostingCodec::kVByte);
+  bp128.encode(PostingCodec::kBP128);
+  REQUIRE(bp128.data.size() < vbyte.data.size() / 2);
+}
+
+TEST_CASE("CursorAdvance", "[PostingList]") {
+  std::mt19937 rng(5950);
+  PostingList list = random_list(&rng, 2000, 50, 3, false);
+  vector<Posting> postings = list.postings;
+  list.encode();
+
+  // Targets that stay in a block, move to the next one, and skip many
+  for (uint32_t max_step : {2U, 200U, 20000U}) {
+    PostingCursor cursor(list.view());
+    DocId target = 0;
+    while (true) {
+      target += rng() % max_step;
+      cursor.advance(target);
+      auto it = std::lower_bound(postings.begin(), postings.end(), target,
+                                 [](const Posting& p, DocId d) {
+                                   return p.doc < d;
+                                 });
+      if (it == postings.end()) {
+        REQUIRE(cursor.doc() == PostingCursor::kEnd);
+        break;
+      }
+      REQUIRE(cursor.doc() == it->doc);
+      REQUIRE(cursor.tf() == it->tf);
+    }
+  }
+
+  // Advancing to a DocId the cursor is already past does not move it
+  PostingCursor cursor(list.view());
+  cursor.advance(postings[300].doc);
+  cursor.advance(postings[10].doc);
+  REQUIRE(cursor.doc() == postings[300].doc);
+}
+
+TEST_CASE("TruncatedListEndsEarly", "[PostingList]") {
+  std::mt19937 rng(3);
+  for (PostingCodec codec : {PostingCodec::kVByte, PostingCodec::kBP128}) {
+    PostingList list = random_list(&rng, 1000, 100, 9, true);
+    vector<Posting> postings = list.postings;
+    list.encode(codec);
+
+    // Cut the data in the middle of a block: the cursor stops before
+    // it, having returned only real postings
+    searchserver::PostingListView view = list.view();
+    view.num_bytes = list.blocks[3].offset + 5;
+    view.position_bytes /= 2;
+    size_t i = 0;
+    vector<uint32_t> positions;
+    for (PostingCursor cursor(view); cursor.doc() != PostingCursor::kEnd;
+         cursor.next(), i++) {
+      REQUIRE(i < 3 * kPostingBlockSize);
+      REQUIRE(cursor.doc() == postings[i].doc);
+      cursor.positions(&positions);
+    }
+  }
+}
+
+TEST_CASE("UnpackMatchesScalar", "[PostingList]") {
+  std::mt19937 rng(42);
+  vector<uint8_t> packed(kPostingBlockSize / 8 * 32);
+  for (uint8_t& byte : packed) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  for (uint32_t bits = 0; bits <= 32; bits++) {
+    INFO("bits " << bits);
+    uint32_t simd[kPostingBlockSize];
+    uint32_t scalar[kPostingBlockSize];
+    searchserver::unpack_bits(packed.data(), bits, simd);
+    searchserver::unpack_bits_scalar(packed.data(), bits, scalar);
+    for (size_t i = 0; i < kPostingBlockSize; i++) {
+      REQUIRE(simd[i] == scalar[i]);
+      if (bits < 32) {
+        REQUIRE(simd[i] < (1ULL << bits));
+      }
+    }
+  }
+}
+
+static PostingList random_list(std::mt19937* rng, size_t n, uint32_t max_gap,
+                               uint32_t max_tf, bool positions) {
+  PostingList list;
+  DocId doc = (*rng)() % max_gap;
+  for (size_t i = 0; i < n; i++) {
+    uint32_t tf = 1 + (*rng)() % max_tf;
+    list.postings.push_back({doc, tf});
+    if (positions) {
+      uint32_t position = (*rng)() % 10;
+      for (uint32_t j = 0; j < tf; j++) {
+        list.positions.push_back(position);
+        position += 1 + (*rng)() % 300;
+      }
+    }
+    doc += 1 + (*rng)() % max_gap;
+  }
+  return list;
+}
+
+static void require_postings(const PostingList& list,
+                             const vector<Posting>& postings,
+                             const vector<uint32_t>& positions) {
+  PostingCursor cursor(list.view());
+  REQUIRE(cursor.size() == postings.size());
+  size_t at = 0;
+  vector<uint32_t> doc_positions;
+  for (const Posting& p : postings) {
+    REQUIRE(cursor.doc() == p.doc);
+    REQUIRE(cursor.tf() == p.tf);
+    if (!positions.empty()) {
+      REQUIRE(cursor.positions(&doc_positions));
+      REQUIRE(doc_positions.size() == p.tf);
+      for (uint32_t position : doc_positions) {
+        REQUIRE(position == positions[at++]);
+      }
+    } else {
+      REQUIRE_FALSE(cursor.positions(&doc_positions));
+    }
+    cursor.next();
+  }
+  REQUIRE(cursor.doc() == PostingCursor::kEnd);
+}
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "./catch.hpp"
+#include "./ShardedIndex.hpp"
+#include "./ThreadPool.hpp"
+
+using std::string;
+using std::vector;
+using searchserver::PhraseQuery;
+using searchserver::Ranking;
+using searchserver::Result;
+using searchserver::ShardedIndex;
+using searchserver::ThreadPool;
+using searchserver::WordIndex;
+
+// The number of shards the tests split their documents between
+static const size_t kNumShards = 4;
+
+// Records a random corpus into a single index and into shards of it.
+// Every document has "common" in it, and there are enough of them that
+// a query of it fans out; rare words are only in a few documents, and
+// so only in some of the shards.
+static void record_corpus(WordIndex* single, vector<WordIndex>* shards);
+
+// Returns the name and rank of every result, sorted, so that results of
+// indexes that break ties differently can be compared
+static vector<std::pair<string, int>> sorted_matches(
+    const vector<Result>& results);
+
+TEST_CASE("MergePagesMatchesStableSort", "[ShardedIndex]") {
+  std::mt19937 rng(24);
+  for (int round = 0; round < 200; round++) {
+    // Few distinct scores, so that there are plenty of ties
+    vector<vector<Result>> pages(1 + rng() % 5);
+    vector<Result> all;
+    for (size_t p = 0; p < pages.size(); p++) {
+      size_t n = rng() % 8;
+      for (size_t i = 0; i < n; i++) {
+        Result r{"p" + std::to_string(p) + "r" + std::to_string(i), 1,
+                 static_cast<double>(rng() % 4)};
+        pages[p].push_back(r);
+      }
+      std::stable_sort(pages[p].begin(), pages[p].end(),
+                       [](const Result& a, const Result& b) {
+                         return a.score > b.score;
+                       });
+      all.insert(all.end(), pages[p].begin(), pages[p].end());
+    }
+    std::stable_sort(all.begin(), all.end(),
+                     [](const Result& a, const Result& b) {
+                       return a.score > b.score;
+                     });
+
+    size_t k = rng() % 10;
+    size_t offset = rng() % 12;
+    INFO("k " << k << " offset " << offset);
+    vector<Result> merged = ShardedIndex::merge_pages(&pages, k, offset);
+    vector<Result> expected;
+    for (size_t i = offset; i < all.size() && i < offset + k; i++) {
+      expected.push_back(all[i]);
+    }
+    REQUIRE(merged == expected);
+  }
+}
+
+TEST_CASE("ShardsMatchSingleIndex", "[ShardedIndex]") {
+  WordIndex whole;
+  vector<WordIndex> shards(kNumShards);
+  record_corpus(&whole, &shards);
+  ThreadPool pool(2);
+  ShardedIndex single(std::move(whole));
+  ShardedIndex sequential(shards, nullptr);
+  ShardedIndex parallel(std::move(shards), &pool);
+  size_t all = single.num_docs();
+  REQUIRE(parallel.num_docs() == all);
+
+  vector<vector<string>> queries{
+      {"common"},         {"rare0"},          {"rare1", "rare2"},
+      {"word3", "rare4"}, {"word1", "word2"}, {"common", "word5"},
+      {"missing"},        {"word1", "missing"}};
+  for (ShardedIndex* sharded : {&sequential, &parallel}) {
+    for (const vector<string>& query : queries) {
+      INFO("query " << query[0] << " of " << query.size() << " words");
+      // Term frequencies do not depend on the other documents of a
+      // shard, so the same documents match with the same ranks
+      size_t expected_matches = 0;
+      size_t num_matches = 0;
+      vector<Result> expected = single.lookup_query(
+          query, all, 0, &expected_matches, Ranking::kTermFrequency);
+      vector<Result> results = sharded->lookup_query(
+          query, all, 0, &num_matches, Ranking::kTermFrequency);
+      REQUIRE(num_matches == expected_matches);
+      REQUIRE(sorted_matches(results) == sorted_matches(expected));
+
+      expected = single.lookup_any(query, all, 0, Ranking::kTermFrequency);
+      results = sharded->lookup_any(query, all, 0, Ranking::kTermFrequency);
+      REQUIRE(sorted_matches(results) == sorted_matches(expected));
+
+      // Pages of the shards never overlap, and follow one another
+      results = sharded->lookup_query(query, all, 0);
+      vector<Result> paged;
+      for (size_t offset = 0; offset < results.size() + 7; offset += 7) {
+        vector<Result> page = sharded->lookup_query(query, 7, offset);
+        paged.insert(paged.end(), page.begin(), page.end());
+      }
+      REQUIRE(paged == results);
+      for (size_t i = 1; i < results.size(); i++) {
+        REQUIRE(results[i - 1].score >= results[i].score);
+      }
+    }
+
+    size_t num_matches = 0;
+    vector<Result> results = sharded->lookup_phrases(
+        PhraseQuery::parse("word1 word2"), all, 0, &num_matches);
+    REQUIRE(num_matches == results.size());
+    REQUIRE(sorted_matches(results) ==
+            sorted_matches(single.lookup_query({"word1", "word2"}, all, 0)));
+  }
+}
+
+static void record_corpus(WordIndex* single, vector<WordIndex>* shards) {
+  std::mt19937 rng(4);
+  for (size_t doc = 0; doc < ShardedIndex::kMinParallelPostings + 100;
+       doc++) {
+    string name = "doc" + std::to_string(doc);
+    WordIndex& shard = (*shards)[ShardedIndex::shard_of(name, kNumShards)];
+    vector<string> words{"common"};
+    if (doc < 400) {
+      for (size_t i = rng() % 20; i > 0; i--) {
+        words.push_back("word" + std::to_string(rng() % 8));
+      }
+      if (doc % 40 == 0) {
+        words.push_back("rare" + std::to_string(doc / 40));
+      }
+    }
+    for (const string& word : words) {
+      single->record(word, name);
+      shard.record(word, name);
+    }
+  }
+}
+
+static vector<std::pair<string, int>> sorted_matches(
+    const vector<Result>& results) {
+  vector<std::pair<string, int>> matches;
+  for (const Result& r : results) {
+    matches.emplace_back(r.doc_name, r.rank);
+  }
+  std::sort(matches.begin(), matches.end());
+  return matches;
+}
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./catch.hpp"
+#include "./TermDictionary.hpp"
+#include "./WordIndex.hpp"
+
+using std::string;
+using std::vector;
+using searchserver::Result;
+using searchserver::TermCursor;
+using searchserver::TermDictionary;
+using searchserver::TermDictionaryView;
+using searchserver::WordIndex;
+
+// Returns n sorted, distinct random terms over a small alphabet, so that
+// neighbouring terms share long prefixes
+static vector<string> random_terms(std::mt19937* rng, size_t n);
+
+// Builds a dictionary of terms
+static TermDictionary build_dict(const vector<string>& terms);
+
+// Returns where term would be inserted into the sorted terms
+static size_t expected_lower_bound(const vector<string>& terms,
+                                   std::string_view term);
+
+TEST_CASE("FindAndLowerBound", "[TermDictionary]") {
+  std::mt19937 rng(22);
+  for (size_t n : {0, 1, 15, 16, 17, 1000}) {
+    INFO("n " << n);
+    vector<string> terms = random_terms(&rng, n);
+    TermDictionary dict = build_dict(terms);
+    TermDictionaryView view = dict.view();
+    REQUIRE(view.size == n);
+
+    for (size_t i = 0; i < n; i++) {
+      REQUIRE(view.find(terms[i]) == i);
+      REQUIRE(view.lower_bound(terms[i]) == i);
+    }
+
+    // Probes between, before and after the terms, including prefixes
+    // and extensions of them
+    vector<string> probes{"", "a", "aaaaaaaaaaaa", "d", "zzz"};
+    for (size_t i = 0; i < 300 && n > 0; i++) {
+      string probe = terms[rng() % n];
+      switch (rng() % 3) {
+        case 0:
+          probe.resize(rng() % (probe.size() + 1));
+          break;
+        case 1:
+          probe += static_cast<char>('a' + rng() % 4);
+          break;
+        default:
+          probe.back() = static_cast<char>('a' + rng() % 4);
+      }
+      probes.push_back(probe);
+    }
+    for (const string& probe : probes) {
+      INFO("probe " << probe);
+      size_t bound = expected_lower_bound(terms, probe);
+      REQUIRE(view.lower_bound(probe) == bound);
+      bool present = bound < n && terms[bound] == probe;
+      REQUIRE(view.find(probe) == (present ? bound : n));
+    }
+  }
+}
+
+TEST_CASE("CursorNextAndSeek", "[TermDictionary]") {
+  std::mt19937 rng(16);
+  vector<string> terms = random_terms(&rng, 2000);
+  TermDictionary dict = build_dict(terms);
+
+  // Stepping from any term visits every term after it in order
+  for (size_t first : {0, 15, 16, 1999, 2000}) {
+    TermCursor cursor(dict.view(), first);
+    for (size_t i = first; i < terms.size(); i++, cursor.next()) {
+      REQUIRE_FALSE(cursor.done());
+      REQUIRE(cursor.index() == i);
+      REQUIRE(cursor.term() == terms[i]);
+    }
+    REQUIRE(cursor.done());
+  }
+
+  // Seeking forward by short and long distances lands on the lower
+  // bound, and seeking backward stays put
+  for (size_t max_step : {3, 40, 700}) {
+    TermCursor cursor(dict.view(), 0);
+    size_t target = 0;
+    while (true) {
+      target += rng() % max_step;
+      if (target >= terms.size()) {
+        cursor.seek("zzzzzzzzzzzzzzz");
+        REQUIRE(cursor.done());
+        break;
+      }
+      string probe = terms[target];
+      if (rng() % 2 == 0) {
+        probe.pop_back();
+      }
+      size_t bound = expected_lower_bound(terms, probe);
+      size_t before = cursor.index();
+      cursor.seek(probe);
+      REQUIRE(cursor.index() == std::max(bound, before));
+      REQUIRE(cursor.term() == terms[cursor.index()]);
+      cursor.seek("");
+      REQUIRE(cursor.index() == std::max(bound, before));
+    }
+  }
+}
+
+TEST_CASE("PrefixExpansion", "[TermDictionary]") {
+  WordIndex index;
+  index.record("apple", "a.txt");
+  index.record("apple", "a.txt");
+  index.record("apply", "a.txt");
+  index.record("apricot", "b.txt");
+  index.record("banana", "c.txt");
+  index.record("ap", "c.txt");
+
+  vector<Result> expected{{"a.txt", 3}, {"b.txt", 1}, {"c.txt", 1}};
+  REQUIRE(index.lookup_word("ap*") == expected);
+  expected = {{"a.txt", 3}};
+  REQUIRE(index.lookup_word("appl*") == expected);
+  REQUIRE(index.lookup_query({"appl*", "apricot*"}).empty());
+  REQUIRE(index.lookup_word("cherry*").empty());
+  REQUIRE(index.lookup_word("*").empty());
+
+  // Words recorded after the dictionary was built are found too
+  index.record("apz", "d.txt");
+  expected = {{"a.txt", 3}, {"b.txt", 1}, {"c.txt", 1}, {"d.txt", 1}};
+  REQUIRE(index.lookup_word("ap*") == expected);
+
+  // A prefix stands for at most kMaxPrefixTerms words, the ones in the
+  // most documents: x0 to x127 are in two documents and the rest in one
+  WordIndex many;
+  for (size_t i = 0; i < 200; i++) {
+    string word = "x" + std::to_string(i);
+    many.record(word, "d" + std::to_string(i));
+    if (i < WordIndex::kMaxPrefixTerms) {
+      many.record(word, "shared");
+    }
+  }
+  vector<Result> results = many.lookup_word("x*");
+  REQUIRE(results.size() == WordIndex::kMaxPrefixTerms + 1);
+  REQUIRE(results[0] ==
+          Result{"shared", static_cast<int>(WordIndex::kMaxPrefixTerms)});
+  for (size_t i = 1; i < results.size(); i++) {
+    REQUIRE(results[i].doc_name == "d" + std::to_string(i - 1));
+  }
+
+  vector<searchserver::Suggestion> suggestions = many.suggest("x1", 3);
+  REQUIRE(suggestions.size() == 3);
+  REQUIRE(suggestions[0].word == "x1");
+  REQUIRE(suggestions[0].num_docs == 2);
+  REQUIRE(suggestions[1].word == "x10");
+  REQUIRE(suggestions[2].word == "x100");
+  REQUIRE(many.suggest("y", 3).empty());
+}
+
+static vector<string> random_terms(std::mt19937* rng, size_t n) {
+  vector<string> terms;
+  while (terms.size() < n * 2) {
+    string term(1 + (*rng)() % 12, 'a');
+    for (char& c : term) {
+      c = static_cast<char>('a' + (*rng)() % 4);
+    }
+    terms.push_back(term);
+  }
+  std::sort(terms.begin(), terms.end());
+  terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+  std::shuffle(terms.begin(), terms.end(), *rng);
+  terms.resize(std::min(n, terms.size()));
+  std::sort(terms.begin(), terms.end());
+  return terms;
+}
+
+static TermDictionary build_dict(const vector<string>& terms) {
+  vector<std::string_view> views(terms.begin(), terms.end());
+  TermDictionary dict;
+  dict.build(views);
+  return dict;
+}
+
+static size_t expected_lower_bound(const vector<string>& terms,
+                                   std::string_view term) {
+  return static_cast<size_t>(
+      std::lower_bound(terms.begin(), terms.end(), term) - terms.begin());
+}
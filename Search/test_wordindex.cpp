@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "./catch.hpp"
+#include "./WordIndex.hpp"
+
+using std::map;
+using std::string;
+using std::vector;
+using searchserver::Ranking;
+using searchserver::Result;
+using searchserver::WordIndex;
+
+// The number of documents and distinct words in the random corpus
+static const size_t kCorpusDocs = 600;
+static const size_t kCorpusWords = 40;
+
+// A corpus of random documents, and for every word the number of
+// occurances of it in each document that contains it, keyed by the
+// index the document was recorded at
+struct Corpus {
+  vector<string> docs;
+  map<string, map<size_t, int>> counts;
+};
+
+// Records a random corpus into index. Word i is in roughly 1 in i + 1
+// documents, so the posting lists range from dense to sparse and span
+// many blocks, which is what makes the intersections skip.
+static Corpus record_corpus(WordIndex* index, uint32_t seed);
+
+// Returns the results lookup_query(query) should give for a corpus: every
+// document with every word of the query, with the total number of
+// occurances of the words, ordered by that total and then by the order
+// the documents were recorded in
+static vector<Result> expected_results(const Corpus& corpus,
+                                       const vector<string>& query);
+
+// Returns the results of every page of k results of a query, in order
+static vector<Result> concat_pages(WordIndex* index,
+                                   const vector<string>& query, size_t k);
+
+// Returns the BM25 score of a word that occurs tf times in a document of
+// len words, in a collection of num_docs documents averaging avg_len
+// words, df of which contain the word
+static double bm25(int tf, double len, double avg_len, size_t df,
+                   size_t num_docs);
+
+// Returns the results lookup_any(query) should give for a corpus, by
+// scoring every document that contains any word of the query, ordered
+// like expected_results()
+static vector<Result> exhaustive_any(WordIndex* index, const Corpus& corpus,
+                                     const vector<string>& query,
+                                     Ranking ranking);
+
+TEST_CASE("Basic", "[WordIndex]") {
+  WordIndex index;
+  index.record("apple", "a.txt");
+  index.record("apple", "a.txt");
+  index.record("pear", "a.txt");
+  index.record("apple", "b.txt");
+  index.record("pear", "c.txt");
+
+  REQUIRE(index.num_words() == 2);
+  REQUIRE(index.num_docs() == 3);
+
+  vector<Result> expected{{"a.txt", 2}, {"b.txt", 1}};
+  REQUIRE(index.lookup_word("apple") == expected);
+  expected = {{"a.txt", 1}, {"c.txt", 1}};
+  REQUIRE(index.lookup_word("pear") == expected);
+  REQUIRE(index.lookup_word("plum").empty());
+
+  expected = {{"a.txt", 3}};
+  REQUIRE(index.lookup_query({"apple", "pear"}) == expected);
+  REQUIRE(index.lookup_query({"apple", "plum"}).empty());
+  REQUIRE(index.lookup_query({}).empty());
+}
+
+TEST_CASE("PostingsSorted", "[WordIndex]") {
+  // Words recorded into documents out of order, and again after a
+  // lookup has finalized the index, still come back once per document,
+  // with ties in the order the documents were first recorded
+  WordIndex index;
+  for (int round = 0; round < 3; round++) {
+    for (int doc = 299; doc >= 0; doc--) {
+      index.record("word", "doc" + std::to_string(doc));
+    }
+  }
+  vector<Result> results = index.lookup_word("word");
+  REQUIRE(results.size() == 300);
+  for (int doc = 0; doc < 300; doc++) {
+    REQUIRE(results[doc].doc_name == "doc" + std::to_string(299 - doc));
+    REQUIRE(results[doc].rank == 3);
+  }
+
+  index.record("word", "doc150");
+  index.record("word", "new");
+  results = index.lookup_word("word");
+  REQUIRE(results.size() == 301);
+  REQUIRE(results[0] == Result{"doc150", 4});
+  REQUIRE(results[300] == Result{"new", 1});
+}
+
+TEST_CASE("IntersectMatchesBruteForce", "[WordIndex]") {
+  WordIndex index;
+  Corpus corpus = record_corpus(&index, 5950);
+
+  // Pairs and triples of dense and sparse lists, so that the shorter
+  // lists gallop over many blocks of the longer ones
+  vector<vector<string>> queries{
+      {"w0", "w1"},        {"w1", "w0"},       {"w0", "w39"},
+      {"w39", "w0", "w2"}, {"w3", "w7", "w11"}, {"w20", "w21"},
+      {"w5", "w5"},        {"w2", "w38", "w1"},
+  };
+  for (const vector<string>& query : queries) {
+    INFO("query starts with " << query[0] << " " << query[1]);
+    REQUIRE(index.lookup_query(query) == expected_results(corpus, query));
+  }
+  REQUIRE(index.lookup_query({"w0", "missing"}).empty());
+}
+
+TEST_CASE("PagesConcatenate", "[WordIndex]") {
+  WordIndex index;
+  Corpus corpus = record_corpus(&index, 121);
+
+  vector<vector<string>> queries{{"w0"}, {"w1", "w2"}, {"w0", "w4", "w9"}};
+  for (const vector<string>& query : queries) {
+    INFO("query starts with " << query[0]);
+    vector<Result> full = index.lookup_query(query);
+    REQUIRE(full == expected_results(corpus, query));
+    for (size_t k : {1, 7, 128, 1000}) {
+      REQUIRE(concat_pages(&index, query, k) == full);
+    }
+
+    size_t matches = 0;
+    index.lookup_query(query, 5, 3, &matches);
+    REQUIRE(matches == full.size());
+  }
+
+  // Empty pages, and bounds large enough to overflow offset + k
+  REQUIRE(index.lookup_query({"w0"}, 0, 0).empty());
+  REQUIRE(index.lookup_query({"w0"}, 10, 1000000).empty());
+  REQUIRE(index.lookup_query({"w0"}, SIZE_MAX, 0).size() ==
+          index.lookup_word("w0").size());
+  REQUIRE(index.lookup_query({"w0"}, SIZE_MAX, SIZE_MAX).empty());
+  REQUIRE(index.lookup_query({"w0"}, 3, SIZE_MAX - 1).empty());
+}
+
+TEST_CASE("BM25Scores", "[WordIndex]") {
+  // Three documents of 4, 8 and 3 words, averaging 5
+  WordIndex index;
+  for (const char* word : {"cat", "cat", "dog", "dog"}) {
+    index.record(word, "a.txt");
+  }
+  index.record("cat", "b.txt");
+  for (int i = 0; i < 7; i++) {
+    index.record("filler", "b.txt");
+  }
+  for (const char* word : {"dog", "filler", "filler"}) {
+    index.record(word, "c.txt");
+  }
+
+  double cat_a = bm25(2, 4, 5, 2, 3);
+  double cat_b = bm25(1, 8, 5, 2, 3);
+  double dog_a = bm25(2, 4, 5, 2, 3);
+  double dog_c = bm25(1, 3, 5, 2, 3);
+
+  vector<Result> results = index.lookup_query({"cat"}, 10, 0);
+  REQUIRE(results.size() == 2);
+  REQUIRE(results[0] == Result{"a.txt", 2});
+  REQUIRE(results[0].score == Approx(cat_a).epsilon(1e-5));
+  REQUIRE(results[1] == Result{"b.txt", 1});
+  REQUIRE(results[1].score == Approx(cat_b).epsilon(1e-5));
+
+  results = index.lookup_query({"cat", "dog"}, 10, 0);
+  REQUIRE(results.size() == 1);
+  REQUIRE(results[0].score == Approx(cat_a + dog_a).epsilon(1e-5));
+
+  // The shorter document outranks the longer one with the same count
+  results = index.lookup_any({"cat", "dog"}, 10, 0);
+  REQUIRE(results.size() == 3);
+  REQUIRE(results[0] == Result{"a.txt", 4});
+  REQUIRE(results[0].score == Approx(cat_a + dog_a).epsilon(1e-5));
+  REQUIRE(results[1] == Result{"c.txt", 1});
+  REQUIRE(results[1].score == Approx(dog_c).epsilon(1e-5));
+  REQUIRE(results[2] == Result{"b.txt", 1});
+  REQUIRE(results[2].score == Approx(cat_b).epsilon(1e-5));
+
+  // A word in most of the documents still scores above zero
+  results = index.lookup_query({"filler"}, 10, 0);
+  REQUIRE(results.size() == 2);
+  REQUIRE(results[1].score > 0);
+}
+
+TEST_CASE("WandMatchesExhaustive", "[WordIndex]") {
+  WordIndex index;
+  Corpus corpus = record_corpus(&index, 2025);
+
+  vector<vector<string>> queries{
+      {"w0"},        {"w0", "w1"},           {"w1", "w30", "w39"},
+      {"w2", "w3"},  {"w0", "w10", "w20"},   {"w25", "missing"},
+      {"missing"},
+  };
+  for (Ranking ranking : {Ranking::kBM25, Ranking::kTermFrequency}) {
+    for (const vector<string>& query : queries) {
+      INFO("query starts with " << query[0]);
+      vector<Result> expected = exhaustive_any(&index, corpus, query, ranking);
+      map<string, double> scores;
+      for (const Result& r : expected) {
+        scores[r.doc_name] = r.score;
+      }
+
+      for (size_t k : {1, 5, 20, 1000}) {
+        vector<Result> results = index.lookup_any(query, k, 0, ranking);
+        REQUIRE(results.size() == std::min(k, expected.size()));
+        for (size_t i = 0; i < results.size(); i++) {
+          // Sums of BM25 scores may round differently in a different
+          // order, which can swap documents with equal scores
+          REQUIRE(scores.count(results[i].doc_name) == 1);
+          REQUIRE(results[i].score ==
+                  Approx(scores[results[i].doc_name]).epsilon(1e-9));
+          REQUIRE(results[i].score == Approx(expected[i].score).epsilon(1e-9));
+          if (ranking == Ranking::kTermFrequency) {
+            REQUIRE(results[i] == expected[i]);
+          }
+        }
+      }
+
+      vector<Result> pages;
+      for (size_t offset = 0; offset < expected.size() + 7; offset += 7) {
+        vector<Result> page = index.lookup_any(query, 7, offset, ranking);
+        pages.insert(pages.end(), page.begin(), page.end());
+      }
+      REQUIRE(pages == index.lookup_any(query, SIZE_MAX, 0, ranking));
+    }
+  }
+}
+
+static Corpus record_corpus(WordIndex* index, uint32_t seed) {
+  Corpus corpus;
+  std::mt19937 rng(seed);
+  for (size_t doc = 0; doc < kCorpusDocs; doc++) {
+    string name = "doc" + std::to_string(doc);
+    corpus.docs.push_back(name);
+    for (size_t word = 0; word < kCorpusWords; word++) {
+      if (rng() % (word + 1) != 0) {
+        continue;
+      }
+      string text = "w" + std::to_string(word);
+      int count = 1 + static_cast<int>(rng() % 4);
+      for (int i = 0; i < count; i++) {
+        index->record(text, name);
+      }
+      corpus.counts[text][doc] = count;
+    }
+  }
+  return corpus;
+}
+
+static vector<Result> expected_results(const Corpus& corpus,
+                                       const vector<string>& query) {
+  vector<std::pair<size_t, int>> hits;
+  for (size_t doc = 0; doc < corpus.docs.size(); doc++) {
+    int rank = 0;
+    bool all = true;
+    for (const string& word : query) {
+      auto counts = corpus.counts.find(word);
+      if (counts == corpus.counts.end() ||
+          counts->second.count(doc) == 0) {
+        all = false;
+        break;
+      }
+      rank += counts->second.at(doc);
+    }
+    if (all) {
+      hits.push_back({doc, rank});
+    }
+  }
+  std::stable_sort(hits.begin(), hits.end(),
+                   [](const auto& a, const auto& b) {
+                     return a.second > b.second;
+                   });
+
+  vector<Result> results;
+  for (const auto& [doc, rank] : hits) {
+    results.push_back({corpus.docs[doc], rank});
+  }
+  return results;
+}
+
+static vector<Result> concat_pages(WordIndex* index,
+                                   const vector<string>& query, size_t k) {
+  vector<Result> results;
+  for (size_t offset = 0;; offset += k) {
+    vector<Result> page = index->lookup_query(
+        query, k, offset, nullptr, searchserver::Ranking::kTermFrequency);
+    REQUIRE(page.size() <= k);
+    results.insert(results.end(), page.begin(), page.end());
+    if (page.size() < k) {
+      return results;
+    }
+  }
+}
+
+static double bm25(int tf, double len, double avg_len, size_t df,
+                   size_t num_docs) {
+  const double k1 = 1.2;
+  const double b = 0.75;
+  double n = static_cast<double>(df);
+  double idf = std::log(1.0 + (num_docs - n + 0.5) / (n + 0.5));
+  double norm = k1 * (1.0 - b + b * len / avg_len);
+  return idf * (k1 + 1.0) * tf / (tf + norm);
+}
+
+static vector<Result> exhaustive_any(WordIndex* index, const Corpus& corpus,
+                                     const vector<string>& query,
+                                     Ranking ranking) {
+  // The BM25 score of each word in each document is that of a lookup of
+  // the word alone, whose correctness BM25Scores checks
+  vector<std::pair<int, double>> totals(corpus.docs.size(), {0, 0.0});
+  map<string, size_t> doc_index;
+  for (size_t doc = 0; doc < corpus.docs.size(); doc++) {
+    doc_index[corpus.docs[doc]] = doc;
+  }
+  for (const string& word : query) {
+    for (const Result& r :
+         index->lookup_query({word}, SIZE_MAX, 0, nullptr, ranking)) {
+      auto& total = totals[doc_index.at(r.doc_name)];
+      total.first += r.rank;
+      total.second += r.score;
+    }
+  }
+
+  vector<size_t> docs;
+  for (size_t doc = 0; doc < totals.size(); doc++) {
+    if (totals[doc].first > 0) {
+      docs.push_back(doc);
+    }
+  }
+  std::stable_sort(docs.begin(), docs.end(), [&totals](size_t a, size_t b) {
+    return totals[a].second > totals[b].second;
+  });
+
+  vector<Result> results;
+  for (size_t doc : docs) {
+    results.push_back({corpus.docs[doc], totals[doc].first,
+                       totals[doc].second});
+  }
+  return results;
+}